@@ -0,0 +1,271 @@
+#include <config.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include <mopher.h>
+
+#define ARENA_ROUND(size) (((size) + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1))
+#define ARENA_HEADER ARENA_ROUND(sizeof (arena_chunk_t))
+#define ARENA_DATA(ac) ((char *) (ac) + ARENA_HEADER)
+
+
+void
+arena_init(arena_t *arena, size_t chunk_size)
+{
+	arena->a_chunks = NULL;
+	arena->a_chunk_size = chunk_size? ARENA_ROUND(chunk_size): ARENA_CHUNK;
+	arena->a_allocs = 0;
+
+	return;
+}
+
+
+void *
+arena_alloc(arena_t *arena, size_t size)
+{
+	arena_chunk_t *ac = arena->a_chunks;
+	size_t chunk_size;
+	void *p;
+
+	size = size? ARENA_ROUND(size): ARENA_ALIGN;
+
+	if (ac == NULL || ac->ac_size - ac->ac_used < size)
+	{
+		/*
+		 * Large allocations get a chunk of their own. It's linked
+		 * behind the current chunk which keeps its free space.
+		 */
+		chunk_size = arena->a_chunk_size;
+		if (size > chunk_size / 4)
+		{
+			chunk_size = size;
+		}
+
+		ac = (arena_chunk_t *) malloc(ARENA_HEADER + chunk_size);
+		if (ac == NULL)
+		{
+			log_sys_error("arena_alloc: malloc");
+			return NULL;
+		}
+
+		ac->ac_size = chunk_size;
+		ac->ac_used = 0;
+
+		if (arena->a_chunks && chunk_size != arena->a_chunk_size)
+		{
+			ac->ac_next = arena->a_chunks->ac_next;
+			arena->a_chunks->ac_next = ac;
+		}
+		else
+		{
+			ac->ac_next = arena->a_chunks;
+			arena->a_chunks = ac;
+		}
+	}
+
+	p = ARENA_DATA(ac) + ac->ac_used;
+	ac->ac_used += size;
+	++arena->a_allocs;
+
+	return p;
+}
+
+
+void *
+arena_memdup(arena_t *arena, void *data, size_t size)
+{
+	void *p;
+
+	p = arena_alloc(arena, size);
+	if (p == NULL)
+	{
+		log_error("arena_memdup: arena_alloc failed");
+		return NULL;
+	}
+
+	memcpy(p, data, size);
+
+	return p;
+}
+
+
+char *
+arena_strdup(arena_t *arena, char *str)
+{
+	return arena_memdup(arena, str, strlen(str) + 1);
+}
+
+
+int
+arena_owns(arena_t *arena, void *p)
+{
+	arena_chunk_t *ac;
+	char *data;
+
+	for (ac = arena->a_chunks; ac; ac = ac->ac_next)
+	{
+		data = ARENA_DATA(ac);
+
+		if ((char *) p >= data && (char *) p < data + ac->ac_used)
+		{
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+
+/*
+ * Releases all allocations. One regular chunk is kept for reuse.
+ */
+void
+arena_reset(arena_t *arena)
+{
+	arena_chunk_t *ac, *next, *keep = NULL;
+
+	for (ac = arena->a_chunks; ac; ac = next)
+	{
+		next = ac->ac_next;
+
+		if (keep == NULL && ac->ac_size == arena->a_chunk_size)
+		{
+			keep = ac;
+			continue;
+		}
+
+		free(ac);
+	}
+
+	if (keep)
+	{
+		keep->ac_next = NULL;
+		keep->ac_used = 0;
+	}
+
+	arena->a_chunks = keep;
+	arena->a_allocs = 0;
+
+	return;
+}
+
+
+void
+arena_clear(arena_t *arena)
+{
+	arena_chunk_t *ac, *next;
+
+	for (ac = arena->a_chunks; ac; ac = next)
+	{
+		next = ac->ac_next;
+		free(ac);
+	}
+
+	arena->a_chunks = NULL;
+	arena->a_allocs = 0;
+
+	return;
+}
+
+
+#ifdef DEBUG
+
+void
+arena_test(int n)
+{
+	arena_t arena;
+	var_t *table, *v;
+	char *p[100], *big, *s;
+	VAR_INT_T i;
+
+	arena_init(&arena, 256);
+	TEST_ASSERT(arena.a_chunks == NULL);
+
+	for (i = 0; i < 100; ++i)
+	{
+		p[i] = arena_alloc(&arena, i + 1);
+		TEST_ASSERT(p[i] != NULL);
+		TEST_ASSERT(((uintptr_t) p[i] & (ARENA_ALIGN - 1)) == 0);
+		memset(p[i], i, i + 1);
+	}
+
+	for (i = 0; i < 100; ++i)
+	{
+		TEST_ASSERT(p[i][i] == i);
+		TEST_ASSERT(arena_owns(&arena, p[i]));
+	}
+
+	TEST_ASSERT(arena.a_allocs == 100);
+	TEST_ASSERT(!arena_owns(&arena, &arena));
+
+	// Large allocations keep the current chunk
+	s = arena_strdup(&arena, "mopher");
+	big = arena_alloc(&arena, 4096);
+	TEST_ASSERT(big != NULL);
+	TEST_ASSERT(arena_owns(&arena, big + 4095));
+	TEST_ASSERT(arena.a_chunks->ac_size == 256);
+	TEST_ASSERT(strcmp(s, "mopher") == 0);
+
+	s = arena_memdup(&arena, "abc", 4);
+	TEST_ASSERT(s != NULL && strcmp(s, "abc") == 0);
+
+	arena_reset(&arena);
+	TEST_ASSERT(arena.a_allocs == 0);
+	TEST_ASSERT(arena.a_chunks != NULL);
+	TEST_ASSERT(arena.a_chunks->ac_next == NULL);
+	TEST_ASSERT(!arena_owns(&arena, p[0]));
+
+	TEST_ASSERT(arena_alloc(&arena, 1) != NULL);
+
+	arena_clear(&arena);
+	TEST_ASSERT(arena.a_chunks == NULL);
+
+	/*
+	 * Arena vars
+	 */
+	table = vtable_create("arena", VF_KEEPNAME);
+	TEST_ASSERT(table != NULL);
+
+	vtable_arena_set(table, &arena);
+
+	TEST_ASSERT(vtable_set_new(table, VT_STRING, "copy", "value",
+	    VF_COPY) == 0);
+	v = vtable_lookup(table, "copy");
+	TEST_ASSERT(v != NULL && v->v_flags & VF_ARENA);
+	TEST_ASSERT(arena_owns(&arena, v) && arena_owns(&arena, v->v_name));
+	TEST_ASSERT(arena_owns(&arena, v->v_data));
+	TEST_ASSERT(strcmp(v->v_data, "value") == 0);
+
+	TEST_ASSERT(vtable_set_new(table, VT_INT, "keep", &i, VF_KEEP) == 0);
+	v = vtable_lookup(table, "keep");
+	TEST_ASSERT(v != NULL && v->v_data == &i);
+
+	// Handed over data is freed by var_delete
+	TEST_ASSERT(vtable_set_new(table, VT_STRING, "heap", strdup("value"),
+	    VF_KEEPNAME) == 0);
+	v = vtable_lookup(table, "heap");
+	TEST_ASSERT(v != NULL && !arena_owns(&arena, v));
+
+	TEST_ASSERT(vtable_set_new(table, VT_STRING, "copy", "other",
+	    VF_COPY) == 0);
+	TEST_ASSERT(strcmp(vtable_get(table, "copy"), "other") == 0);
+
+	vtable_arena_set(NULL, NULL);
+
+	TEST_ASSERT(vtable_set_new(table, VT_INT, "none", &i,
+	    VF_KEEPNAME | VF_COPYDATA) == 0);
+	TEST_ASSERT(!arena_owns(&arena, vtable_lookup(table, "none")));
+
+	vtable_remv(table, "copy", "keep", NULL);
+	arena_reset(&arena);
+	TEST_ASSERT(vtable_lookup(table, "heap") != NULL);
+
+	var_delete(table);
+	arena_clear(&arena);
+
+	return;
+}
+
+#endif
@@ -18,6 +18,22 @@
 
 #define DBT_STRESS_ROUNDS 100
 
+/*
+ * Persistence defaults (seconds)
+ */
+#define DBT_FSYNC_INTERVAL 1
+#define DBT_SNAPSHOT_INTERVAL 300
+
+/*
+ * Lookups per dd_mget call by dbt_db_mget
+ */
+#define DBT_MGET_BATCH 32
+
+/*
+ * Expiry index defaults
+ */
+#define DBT_INDEX_BATCH 256
+
 /*
  * dbt_test_stage1 time limit
  */
@@ -32,12 +48,12 @@ static int		dbt_janitor_running;
 static pthread_t	dbt_janitor_thread;
 static pthread_mutex_t	dbt_janitor_mutex = PTHREAD_MUTEX_INITIALIZER;
 static pthread_cond_t	dbt_janitor_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t	dbt_janitor_work_cond = PTHREAD_COND_INITIALIZER;
+static ll_t		dbt_janitor_jobs;
+static int		dbt_janitor_workers;
+static pthread_t	*dbt_janitor_worker_threads;
 
-static char           **dbt_dump_buffer;
-static int              dbt_dump_buffer_size;
-static pthread_mutex_t  dbt_dump_mutex = PTHREAD_MUTEX_INITIALIZER;
-
-static int dbt_sync = 1;
+int dbt_sync = 1;
 
 /*
  * Used to avoid circular include
@@ -45,8 +61,14 @@ static int dbt_sync = 1;
 int sql_db_get(void *dbt, var_t *record, var_t **result);
 int sql_db_set(void *dbt, var_t *record);
 int sql_db_del(void *dbt, var_t *record);
+int sql_db_mget(void *dbt, int n, var_t **records, var_t **results);
 int sql_db_walk(void *dbt, dbt_db_callback_t callback);
+int sql_db_scan(void *dbt, dbt_cursor_t *cursor, int count,
+    dbt_db_callback_t callback);
 int sql_db_expire(void *dbt);
+int sql_db_begin(void *dbt);
+int sql_db_commit(void *dbt);
+int sql_db_rollback(void *dbt);
 
 void
 dbt_driver_register(dbt_driver_t *dd)
@@ -56,8 +78,20 @@ dbt_driver_register(dbt_driver_t *dd)
 		dd->dd_get = sql_db_get;
 		dd->dd_set = sql_db_set;
 		dd->dd_del = sql_db_del;
+		dd->dd_mget = sql_db_mget;
 		dd->dd_walk = sql_db_walk;
+		dd->dd_scan = sql_db_scan;
 		dd->dd_expire = sql_db_expire;
+
+		/*
+		 * Without upsert sql_db_set opens its own transaction.
+		 */
+		if (dd->dd_sql.sql_upsert)
+		{
+			dd->dd_begin = sql_db_begin;
+			dd->dd_commit = sql_db_commit;
+			dd->dd_rollback = sql_db_rollback;
+		}
 	}
 
 	if (dd->dd_init)
@@ -78,35 +112,7 @@ dbt_driver_register(dbt_driver_t *dd)
 }
 
 
-static void
-dbt_close(dbt_t *dbt)
-{
-	if (!dbt->dbt_open)
-	{
-		return;
-	}
-
-	if ((dbt->dbt_driver->dd_flags & DBT_LOCK))
-	{
-		if(pthread_mutex_destroy(&dbt->dbt_mutex))
-		{
-			log_sys_error("dbt_close: ptrhead_mutex_destroy");
-		}
-	}
-
-	DBT_DB_CLOSE(dbt);
-
-	if (dbt->dbt_scheme)
-	{
-		var_delete(dbt->dbt_scheme);
-	}
-
-	dbt->dbt_open = 0;
-
-	return;
-}
-
-static int
+int
 dbt_lock(dbt_t *dbt)
 {
 	/*
@@ -126,7 +132,7 @@ dbt_lock(dbt_t *dbt)
 	return 0;
 }
 
-static void
+void
 dbt_unlock(dbt_t *dbt)
 {
 	if ((dbt->dbt_driver->dd_flags & DBT_LOCK) == 0)
@@ -142,1020 +148,2360 @@ dbt_unlock(dbt_t *dbt)
 	return;
 }
 
-int
-dbt_db_get(dbt_t *dbt, var_t *record, var_t **result)
+
+void
+dbt_db_close(dbt_t *dbt)
 {
-	int r;
+	// Prepared statements belong to the connection
+	if (dbt->dbt_driver->dd_use_sql)
+	{
+		sql_close(&dbt->dbt_driver->dd_sql, dbt->dbt_handle,
+		    dbt->dbt_stmt);
+	}
 
-	*result = NULL;
+	DBT_DB_CLOSE(dbt);
 
-	if (dbt_lock(dbt))
+	return;
+}
+
+
+static void
+dbt_close(dbt_t *dbt)
+{
+	if (!dbt->dbt_open)
 	{
-		return -1;
+		return;
 	}
 
-	r = dbt->dbt_driver->dd_get(dbt, record, result);
-	if (r < 0 && cf_dbt_fatal_errors)
+	// Pending records need the connection pool and the table lock
+	dbt_breaker_clear(dbt);
+
+	dbt_queue_clear(dbt);
+
+	dbt_pool_clear(dbt);
+
+	dbt_db_close(dbt);
+
+	if ((dbt->dbt_driver->dd_flags & DBT_LOCK))
 	{
-		log_die(EX_SOFTWARE, "fatal database error");
+		if(pthread_mutex_destroy(&dbt->dbt_mutex))
+		{
+			log_sys_error("dbt_close: ptrhead_mutex_destroy");
+		}
 	}
 
-	dbt_unlock(dbt);
+	dbt_cache_clear(dbt);
 
-	return r;
-}
+	dbt_index_clear(dbt);
+
+	if (dbt->dbt_scheme)
+	{
+		var_delete(dbt->dbt_scheme);
+	}
+
+	dbt->dbt_open = 0;
 
+	return;
+}
 
 int
-dbt_db_set(dbt_t *dbt, var_t *record)
+dbt_db_get(dbt_t *dbt, var_t *record, var_t **result)
 {
-	int r;
+	struct timespec start;
+	dbt_t *conn;
+	unsigned long generation = 0;
+	long wait = 0;
+	int breaker, r;
 
-	if (dbt_lock(dbt))
+	*result = NULL;
+
+	dbt_stats_now(&start);
+
+	// Backend bypassed: journaled records come first
+	breaker = dbt_breaker_check(dbt);
+	if (breaker == DBT_BREAKER_OPEN)
 	{
-		return -1;
+		r = dbt_journal_get(dbt, record, result);
+		if (r)
+		{
+			r = r == 1 ? 0 : -1;
+			goto exit;
+		}
 	}
 
-	if (dbt_sync)
+	// Pending writes are visible to readers
+	if (dbt->dbt_queue.dq_ht)
 	{
-		client_sync(dbt, record);
+		r = dbt_queue_get(dbt, record, result);
+		if (r)
+		{
+			r = r == 1 ? 0 : -1;
+			goto exit;
+		}
 	}
 
-	r = dbt->dbt_driver->dd_set(dbt, record);
-	if (r < 0 && cf_dbt_fatal_errors)
+	if (dbt->dbt_cache.dc_ht)
 	{
-		log_die(EX_SOFTWARE, "fatal database error");
+		r = dbt_cache_get(dbt, record, result, &generation);
+		if (r == 1)
+		{
+			r = 0;
+			goto exit;
+		}
 	}
 
-	dbt_unlock(dbt);
-
-	return r;
-}
-
-
-int
-dbt_db_del(dbt_t *dbt, var_t *record)
-{
-	int r;
+	// Degraded: unknown records are not found
+	if (breaker == DBT_BREAKER_OPEN)
+	{
+		r = 0;
+		goto exit;
+	}
 
-	if (dbt_lock(dbt))
+	conn = dbt_stats_checkout(dbt, &wait);
+	if (conn == NULL)
 	{
-		return -1;
+		r = -1;
+		dbt_breaker_update(dbt, breaker, r, &start);
+		goto exit;
 	}
 
-	r = dbt->dbt_driver->dd_del(dbt, record);
-	if (r < 0 && cf_dbt_fatal_errors)
+	r = dbt->dbt_driver->dd_get(conn, record, result);
+	if (r < 0 && cf_dbt_fatal_errors && !dbt_breaker_enabled(dbt))
 	{
 		log_die(EX_SOFTWARE, "fatal database error");
 	}
 
-	dbt_unlock(dbt);
+	dbt_pool_checkin(dbt, conn);
+
+	dbt_breaker_update(dbt, breaker, r, &start);
+
+	if (r == 0 && *result && dbt->dbt_cache.dc_ht)
+	{
+		dbt_cache_set(dbt, record, *result, generation);
+	}
+
+exit:
+	dbt_stats_update(dbt, DBT_OP_GET, &start, wait, r);
 
 	return r;
 }
 
 
 int
-dbt_db_walk(dbt_t *dbt, dbt_db_callback_t callback)
+dbt_db_set(dbt_t *dbt, var_t *record)
 {
-	int r;
+	struct timespec start;
+	dbt_t *conn;
+	long wait = 0;
+	int breaker, r;
 
-	if(dbt_lock(dbt) == -1)
+	dbt_stats_now(&start);
+
+	// Composite drivers sync their parent table only
+	if (dbt_sync && dbt->dbt_parent == NULL)
 	{
-		log_error("dbt_db_walk: dbt_lock failed");
-		return -1;
+		client_sync(dbt, record);
 	}
-	
-	r = dbt->dbt_driver->dd_walk(dbt, callback);
-	if (r < 0 && cf_dbt_fatal_errors)
+
+	breaker = dbt_breaker_check(dbt);
+	if (breaker == DBT_BREAKER_OPEN)
 	{
-		log_die(EX_SOFTWARE, "fatal database error");
-	}
+		r = dbt_journal_set(dbt, record, 0);
+		if (r <= 0)
+		{
+			goto exit;
+		}
 
-	dbt_unlock(dbt);
+		// Closed meanwhile
+		breaker = DBT_BREAKER_CLOSED;
+	}
 
-	return r;
-}
+	// Write-behind
+	if (dbt->dbt_queue.dq_ht)
+	{
+		r = dbt_queue_set(dbt, record);
+		if (r <= 0)
+		{
+			goto exit;
+		}
+	}
 
-int
-dbt_db_sync(dbt_t *dbt)
-{
-	int r;
+	conn = dbt_stats_checkout(dbt, &wait);
+	if (conn == NULL)
+	{
+		r = -1;
+		dbt_breaker_update(dbt, breaker, r, &start);
+		goto exit;
+	}
 
-	if (dbt->dbt_driver->dd_sync == NULL)
+	r = dbt->dbt_driver->dd_set(conn, record);
+	if (r < 0 && cf_dbt_fatal_errors && !dbt_breaker_enabled(dbt))
 	{
-		return 0;
+		log_die(EX_SOFTWARE, "fatal database error");
 	}
 
-	if (dbt_lock(dbt))
+	/*
+	 * Invalidate instead of updating the cache. SQL drivers may modify
+	 * the record on the fly (VF_SQL_SAFE_UPDATE).
+	 *
+	 * Pooled connections run concurrently. A reader may have fetched the
+	 * old row while dd_set was running. Invalidating after the write
+	 * bumps the cache generation and keeps dbt_cache_set from storing it.
+	 */
+	if (dbt->dbt_cache.dc_ht)
 	{
-		return -1;
+		dbt_cache_del(dbt, record);
 	}
 
-	r = dbt->dbt_driver->dd_sync(dbt);
+	dbt_pool_checkin(dbt, conn);
 
-	dbt_unlock(dbt);
+	dbt_breaker_update(dbt, breaker, r, &start);
+
+	if (r == 0 && dbt->dbt_index.di_ht)
+	{
+		dbt_index_set(dbt, record);
+	}
+
+exit:
+	dbt_stats_update(dbt, DBT_OP_SET, &start, wait, r);
 
 	return r;
 }
 
+
 int
-dbt_db_expire(dbt_t *dbt)
+dbt_db_del(dbt_t *dbt, var_t *record)
 {
-	int r;
+	struct timespec start;
+	dbt_t *conn;
+	long wait = 0;
+	int breaker, r;
 
-	if (dbt_lock(dbt))
+	dbt_stats_now(&start);
+
+	// A pending write would restore the record
+	if (dbt->dbt_queue.dq_ht && dbt_queue_remove(dbt, record, 0))
 	{
-		return -1;
+		r = -1;
+		goto exit;
 	}
 
-	if (dbt->dbt_driver->dd_expire == NULL)
+	breaker = dbt_breaker_check(dbt);
+	if (breaker == DBT_BREAKER_OPEN)
 	{
-		log_die(EX_SOFTWARE, "dbt_expire: driver %s doesn't support expire",
-			dbt->dbt_driver->dd_name);
+		r = dbt_journal_set(dbt, record, 1);
+		if (r <= 0)
+		{
+			goto exit;
+		}
+
+		// Closed meanwhile
+		breaker = DBT_BREAKER_CLOSED;
 	}
 
-	r = dbt->dbt_driver->dd_expire(dbt);
-	if (r < 0 && cf_dbt_fatal_errors)
+	conn = dbt_stats_checkout(dbt, &wait);
+	if (conn == NULL)
+	{
+		r = -1;
+		dbt_breaker_update(dbt, breaker, r, &start);
+		goto exit;
+	}
+
+	r = dbt->dbt_driver->dd_del(conn, record);
+	if (r < 0 && cf_dbt_fatal_errors && !dbt_breaker_enabled(dbt))
 	{
 		log_die(EX_SOFTWARE, "fatal database error");
 	}
 
-	dbt_unlock(dbt);
+	// See dbt_db_set
+	if (dbt->dbt_cache.dc_ht)
+	{
+		dbt_cache_del(dbt, record);
+	}
+
+	dbt_pool_checkin(dbt, conn);
+
+	dbt_breaker_update(dbt, breaker, r, &start);
+
+	if (r == 0 && dbt->dbt_index.di_ht)
+	{
+		dbt_index_del(dbt, record);
+	}
+
+exit:
+	dbt_stats_update(dbt, DBT_OP_DEL, &start, wait, r);
 
 	return r;
 }
 
 
+/*
+ * Fetch n records using a single connection checkout. results[i] is set to
+ * the record stored for records[i] or NULL if it does not exist. Pending
+ * writes and cached records are served first. The remaining lookups are
+ * passed to dd_mget in chunks of DBT_MGET_BATCH. Drivers without dd_mget
+ * are queried record by record while holding the connection.
+ */
 int
-dbt_db_get_from_table(dbt_t *dbt, var_t *attrs, var_t **record)
+dbt_db_mget(dbt_t *dbt, int n, var_t **records, var_t **results)
 {
-	var_t *lookup = NULL;
-	var_t *v, *template;
-	ll_t *scheme_ll, *lookup_ll;
-	ll_entry_t *scheme_pos, *lookup_pos;
+	dbt_driver_t *dd = dbt->dbt_driver;
+	struct timespec start;
+	dbt_t *conn;
+	var_t **lookups = NULL, **found = NULL;
+	unsigned long *generation = NULL;
+	int *index = NULL;
+	int misses = 0;
+	long wait = 0;
+	int breaker, i, len, r = -1;
 
-	lookup = VAR_COPY(dbt->dbt_scheme);
-	if (lookup == NULL)
+	for (i = 0; i < n; ++i)
 	{
-		log_error("dbt_db_get_from_table: VAR_COPY failed");
-		return -1;
+		results[i] = NULL;
 	}
 
-	scheme_ll = dbt->dbt_scheme->v_data;
-	scheme_pos = LL_START(scheme_ll);
+	if (n <= 0)
+	{
+		return 0;
+	}
 
-	lookup_ll = lookup->v_data;
-	lookup_pos = LL_START(lookup_ll);
+	dbt_stats_now(&start);
 
-	for (;;)
+	lookups = (var_t **) malloc(n * sizeof (var_t *));
+	found = (var_t **) malloc(n * sizeof (var_t *));
+	generation = (unsigned long *) malloc(n * sizeof (unsigned long));
+	index = (int *) malloc(n * sizeof (int));
+	if (lookups == NULL || found == NULL || generation == NULL ||
+	    index == NULL)
 	{
-		template = ll_next(scheme_ll, &scheme_pos);
-		v = ll_next(lookup_ll, &lookup_pos);
+		log_sys_error("dbt_db_mget: malloc");
+		goto exit;
+	}
 
-		if (v == NULL || template == NULL)
-		{
-			break;
-		}
+	breaker = dbt_breaker_check(dbt);
 
-		if ((template->v_flags & VF_KEY) == 0)
+	for (i = 0; i < n; ++i)
+	{
+		// Backend bypassed: journaled records come first
+		if (breaker == DBT_BREAKER_OPEN)
 		{
-			continue;
+			r = dbt_journal_get(dbt, records[i], &results[i]);
+			if (r == -1)
+			{
+				goto exit;
+			}
+			if (r == 1)
+			{
+				continue;
+			}
 		}
 
-		v->v_flags |= VF_KEY;
-
-		if (v->v_data != NULL)
+		// Pending writes are visible to readers
+		if (dbt->dbt_queue.dq_ht)
 		{
-			log_error(
-			    "dbt_db_get_from_table: scheme contains data");
-			goto error;
+			r = dbt_queue_get(dbt, records[i], &results[i]);
+			if (r == -1)
+			{
+				goto exit;
+			}
+			if (r == 1)
+			{
+				continue;
+			}
 		}
 
-		v->v_data = vtable_get(attrs, v->v_name);
-		if (v->v_data == NULL)
+		generation[misses] = 0;
+
+		if (dbt->dbt_cache.dc_ht)
 		{
-			log_error("dbt_db_get_from_table: required key "
-			    "attribute \"%s\" for table \"%s\" not set",
-			    v->v_name, dbt->dbt_name);
-			goto error;
+			r = dbt_cache_get(dbt, records[i], &results[i],
+			    &generation[misses]);
+			if (r == 1)
+			{
+				continue;
+			}
 		}
 
-		v->v_flags |= VF_KEEPDATA;
+		lookups[misses] = records[i];
+		found[misses] = NULL;
+		index[misses] = i;
+		++misses;
 	}
 
-	if (dbt_db_get(dbt, lookup, record))
+	r = 0;
+
+	// Degraded: unknown records are not found
+	if (misses == 0 || breaker == DBT_BREAKER_OPEN)
 	{
-		log_warning("dbt_db_get_from_table: dbt_db_get failed");
-		goto error;
+		goto exit;
 	}
 
-	if (*record)
+	conn = dbt_stats_checkout(dbt, &wait);
+	if (conn == NULL)
 	{
-		log_debug("dbt_db_get_from_table: record found");
+		r = -1;
+		dbt_breaker_update(dbt, breaker, r, &start);
+		goto exit;
 	}
-	else
+
+	for (i = 0; i < misses && r == 0; i += len)
 	{
-		log_debug("dbt_db_get_from_table: no record");
+		if (dd->dd_mget == NULL)
+		{
+			len = 1;
+			r = dd->dd_get(conn, lookups[i], &found[i]);
+			continue;
+		}
+
+		len = misses - i;
+		if (len > DBT_MGET_BATCH)
+		{
+			len = DBT_MGET_BATCH;
+		}
+
+		r = dd->dd_mget(conn, len, lookups + i, found + i);
 	}
 
-	var_delete(lookup);
+	if (r < 0 && cf_dbt_fatal_errors && !dbt_breaker_enabled(dbt))
+	{
+		log_die(EX_SOFTWARE, "fatal database error");
+	}
 
-	return 0;
+	dbt_pool_checkin(dbt, conn);
 
+	dbt_breaker_update(dbt, breaker, r, &start);
 
-error:
+	for (i = 0; i < misses; ++i)
+	{
+		results[index[i]] = found[i];
 
-	if (lookup)
+		if (r == 0 && found[i] && dbt->dbt_cache.dc_ht)
+		{
+			dbt_cache_set(dbt, lookups[i], found[i], generation[i]);
+		}
+	}
+
+exit:
+	if (r)
 	{
-		var_delete(lookup);
+		for (i = 0; i < n; ++i)
+		{
+			if (results[i])
+			{
+				var_delete(results[i]);
+				results[i] = NULL;
+			}
+		}
 	}
 
-	return -1;
+	if (lookups)
+	{
+		free(lookups);
+	}
+	if (found)
+	{
+		free(found);
+	}
+	if (generation)
+	{
+		free(generation);
+	}
+	if (index)
+	{
+		free(index);
+	}
+
+	r = r ? -1 : 0;
+
+	dbt_stats_update(dbt, DBT_OP_MGET, &start, wait, r);
+
+	return r;
+}
+
+
+/*
+ * Sets written[i] if records[i] was stored. Returns the number of failed
+ * records.
+ */
+static int
+dbt_db_mset_records(dbt_t *dbt, dbt_t *conn, int n, var_t **records,
+    int *written)
+{
+	int failed = 0;
+	int i;
+
+	for (i = 0; i < n; ++i)
+	{
+		written[i] = dbt->dbt_driver->dd_set(conn, records[i]) == 0;
+		if (!written[i])
+		{
+			log_error("dbt_db_mset_records: %s: dd_set failed",
+			    dbt->dbt_name);
+			++failed;
+		}
+	}
+
+	return failed;
 }
 
 
+/*
+ * Store n records using a single connection checkout. Records are written
+ * by dd_mset if the driver has it, otherwise in a single transaction like
+ * the write-behind queue does.
+ */
 int
-dbt_db_load_into_table(dbt_t *dbt, var_t *table)
+dbt_db_mset(dbt_t *dbt, int n, var_t **records)
 {
-	var_t *record;
-	ll_t *list;
-	ll_entry_t *pos;
-	var_t *v;
-	void *data;
+	dbt_driver_t *dd = dbt->dbt_driver;
+	struct timespec start;
+	dbt_t *conn;
+	var_t **pending;
+	int *written = NULL;
+	int failed = 0, m = 0;
+	long wait = 0;
+	int breaker, i, r;
 
-	if (dbt_db_get_from_table(dbt, table, &record))
+	if (n <= 0)
 	{
-		log_error("dbt_db_load_into_tabe: dbt_db_get_from_table "
-		    "failed");
-		return -1;
+		return 0;
 	}
 
-	list = record == NULL ? dbt->dbt_scheme->v_data : record->v_data;
+	dbt_stats_now(&start);
 
-	pos = LL_START(list);
-	while ((v = ll_next(list, &pos)))
+	if (dbt_sync && dbt->dbt_parent == NULL)
 	{
-		/*
-		 * Keys are already stored in the table
-		 */
-		if ((v->v_flags & VF_KEY))
+		for (i = 0; i < n; ++i)
 		{
-			continue;
+			client_sync(dbt, records[i]);
 		}
+	}
 
-		/*
-	 	 * If not found set table entries to NULL
-	 	 */
-		data = record == NULL ? NULL : v->v_data;
+	pending = (var_t **) malloc(n * sizeof (var_t *));
+	written = (int *) malloc(n * sizeof (int));
+	if (pending == NULL || written == NULL)
+	{
+		log_sys_error("dbt_db_mset: malloc");
+		failed = n;
+		goto exit;
+	}
 
-		/*
-		 * Do not overwrite existing data
-		 */
-		if (vtable_get(table, v->v_name))
+	breaker = dbt_breaker_check(dbt);
+
+	for (i = 0; i < n; ++i)
+	{
+		if (breaker == DBT_BREAKER_OPEN)
 		{
-			log_debug("dbt_db_load_into_table: key \"%s\" exists",
-			    v->v_name);
+			r = dbt_journal_set(dbt, records[i], 0);
+			if (r < 0)
+			{
+				++failed;
+			}
+			if (r <= 0)
+			{
+				continue;
+			}
 
-			continue;
+			// Closed meanwhile
+			breaker = DBT_BREAKER_CLOSED;
 		}
 
-		if (vtable_set_new(table, v->v_type, v->v_name, data, VF_COPY))
+		// Write-behind
+		if (dbt->dbt_queue.dq_ht)
 		{
-			log_error("dbt_db_load_into_table: var_table_set_new "
-			    "failed");
-
-			return -1;
+			r = dbt_queue_set(dbt, records[i]);
+			if (r < 0)
+			{
+				++failed;
+			}
+			if (r <= 0)
+			{
+				continue;
+			}
 		}
+
+		pending[m++] = records[i];
 	}
 
-	if (record)
+	if (m == 0)
 	{
-		var_delete(record);
+		goto exit;
 	}
 
-	return 0;
-}
-
-
-int
-dbt_register(char *name, dbt_t *dbt)
-{
-	var_t *config;
-	char *config_key;
-
-	config_key = dbt->dbt_config_key == NULL? name: dbt->dbt_config_key;
+	conn = dbt_stats_checkout(dbt, &wait);
+	if (conn == NULL)
+	{
+		failed += m;
+		dbt_breaker_update(dbt, breaker, -1, &start);
+		goto exit;
+	}
 
-	/*
-	 * Load config table
-	 */
-	config = cf_get(VT_TABLE, "table", config_key, NULL);
-	if (config == NULL) {
-		if (dbt_default_database != NULL)
+	if (dd->dd_mset)
+	{
+		r = dd->dd_mset(conn, m, pending);
+		if (r)
 		{
-			config = dbt_default_database;
+			failed += m;
 		}
-		else
+
+		for (i = 0; i < m; ++i)
 		{
-			log_error("dbt_register: missing database configuration for"
-				" \"%s\" and default_database is not set", name);
-			return -1;
+			written[i] = r == 0;
 		}
 	}
+	else if (m > 1 && dd->dd_begin && dd->dd_begin(conn) == 0)
+	{
+		r = dbt_db_mset_records(dbt, conn, m, pending, written);
+		if (r == 0 && dd->dd_commit(conn) == 0)
+		{
+			goto committed;
+		}
 
-	/*
-	 * Fill configuration into dbt. CAVEAT: No real error checking. A bad
-	 * or incomplete configuration should be determined by the database
-	 * driver.
-	 */
-	if (vtable_dereference(config, "driver", &dbt->dbt_drivername,
-	    "path", &dbt->dbt_path, "host", &dbt->dbt_host,
-	    "port", &dbt->dbt_port, "user", &dbt->dbt_user,
-	    "pass", &dbt->dbt_pass, "database", &dbt->dbt_database,
-	    NULL) == -1)
+		log_error("dbt_db_mset: %s: transaction failed. Writing "
+		    "%d records one by one", dbt->dbt_name, m);
+
+		dd->dd_rollback(conn);
+
+		failed += dbt_db_mset_records(dbt, conn, m, pending, written);
+	}
+	else
 	{
-		log_error("dbt_register: vtable_dereference failed");
-		return -1;
+		failed += dbt_db_mset_records(dbt, conn, m, pending, written);
 	}
 
+committed:
 	/*
-	 * dbt_name is used by the janitor
-	 */
-	dbt->dbt_name = name;
-
-	/*
-	 * Set driver to NULL (filled in upon connection)
+	 * See dbt_db_set. The expiry index is updated once the records are
+	 * committed.
 	 */
-	dbt->dbt_driver = NULL;
+	for (i = 0; i < m; ++i)
+	{
+		if (dbt->dbt_cache.dc_ht)
+		{
+			dbt_cache_del(dbt, pending[i]);
+		}
 
-	/*
-	 * Add some defaults
-	 */
-	if (dbt->dbt_database == NULL) {
-		dbt->dbt_database = BINNAME;
+		if (written[i] && dbt->dbt_index.di_ht)
+		{
+			dbt_index_set(dbt, pending[i]);
+		}
 	}
 
-	if (dbt->dbt_cleanup_interval == 0) {
-		dbt->dbt_cleanup_interval = cf_dbt_cleanup_interval;
-	}
+	dbt_pool_checkin(dbt, conn);
 
-	if (strlen(dbt->dbt_expire_field) == 0)
-	{
-		snprintf(dbt->dbt_expire_field, DBT_FIELD_MAX, "%s%s", dbt->dbt_name,
-			EXPIRE_SUFFIX);
-	}
+	dbt_breaker_update(dbt, breaker, failed ? -1 : 0, &start);
 
-	/*
-	 * Lock janitor mutex in case the janitor is already working
-	 */
-	if (pthread_mutex_lock(&dbt_janitor_mutex))
+	if (failed && cf_dbt_fatal_errors && !dbt_breaker_enabled(dbt))
 	{
-		log_sys_error("dbt_register: pthread_mutex_lock");
-		return -1;
+		log_die(EX_SOFTWARE, "fatal database error");
 	}
 
-	/*
-	 * Store dbt in dbt_tables
-	 */
-	if (sht_insert(dbt_tables, name, dbt)) {
-		log_error("dbt_register: ht_insert failed");
-		return -1;
+exit:
+	if (pending)
+	{
+		free(pending);
 	}
 
-	if (pthread_mutex_unlock(&dbt_janitor_mutex))
+	if (written)
 	{
-		log_sys_error("dbt_register: pthread_mutex_unlock");
-		return -1;
+		free(written);
 	}
 
-	return 0;
+	r = failed ? -1 : 0;
+
+	dbt_stats_update(dbt, DBT_OP_MSET, &start, wait, r);
+
+	return r;
 }
 
 
+/*
+ * Returns 1 if all key fields of lookup are equal in record. Used by
+ * dd_mget implementations to assign fetched rows to their lookups.
+ */
 int
-dbt_common_validate(dbt_t *dbt, var_t *record)
+dbt_key_match(var_t *lookup, var_t *record)
 {
-	VAR_INT_T *expire = NULL;
+	ll_t *ll = lookup->v_data;
+	ll_entry_t *pos;
+	var_t *key, *v;
+	int cmp;
 
-	/*
-	 * Lookup expiry in record.
-	 */
-	expire = vlist_record_get(record, dbt->dbt_expire_field);
-	if (expire == NULL)
+	pos = LL_START(ll);
+	while ((key = ll_next(ll, &pos)))
 	{
-		log_die(EX_SOFTWARE, "dbt_common_vaildate: table \"%s\" must "
-		    "set %s_expire to use dbt_common_validate", dbt->dbt_name,
-		    dbt->dbt_name, dbt->dbt_name);
-	}
+		if ((key->v_flags & VF_KEY) == 0)
+		{
+			continue;
+		}
 
-	/*
-	 * dbt->dbt_cleanup_schedule == time(NULL)
-	 */
-	if (dbt->dbt_cleanup_schedule > *expire)
-	{
-		return 0;
+		v = vlist_record_lookup(record, key->v_name);
+		if (v == NULL || v->v_data == NULL || key->v_data == NULL)
+		{
+			return 0;
+		}
+
+		if (var_compare(&cmp, key, v) || cmp)
+		{
+			return 0;
+		}
 	}
 
 	return 1;
 }
 
 
-static int
-dbt_janitor_cleanup_expire(dbt_t *dbt)
+int
+dbt_cursor_key(dbt_cursor_t *cursor, void *key, int klen)
 {
-	int deleted;
+	void *p;
 
-	deleted = dbt_db_expire(dbt);
-	if (deleted == -1)
+	if (klen > cursor->dc_size)
 	{
-		log_error("dbt_janitor_cleanup_exipre: dbt_db_cleanup failed");
+		p = realloc(cursor->dc_key, klen);
+		if (p == NULL)
+		{
+			log_sys_error("dbt_cursor_key: realloc");
+			return -1;
+		}
+
+		cursor->dc_key = p;
+		cursor->dc_size = klen;
 	}
 
-	return deleted;
+	memcpy(cursor->dc_key, key, klen);
+	cursor->dc_klen = klen;
+
+	return 0;
 }
 
 
-static int
-dbt_janitor_validate(dbt_t *dbt, var_t *record)
+void
+dbt_cursor_record(dbt_cursor_t *cursor, var_t *record)
 {
-	int expire;
-
-	expire = DBT_VALIDATE(dbt, record);
-	if (expire == -1) {
-		log_error("dbt_cleanup: DBT_VALIDATE failed");
-		return -1;
-	}
-	if (expire) {
-		return 0;
+	if (cursor->dc_record)
+	{
+		var_delete(cursor->dc_record);
 	}
-	if (dbt_db_del(dbt, record)) {
-		log_error("dbt_cleanup: dbt_db_del failed");
-		return -1;
-	}
-
-	++dbt->dbt_cleanup_deleted;
-
-	return 0;
-}
 
+	cursor->dc_record = record;
 
-static int
-dbt_janitor_cleanup_walk(dbt_t *dbt)
-{
-	dbt->dbt_cleanup_deleted = 0;
-
-	if (dbt_db_walk(dbt, (void *) dbt_janitor_validate)) {
-		log_error("dbt_janitor_cleanup_walk: dbt_db_walk failed");
-		return -1;
-	}
-		
-	/*
-	 * Sync database if driver supports syncing
-	 */
-	if (dbt->dbt_driver->dd_sync) {
-		if (dbt_db_sync(dbt)) {
-			log_warning("dbt_janitor: dbt_db_sync failed");
-		}
-	}
-
-	return dbt->dbt_cleanup_deleted;
+	return;
 }
 
 
-static int
-dbt_janitor_cleanup(time_t now, dbt_t *dbt)
+/*
+ * Identifies the layout of a scheme in files written by drivers.
+ */
+hash_t
+dbt_scheme_hash(var_t *scheme)
 {
-	int deleted = 0;
-
-	log_debug("dbt_janitor_cleanup: cleaning up \"%s\"", dbt->dbt_name);
+	char buffer[BUFLEN];
+	ll_t *ll = scheme->v_data;
+	ll_entry_t *pos;
+	var_t *v;
+	int n = 0;
 
-	/*
-	 * Check if driver is registered
-	 */
-	if (dbt->dbt_driver == NULL)
+	pos = LL_START(ll);
+	while ((v = ll_next(ll, &pos)) && n < sizeof buffer)
 	{
-		log_debug("dbt_janitor_cleanup: database \"%s\" not connected "
-		    "yet", dbt->dbt_name);
-		return 0;
+		n += snprintf(buffer + n, sizeof buffer - n, "%s:%d:%d;",
+		    v->v_name, v->v_type, (v->v_flags & VF_KEY) != 0);
 	}
 
-	/*
-	 * Check if driver supports SQL
-	 */
-	if (dbt->dbt_driver->dd_expire)
+	if (n > sizeof buffer)
 	{
-		deleted = dbt_janitor_cleanup_expire(dbt);
+		n = sizeof buffer;
 	}
 
-	/*
-	 * Check if driver and table support walking
-	 */
-	else if (dbt->dbt_driver->dd_walk)
-	{
-		if (dbt->dbt_validate)
-		{
-			deleted = dbt_janitor_cleanup_walk(dbt);
-		}
+	return HASH_STABLE(buffer, n);
+}
 
-		/*
-		 * No validate callback registered. Not cleaning.
-		 */
-		else
-		{
-			log_debug("dbt_janitor_cleanup: database \"%s\" has "
-			    "no validate callback. Not cleaning.",
-			    dbt->dbt_name);
-			deleted = 0;
-		}
-	}
 
-	else
+void
+dbt_cursor_clear(dbt_cursor_t *cursor)
+{
+	if (cursor->dc_key)
 	{
-		log_error("dbt_janitor_cleanup: can't cleanup database \"%s\":"
-		    " bad driver \"%s\": dd_expire and dd_walk unset", dbt->dbt_name,
-		    dbt->dbt_driver->dd_name);
-		return -1;
+		free(cursor->dc_key);
 	}
 
-	/*
-	 * dbt_janitor_cleanup_expire or dbt_janitor_cleanup_walk should have
-	 * logged already
-	 */
-	if (deleted == -1)
+	if (cursor->dc_record)
 	{
-		return -1;
+		var_delete(cursor->dc_record);
 	}
 
-	if (deleted)
-	{
-		log_debug("dbt_janitor_cleanup: disposed %d stale record%s "
-			"from %s", deleted, deleted > 1 ? "s" : "", dbt->dbt_name);
-	}
+	memset(cursor, 0, sizeof (dbt_cursor_t));
 
-	return deleted;
+	return;
 }
 
 
-static void *
-dbt_janitor(void *arg)
+/*
+ * Drivers supporting dd_scan release the table lock every DBT_WALK_BATCH
+ * records. Lookups are not blocked by long running walks. Callbacks may
+ * see a record twice and must be idempotent. The janitor deletes expired
+ * records only and dbt_index_set updates existing nodes.
+ */
+int
+dbt_db_walk(dbt_t *dbt, dbt_db_callback_t callback)
 {
-	time_t now;
-	dbt_t *dbt;
-	int deleted;
-	unsigned long schedule;
-	struct timespec	ts;
+	struct timespec start;
+	dbt_cursor_t cursor;
+	long wait = 0;
 	int r;
-	ht_pos_t pos;
-	char log_message[BUFLEN];
-	int log_len;
 
-	log_debug("dbt_janitor: janitor thread running");
-
-	dbt_janitor_running = 1;
-
-	if (pthread_mutex_lock(&dbt_janitor_mutex))
-	{
-		log_sys_error("dbt_janitor: pthread_mutex_lock");
-		return NULL;
-	}
+	dbt_stats_now(&start);
 
-	while(dbt_janitor_running)
+	if (dbt->dbt_driver->dd_scan == NULL)
 	{
-		if (util_now(&ts))
+		if(dbt_stats_lock(dbt, &wait) == -1)
 		{
-			log_error("dbt_janitor: util_now failed");
-			return NULL;
+			log_error("dbt_db_walk: dbt_lock failed");
+			r = -1;
+			goto exit;
 		}
 
-		/*
- 		 * Call watchdog to log stale connections
-		 */
-		if (cf_watchdog_stage_timeout)
+		r = dbt->dbt_driver->dd_walk(dbt, callback);
+		if (r < 0 && cf_dbt_fatal_errors)
 		{
-			watchdog_check();
+			log_die(EX_SOFTWARE, "fatal database error");
 		}
 
-		now = ts.tv_sec;
+		dbt_unlock(dbt);
+
+		goto exit;
+	}
 
-		// Clear log message
-		log_message[0] = 0;
-		log_len = 0;
+	memset(&cursor, 0, sizeof cursor);
 
-		sht_start(dbt_tables, &pos);
-		while ((dbt = sht_next(dbt_tables, &pos)))
+	do
+	{
+		if(dbt_stats_lock(dbt, &wait) == -1)
 		{
-			if (dbt->dbt_cleanup_interval == -1)
-			{
-				continue;
-			}
+			log_error("dbt_db_walk: dbt_lock failed");
+			r = -1;
+			break;
+		}
 
-			if (dbt->dbt_cleanup_schedule == 0)
-			{
-				dbt->dbt_cleanup_schedule = now;
-			}
+		r = dbt->dbt_driver->dd_scan(dbt, &cursor, DBT_WALK_BATCH,
+		    callback);
 
-			/*
-			 * Check if table needs a clean up
-			 */
-			if (now < dbt->dbt_cleanup_schedule)
-			{
-				continue;
-			}
+		dbt_unlock(dbt);
+	}
+	while (r > 0);
 
-			deleted = dbt_janitor_cleanup(now, dbt);
-			if (deleted == -1)
-			{
-				log_error("dbt_janitor: dbt_janitor_cleanup "
-				    "failed");
-			}
+	dbt_cursor_clear(&cursor);
 
-			if (deleted > 0)
-			{
-				log_len += snprintf(log_message + log_len,
-					sizeof log_message - log_len, " %s=%d",
-					dbt->dbt_name, deleted);
-				if (log_len >= sizeof log_message)
-				{
-					log_error("dbt_janitor: log buffer exhausted");
-					log_len = 0;
-					log_message[0] = 0;
-				}
-			}
+	if (r < 0 && cf_dbt_fatal_errors)
+	{
+		log_die(EX_SOFTWARE, "fatal database error");
+	}
 
-			/*
-			 * Schedule next cleanup cycle
-			 */
-			dbt->dbt_cleanup_schedule =
-				now + dbt->dbt_cleanup_interval;
-		}
+exit:
+	dbt_stats_update(dbt, DBT_OP_WALK, &start, wait, r);
 
-		if (log_len)
-		{
-			log_error("database cleanup: deleted:%s",
-				log_message);
-		}
+	return r;
+}
 
-		/*
-		 * Schedule next run
-		 */
-		schedule = 0xffffffff;
 
-		sht_start(dbt_tables, &pos);
-		while ((dbt = sht_next(dbt_tables, &pos)))
-		{
-			if (dbt->dbt_cleanup_interval == -1)
-			{
-				continue;
-			}
+/*
+ * Visits the next batch of a walk. Used by composite drivers. Returns the
+ * number of visited records, 0 at the end of the table.
+ */
+int
+dbt_db_scan(dbt_t *dbt, dbt_cursor_t *cursor, int count,
+    dbt_db_callback_t callback)
+{
+	int r;
 
-			if (dbt->dbt_cleanup_schedule < schedule)
-			{
-				schedule = dbt->dbt_cleanup_schedule;
-			}
-		}
+	if (dbt->dbt_driver->dd_scan == NULL)
+	{
+		log_error("dbt_db_scan: driver %s doesn't support scan",
+		    dbt->dbt_driver->dd_name);
+		return -1;
+	}
 
-		/*
-		 * Happens only if no table is registed
-		 */
-		if (schedule == 0xffffffff)
-		{
-			schedule = now + 1;
-		}
+	if (dbt_lock(dbt))
+	{
+		log_error("dbt_db_scan: dbt_lock failed");
+		return -1;
+	}
 
-		log_debug("dbt_janitor: sleeping for %lu seconds",
-		    schedule - now);
+	r = dbt->dbt_driver->dd_scan(dbt, cursor, count, callback);
+	if (r < 0 && cf_dbt_fatal_errors)
+	{
+		log_die(EX_SOFTWARE, "fatal database error");
+	}
 
-		ts.tv_sec = schedule;
+	dbt_unlock(dbt);
 
-		/*
-		 * Suspend execution
-		 */
-		r = pthread_cond_timedwait(&dbt_janitor_cond,
-		    &dbt_janitor_mutex, &ts);
+	return r;
+}
 
-		/*
-		 * Signaled wakeup or timeout
-		 */
-		if (r == 0 || r == ETIMEDOUT)
-		{
-			continue;
-		}
+int
+dbt_db_sync(dbt_t *dbt)
+{
+	int r;
 
-		log_sys_error("client_main: pthread_cond_timedwait");
-		break;
+	if (dbt->dbt_driver->dd_sync == NULL)
+	{
+		return 0;
 	}
 
-	log_debug("dbt_janitor: shutdown");
-
 	/*
-	 * Unlock janitor mutex
+	 * Drivers that write to disk while syncing lock only while they
+	 * need to.
 	 */
-	if (pthread_mutex_unlock(&dbt_janitor_mutex))
+	if (dbt->dbt_driver->dd_flags & DBT_SYNC_SELF)
 	{
-		log_sys_error("dbt_janitor: pthread_mutex_unlock");
+		return dbt->dbt_driver->dd_sync(dbt);
 	}
 
-	return NULL;
-}
+	if (dbt_lock(dbt))
+	{
+		return -1;
+	}
+
+	r = dbt->dbt_driver->dd_sync(dbt);
+
+	dbt_unlock(dbt);
 
+	return r;
+}
 
 int
-dbt_open_database(dbt_t *dbt)
+dbt_db_expire(dbt_t *dbt)
 {
-	dbt_driver_t *dd;
+	struct timespec start;
+	long wait = 0;
+	int r;
 
-	/*
-	 * Lookup database driver
-	 */
-	dd = sht_lookup(dbt_drivers, dbt->dbt_drivername);
-	if (dd == NULL)
+	dbt_stats_now(&start);
+
+	if (dbt_stats_lock(dbt, &wait))
 	{
-		log_error("dbt_open_database: unknown database driver \"%s\"",
-			dbt->dbt_drivername);
-		return -1;
+		r = -1;
+		goto exit;
 	}
 
-	dbt->dbt_driver = dd;
+	if (dbt->dbt_driver->dd_expire == NULL)
+	{
+		log_die(EX_SOFTWARE, "dbt_expire: driver %s doesn't support expire",
+			dbt->dbt_driver->dd_name);
+	}
 
-	/*
-	 * Initialize mutex if driver requires locking
-	 */
-	if ((dd->dd_flags & DBT_LOCK))
+	r = dbt->dbt_driver->dd_expire(dbt);
+	if (r < 0 && cf_dbt_fatal_errors)
 	{
-		if(pthread_mutexattr_init(&dbt->dbt_mutexattr))
-		{
-			log_error("dbt_open_database: ptrhead_mutexattr_init failed");
-			return -1;
-		}
-		if(pthread_mutexattr_settype(&dbt->dbt_mutexattr, PTHREAD_MUTEX_RECURSIVE))
-		{
-			log_error("dbt_open_database: ptrhead_mutexattr_settype failed");
-			return -1;
-		}
-		if(pthread_mutex_init(&dbt->dbt_mutex, &dbt->dbt_mutexattr))
-		{
-			log_error("dbt_open_database: ptrhead_mutex_init failed");
-			return -1;
-		}
+		log_die(EX_SOFTWARE, "fatal database error");
 	}
 
 	/*
-	 * Open database
+	 * Expired records are unknown. Flush the cache if anything was
+	 * deleted.
 	 */
-	log_debug("dbt_open_database: open table %s (%s)", dbt->dbt_name, dbt->dbt_drivername);
-
-	if (dbt->dbt_driver->dd_open(dbt))
+	if (r != 0)
 	{
-		log_error("dbt_open_database: can't open \"%s\"",
-			dbt->dbt_name);
-		return -1;
+		dbt_cache_flush(dbt);
 	}
 
-	// Create tables in SQL databases
-	if (dbt->dbt_driver->dd_use_sql)
-	{
-		sql_open(&dbt->dbt_driver->dd_sql, dbt->dbt_handle,
-			dbt->dbt_scheme);
-	}
+	dbt_unlock(dbt);
 
-	dbt->dbt_open = 1;
+exit:
+	dbt_stats_update(dbt, DBT_OP_EXPIRE, &start, wait, r);
 
-	return 0;
+	return r;
 }
 
 
-void
-dbt_open_databases(void)
+int
+dbt_db_get_from_table(dbt_t *dbt, var_t *attrs, var_t **record)
 {
-	dbt_t *dbt;
-	ht_pos_t pos;
-
-	/*
-	 * Open all tables
-	 */
-	sht_start(dbt_tables, &pos);
-	while ((dbt = sht_next(dbt_tables, &pos)))
-	{
-		if (dbt_open_database(dbt))
-		{
-			log_die(EX_SOFTWARE, "dbt_init: cannot open database "
-				"%s", dbt->dbt_name);
-		}
-	}
-
-	/*
-	 * Start table janitor thread
-	 */
-	if (util_thread_create(&dbt_janitor_thread, dbt_janitor, NULL))
-	{
-		log_die(EX_SOFTWARE, "dbt_init: util_thread_create failed");
-	}
-
-	return;
-}
+	var_t *lookup = NULL;
+	var_t *v, *template;
+	ll_t *scheme_ll, *lookup_ll;
+	ll_entry_t *scheme_pos, *lookup_pos;
 
-static void
-dbt_driver_cleanup(dbt_driver_t *dd) {
-	if(dd->dd_cleanup)
+	lookup = VAR_COPY(dbt->dbt_scheme);
+	if (lookup == NULL)
 	{
-		dd->dd_cleanup();
-	}
-	
-	return;
-}
-
-void
-dbt_init(int start_threads)
-{
-	/*
-	 * Initialize driver table
-	 */
-	dbt_drivers = sht_create(DBT_BUCKETS, (sht_delete_t) dbt_driver_cleanup);
-	if(dbt_drivers == NULL) {
-		log_die(EX_SOFTWARE, "dbt_init: sht_create failed");
+		log_error("dbt_db_get_from_table: VAR_COPY failed");
+		return -1;
 	}
 
-	/*
-	 * Initailaize tables
-	 */
-	dbt_tables = sht_create(DBT_BUCKETS, (sht_delete_t) dbt_close);
-	if (dbt_tables == NULL) {
-		log_die(EX_SOFTWARE, "dbt_init: ht_init failed");
-	}
+	scheme_ll = dbt->dbt_scheme->v_data;
+	scheme_pos = LL_START(scheme_ll);
 
-	/*
-	 * Load database defaults
-	 */
-	dbt_default_database = cf_get(VT_TABLE, "default_database", NULL);
-	if (dbt_default_database == NULL) {
-		log_debug("dbt_init: no default_database found");
-	}
+	lookup_ll = lookup->v_data;
+	lookup_pos = LL_START(lookup_ll);
 
-	/*
-	 * Start sync threads
-	 */
-	if (start_threads)
+	for (;;)
 	{
-		if (server_init())
-		{
-			log_die(EX_SOFTWARE, "dbt_init: server_init failed");
-		}
+		template = ll_next(scheme_ll, &scheme_pos);
+		v = ll_next(lookup_ll, &lookup_pos);
 
-		if (client_init())
+		if (v == NULL || template == NULL)
 		{
-			log_die(EX_SOFTWARE, "dbt_init: client_init failed");
+			break;
 		}
 
-		dbt_threads_running = 1;
-	}
-
-	return;
-}
-
-
-void
-dbt_clear()
-{
-	if (dbt_threads_running)
-	{
-		dbt_threads_running = 0;
-
-		client_clear();
-		server_clear();
-	}
-
-	if (dbt_janitor_running)
-	{
-		if (pthread_mutex_lock(&dbt_janitor_mutex))
+		if ((template->v_flags & VF_KEY) == 0)
 		{
-			log_sys_error("dbt_janitor_clear: pthread_mutex_lock");
+			continue;
 		}
 
-		dbt_janitor_running = 0;
+		v->v_flags |= VF_KEY;
 
-		if (pthread_cond_signal(&dbt_janitor_cond))
+		if (v->v_data != NULL)
 		{
-			log_sys_error("dbt_janitor_clear: pthread_cond_signal");
+			log_error(
+			    "dbt_db_get_from_table: scheme contains data");
+			goto error;
 		}
 
-		if (pthread_mutex_unlock(&dbt_janitor_mutex))
+		v->v_data = vtable_get(attrs, v->v_name);
+		if (v->v_data == NULL)
 		{
-			log_sys_error("dbt_janitor_clear: pthread_mutex_unlock");
+			log_error("dbt_db_get_from_table: required key "
+			    "attribute \"%s\" for table \"%s\" not set",
+			    v->v_name, dbt->dbt_name);
+			goto error;
 		}
 
-		util_thread_join(dbt_janitor_thread);
+		v->v_flags |= VF_KEEPDATA;
 	}
 
-	if (dbt_tables)
+	if (dbt_db_get(dbt, lookup, record))
 	{
-		sht_delete(dbt_tables);
+		log_warning("dbt_db_get_from_table: dbt_db_get failed");
+		goto error;
 	}
 
-	if (dbt_drivers)
+	if (*record)
 	{
-		sht_delete(dbt_drivers);
+		log_debug("dbt_db_get_from_table: record found");
+	}
+	else
+	{
+		log_debug("dbt_db_get_from_table: no record");
 	}
 
-	return;
-}
-
-
-dbt_t *
-dbt_lookup(char *name)
-{
-	return sht_lookup(dbt_tables, name);
-}
+	var_delete(lookup);
 
+	return 0;
 
-/*
- * CAVEAT: dbt_dump_record is not thread safe. Needs to run in locked
- * context.
- */
-int
-dbt_dump_record(dbt_t *dbt, var_t *record)
-{
-	char buffer[BUFLEN];
-	int len;
 
-	len = var_dump_data(record, buffer, sizeof buffer);
-	if (len == -1)
-	{
-		return -1;
-	}
+error:
 
-	*dbt_dump_buffer = realloc(*dbt_dump_buffer, dbt_dump_buffer_size + len + 2);
-	if (*dbt_dump_buffer == NULL)
+	if (lookup)
 	{
-		log_sys_error("dbt_dump_record: realloc");
-		return -1;
+		var_delete(lookup);
 	}
 
-	snprintf(*dbt_dump_buffer + dbt_dump_buffer_size, len + 2, "%s\n", buffer);
-
-	// Add the record an a trailing newline
-	dbt_dump_buffer_size += len + 1;
-
-	return 0;
+	return -1;
 }
 
+
 int
-dbt_dump(char **dump, char *tablename)
+dbt_db_load_into_table(dbt_t *dbt, var_t *table)
 {
-	dbt_t *table;
-
-	table = dbt_lookup(tablename);
-	if (table == NULL)
-	{
-		log_error("dbt_dump: dbt_lookup failed for table: %s", tablename);
-		return -1;
-	}
+	var_t *record;
+	ll_t *list;
+	ll_entry_t *pos;
+	var_t *v;
+	void *data;
 
-	/*
-	 * arguments to dbt_dump_record are passed through static globals
-	 * hence dbt_dump is mutex.
-	 */
-	if (pthread_mutex_lock(&dbt_dump_mutex))
+	if (dbt_db_get_from_table(dbt, table, &record))
 	{
-		log_sys_error("dbt_dump: pthread_mutex_lock");
+		log_error("dbt_db_load_into_tabe: dbt_db_get_from_table "
+		    "failed");
 		return -1;
 	}
 
-	/*
-	 * For safety we require *dump to be NULL.
-	 */
-	if (*dump)
-	{
-		dbt_dump_buffer_size = -1;
-		goto error;
-	}
-
-	dbt_dump_buffer = dump;
-	dbt_dump_buffer_size = 0;
-
-	dbt_db_walk(table, (dbt_db_callback_t) dbt_dump_record);
+	list = record == NULL ? dbt->dbt_scheme->v_data : record->v_data;
 
-	if (dbt_dump_buffer_size == -1)
+	pos = LL_START(list);
+	while ((v = ll_next(list, &pos)))
 	{
-		if (*dbt_dump_buffer)
+		/*
+		 * Keys are already stored in the table
+		 */
+		if ((v->v_flags & VF_KEY))
 		{
-			free(*dbt_dump_buffer);
-			*dbt_dump_buffer = NULL;
+			continue;
 		}
 
-		log_error("dbt_dump: dbt_dump_record failed");
-
-		goto error;
-	}
+		/*
+	 	 * If not found set table entries to NULL
+	 	 */
+		data = record == NULL ? NULL : v->v_data;
 
-error:
-	if (pthread_mutex_unlock(&dbt_dump_mutex))
-	{
-		log_sys_error("dbt_dump: pthread_mutex_unlock");
+		/*
+		 * Do not overwrite existing data
+		 */
+		if (vtable_get(table, v->v_name))
+		{
+			log_debug("dbt_db_load_into_table: key \"%s\" exists",
+			    v->v_name);
+
+			continue;
+		}
+
+		if (vtable_set_new(table, v->v_type, v->v_name, data, VF_COPY))
+		{
+			log_error("dbt_db_load_into_table: var_table_set_new "
+			    "failed");
+
+			return -1;
+		}
+	}
+
+	if (record)
+	{
+		var_delete(record);
+	}
+
+	return 0;
+}
+
+
+/*
+ * Fills the table configuration config into dbt. Composite drivers configure
+ * their child tables with dbt_configure.
+ */
+int
+dbt_configure(dbt_t *dbt, char *name, var_t *config)
+{
+	VAR_INT_T *cache_size = NULL, *cache_ttl = NULL;
+	VAR_INT_T *pool_size = NULL;
+	VAR_INT_T *write_queue = NULL, *write_batch = NULL;
+	VAR_INT_T *write_latency = NULL;
+	VAR_INT_T *expire_batch = NULL, *expire_rate = NULL;
+	VAR_INT_T *fsync_interval = NULL, *snapshot_interval = NULL;
+	VAR_INT_T *breaker_errors = NULL, *breaker_latency = NULL;
+	VAR_INT_T *breaker_timeout = NULL, *breaker_memory = NULL;
+
+	dbt->dbt_config = config;
+
+	/*
+	 * Fill configuration into dbt. CAVEAT: No real error checking. A bad
+	 * or incomplete configuration should be determined by the database
+	 * driver.
+	 */
+	if (vtable_dereference(config, "driver", &dbt->dbt_drivername,
+	    "path", &dbt->dbt_path, "host", &dbt->dbt_host,
+	    "port", &dbt->dbt_port, "user", &dbt->dbt_user,
+	    "pass", &dbt->dbt_pass, "database", &dbt->dbt_database,
+	    "cache_size", &cache_size, "cache_ttl", &cache_ttl,
+	    "pool_size", &pool_size, "write_queue", &write_queue,
+	    "write_batch", &write_batch, "write_latency", &write_latency,
+	    "expire_batch", &expire_batch, "expire_rate", &expire_rate,
+	    "fsync_interval", &fsync_interval,
+	    "snapshot_interval", &snapshot_interval,
+	    "breaker_errors", &breaker_errors,
+	    "breaker_latency", &breaker_latency,
+	    "breaker_timeout", &breaker_timeout,
+	    "breaker_memory", &breaker_memory,
+	    NULL) == -1)
+	{
+		log_error("dbt_configure: vtable_dereference failed");
+		return -1;
+	}
+
+	/*
+	 * Record cache is disabled by default
+	 */
+	dbt->dbt_cache.dc_size = cache_size == NULL ? 0 : *cache_size;
+	dbt->dbt_cache.dc_ttl = cache_ttl == NULL ? 0 : *cache_ttl;
+
+	/*
+	 * Connection pool is disabled by default
+	 */
+	dbt->dbt_pool.dp_size = pool_size == NULL ? 0 : *pool_size;
+
+	/*
+	 * Write-behind is disabled by default
+	 */
+	dbt->dbt_queue.dq_size = write_queue == NULL ? 0 : *write_queue;
+	dbt->dbt_queue.dq_batch = write_batch == NULL ? 0 : *write_batch;
+	dbt->dbt_queue.dq_latency = write_latency == NULL ? 0 : *write_latency;
+
+	/*
+	 * Circuit breaker is disabled by default
+	 */
+	dbt->dbt_breaker.dbr_errors = breaker_errors == NULL ? 0 :
+	    *breaker_errors;
+	dbt->dbt_breaker.dbr_latency = breaker_latency == NULL ? 0 :
+	    *breaker_latency;
+	dbt->dbt_breaker.dbr_timeout = breaker_timeout == NULL ? 0 :
+	    *breaker_timeout;
+	dbt->dbt_breaker.dbr_memory_max = breaker_memory == NULL ? 0 :
+	    *breaker_memory;
+
+	/*
+	 * Expired records are deleted at once by default
+	 */
+	dbt->dbt_expire_batch = expire_batch == NULL ? 0 : *expire_batch;
+	dbt->dbt_expire_rate = expire_rate == NULL ? 0 : *expire_rate;
+
+	/*
+	 * Persistence (memdb)
+	 */
+	dbt->dbt_fsync_interval = fsync_interval == NULL ?
+	    DBT_FSYNC_INTERVAL : *fsync_interval;
+	dbt->dbt_snapshot_interval = snapshot_interval == NULL ?
+	    DBT_SNAPSHOT_INTERVAL : *snapshot_interval;
+
+	/*
+	 * dbt_name is used by the janitor
+	 */
+	dbt->dbt_name = name;
+
+	/*
+	 * Set driver to NULL (filled in upon connection)
+	 */
+	dbt->dbt_driver = NULL;
+
+	/*
+	 * Add some defaults
+	 */
+	if (dbt->dbt_database == NULL) {
+		dbt->dbt_database = BINNAME;
+	}
+
+	if (dbt->dbt_cleanup_interval == 0) {
+		dbt->dbt_cleanup_interval = cf_dbt_cleanup_interval;
+	}
+
+	if (strlen(dbt->dbt_expire_field) == 0)
+	{
+		snprintf(dbt->dbt_expire_field, DBT_FIELD_MAX, "%s%s", dbt->dbt_name,
+			EXPIRE_SUFFIX);
+	}
+
+	return 0;
+}
+
+
+int
+dbt_register(char *name, dbt_t *dbt)
+{
+	var_t *config;
+	char *config_key;
+
+	config_key = dbt->dbt_config_key == NULL? name: dbt->dbt_config_key;
+
+	/*
+	 * Load config table
+	 */
+	config = cf_get(VT_TABLE, "table", config_key, NULL);
+	if (config == NULL) {
+		if (dbt_default_database != NULL)
+		{
+			config = dbt_default_database;
+		}
+		else
+		{
+			log_error("dbt_register: missing database configuration for"
+				" \"%s\" and default_database is not set", name);
+			return -1;
+		}
+	}
+
+	if (dbt_configure(dbt, name, config))
+	{
+		log_error("dbt_register: dbt_configure failed");
+		return -1;
+	}
+
+	/*
+	 * Lock janitor mutex in case the janitor is already working
+	 */
+	if (pthread_mutex_lock(&dbt_janitor_mutex))
+	{
+		log_sys_error("dbt_register: pthread_mutex_lock");
+		return -1;
+	}
+
+	/*
+	 * Store dbt in dbt_tables
+	 */
+	if (sht_insert(dbt_tables, name, dbt)) {
+		log_error("dbt_register: ht_insert failed");
+		return -1;
+	}
+
+	if (pthread_mutex_unlock(&dbt_janitor_mutex))
+	{
+		log_sys_error("dbt_register: pthread_mutex_unlock");
+		return -1;
+	}
+
+	return 0;
+}
+
+
+int
+dbt_common_validate(dbt_t *dbt, var_t *record)
+{
+	VAR_INT_T *expire = NULL;
+
+	/*
+	 * Lookup expiry in record.
+	 */
+	expire = vlist_record_get(record, dbt->dbt_expire_field);
+	if (expire == NULL)
+	{
+		log_die(EX_SOFTWARE, "dbt_common_vaildate: table \"%s\" must "
+		    "set %s_expire to use dbt_common_validate", dbt->dbt_name,
+		    dbt->dbt_name, dbt->dbt_name);
+	}
+
+	/*
+	 * dbt->dbt_cleanup_schedule == time(NULL)
+	 */
+	if (dbt->dbt_cleanup_schedule > *expire)
+	{
+		return 0;
+	}
+
+	return 1;
+}
+
+
+/*
+ * Sleep until chunk deletions used up their share of dbt_expire_rate.
+ */
+static void
+dbt_janitor_throttle(dbt_t *dbt, int deleted, long elapsed)
+{
+	struct timespec ts;
+	long budget;
+
+	if (dbt->dbt_expire_rate <= 0)
+	{
+		return;
+	}
+
+	// Microseconds
+	budget = (long) deleted * 1000000 / dbt->dbt_expire_rate - elapsed;
+	if (budget <= 0)
+	{
+		return;
+	}
+
+	ts.tv_sec = budget / 1000000;
+	ts.tv_nsec = (budget % 1000000) * 1000;
+
+	while (nanosleep(&ts, &ts) == -1 && errno == EINTR);
+
+	return;
+}
+
+
+static int
+dbt_janitor_cleanup_expire(dbt_t *dbt)
+{
+	struct timespec start, stop;
+	int deleted, total = 0;
+	long elapsed;
+
+	if (dbt->dbt_expire_batch <= 0)
+	{
+		deleted = dbt_db_expire(dbt);
+		if (deleted == -1)
+		{
+			log_error("dbt_janitor_cleanup_exipre: dbt_db_cleanup "
+			    "failed");
+		}
+
+		return deleted;
+	}
+
+	/*
+	 * Chunked expiry: the driver deletes at most dbt_expire_batch records
+	 * per call. The table is unlocked between chunks.
+	 */
+	do
+	{
+		util_now(&start);
+
+		deleted = dbt_db_expire(dbt);
+		if (deleted == -1)
+		{
+			log_error("dbt_janitor_cleanup_expire: dbt_db_expire "
+			    "failed");
+			return total ? total : -1;
+		}
+
+		util_now(&stop);
+		elapsed = (stop.tv_sec - start.tv_sec) * 1000000 +
+		    (stop.tv_nsec - start.tv_nsec) / 1000;
+
+		total += deleted;
+
+		log_debug("dbt_janitor_cleanup_expire: %s: chunk deleted %d "
+		    "records in %ld ms (%ld records/s)", dbt->dbt_name, deleted,
+		    elapsed / 1000, elapsed ? deleted * 1000000L / elapsed : 0);
+
+		if (deleted < dbt->dbt_expire_batch)
+		{
+			break;
+		}
+
+		dbt_janitor_throttle(dbt, deleted, elapsed);
+	}
+	while (dbt_janitor_running);
+
+	return total;
+}
+
+
+static int
+dbt_janitor_validate(dbt_t *dbt, var_t *record)
+{
+	int expire;
+
+	expire = DBT_VALIDATE(dbt, record);
+	if (expire == -1) {
+		log_error("dbt_cleanup: DBT_VALIDATE failed");
+		return -1;
+	}
+	if (expire) {
+		return 0;
+	}
+	if (dbt_db_del(dbt, record)) {
+		log_error("dbt_cleanup: dbt_db_del failed");
+		return -1;
+	}
+
+	++dbt->dbt_cleanup_deleted;
+
+	return 0;
+}
+
+
+static int
+dbt_janitor_cleanup_walk(dbt_t *dbt)
+{
+	dbt->dbt_cleanup_deleted = 0;
+
+	if (dbt_db_walk(dbt, (void *) dbt_janitor_validate)) {
+		log_error("dbt_janitor_cleanup_walk: dbt_db_walk failed");
+		return -1;
+	}
+		
+	/*
+	 * Sync database if driver supports syncing
+	 */
+	if (dbt->dbt_driver->dd_sync) {
+		if (dbt_db_sync(dbt)) {
+			log_warning("dbt_janitor: dbt_db_sync failed");
+		}
+	}
+
+	return dbt->dbt_cleanup_deleted;
+}
+
+
+/*
+ * Returns 1 if the record was deleted, 0 if it was still valid or gone
+ * already and -1 on error.
+ */
+static int
+dbt_janitor_index_expire(dbt_t *dbt, dbt_index_node_t *din)
+{
+	var_t *lookup, *record = NULL;
+	dbt_t *conn;
+	int valid, r = -1;
+
+	lookup = dbt_index_lookup(dbt, din);
+	if (lookup == NULL)
+	{
+		log_error("dbt_janitor_index_expire: dbt_index_lookup failed");
+		return -1;
+	}
+
+	conn = dbt_pool_checkout(dbt);
+	if (conn == NULL)
+	{
+		goto exit;
+	}
+
+	if (dbt->dbt_driver->dd_get(conn, lookup, &record))
+	{
+		log_error("dbt_janitor_index_expire: %s: dd_get failed",
+		    dbt->dbt_name);
+		goto checkin;
+	}
+
+	if (record == NULL)
+	{
+		r = 0;
+		goto checkin;
+	}
+
+	valid = DBT_VALIDATE(dbt, record);
+	if (valid == -1)
+	{
+		log_error("dbt_janitor_index_expire: DBT_VALIDATE failed");
+		goto checkin;
+	}
+
+	// Record was updated without passing dbt_db_set
+	if (valid)
+	{
+		r = dbt_index_set(dbt, record);
+		goto checkin;
+	}
+
+	r = dbt->dbt_driver->dd_del(conn, lookup);
+
+	// See dbt_db_set
+	if (dbt->dbt_cache.dc_ht)
+	{
+		dbt_cache_del(dbt, lookup);
+	}
+
+	if (r)
+	{
+		log_error("dbt_janitor_index_expire: %s: dd_del failed",
+		    dbt->dbt_name);
+		r = -1;
+		goto checkin;
+	}
+
+	r = 1;
+
+checkin:
+	dbt_pool_checkin(dbt, conn);
+
+exit:
+	if (record)
+	{
+		var_delete(record);
+	}
+
+	var_delete(lookup);
+
+	return r;
+}
+
+
+static int
+dbt_janitor_cleanup_index(dbt_t *dbt)
+{
+	dbt_index_node_t *batch[DBT_INDEX_BATCH];
+	int deleted = 0;
+	int failed = 0;
+	int i, n, r;
+
+	do
+	{
+		n = dbt_index_pop(dbt, dbt->dbt_cleanup_schedule, batch,
+		    DBT_INDEX_BATCH);
+
+		for (i = 0; i < n; ++i)
+		{
+			r = dbt_janitor_index_expire(dbt, batch[i]);
+			if (r == -1)
+			{
+				/*
+				 * Retry on the next run. The node is not
+				 * popped again in this one.
+				 */
+				++failed;
+				dbt_index_retry(dbt, batch[i],
+				    dbt->dbt_cleanup_schedule);
+				continue;
+			}
+
+			deleted += r;
+			dbt_index_node_delete(batch[i]);
+		}
+	}
+	while (n == DBT_INDEX_BATCH);
+
+	if (failed)
+	{
+		log_error("dbt_janitor_cleanup_index: %s: %d records could not "
+		    "be expired. Retrying on the next run", dbt->dbt_name,
+		    failed);
+	}
+
+	/*
+	 * Sync database if driver supports syncing. Sync even if nothing
+	 * expired: persistent memdb tables take their snapshots here.
+	 */
+	if (dbt->dbt_driver->dd_sync)
+	{
+		if (dbt_db_sync(dbt))
+		{
+			log_warning("dbt_janitor: dbt_db_sync failed");
+		}
+	}
+
+	return deleted;
+}
+
+
+static int
+dbt_janitor_cleanup(time_t now, dbt_t *dbt)
+{
+	int deleted = 0;
+
+	log_debug("dbt_janitor_cleanup: cleaning up \"%s\"", dbt->dbt_name);
+
+	/*
+	 * Check if driver is registered
+	 */
+	if (dbt->dbt_driver == NULL)
+	{
+		log_debug("dbt_janitor_cleanup: database \"%s\" not connected "
+		    "yet", dbt->dbt_name);
+		return 0;
+	}
+
+	/*
+	 * Don't touch a failing backend
+	 */
+	if (dbt->dbt_breaker.dbr_journal &&
+	    dbt->dbt_breaker.dbr_state != DBT_BREAKER_CLOSED)
+	{
+		log_debug("dbt_janitor_cleanup: database \"%s\" bypassed by "
+		    "circuit breaker", dbt->dbt_name);
+		dbt_breaker_log(dbt);
+		return 0;
+	}
+
+	/*
+	 * Check if driver supports SQL
+	 */
+	if (dbt->dbt_driver->dd_expire)
+	{
+		deleted = dbt_janitor_cleanup_expire(dbt);
+	}
+
+	/*
+	 * Expired records are indexed
+	 */
+	else if (dbt->dbt_index.di_ht)
+	{
+		deleted = dbt_janitor_cleanup_index(dbt);
+	}
+
+	/*
+	 * Check if driver and table support walking
+	 */
+	else if (dbt->dbt_driver->dd_walk)
+	{
+		if (dbt->dbt_validate)
+		{
+			deleted = dbt_janitor_cleanup_walk(dbt);
+		}
+
+		/*
+		 * No validate callback registered. Not cleaning.
+		 */
+		else
+		{
+			log_debug("dbt_janitor_cleanup: database \"%s\" has "
+			    "no validate callback. Not cleaning.",
+			    dbt->dbt_name);
+			deleted = 0;
+		}
+	}
+
+	else
+	{
+		log_error("dbt_janitor_cleanup: can't cleanup database \"%s\":"
+		    " bad driver \"%s\": dd_expire and dd_walk unset", dbt->dbt_name,
+		    dbt->dbt_driver->dd_name);
+		return -1;
+	}
+
+	/*
+	 * dbt_janitor_cleanup_expire or dbt_janitor_cleanup_walk should have
+	 * logged already
+	 */
+	if (deleted == -1)
+	{
+		return -1;
+	}
+
+	if (deleted)
+	{
+		log_debug("dbt_janitor_cleanup: disposed %d stale record%s "
+			"from %s", deleted, deleted > 1 ? "s" : "", dbt->dbt_name);
+	}
+
+	dbt_cache_log(dbt);
+	dbt_pool_log(dbt);
+	dbt_queue_log(dbt);
+	dbt_breaker_log(dbt);
+
+	return deleted;
+}
+
+
+/*
+ * Cleans up a table that is not registered, e.g. a child table of a
+ * composite driver. dbt_cleanup_schedule is set by the caller.
+ */
+int
+dbt_db_cleanup(dbt_t *dbt)
+{
+	return dbt_janitor_cleanup(dbt->dbt_cleanup_schedule, dbt);
+}
+
+
+int
+dbt_janitor_stats(dbt_t *dbt, char **buffer, int *len)
+{
+	int r;
+
+	if (pthread_mutex_lock(&dbt_janitor_mutex))
+	{
+		return 0;
+	}
+
+	r = dbt_stats_printf(buffer, len, "%s: janitor: running=%d "
+	    "next=%lds deleted=%d duration=%ldms\n", dbt->dbt_name,
+	    dbt->dbt_cleanup_running,
+	    (long) (dbt->dbt_cleanup_schedule - time(NULL)),
+	    dbt->dbt_cleanup_last_deleted, dbt->dbt_cleanup_duration);
+
+	pthread_mutex_unlock(&dbt_janitor_mutex);
+
+	return r;
+}
+
+
+/*
+ * Cleans up a single table and records the result. Called by janitor
+ * workers without dbt_janitor_mutex held.
+ */
+static void
+dbt_janitor_run(dbt_t *dbt)
+{
+	struct timespec start, stop;
+	long duration;
+	int deleted;
+
+	util_now(&start);
+
+	deleted = dbt_janitor_cleanup(start.tv_sec, dbt);
+	if (deleted == -1)
+	{
+		log_error("dbt_janitor: dbt_janitor_cleanup failed");
+	}
+
+	util_now(&stop);
+	duration = (stop.tv_sec - start.tv_sec) * 1000 +
+	    (stop.tv_nsec - start.tv_nsec) / 1000000;
+
+	if (deleted > 0)
+	{
+		log_error("database cleanup: deleted: %s=%d (%ld ms)",
+		    dbt->dbt_name, deleted, duration);
+	}
+
+	if (pthread_mutex_lock(&dbt_janitor_mutex))
+	{
+		log_sys_error("dbt_janitor_run: pthread_mutex_lock");
+		return;
+	}
+
+	dbt->dbt_cleanup_started = start.tv_sec;
+	dbt->dbt_cleanup_duration = duration;
+	dbt->dbt_cleanup_last_deleted = deleted;
+	dbt->dbt_cleanup_running = 0;
+
+	/*
+	 * Schedule next cleanup cycle
+	 */
+	dbt->dbt_cleanup_schedule = start.tv_sec + dbt->dbt_cleanup_interval;
+
+	/*
+	 * Wake up the janitor to reschedule
+	 */
+	if (pthread_cond_signal(&dbt_janitor_cond))
+	{
+		log_sys_error("dbt_janitor_run: pthread_cond_signal");
+	}
+
+	if (pthread_mutex_unlock(&dbt_janitor_mutex))
+	{
+		log_sys_error("dbt_janitor_run: pthread_mutex_unlock");
+	}
+
+	return;
+}
+
+
+static void *
+dbt_janitor_worker(void *arg)
+{
+	dbt_t *dbt;
+
+	if (pthread_mutex_lock(&dbt_janitor_mutex))
+	{
+		log_sys_error("dbt_janitor_worker: pthread_mutex_lock");
+		return NULL;
+	}
+
+	while (dbt_janitor_running)
+	{
+		dbt = ll_remove_head(&dbt_janitor_jobs);
+		if (dbt == NULL)
+		{
+			if (pthread_cond_wait(&dbt_janitor_work_cond,
+			    &dbt_janitor_mutex))
+			{
+				log_sys_error("dbt_janitor_worker: "
+				    "pthread_cond_wait");
+				break;
+			}
+
+			continue;
+		}
+
+		if (pthread_mutex_unlock(&dbt_janitor_mutex))
+		{
+			log_sys_error("dbt_janitor_worker: pthread_mutex_unlock");
+			return NULL;
+		}
+
+		dbt_janitor_run(dbt);
+
+		if (pthread_mutex_lock(&dbt_janitor_mutex))
+		{
+			log_sys_error("dbt_janitor_worker: pthread_mutex_lock");
+			return NULL;
+		}
+	}
+
+	if (pthread_mutex_unlock(&dbt_janitor_mutex))
+	{
+		log_sys_error("dbt_janitor_worker: pthread_mutex_unlock");
+	}
+
+	return NULL;
+}
+
+
+static void *
+dbt_janitor(void *arg)
+{
+	time_t now;
+	dbt_t *dbt;
+	unsigned long schedule;
+	struct timespec	ts;
+	int r, i;
+	ht_pos_t pos;
+
+	log_debug("dbt_janitor: janitor thread running");
+
+	dbt_janitor_running = 1;
+
+	if (pthread_mutex_lock(&dbt_janitor_mutex))
+	{
+		log_sys_error("dbt_janitor: pthread_mutex_lock");
+		return NULL;
+	}
+
+	/*
+	 * Tables are cleaned up by a pool of workers. A slow table does not
+	 * delay the others.
+	 */
+	ll_init(&dbt_janitor_jobs);
+
+	dbt_janitor_workers = cf_dbt_janitor_workers > 0 ?
+	    cf_dbt_janitor_workers : 1;
+
+	dbt_janitor_worker_threads = (pthread_t *) calloc(dbt_janitor_workers,
+	    sizeof (pthread_t));
+	if (dbt_janitor_worker_threads == NULL)
+	{
+		log_sys_die(EX_OSERR, "dbt_janitor: calloc");
+	}
+
+	for (i = 0; i < dbt_janitor_workers; ++i)
+	{
+		if (util_thread_create(&dbt_janitor_worker_threads[i],
+		    dbt_janitor_worker, NULL))
+		{
+			log_die(EX_SOFTWARE, "dbt_janitor: util_thread_create "
+			    "failed");
+		}
+	}
+
+	while(dbt_janitor_running)
+	{
+		if (util_now(&ts))
+		{
+			log_error("dbt_janitor: util_now failed");
+			break;
+		}
+
+		/*
+ 		 * Call watchdog to log stale connections
+		 */
+		if (cf_watchdog_stage_timeout)
+		{
+			watchdog_check();
+		}
+
+		now = ts.tv_sec;
+
+		/*
+		 * Hand due tables to the workers and schedule next run
+		 */
+		schedule = 0xffffffff;
+
+		sht_start(dbt_tables, &pos);
+		while ((dbt = sht_next(dbt_tables, &pos)))
+		{
+			if (dbt->dbt_cleanup_interval == -1)
+			{
+				continue;
+			}
+
+			/*
+			 * Rescheduled by the worker when finished
+			 */
+			if (dbt->dbt_cleanup_running)
+			{
+				continue;
+			}
+
+			if (dbt->dbt_cleanup_schedule == 0)
+			{
+				dbt->dbt_cleanup_schedule = now;
+			}
+
+			/*
+			 * Check if table needs a clean up
+			 */
+			if (now < dbt->dbt_cleanup_schedule)
+			{
+				if (dbt->dbt_cleanup_schedule < schedule)
+				{
+					schedule = dbt->dbt_cleanup_schedule;
+				}
+
+				continue;
+			}
+
+			if (ll_insert_tail(&dbt_janitor_jobs, dbt) == -1)
+			{
+				log_error("dbt_janitor: ll_insert_tail failed");
+				continue;
+			}
+
+			dbt->dbt_cleanup_running = 1;
+
+			if (pthread_cond_signal(&dbt_janitor_work_cond))
+			{
+				log_sys_error("dbt_janitor: pthread_cond_signal");
+			}
+		}
+
+		/*
+		 * Happens only if no table is idle
+		 */
+		if (schedule == 0xffffffff)
+		{
+			schedule = now + 1;
+		}
+
+		log_debug("dbt_janitor: sleeping for %lu seconds",
+		    schedule - now);
+
+		ts.tv_sec = schedule;
+
+		/*
+		 * Suspend execution
+		 */
+		r = pthread_cond_timedwait(&dbt_janitor_cond,
+		    &dbt_janitor_mutex, &ts);
+
+		/*
+		 * Signaled wakeup or timeout
+		 */
+		if (r == 0 || r == ETIMEDOUT)
+		{
+			continue;
+		}
+
+		log_sys_error("client_main: pthread_cond_timedwait");
+		break;
+	}
+
+	log_debug("dbt_janitor: shutdown");
+
+	/*
+	 * Stop workers. Running cleanups are finished first.
+	 */
+	dbt_janitor_running = 0;
+
+	if (pthread_cond_broadcast(&dbt_janitor_work_cond))
+	{
+		log_sys_error("dbt_janitor: pthread_cond_broadcast");
+	}
+
+	/*
+	 * Unlock janitor mutex
+	 */
+	if (pthread_mutex_unlock(&dbt_janitor_mutex))
+	{
+		log_sys_error("dbt_janitor: pthread_mutex_unlock");
+	}
+
+	for (i = 0; i < dbt_janitor_workers; ++i)
+	{
+		util_thread_join(dbt_janitor_worker_threads[i]);
+	}
+
+	free(dbt_janitor_worker_threads);
+	dbt_janitor_worker_threads = NULL;
+
+	ll_clear(&dbt_janitor_jobs, NULL);
+
+	return NULL;
+}
+
+
+int
+dbt_open_database(dbt_t *dbt)
+{
+	dbt_driver_t *dd;
+
+	/*
+	 * Lookup database driver
+	 */
+	dd = sht_lookup(dbt_drivers, dbt->dbt_drivername);
+	if (dd == NULL)
+	{
+		log_error("dbt_open_database: unknown database driver \"%s\"",
+			dbt->dbt_drivername);
+		return -1;
+	}
+
+	dbt->dbt_driver = dd;
+
+	/*
+	 * Initialize mutex if driver requires locking
+	 */
+	if ((dd->dd_flags & DBT_LOCK))
+	{
+		if(pthread_mutexattr_init(&dbt->dbt_mutexattr))
+		{
+			log_error("dbt_open_database: ptrhead_mutexattr_init failed");
+			return -1;
+		}
+		if(pthread_mutexattr_settype(&dbt->dbt_mutexattr, PTHREAD_MUTEX_RECURSIVE))
+		{
+			log_error("dbt_open_database: ptrhead_mutexattr_settype failed");
+			return -1;
+		}
+		if(pthread_mutex_init(&dbt->dbt_mutex, &dbt->dbt_mutexattr))
+		{
+			log_error("dbt_open_database: ptrhead_mutex_init failed");
+			return -1;
+		}
+	}
+
+	/*
+	 * Open database
+	 */
+	log_debug("dbt_open_database: open table %s (%s)", dbt->dbt_name, dbt->dbt_drivername);
+
+	if (dbt->dbt_driver->dd_open(dbt))
+	{
+		log_error("dbt_open_database: can't open \"%s\"",
+			dbt->dbt_name);
+		return -1;
+	}
+
+	// Create tables in SQL databases
+	if (dbt->dbt_driver->dd_use_sql)
+	{
+		sql_open(&dbt->dbt_driver->dd_sql, dbt->dbt_handle,
+			dbt->dbt_scheme, dbt->dbt_expire_field);
+	}
+
+	if (dbt_pool_init(dbt))
+	{
+		log_error("dbt_open_database: dbt_pool_init failed for \"%s\"",
+			dbt->dbt_name);
+		return -1;
+	}
+
+	if (dbt_cache_init(dbt))
+	{
+		log_error("dbt_open_database: dbt_cache_init failed for \"%s\"",
+			dbt->dbt_name);
+		return -1;
+	}
+
+	if (dbt_queue_init(dbt))
+	{
+		log_error("dbt_open_database: dbt_queue_init failed for \"%s\"",
+			dbt->dbt_name);
+		return -1;
+	}
+
+	if (dbt_breaker_init(dbt))
+	{
+		log_error("dbt_open_database: dbt_breaker_init failed for \"%s\"",
+			dbt->dbt_name);
+		return -1;
+	}
+
+	if (dbt_index_init(dbt))
+	{
+		log_error("dbt_open_database: dbt_index_init failed for \"%s\"",
+			dbt->dbt_name);
+		return -1;
+	}
+
+	if (dbt_stats_init(dbt))
+	{
+		log_error("dbt_open_database: dbt_stats_init failed for \"%s\"",
+			dbt->dbt_name);
+		return -1;
+	}
+
+	dbt->dbt_open = 1;
+
+	return 0;
+}
+
+
+void
+dbt_open_databases(void)
+{
+	dbt_t *dbt;
+	ht_pos_t pos;
+
+	/*
+	 * Open all tables
+	 */
+	sht_start(dbt_tables, &pos);
+	while ((dbt = sht_next(dbt_tables, &pos)))
+	{
+		if (dbt_open_database(dbt))
+		{
+			log_die(EX_SOFTWARE, "dbt_init: cannot open database "
+				"%s", dbt->dbt_name);
+		}
+	}
+
+	/*
+	 * Start table janitor thread
+	 */
+	if (util_thread_create(&dbt_janitor_thread, dbt_janitor, NULL))
+	{
+		log_die(EX_SOFTWARE, "dbt_init: util_thread_create failed");
+	}
+
+	return;
+}
+
+/*
+ * Tables opened by dbt_open_database without dbt_register need to be closed
+ * by the caller.
+ */
+void
+dbt_close_database(dbt_t *dbt)
+{
+	dbt_close(dbt);
+
+	return;
+}
+
+static void
+dbt_driver_cleanup(dbt_driver_t *dd) {
+	if(dd->dd_cleanup)
+	{
+		dd->dd_cleanup();
+	}
+	
+	return;
+}
+
+void
+dbt_init(int start_threads)
+{
+	/*
+	 * Initialize driver table
+	 */
+	dbt_drivers = sht_create(DBT_BUCKETS, (sht_delete_t) dbt_driver_cleanup);
+	if(dbt_drivers == NULL) {
+		log_die(EX_SOFTWARE, "dbt_init: sht_create failed");
+	}
+
+	/*
+	 * Initailaize tables
+	 */
+	dbt_tables = sht_create(DBT_BUCKETS, (sht_delete_t) dbt_close);
+	if (dbt_tables == NULL) {
+		log_die(EX_SOFTWARE, "dbt_init: ht_init failed");
+	}
+
+	/*
+	 * Load database defaults
+	 */
+	dbt_default_database = cf_get(VT_TABLE, "default_database", NULL);
+	if (dbt_default_database == NULL) {
+		log_debug("dbt_init: no default_database found");
+	}
+
+	/*
+	 * Start sync threads
+	 */
+	if (start_threads)
+	{
+		if (server_init())
+		{
+			log_die(EX_SOFTWARE, "dbt_init: server_init failed");
+		}
+
+		if (client_init())
+		{
+			log_die(EX_SOFTWARE, "dbt_init: client_init failed");
+		}
+
+		dbt_threads_running = 1;
+	}
+
+	return;
+}
+
+
+void
+dbt_clear()
+{
+	dbt_t *dbt;
+	ht_pos_t pos;
+
+	if (dbt_threads_running)
+	{
+		dbt_threads_running = 0;
+
+		client_clear();
+		server_clear();
+	}
+
+	if (dbt_janitor_running)
+	{
+		if (pthread_mutex_lock(&dbt_janitor_mutex))
+		{
+			log_sys_error("dbt_janitor_clear: pthread_mutex_lock");
+		}
+
+		dbt_janitor_running = 0;
+
+		if (pthread_cond_signal(&dbt_janitor_cond))
+		{
+			log_sys_error("dbt_janitor_clear: pthread_cond_signal");
+		}
+
+		if (pthread_mutex_unlock(&dbt_janitor_mutex))
+		{
+			log_sys_error("dbt_janitor_clear: pthread_mutex_unlock");
+		}
+
+		util_thread_join(dbt_janitor_thread);
+	}
+
+	if (dbt_tables)
+	{
+		/*
+		 * Drain write-behind queues before any table is closed
+		 */
+		sht_start(dbt_tables, &pos);
+		while ((dbt = sht_next(dbt_tables, &pos)))
+		{
+			dbt_queue_clear(dbt);
+		}
+
+		sht_delete(dbt_tables);
+	}
+
+	if (dbt_drivers)
+	{
+		sht_delete(dbt_drivers);
+	}
+
+	return;
+}
+
+
+dbt_t *
+dbt_lookup(char *name)
+{
+	return sht_lookup(dbt_tables, name);
+}
+
+
+/*
+ * Formats the statistics of a table or of all tables if tablename is NULL.
+ * Returns the length of *dump or -1 on error.
+ */
+int
+dbt_stats(char **dump, char *tablename)
+{
+	dbt_t *dbt;
+	ht_pos_t pos;
+	int len = 0;
+
+	*dump = NULL;
+
+	if (tablename)
+	{
+		dbt = dbt_lookup(tablename);
+		if (dbt == NULL)
+		{
+			log_error("dbt_stats: dbt_lookup failed for table: %s",
+			    tablename);
+			return -1;
+		}
+
+		if (dbt_stats_table(dbt, dump, &len))
+		{
+			goto error;
+		}
+
+		return len;
+	}
+
+	sht_start(dbt_tables, &pos);
+	while ((dbt = sht_next(dbt_tables, &pos)))
+	{
+		if (dbt_stats_table(dbt, dump, &len))
+		{
+			goto error;
+		}
+	}
+
+	return len;
+
+error:
+	log_error("dbt_stats: dbt_stats_table failed");
+
+	if (*dump)
+	{
+		free(*dump);
+		*dump = NULL;
 	}
 
-	return dbt_dump_buffer_size;
+	return -1;
 }
 
+
 #ifdef DEBUG
 
 static int dbt_test_stage;
@@ -1166,6 +2512,7 @@ static var_t *dbt_test_scheme;
 static time_t dbt_test_time;
 static sht_t dbt_test_ht;
 static pthread_mutex_t dbt_test_mutex = PTHREAD_MUTEX_INITIALIZER;
+static char *dbt_test_driver_module;
 
 typedef struct dbt_test_record {
 	VAR_INT_T       tr_int_key;
@@ -1202,169 +2549,686 @@ dbt_test_record(dbt_test_record_t *tr, var_t *scheme, int n, int expire)
 	sin->sin_family = AF_INET;
 	sin->sin_addr.s_addr = (n * 0x01010101);
 
-	tr->tr_int_value = n;
-	tr->tr_float_value = n * 0.5;
-	snprintf(tr->tr_string_value, 19, "VALUE: %d", n);
-	sin = (struct sockaddr_in *) &tr->tr_sockaddr_value;
-	sin->sin_family = AF_INET;
-	sin->sin_addr.s_addr = (n * 0x01010101);
+	tr->tr_int_value = n;
+	tr->tr_float_value = n * 0.5;
+	snprintf(tr->tr_string_value, 19, "VALUE: %d", n);
+	sin = (struct sockaddr_in *) &tr->tr_sockaddr_value;
+	sin->sin_family = AF_INET;
+	sin->sin_addr.s_addr = (n * 0x01010101);
+
+	char *text = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789";
+	blob_init(tr->tr_blob1_raw, sizeof tr->tr_blob1_raw, (void *) &n, sizeof n);
+	blob_init(tr->tr_blob2_raw, sizeof tr->tr_blob2_raw, (void *) text, strlen(text) + 1);
+	tr->tr_blob1 = (blob_t *) tr->tr_blob1_raw;
+	tr->tr_blob2 = (blob_t *) tr->tr_blob2_raw;
+
+	tr->tr_chars = "'\"~!@#$%^&*()_";
+	tr->tr_null = NULL;
+
+	tr->tr_test_created = dbt_test_time;
+	tr->tr_test_updated = dbt_test_time;
+
+	tr->tr_test_expire = dbt_test_time + expire;
+
+	return vlist_record(scheme, &tr->tr_int_key, &tr->tr_float_key,
+		tr->tr_string_key, &tr->tr_sockaddr_key, &tr->tr_int_value,
+		&tr->tr_float_value, tr->tr_string_value,
+		tr->tr_blob1, tr->tr_blob2,
+		&tr->tr_sockaddr_value, tr->tr_chars,
+		tr->tr_null, &tr->tr_test_created, &tr->tr_test_updated,
+		&tr->tr_test_expire);
+}
+
+void
+dbt_test_stage1(int n)
+{
+	dbt_test_record_t tr1;
+	dbt_test_record_t tr2;
+	var_t *record1= NULL;
+	var_t *record2 = NULL;
+	var_t *lookup= NULL;
+	var_t *result = NULL;
+	char rec1_str[BUFLEN];
+	char rec2_str[BUFLEN];
+	char rec_match[BUFLEN];
+	char *stats = NULL;
+	int i;
+
+	// Create test record data	
+	record1 = dbt_test_record(&tr1, dbt_test_scheme, n, DBT_TEST_EXPIRE);
+	record2 = dbt_test_record(&tr2, dbt_test_scheme, n + 10000, DBT_TEST_EXPIRE);
+	TEST_ASSERT(record1 != NULL && record2 != NULL);
+	TEST_ASSERT(var_dump(record1, rec1_str, sizeof rec1_str) > 0);
+	TEST_ASSERT(var_dump(record2, rec2_str, sizeof rec2_str) > 0);
+
+	// Add record strings to test hash table (used in stage 2).
+	pthread_mutex_lock(&dbt_test_mutex);
+	TEST_ASSERT(sht_insert(&dbt_test_ht, rec1_str, rec1_str) == 0);
+	TEST_ASSERT(sht_insert(&dbt_test_ht, rec2_str, rec2_str) == 0);
+	//printf("1: %s\n2: %s\n\n", rec1_str, rec2_str);
+	pthread_mutex_unlock(&dbt_test_mutex);
+
+	// Lookup record
+	lookup = vlist_record(dbt_test_scheme, &tr1.tr_int_key, &tr1.tr_float_key,
+		tr1.tr_string_key, &tr1.tr_sockaddr_key, NULL, NULL, NULL,
+		NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL);
+
+	// Stress test
+	for (i = 0; i < DBT_STRESS_ROUNDS; ++i)
+	{
+		// Insert
+		TEST_ASSERT(dbt_db_set(&dbt_test_table, record1) == 0);
+		TEST_ASSERT(dbt_db_sync(&dbt_test_table) == 0);
+
+		// Select
+		TEST_ASSERT(dbt_db_get(&dbt_test_table, lookup, &result) == 0);
+		TEST_ASSERT(result != NULL);
+		TEST_ASSERT(var_dump(result, rec_match, sizeof rec_match) > 0);
+		TEST_ASSERT(strcmp(rec1_str, rec_match) == 0);
+		var_delete(result);
+		result = NULL;
+
+		// Select again (served from cache if enabled)
+		TEST_ASSERT(dbt_db_get(&dbt_test_table, lookup, &result) == 0);
+		TEST_ASSERT(result != NULL);
+		TEST_ASSERT(var_dump(result, rec_match, sizeof rec_match) > 0);
+		TEST_ASSERT(strcmp(rec1_str, rec_match) == 0);
+		var_delete(result);
+		result = NULL;
+
+		// Update
+		TEST_ASSERT(dbt_db_set(&dbt_test_table, record1) == 0);
+		TEST_ASSERT(dbt_db_sync(&dbt_test_table) == 0);
+		TEST_ASSERT(dbt_db_get(&dbt_test_table, lookup, &result) == 0);
+		TEST_ASSERT(result != NULL);
+		TEST_ASSERT(var_dump(result, rec_match, sizeof rec_match) > 0);
+		TEST_ASSERT(strcmp(rec1_str, rec_match) == 0);
+		var_delete(result);
+		result = NULL;
+
+		// Delete
+		TEST_ASSERT(dbt_db_del(&dbt_test_table, lookup) == 0);
+		TEST_ASSERT(dbt_db_get(&dbt_test_table, lookup, &result) == 0);
+		TEST_ASSERT(result == NULL);
+		TEST_ASSERT(dbt_db_sync(&dbt_test_table) == 0);
+	}
+
+	// Add records for dbt_test_stage2()
+	TEST_ASSERT(dbt_db_set(&dbt_test_table, record1) == 0);
+	TEST_ASSERT(dbt_db_sync(&dbt_test_table) == 0);
+	TEST_ASSERT(dbt_db_set(&dbt_test_table, record2) == 0);
+	TEST_ASSERT(dbt_db_sync(&dbt_test_table) == 0);
+
+	// Statistics
+	TEST_ASSERT(dbt_stats(&stats, "test") > 0);
+	TEST_ASSERT(strstr(stats, "test: get: count=") != NULL);
+	TEST_ASSERT(strstr(stats, "test: del: count=") != NULL);
+	TEST_ASSERT(strstr(stats, "test: janitor: running=") != NULL);
+	free(stats);
+
+	var_delete(record1);
+	var_delete(record2);
+	var_delete(lookup);
+
+	return;
+}
+
+// Records visited by dbt_test_walk in the current thread
+static __thread int dbt_test_walked;
+
+int
+dbt_test_walk(dbt_t *dbt, var_t *record)
+{
+	char rec_match[BUFLEN];
+
+	TEST_ASSERT(var_dump(record, rec_match, sizeof rec_match) > 0);
+	TEST_ASSERT(sht_lookup(&dbt_test_ht, rec_match) != NULL);
+	++dbt_test_walked;
+
+	return 0;
+}
+
+typedef struct dbt_test_stream {
+	int		 ts_records;
+	char		*ts_prefix;
+} dbt_test_stream_t;
+
+static int
+dbt_test_stream_flush(dbt_test_stream_t *ts, char *buffer, int len,
+    char *token)
+{
+	char *p;
+
+	TEST_ASSERT(len > 0 && buffer[len - 1] == '\n');
+
+	for (p = buffer; p < buffer + len; p = strchr(p, '\n') + 1)
+	{
+		if (ts->ts_prefix)
+		{
+			TEST_ASSERT(p[0] == '(' && strncmp(p + 1, ts->ts_prefix,
+			    strlen(ts->ts_prefix)) == 0);
+		}
+
+		++ts->ts_records;
+	}
+
+	return 0;
+}
+
+static int
+dbt_test_stream(dbt_test_stream_t *ts, dbt_stream_t *stream)
+{
+	char token[DBT_TOKEN_BUFLEN];
+
+	memset(ts, 0, sizeof (dbt_test_stream_t));
+	ts->ts_prefix = stream->dst_prefix;
+	stream->dst_flush = (dbt_stream_flush_t) dbt_test_stream_flush;
+	stream->dst_data = ts;
+	stream->dst_resume = NULL;
+
+	do
+	{
+		TEST_ASSERT(dbt_stream(&dbt_test_table, stream) == 0);
+		TEST_ASSERT(stream->dst_limit == 0 ||
+		    stream->dst_records <= stream->dst_limit);
+
+		strcpy(token, stream->dst_token);
+		stream->dst_resume = token;
+	}
+	while (token[0]);
+
+	stream->dst_resume = NULL;
+
+	return ts->ts_records;
+}
+
+void
+dbt_test_stage2(int n)
+{
+	dbt_test_record_t tr1;
+	dbt_test_record_t tr2;
+	var_t *record1= NULL;
+	var_t *record2= NULL;
+	var_t *result = NULL;
+	char rec1_str[BUFLEN];
+	char rec2_str[BUFLEN];
+	char rec_match[BUFLEN];
+	char prefix[BUFLEN];
+	dbt_stream_t stream;
+	dbt_test_stream_t ts;
+
+	// Create records
+	record1 = dbt_test_record(&tr1, dbt_test_scheme, n, DBT_TEST_EXPIRE);
+	record2 = dbt_test_record(&tr2, dbt_test_scheme, n + 10000, DBT_TEST_EXPIRE);
+	TEST_ASSERT(record1 != NULL && record2 != NULL);
+	TEST_ASSERT(var_dump(record1, rec1_str, sizeof rec1_str) > 0);
+	TEST_ASSERT(var_dump(record2, rec2_str, sizeof rec2_str) > 0);
+
+	// Walk table. Batched walks must visit every record exactly once.
+	dbt_test_walked = 0;
+	TEST_ASSERT(dbt_db_walk(&dbt_test_table, (void *) dbt_test_walk) == 0);
+	TEST_ASSERT(dbt_test_walked == HT_RECORDS(dbt_test_ht.sht_ht));
+
+	// Paged streams must not skip or repeat records
+	memset(&stream, 0, sizeof stream);
+	stream.dst_limit = 7;
+	TEST_ASSERT(dbt_test_stream(&ts, &stream) ==
+	    HT_RECORDS(dbt_test_ht.sht_ht));
+
+	// Filters
+	memset(&stream, 0, sizeof stream);
+	snprintf(prefix, sizeof prefix, "%d", n);
+	stream.dst_prefix = prefix;
+	TEST_ASSERT(dbt_test_stream(&ts, &stream) > 0);
+
+	memset(&stream, 0, sizeof stream);
+	stream.dst_expire = dbt_test_time + 1;
+	TEST_ASSERT(dbt_test_stream(&ts, &stream) == 0);
+
+	// Lookup record 1
+	TEST_ASSERT(dbt_db_get(&dbt_test_table, record1, &result) == 0);
+	TEST_ASSERT(result != NULL);
+	TEST_ASSERT(var_dump(result, rec_match, sizeof rec_match) > 0);
+	TEST_ASSERT(strcmp(rec1_str, rec_match) == 0);
+	var_delete(record1);
+	var_delete(result);
+
+	// Lookup record 2
+	TEST_ASSERT(dbt_db_get(&dbt_test_table, record2, &result) == 0);
+	TEST_ASSERT(result != NULL);
+	TEST_ASSERT(var_dump(result, rec_match, sizeof rec_match) > 0);
+	TEST_ASSERT(strcmp(rec2_str, rec_match) == 0);
+	var_delete(record2);
+	var_delete(result);
+
+	return;
+}
+
+void
+dbt_test_mget(int n)
+{
+	dbt_test_record_t tr[3];
+	var_t *records[4];
+	var_t *results[4];
+	char rec_str[2][BUFLEN];
+	char rec_match[BUFLEN];
+	int i;
+
+	// Record 3 is never stored. Record 1 is looked up twice.
+	for (i = 0; i < 3; ++i)
+	{
+		records[i] = dbt_test_record(&tr[i], dbt_test_scheme,
+		    n + i * 10000, DBT_TEST_EXPIRE);
+		TEST_ASSERT(records[i] != NULL);
+	}
+	records[3] = records[0];
+
+	TEST_ASSERT(var_dump(records[0], rec_str[0], sizeof rec_str[0]) > 0);
+	TEST_ASSERT(var_dump(records[1], rec_str[1], sizeof rec_str[1]) > 0);
+
+	TEST_ASSERT(dbt_db_mset(&dbt_test_table, 2, records) == 0);
+	TEST_ASSERT(dbt_db_sync(&dbt_test_table) == 0);
+
+	// Twice: the second round is served from cache if enabled
+	for (i = 0; i < 2; ++i)
+	{
+		TEST_ASSERT(dbt_db_mget(&dbt_test_table, 4, records, results)
+		    == 0);
+
+		TEST_ASSERT(results[0] != NULL);
+		TEST_ASSERT(var_dump(results[0], rec_match, sizeof rec_match) > 0);
+		TEST_ASSERT(strcmp(rec_str[0], rec_match) == 0);
+
+		TEST_ASSERT(results[1] != NULL);
+		TEST_ASSERT(var_dump(results[1], rec_match, sizeof rec_match) > 0);
+		TEST_ASSERT(strcmp(rec_str[1], rec_match) == 0);
+
+		TEST_ASSERT(results[2] == NULL);
+
+		TEST_ASSERT(results[3] != NULL);
+		TEST_ASSERT(var_dump(results[3], rec_match, sizeof rec_match) > 0);
+		TEST_ASSERT(strcmp(rec_str[0], rec_match) == 0);
+
+		var_delete(results[0]);
+		var_delete(results[1]);
+		var_delete(results[3]);
+	}
+
+	TEST_ASSERT(dbt_db_mget(&dbt_test_table, 0, records, results) == 0);
+	TEST_ASSERT(dbt_db_mset(&dbt_test_table, 0, records) == 0);
+
+	TEST_ASSERT(dbt_db_del(&dbt_test_table, records[0]) == 0);
+	TEST_ASSERT(dbt_db_del(&dbt_test_table, records[1]) == 0);
+	TEST_ASSERT(dbt_db_sync(&dbt_test_table) == 0);
+
+	for (i = 0; i < 3; ++i)
+	{
+		var_delete(records[i]);
+	}
+
+	return;
+}
+
+/*
+ * Cache race: a reader misses the cache and fetches the old row while a
+ * writer is inside dd_set/dd_del on another pooled connection. The reader
+ * stores the row once the backend write is done. The wrappers below run the
+ * reader steps inside the backend call to force this interleaving.
+ */
+static __thread var_t *dbt_test_race_lookup;
+static dbt_db_set_t dbt_test_race_set;
+static dbt_db_del_t dbt_test_race_del;
+
+static int
+dbt_test_race_write(dbt_t *conn, var_t *record, int deleted)
+{
+	var_t *stale = NULL;
+	unsigned long generation = 0;
+	int r;
+
+	if (dbt_test_race_lookup == NULL)
+	{
+		return deleted ? dbt_test_race_del(conn, record) :
+		    dbt_test_race_set(conn, record);
+	}
 
-	char *text = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789";
-	blob_init(tr->tr_blob1_raw, sizeof tr->tr_blob1_raw, (void *) &n, sizeof n);
-	blob_init(tr->tr_blob2_raw, sizeof tr->tr_blob2_raw, (void *) text, strlen(text) + 1);
-	tr->tr_blob1 = (blob_t *) tr->tr_blob1_raw;
-	tr->tr_blob2 = (blob_t *) tr->tr_blob2_raw;
+	// Reader misses the cache and fetches the old row
+	dbt_cache_del(&dbt_test_table, dbt_test_race_lookup);
+	TEST_ASSERT(dbt_cache_get(&dbt_test_table, dbt_test_race_lookup,
+	    &stale, &generation) == 0);
+	TEST_ASSERT(conn->dbt_driver->dd_get(conn, dbt_test_race_lookup,
+	    &stale) == 0);
+	TEST_ASSERT(stale != NULL);
 
-	tr->tr_chars = "'\"~!@#$%^&*()_";
-	tr->tr_null = NULL;
+	r = deleted ? dbt_test_race_del(conn, record) :
+	    dbt_test_race_set(conn, record);
 
-	tr->tr_test_created = dbt_test_time;
-	tr->tr_test_updated = dbt_test_time;
+	// Reader caches the old row after the write
+	dbt_cache_set(&dbt_test_table, dbt_test_race_lookup, stale,
+	    generation);
+	var_delete(stale);
 
-	tr->tr_test_expire = dbt_test_time + expire;
+	return r;
+}
 
-	return vlist_record(scheme, &tr->tr_int_key, &tr->tr_float_key,
-		tr->tr_string_key, &tr->tr_sockaddr_key, &tr->tr_int_value,
-		&tr->tr_float_value, tr->tr_string_value,
-		tr->tr_blob1, tr->tr_blob2,
-		&tr->tr_sockaddr_value, tr->tr_chars,
-		tr->tr_null, &tr->tr_test_created, &tr->tr_test_updated,
-		&tr->tr_test_expire);
+static int
+dbt_test_race_dd_set(dbt_t *conn, var_t *record)
+{
+	return dbt_test_race_write(conn, record, 0);
+}
+
+static int
+dbt_test_race_dd_del(dbt_t *conn, var_t *record)
+{
+	return dbt_test_race_write(conn, record, 1);
 }
 
 void
-dbt_test_stage1(int n)
+dbt_test_race(int n)
 {
 	dbt_test_record_t tr1;
 	dbt_test_record_t tr2;
-	var_t *record1= NULL;
+	var_t *record1 = NULL;
 	var_t *record2 = NULL;
-	var_t *lookup= NULL;
+	var_t *shared = NULL;
 	var_t *result = NULL;
-	char rec1_str[BUFLEN];
 	char rec2_str[BUFLEN];
 	char rec_match[BUFLEN];
+	VAR_INT_T *value;
 	int i;
 
-	// Create test record data	
+	// Same key, different values
 	record1 = dbt_test_record(&tr1, dbt_test_scheme, n, DBT_TEST_EXPIRE);
-	record2 = dbt_test_record(&tr2, dbt_test_scheme, n + 10000, DBT_TEST_EXPIRE);
+	record2 = dbt_test_record(&tr2, dbt_test_scheme, n, DBT_TEST_EXPIRE);
 	TEST_ASSERT(record1 != NULL && record2 != NULL);
-	TEST_ASSERT(var_dump(record1, rec1_str, sizeof rec1_str) > 0);
+	tr2.tr_int_value = n + 1;
 	TEST_ASSERT(var_dump(record2, rec2_str, sizeof rec2_str) > 0);
 
-	// Add record strings to test hash table (used in stage 2).
-	pthread_mutex_lock(&dbt_test_mutex);
-	TEST_ASSERT(sht_insert(&dbt_test_ht, rec1_str, rec1_str) == 0);
-	TEST_ASSERT(sht_insert(&dbt_test_ht, rec2_str, rec2_str) == 0);
-	//printf("1: %s\n2: %s\n\n", rec1_str, rec2_str);
-	pthread_mutex_unlock(&dbt_test_mutex);
-
-	// Lookup record
-	lookup = vlist_record(dbt_test_scheme, &tr1.tr_int_key, &tr1.tr_float_key,
-		tr1.tr_string_key, &tr1.tr_sockaddr_key, NULL, NULL, NULL,
-		NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL);
-
-	// Stress test
 	for (i = 0; i < DBT_STRESS_ROUNDS; ++i)
 	{
-		// Insert
 		TEST_ASSERT(dbt_db_set(&dbt_test_table, record1) == 0);
-		TEST_ASSERT(dbt_db_sync(&dbt_test_table) == 0);
 
-		// Select
-		TEST_ASSERT(dbt_db_get(&dbt_test_table, lookup, &result) == 0);
+		// Update while a reader caches the old row
+		dbt_test_race_lookup = record1;
+		TEST_ASSERT(dbt_db_set(&dbt_test_table, record2) == 0);
+		dbt_test_race_lookup = NULL;
+
+		TEST_ASSERT(dbt_db_get(&dbt_test_table, record1, &result) == 0);
 		TEST_ASSERT(result != NULL);
 		TEST_ASSERT(var_dump(result, rec_match, sizeof rec_match) > 0);
-		TEST_ASSERT(strcmp(rec1_str, rec_match) == 0);
+		TEST_ASSERT(strcmp(rec2_str, rec_match) == 0);
 		var_delete(result);
 		result = NULL;
 
-		// Update
-		TEST_ASSERT(dbt_db_set(&dbt_test_table, record1) == 0);
-		TEST_ASSERT(dbt_db_sync(&dbt_test_table) == 0);
-		TEST_ASSERT(dbt_db_get(&dbt_test_table, lookup, &result) == 0);
+		// Delete while a reader caches the old row
+		dbt_test_race_lookup = record1;
+		TEST_ASSERT(dbt_db_del(&dbt_test_table, record1) == 0);
+		dbt_test_race_lookup = NULL;
+
+		TEST_ASSERT(dbt_db_get(&dbt_test_table, record1, &result) == 0);
+		TEST_ASSERT(result == NULL);
+	}
+
+	/*
+	 * All threads get and set the same key. A thread always reads its
+	 * own write or a newer one by another thread. The shared record is
+	 * dropped with the memdb table.
+	 */
+	shared = dbt_test_record(&tr1, dbt_test_scheme, -1, DBT_TEST_EXPIRE);
+	TEST_ASSERT(shared != NULL);
+
+	for (i = 0; i < DBT_STRESS_ROUNDS; ++i)
+	{
+		tr1.tr_int_value = n * DBT_STRESS_ROUNDS + i;
+		TEST_ASSERT(dbt_db_set(&dbt_test_table, shared) == 0);
+
+		TEST_ASSERT(dbt_db_get(&dbt_test_table, shared, &result) == 0);
 		TEST_ASSERT(result != NULL);
-		TEST_ASSERT(var_dump(result, rec_match, sizeof rec_match) > 0);
-		TEST_ASSERT(strcmp(rec1_str, rec_match) == 0);
+		value = vlist_record_get(result, "test_int");
+		TEST_ASSERT(value != NULL);
+		if (*value / DBT_STRESS_ROUNDS == n)
+		{
+			TEST_ASSERT(*value == tr1.tr_int_value);
+		}
 		var_delete(result);
 		result = NULL;
-
-		// Delete
-		TEST_ASSERT(dbt_db_del(&dbt_test_table, lookup) == 0);
-		TEST_ASSERT(dbt_db_get(&dbt_test_table, lookup, &result) == 0);
-		TEST_ASSERT(result == NULL);
-		TEST_ASSERT(dbt_db_sync(&dbt_test_table) == 0);
 	}
 
-	// Add records for dbt_test_stage2()
+	var_delete(record1);
+	var_delete(record2);
+	var_delete(shared);
+
+	return;
+}
+
+void
+dbt_test_expire(int n)
+{
+	dbt_test_record_t tr1;
+	dbt_test_record_t tr2;
+	var_t *record1 = NULL;
+	var_t *record2 = NULL;
+	var_t *result = NULL;
+
+	// Record 1 expired a second ago
+	record1 = dbt_test_record(&tr1, dbt_test_scheme, n, -1);
+	record2 = dbt_test_record(&tr2, dbt_test_scheme, n + 10000, DBT_TEST_EXPIRE);
+	TEST_ASSERT(record1 != NULL && record2 != NULL);
+
 	TEST_ASSERT(dbt_db_set(&dbt_test_table, record1) == 0);
-	TEST_ASSERT(dbt_db_sync(&dbt_test_table) == 0);
 	TEST_ASSERT(dbt_db_set(&dbt_test_table, record2) == 0);
-	TEST_ASSERT(dbt_db_sync(&dbt_test_table) == 0);
+
+	// Memdb tables are cleaned up using the expiry index
+	TEST_ASSERT(dbt_test_table.dbt_index.di_ht != NULL);
+	TEST_ASSERT(dbt_janitor_cleanup(dbt_test_time, &dbt_test_table) >= 0);
+
+	TEST_ASSERT(dbt_db_get(&dbt_test_table, record1, &result) == 0);
+	TEST_ASSERT(result == NULL);
+
+	TEST_ASSERT(dbt_db_get(&dbt_test_table, record2, &result) == 0);
+	TEST_ASSERT(result != NULL);
+	var_delete(result);
+
+	// Expired record renewed before the janitor runs
+	TEST_ASSERT(dbt_db_set(&dbt_test_table, record1) == 0);
+	var_delete(record1);
+	record1 = dbt_test_record(&tr1, dbt_test_scheme, n, DBT_TEST_EXPIRE);
+	TEST_ASSERT(record1 != NULL);
+	TEST_ASSERT(dbt_db_set(&dbt_test_table, record1) == 0);
+	TEST_ASSERT(dbt_janitor_cleanup(dbt_test_time, &dbt_test_table) >= 0);
+
+	TEST_ASSERT(dbt_db_get(&dbt_test_table, record1, &result) == 0);
+	TEST_ASSERT(result != NULL);
+	var_delete(result);
 
 	var_delete(record1);
 	var_delete(record2);
-	var_delete(lookup);
 
 	return;
 }
 
-int
-dbt_test_walk(dbt_t *dbt, var_t *record)
+/*
+ * Replayed records stay journaled until the backend write is done.
+ */
+static dbt_db_set_t dbt_test_replay_set;
+
+static int
+dbt_test_replay_dd_set(dbt_t *conn, var_t *record)
 {
-	char rec_match[BUFLEN];
+	var_t *result = NULL;
 
-	TEST_ASSERT(var_dump(record, rec_match, sizeof rec_match) > 0);
-	TEST_ASSERT(sht_lookup(&dbt_test_ht, rec_match) != NULL);
+	if (dbt_test_table.dbt_breaker.dbr_state == DBT_BREAKER_PROBE)
+	{
+		TEST_ASSERT(dbt_journal_get(&dbt_test_table, record, &result)
+		    == 1);
+		TEST_ASSERT(result != NULL);
+		var_delete(result);
+	}
 
-	return 0;
+	return dbt_test_replay_set(conn, record);
 }
 
+/*
+ * The breaker state is shared by all threads. The scenario runs in one
+ * thread at a time.
+ */
 void
-dbt_test_stage2(int n)
+dbt_test_breaker(int n)
 {
+	dbt_breaker_t *dbr = &dbt_test_table.dbt_breaker;
+	dbt_driver_t *dd;
 	dbt_test_record_t tr1;
 	dbt_test_record_t tr2;
-	var_t *record1= NULL;
-	var_t *record2= NULL;
+	dbt_test_record_t tr3;
+	var_t *record1 = NULL;
+	var_t *record2 = NULL;
+	var_t *record3 = NULL;
 	var_t *result = NULL;
+	var_t *records[2];
+	var_t *results[2];
 	char rec1_str[BUFLEN];
-	char rec2_str[BUFLEN];
 	char rec_match[BUFLEN];
+	struct timespec start;
+	unsigned long trips;
+	VAR_INT_T *expire;
+	int i;
 
-	// Create records
 	record1 = dbt_test_record(&tr1, dbt_test_scheme, n, DBT_TEST_EXPIRE);
 	record2 = dbt_test_record(&tr2, dbt_test_scheme, n + 10000, DBT_TEST_EXPIRE);
-	TEST_ASSERT(record1 != NULL && record2 != NULL);
+	record3 = dbt_test_record(&tr3, dbt_test_scheme, n + 20000, DBT_TEST_EXPIRE);
+	TEST_ASSERT(record1 != NULL && record2 != NULL && record3 != NULL);
 	TEST_ASSERT(var_dump(record1, rec1_str, sizeof rec1_str) > 0);
-	TEST_ASSERT(var_dump(record2, rec2_str, sizeof rec2_str) > 0);
 
-	// Walk table
-	TEST_ASSERT(dbt_db_walk(&dbt_test_table, (void *) dbt_test_walk) == 0);
+	records[0] = record1;
+	records[1] = record2;
+
+	pthread_mutex_lock(&dbt_test_mutex);
+
+	dd = dbt_test_table.dbt_driver;
+
+	TEST_ASSERT(dbr->dbr_journal != NULL);
+	TEST_ASSERT(dbr->dbr_state == DBT_BREAKER_CLOSED);
+	trips = dbr->dbr_trips;
+
+	// A successful operation resets the error count
+	dbt_stats_now(&start);
+	for (i = 0; i < dbr->dbr_errors - 1; ++i)
+	{
+		dbt_breaker_update(&dbt_test_table, DBT_BREAKER_CLOSED, -1,
+		    &start);
+	}
+	TEST_ASSERT(dbr->dbr_failures == dbr->dbr_errors - 1);
+	dbt_breaker_update(&dbt_test_table, DBT_BREAKER_CLOSED, 0, &start);
+	TEST_ASSERT(dbr->dbr_failures == 0);
+	TEST_ASSERT(dbr->dbr_state == DBT_BREAKER_CLOSED);
+
+	// Slow operations open the breaker
+	start.tv_sec -= dbr->dbr_latency / 1000 + 1;
+	for (i = 0; i < dbr->dbr_errors; ++i)
+	{
+		dbt_breaker_update(&dbt_test_table, DBT_BREAKER_CLOSED, 0,
+		    &start);
+	}
+	TEST_ASSERT(dbr->dbr_state == DBT_BREAKER_OPEN);
+	TEST_ASSERT(dbr->dbr_trips == trips + 1);
+
+	// Writes are journaled
+	TEST_ASSERT(dbt_db_set(&dbt_test_table, record1) == 0);
+	TEST_ASSERT(dbt_db_set(&dbt_test_table, record2) == 0);
+	TEST_ASSERT(HT_RECORDS(dbr->dbr_journal) == 2);
+	TEST_ASSERT(dd->dd_get(&dbt_test_table, record1, &result) == 0);
+	TEST_ASSERT(result == NULL);
 
-	// Lookup record 1
 	TEST_ASSERT(dbt_db_get(&dbt_test_table, record1, &result) == 0);
 	TEST_ASSERT(result != NULL);
 	TEST_ASSERT(var_dump(result, rec_match, sizeof rec_match) > 0);
 	TEST_ASSERT(strcmp(rec1_str, rec_match) == 0);
-	var_delete(record1);
 	var_delete(result);
-
-	// Lookup record 2
-	TEST_ASSERT(dbt_db_get(&dbt_test_table, record2, &result) == 0);
+	result = NULL;
+
+	// Record 3 is updated in the backend through another path
+	TEST_ASSERT(dbt_db_set(&dbt_test_table, record3) == 0);
+	tr3.tr_test_expire += DBT_TEST_EXPIRE;
+	TEST_ASSERT(dd->dd_set(&dbt_test_table, record3) == 0);
+	tr3.tr_test_expire -= DBT_TEST_EXPIRE;
+
+	// Deletes are journaled
+	TEST_ASSERT(dbt_db_del(&dbt_test_table, record2) == 0);
+	TEST_ASSERT(dbt_db_mget(&dbt_test_table, 2, records, results) == 0);
+	TEST_ASSERT(results[0] != NULL);
+	TEST_ASSERT(results[1] == NULL);
+	var_delete(results[0]);
+
+	// The probe replays the journal
+	dbt_test_replay_set = dd->dd_set;
+	dd->dd_set = (dbt_db_set_t) dbt_test_replay_dd_set;
+	dbr->dbr_opened -= dbr->dbr_timeout;
+	TEST_ASSERT(dbt_db_get(&dbt_test_table, record1, &result) == 0);
+	dd->dd_set = dbt_test_replay_set;
 	TEST_ASSERT(result != NULL);
 	TEST_ASSERT(var_dump(result, rec_match, sizeof rec_match) > 0);
-	TEST_ASSERT(strcmp(rec2_str, rec_match) == 0);
-	var_delete(record2);
+	TEST_ASSERT(strcmp(rec1_str, rec_match) == 0);
+	var_delete(result);
+	result = NULL;
+
+	TEST_ASSERT(dbr->dbr_state == DBT_BREAKER_CLOSED);
+	TEST_ASSERT(HT_RECORDS(dbr->dbr_journal) == 0);
+	TEST_ASSERT(dbr->dbr_memory == 0);
+
+	// Writers racing the probe fall back to the backend
+	TEST_ASSERT(dbt_journal_set(&dbt_test_table, record2, 0) == 1);
+	TEST_ASSERT(HT_RECORDS(dbr->dbr_journal) == 0);
+
+	TEST_ASSERT(dd->dd_get(&dbt_test_table, record1, &result) == 0);
+	TEST_ASSERT(result != NULL);
+	var_delete(result);
+	result = NULL;
+	TEST_ASSERT(dd->dd_get(&dbt_test_table, record2, &result) == 0);
+	TEST_ASSERT(result == NULL);
+
+	// The newer backend record was kept
+	TEST_ASSERT(dd->dd_get(&dbt_test_table, record3, &result) == 0);
+	TEST_ASSERT(result != NULL);
+	expire = vlist_record_get(result, "test_expire");
+	TEST_ASSERT(expire != NULL);
+	TEST_ASSERT(*expire == tr3.tr_test_expire + DBT_TEST_EXPIRE);
 	var_delete(result);
+	result = NULL;
+
+	TEST_ASSERT(dbt_db_del(&dbt_test_table, record1) == 0);
+	TEST_ASSERT(dbt_db_del(&dbt_test_table, record3) == 0);
+
+	pthread_mutex_unlock(&dbt_test_mutex);
+
+	var_delete(record1);
+	var_delete(record2);
+	var_delete(record3);
+
+	return;
+}
+
+/*
+ * Runs the driver's own tests (<driver>_test) on the test table. Used for
+ * driver internals that can't be reached through dbt_db_*.
+ */
+void
+dbt_test_driver(int n)
+{
+	void (*test)(dbt_t *dbt, int n);
+
+	test = module_symbol(dbt_test_driver_module, "test");
+	TEST_ASSERT(test != NULL);
+
+	test(&dbt_test_table, n);
 
 	return;
 }
 
 int
-dbt_test_init(char *config_key, char *driver, int run_stage2)
+dbt_test_init(char *config_key, char *driver, char *child, int run_stage2)
 {
+	sql_t *sql;
+
 	// Check if driver exists
 	if (!module_exists(driver))
 	{
@@ -1372,6 +3236,13 @@ dbt_test_init(char *config_key, char *driver, int run_stage2)
 		return -1;
 	}
 
+	// Driver of the child tables of a composite driver
+	if (child && !module_exists(child))
+	{
+		log_crit("dbt_test_prepare: %s not installed", child);
+		return -1;
+	}
+
 	// Create test scheme
 	dbt_test_scheme = vlist_scheme("test",
 		"test_int_key",		VT_INT,		VF_KEEPNAME | VF_KEY,
@@ -1387,11 +3258,12 @@ dbt_test_init(char *config_key, char *driver, int run_stage2)
 		"test_chars",		VT_STRING,	VF_KEEPNAME,
 		"test_null",		VT_STRING,	VF_KEEPNAME,
 		"test_created",		VT_INT,		VF_KEEPNAME,
-		"test_updated",		VT_INT,		VF_KEEPNAME,
+		"test_updated",		VT_INT,		VF_KEEPNAME | VF_INDEX,
 		"test_expire",		VT_INT,		VF_KEEPNAME,
 		NULL);
 
 	dbt_test_run_stage2 = run_stage2;
+	dbt_test_driver_module = driver;
 	
 	// Runs only once before stage 1
 	if (dbt_test_stage == 0)
@@ -1416,7 +3288,7 @@ dbt_test_init(char *config_key, char *driver, int run_stage2)
 	dbt_init(0);
 
 	// Load database drivers
-	module_init(0, driver, NULL);
+	module_init(0, driver, child, NULL);
 
 	// Register test table
 	dbt_register("test", &dbt_test_table);
@@ -1427,6 +3299,16 @@ dbt_test_init(char *config_key, char *driver, int run_stage2)
 	// Open database
 	dbt_open_database(&dbt_test_table);
 
+	// SQL tables need secondary indexes on expire and VF_INDEX fields
+	sql = &dbt_test_table.dbt_driver->dd_sql;
+	if (dbt_test_table.dbt_driver->dd_use_sql && sql->sql_index_exists)
+	{
+		TEST_ASSERT(sql->sql_index_exists(dbt_test_table.dbt_handle,
+		    "test", dbt_test_table.dbt_expire_field) > 0);
+		TEST_ASSERT(sql->sql_index_exists(dbt_test_table.dbt_handle,
+		    "test", "test_updated") > 0);
+	}
+
 	// Clean table
 	dbt_janitor_cleanup(time(NULL), &dbt_test_table);
 
@@ -1453,37 +3335,117 @@ dbt_test_clear(void)
 int
 dbt_test_memdb_init(void)
 {
-	return dbt_test_init("test_memdb", "memdb.so", 0);
+	return dbt_test_init("test_memdb", "memdb.so", NULL, 0);
+}
+
+int
+dbt_test_memdb_persist_init(void)
+{
+	return dbt_test_init("test_memdb_persist", "memdb.so", NULL, 1);
+}
+
+int
+dbt_test_mmapdb_init(void)
+{
+	return dbt_test_init("test_mmapdb", "mmapdb.so", NULL, 1);
+}
+
+int
+dbt_test_mmapdb_driver_init(void)
+{
+	return dbt_test_init("test_mmapdb", "mmapdb.so", NULL, 0);
+}
+
+int
+dbt_test_cache_init(void)
+{
+	return dbt_test_init("test_cache", "memdb.so", NULL, 0);
+}
+
+int
+dbt_test_queue_init(void)
+{
+	return dbt_test_init("test_queue", "memdb.so", NULL, 0);
 }
 
 int
 dbt_test_bdb_init(void)
 {
-	return dbt_test_init("test_bdb", "bdb.so", 1);
+	return dbt_test_init("test_bdb", "bdb.so", NULL, 1);
 }
 
 int
 dbt_test_lite_init(void)
 {
-	return dbt_test_init("test_lite", "lite.so", 1);
+	return dbt_test_init("test_lite", "lite.so", NULL, 1);
+}
+
+int
+dbt_test_lite_mget_init(void)
+{
+	return dbt_test_init("test_lite", "lite.so", NULL, 0);
 }
 
 int
 dbt_test_pgsql_init(void)
 {
-	return dbt_test_init("test_pgsql", "pgsql.so", 1);
+	return dbt_test_init("test_pgsql", "pgsql.so", NULL, 1);
 }
 
 int
 dbt_test_mysql_init(void)
 {
-	return dbt_test_init("test_mysql", "sakila.so", 1);
+	return dbt_test_init("test_mysql", "sakila.so", NULL, 1);
 }
 
 int
 dbt_test_mongodb_init(void)
 {
-	return dbt_test_init("test_mongodb", "mongodb.so", 1);
+	return dbt_test_init("test_mongodb", "mongodb.so", NULL, 1);
+}
+
+int
+dbt_test_tiered_init(void)
+{
+	return dbt_test_init("test_tiered", "tiered.so", "memdb.so", 1);
+}
+
+int
+dbt_test_tiered_mget_init(void)
+{
+	return dbt_test_init("test_tiered", "tiered.so", "memdb.so", 0);
+}
+
+int
+dbt_test_race_init(void)
+{
+	dbt_driver_t *dd;
+
+	if (dbt_test_init("test_cache", "memdb.so", NULL, 0))
+	{
+		return -1;
+	}
+
+	// The driver is unloaded by dbt_test_clear
+	dd = dbt_test_table.dbt_driver;
+	dbt_test_race_set = dd->dd_set;
+	dbt_test_race_del = dd->dd_del;
+	dd->dd_set = (dbt_db_set_t) dbt_test_race_dd_set;
+	dd->dd_del = (dbt_db_del_t) dbt_test_race_dd_del;
+
+	return 0;
+}
+
+int
+dbt_test_breaker_init(void)
+{
+	return dbt_test_init("test_breaker", "memdb.so", NULL, 0);
+}
+
+int
+dbt_test_mongodb_mget_init(void)
+{
+	return dbt_test_init("test_mongodb", "mongodb.so", NULL, 0);
 }
 
 #endif
@@ -0,0 +1,799 @@
+#include <config.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <errno.h>
+
+#include <mopher.h>
+
+#ifdef DEBUG
+
+#define BUFLEN 8192
+
+/*
+ * Benchmark (mopherd -B). Each driver is run with every thread count on
+ * greylist shaped records. Operations are picked at random according to
+ * the mix. Results are printed to stdout as key=value lines.
+ */
+#define DBT_BENCH_OPS 50000
+#define DBT_BENCH_RECORDS 10000
+#define DBT_BENCH_THREADS "1,8,50"
+#define DBT_BENCH_MIX "get:80,set:15,del:4,expire:1"
+#define DBT_BENCH_THREADS_MAX 256
+#define DBT_BENCH_BATCH 16
+#define DBT_BENCH_TTL 3600
+
+// Percentage of writes that store an expired record
+#define DBT_BENCH_EXPIRED 10
+
+typedef struct dbt_bench_driver {
+	char			*dbd_name;
+	char			*dbd_config_key;
+	char			*dbd_module;
+	char			*dbd_child;
+	int			 dbd_default;
+} dbt_bench_driver_t;
+
+typedef struct dbt_bench_record {
+	char			 dbr_origin[32];
+	char			 dbr_envfrom[64];
+	char			 dbr_envrcpt[64];
+	VAR_INT_T		 dbr_created;
+	VAR_INT_T		 dbr_updated;
+	VAR_INT_T		 dbr_expire;
+	VAR_INT_T		 dbr_connections;
+	VAR_INT_T		 dbr_deadline;
+	VAR_INT_T		 dbr_delay;
+	VAR_INT_T		 dbr_attempts;
+	VAR_INT_T		 dbr_visa;
+	VAR_INT_T		 dbr_passed;
+} dbt_bench_record_t;
+
+typedef struct dbt_bench_worker {
+	pthread_t		 dbw_thread;
+	unsigned int		 dbw_seed;
+	int			 dbw_ops;
+	long			*dbw_latency[DBT_OP_MAX];
+	int			 dbw_count[DBT_OP_MAX];
+	int			 dbw_errors[DBT_OP_MAX];
+} dbt_bench_worker_t;
+
+/*
+ * Drivers without a database server run by default
+ */
+static dbt_bench_driver_t dbt_bench_drivers[] = {
+	{ "memdb",	"bench_memdb",	"memdb.so",	NULL,		1 },
+	{ "mmapdb",	"bench_mmapdb",	"mmapdb.so",	NULL,		1 },
+	{ "bdb",	"bench_bdb",	"bdb.so",	NULL,		1 },
+	{ "sqlite3",	"bench_lite",	"lite.so",	NULL,		1 },
+	{ "tiered",	"bench_tiered",	"tiered.so",	"memdb.so",	0 },
+	{ "pgsql",	"test_pgsql",	"pgsql.so",	NULL,		0 },
+	{ "mysql",	"test_mysql",	"sakila.so",	NULL,		0 },
+	{ "mongodb",	"test_mongodb",	"mongodb.so",	NULL,		0 },
+	{ NULL,		NULL,		NULL,		NULL,		0 }
+};
+
+static dbt_t dbt_bench_table;
+static int dbt_bench_records = DBT_BENCH_RECORDS;
+static int dbt_bench_mix[DBT_OP_MAX];
+static int dbt_bench_weight;
+static time_t dbt_bench_time;
+
+// Tables are cleaned up by one janitor at a time
+static pthread_mutex_t dbt_bench_expire_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+
+static var_t *
+dbt_bench_record(dbt_bench_record_t *br, int n, int expired, int lookup)
+{
+	snprintf(br->dbr_origin, sizeof br->dbr_origin, "198.51.%d.%d",
+	    (n >> 8) & 0xff, n & 0xff);
+	snprintf(br->dbr_envfrom, sizeof br->dbr_envfrom,
+	    "sender%d@example.com", n);
+	snprintf(br->dbr_envrcpt, sizeof br->dbr_envrcpt,
+	    "rcpt%d@example.org", n % 1000);
+
+	if (lookup)
+	{
+		return vlist_record(dbt_bench_table.dbt_scheme, br->dbr_origin,
+		    br->dbr_envfrom, br->dbr_envrcpt, NULL, NULL, NULL, NULL,
+		    NULL, NULL, NULL, NULL, NULL);
+	}
+
+	br->dbr_created = dbt_bench_time - n % 600;
+	br->dbr_updated = dbt_bench_time;
+	br->dbr_expire = dbt_bench_time + (expired ? -1 : DBT_BENCH_TTL);
+	br->dbr_connections = 1 + n % 5;
+	br->dbr_deadline = br->dbr_created + 86400;
+	br->dbr_delay = 300;
+	br->dbr_attempts = 1 + n % 3;
+	br->dbr_visa = n % 2 ? 86400 * 7 : 0;
+	br->dbr_passed = n % 2;
+
+	return vlist_record(dbt_bench_table.dbt_scheme, br->dbr_origin,
+	    br->dbr_envfrom, br->dbr_envrcpt, &br->dbr_created,
+	    &br->dbr_updated, &br->dbr_expire, &br->dbr_connections,
+	    &br->dbr_deadline, &br->dbr_delay, &br->dbr_attempts,
+	    &br->dbr_visa, &br->dbr_passed);
+}
+
+
+static int
+dbt_bench_walk(dbt_t *dbt, var_t *record)
+{
+	return 0;
+}
+
+
+static int
+dbt_bench_pick(unsigned int *seed)
+{
+	int op, w;
+
+	w = rand_r(seed) % dbt_bench_weight;
+
+	for (op = 0; op < DBT_OP_MAX - 1; ++op)
+	{
+		if (w < dbt_bench_mix[op])
+		{
+			break;
+		}
+
+		w -= dbt_bench_mix[op];
+	}
+
+	return op;
+}
+
+
+static int
+dbt_bench_batch(dbt_bench_worker_t *dbw, int op)
+{
+	dbt_bench_record_t br[DBT_BENCH_BATCH];
+	var_t *records[DBT_BENCH_BATCH];
+	var_t *results[DBT_BENCH_BATCH];
+	int i, n, expired, r;
+
+	for (i = 0; i < DBT_BENCH_BATCH; ++i)
+	{
+		n = rand_r(&dbw->dbw_seed) % dbt_bench_records;
+		expired = rand_r(&dbw->dbw_seed) % 100 < DBT_BENCH_EXPIRED;
+
+		records[i] = dbt_bench_record(br + i, n, expired,
+		    op == DBT_OP_MGET);
+		if (records[i] == NULL)
+		{
+			log_error("dbt_bench_batch: dbt_bench_record failed");
+			r = -1;
+			goto exit;
+		}
+	}
+
+	if (op == DBT_OP_MGET)
+	{
+		r = dbt_db_mget(&dbt_bench_table, i, records, results);
+		for (n = 0; r == 0 && n < i; ++n)
+		{
+			if (results[n])
+			{
+				var_delete(results[n]);
+			}
+		}
+	}
+	else
+	{
+		r = dbt_db_mset(&dbt_bench_table, i, records);
+	}
+
+exit:
+	while (i--)
+	{
+		var_delete(records[i]);
+	}
+
+	return r;
+}
+
+
+static int
+dbt_bench_op(dbt_bench_worker_t *dbw, int op)
+{
+	dbt_bench_record_t br;
+	var_t *record, *result = NULL;
+	int n, r;
+
+	switch (op)
+	{
+	case DBT_OP_MGET:
+	case DBT_OP_MSET:
+		return dbt_bench_batch(dbw, op);
+
+	case DBT_OP_WALK:
+		return dbt_db_walk(&dbt_bench_table,
+		    (dbt_db_callback_t) dbt_bench_walk);
+
+	case DBT_OP_EXPIRE:
+		pthread_mutex_lock(&dbt_bench_expire_mutex);
+		r = dbt_db_cleanup(&dbt_bench_table);
+		pthread_mutex_unlock(&dbt_bench_expire_mutex);
+		return r < 0 ? -1 : 0;
+
+	default:
+		break;
+	}
+
+	n = rand_r(&dbw->dbw_seed) % dbt_bench_records;
+	record = dbt_bench_record(&br, n,
+	    rand_r(&dbw->dbw_seed) % 100 < DBT_BENCH_EXPIRED,
+	    op != DBT_OP_SET);
+	if (record == NULL)
+	{
+		log_error("dbt_bench_op: dbt_bench_record failed");
+		return -1;
+	}
+
+	switch (op)
+	{
+	case DBT_OP_GET:
+		r = dbt_db_get(&dbt_bench_table, record, &result);
+		if (result)
+		{
+			var_delete(result);
+		}
+		break;
+
+	case DBT_OP_SET:
+		r = dbt_db_set(&dbt_bench_table, record);
+		break;
+
+	default:
+		r = dbt_db_del(&dbt_bench_table, record);
+		break;
+	}
+
+	var_delete(record);
+
+	return r;
+}
+
+
+static void *
+dbt_bench_worker(dbt_bench_worker_t *dbw)
+{
+	struct timespec start, stop;
+	int i, op;
+
+	for (i = 0; i < dbw->dbw_ops; ++i)
+	{
+		op = dbt_bench_pick(&dbw->dbw_seed);
+
+		clock_gettime(CLOCK_MONOTONIC, &start);
+
+		if (dbt_bench_op(dbw, op))
+		{
+			++dbw->dbw_errors[op];
+		}
+
+		clock_gettime(CLOCK_MONOTONIC, &stop);
+
+		dbw->dbw_latency[op][dbw->dbw_count[op]++] =
+		    (stop.tv_sec - start.tv_sec) * 1000000000L +
+		    stop.tv_nsec - start.tv_nsec;
+	}
+
+	return NULL;
+}
+
+
+static int
+dbt_bench_compare(const void *a, const void *b)
+{
+	long la = *(const long *) a, lb = *(const long *) b;
+
+	return la < lb ? -1 : la > lb;
+}
+
+
+/*
+ * Latency in microseconds at quantile q of n sorted nanosecond samples
+ */
+static double
+dbt_bench_quantile(long *latency, int n, double q)
+{
+	return latency[(int) (q * (n - 1))] / 1000.0;
+}
+
+
+static int
+dbt_bench_report(dbt_bench_driver_t *dbd, dbt_bench_worker_t *workers,
+    int threads, double seconds)
+{
+	dbt_op_stats_t ops[DBT_OP_MAX];
+	dbt_op_stats_t *dos;
+	long *latency;
+	int count, errors, total = 0;
+	int op, i;
+
+	memcpy(ops, dbt_bench_table.dbt_stats.ds_ops, sizeof ops);
+
+	for (op = 0; op < DBT_OP_MAX; ++op)
+	{
+		count = 0;
+		errors = 0;
+
+		for (i = 0; i < threads; ++i)
+		{
+			count += workers[i].dbw_count[op];
+			errors += workers[i].dbw_errors[op];
+		}
+
+		if (count == 0)
+		{
+			continue;
+		}
+
+		latency = (long *) malloc(count * sizeof (long));
+		if (latency == NULL)
+		{
+			log_sys_error("dbt_bench_report: malloc");
+			return -1;
+		}
+
+		for (count = 0, i = 0; i < threads; ++i)
+		{
+			memcpy(latency + count, workers[i].dbw_latency[op],
+			    workers[i].dbw_count[op] * sizeof (long));
+			count += workers[i].dbw_count[op];
+		}
+
+		qsort(latency, count, sizeof (long), dbt_bench_compare);
+
+		// Time spent waiting for the table lock or a pool connection
+		dos = ops + op;
+
+		printf("driver=%s threads=%d op=%s count=%d errors=%d "
+		    "ops_per_sec=%.0f p50_us=%.1f p99_us=%.1f p999_us=%.1f "
+		    "max_us=%.1f wait_avg_us=%.1f\n", dbd->dbd_name, threads,
+		    dbt_stats_ops[op], count, errors, count / seconds,
+		    dbt_bench_quantile(latency, count, 0.5),
+		    dbt_bench_quantile(latency, count, 0.99),
+		    dbt_bench_quantile(latency, count, 0.999),
+		    latency[count - 1] / 1000.0,
+		    dos->dos_count ?
+		    (double) dos->dos_wait_usec / dos->dos_count : 0);
+
+		free(latency);
+
+		total += count;
+	}
+
+	printf("driver=%s threads=%d op=all count=%d ops_per_sec=%.0f "
+	    "seconds=%.3f\n", dbd->dbd_name, threads, total, total / seconds,
+	    seconds);
+	fflush(stdout);
+
+	log_error("%-8s: %3d threads: %9.0f ops/s", dbd->dbd_name, threads,
+	    total / seconds);
+
+	return 0;
+}
+
+
+static int
+dbt_bench_threads(dbt_bench_driver_t *dbd, int threads, int ops)
+{
+	dbt_bench_worker_t *workers;
+	struct timespec start, stop;
+	int i, op, r = -1;
+
+	workers = (dbt_bench_worker_t *) calloc(threads,
+	    sizeof (dbt_bench_worker_t));
+	if (workers == NULL)
+	{
+		log_sys_error("dbt_bench_threads: calloc");
+		return -1;
+	}
+
+	for (i = 0; i < threads; ++i)
+	{
+		workers[i].dbw_seed = i + 1;
+		workers[i].dbw_ops = ops > threads ? ops / threads : 1;
+
+		for (op = 0; op < DBT_OP_MAX; ++op)
+		{
+			if (dbt_bench_mix[op] == 0)
+			{
+				continue;
+			}
+
+			workers[i].dbw_latency[op] = (long *) malloc(
+			    workers[i].dbw_ops * sizeof (long));
+			if (workers[i].dbw_latency[op] == NULL)
+			{
+				log_sys_error("dbt_bench_threads: malloc");
+				goto exit;
+			}
+		}
+	}
+
+	// Count this run only. No workers are running yet.
+	memset(dbt_bench_table.dbt_stats.ds_ops, 0,
+	    sizeof dbt_bench_table.dbt_stats.ds_ops);
+
+	dbt_bench_table.dbt_cleanup_schedule = dbt_bench_time;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (i = 0; i < threads; ++i)
+	{
+		if (util_thread_create(&workers[i].dbw_thread,
+		    (void *) dbt_bench_worker, workers + i))
+		{
+			log_die(EX_SOFTWARE, "dbt_bench_threads: "
+			    "util_thread_create failed");
+		}
+	}
+
+	for (i = 0; i < threads; ++i)
+	{
+		util_thread_join(workers[i].dbw_thread);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &stop);
+
+	r = dbt_bench_report(dbd, workers, threads,
+	    (stop.tv_sec - start.tv_sec) + (stop.tv_nsec - start.tv_nsec) /
+	    1e9);
+
+exit:
+	for (i = 0; i < threads; ++i)
+	{
+		for (op = 0; op < DBT_OP_MAX; ++op)
+		{
+			if (workers[i].dbw_latency[op])
+			{
+				free(workers[i].dbw_latency[op]);
+			}
+		}
+	}
+
+	free(workers);
+
+	return r;
+}
+
+
+static void
+dbt_bench_close(void)
+{
+	dbt_clear();
+	module_clear();
+	cf_clear();
+
+	return;
+}
+
+
+static int
+dbt_bench_open(dbt_bench_driver_t *dbd)
+{
+	if (!module_exists(dbd->dbd_module))
+	{
+		log_error("dbt_bench: %s: %s not installed", dbd->dbd_name,
+		    dbd->dbd_module);
+		return -1;
+	}
+
+	if (dbd->dbd_child && !module_exists(dbd->dbd_child))
+	{
+		log_error("dbt_bench: %s: %s not installed", dbd->dbd_name,
+		    dbd->dbd_child);
+		return -1;
+	}
+
+	cf_init();
+	dbt_init(0);
+	module_init(0, dbd->dbd_module, dbd->dbd_child, NULL);
+
+	memset(&dbt_bench_table, 0, sizeof dbt_bench_table);
+
+	// Same layout as the greylist table
+	dbt_bench_table.dbt_scheme = vlist_scheme("greylist",
+		"origin",	VT_STRING,	VF_KEEPNAME | VF_KEY,
+		"envfrom_addr",	VT_STRING,	VF_KEEPNAME | VF_KEY,
+		"envrcpt_addr",	VT_STRING,	VF_KEEPNAME | VF_KEY,
+		"greylist_created",	VT_INT,		VF_KEEPNAME,
+		"greylist_updated",	VT_INT,		VF_KEEPNAME,
+		"greylist_expire",	VT_INT,		VF_KEEPNAME,
+		"greylist_connections",	VT_INT,		VF_KEEPNAME,
+		"greylist_deadline",	VT_INT,		VF_KEEPNAME,
+		"greylist_delay",	VT_INT,		VF_KEEPNAME,
+		"greylist_attempts",	VT_INT,		VF_KEEPNAME,
+		"greylist_visa",	VT_INT,		VF_KEEPNAME,
+		"greylist_passed",	VT_INT,		VF_KEEPNAME,
+		NULL);
+	if (dbt_bench_table.dbt_scheme == NULL)
+	{
+		log_die(EX_SOFTWARE, "dbt_bench: vlist_scheme failed");
+	}
+
+	dbt_bench_table.dbt_validate = dbt_common_validate;
+	dbt_bench_table.dbt_config_key = dbd->dbd_config_key;
+
+	if (dbt_register("greylist", &dbt_bench_table))
+	{
+		log_die(EX_SOFTWARE, "dbt_bench: dbt_register failed");
+	}
+
+	dbt_sync = 0;
+
+	if (dbt_open_database(&dbt_bench_table))
+	{
+		log_error("dbt_bench: %s: dbt_open_database failed",
+		    dbd->dbd_name);
+		dbt_bench_close();
+		return -1;
+	}
+
+	return 0;
+}
+
+
+/*
+ * Stores every record once. Lookups hit from the start.
+ */
+static int
+dbt_bench_load(void)
+{
+	dbt_bench_record_t br[DBT_BENCH_BATCH];
+	var_t *records[DBT_BENCH_BATCH];
+	int i, n, r = 0;
+
+	for (n = 0; n < dbt_bench_records && r == 0; )
+	{
+		for (i = 0; i < DBT_BENCH_BATCH && n < dbt_bench_records; ++i)
+		{
+			records[i] = dbt_bench_record(br + i, n++, 0, 0);
+			if (records[i] == NULL)
+			{
+				log_error("dbt_bench_load: dbt_bench_record "
+				    "failed");
+				r = -1;
+				break;
+			}
+		}
+
+		if (r == 0)
+		{
+			r = dbt_db_mset(&dbt_bench_table, i, records);
+		}
+
+		while (i--)
+		{
+			var_delete(records[i]);
+		}
+	}
+
+	return r;
+}
+
+
+static int
+dbt_bench_parse_mix(char *mix)
+{
+	char buffer[BUFLEN];
+	char *p, *save = NULL, *weight;
+	int op;
+
+	if (strlen(mix) >= sizeof buffer)
+	{
+		log_error("dbt_bench: mix too long");
+		return -1;
+	}
+
+	strcpy(buffer, mix);
+
+	memset(dbt_bench_mix, 0, sizeof dbt_bench_mix);
+	dbt_bench_weight = 0;
+
+	for (p = strtok_r(buffer, ",", &save); p;
+	    p = strtok_r(NULL, ",", &save))
+	{
+		weight = strchr(p, ':');
+		if (weight == NULL)
+		{
+			log_error("dbt_bench: bad mix \"%s\"", p);
+			return -1;
+		}
+
+		*weight++ = 0;
+
+		for (op = 0; op < DBT_OP_MAX; ++op)
+		{
+			if (strcmp(p, dbt_stats_ops[op]) == 0)
+			{
+				break;
+			}
+		}
+
+		if (op == DBT_OP_MAX || atoi(weight) < 0)
+		{
+			log_error("dbt_bench: bad mix \"%s\"", p);
+			return -1;
+		}
+
+		dbt_bench_mix[op] = atoi(weight);
+		dbt_bench_weight += dbt_bench_mix[op];
+	}
+
+	if (dbt_bench_weight == 0)
+	{
+		log_error("dbt_bench: empty mix");
+		return -1;
+	}
+
+	return 0;
+}
+
+
+static int
+dbt_bench_parse_threads(char *list, int *threads)
+{
+	char *p = list;
+	int n = 0;
+
+	while (*p && n < DBT_BENCH_THREADS_MAX)
+	{
+		threads[n] = strtol(p, &p, 10);
+		if (threads[n] <= 0 || threads[n] > DBT_BENCH_THREADS_MAX ||
+		    (*p && *p != ','))
+		{
+			log_error("dbt_bench: bad thread count \"%s\"", list);
+			return -1;
+		}
+
+		++n;
+
+		if (*p == ',')
+		{
+			++p;
+		}
+	}
+
+	return n;
+}
+
+
+/*
+ * mopherd -B [ops=N] [records=N] [threads=N,...] [mix=op:weight,...]
+ * [driver ...]
+ */
+int
+dbt_bench(int optind, int argc, char **argv)
+{
+	dbt_bench_driver_t *dbd;
+	int threads[DBT_BENCH_THREADS_MAX];
+	char *mix = DBT_BENCH_MIX;
+	int ops = DBT_BENCH_OPS;
+	int nthreads, ndrivers = 0, ht = 0, hash = 0, vlist = 0, vtable = 0;
+	int var = 0;
+	int i, j, selected, r = 0;
+
+	log_init("mopher bench", LOG_ERR, 0, 1);
+
+	nthreads = dbt_bench_parse_threads(DBT_BENCH_THREADS, threads);
+
+	for (i = optind; i < argc; ++i)
+	{
+		if (strncmp(argv[i], "ops=", 4) == 0)
+		{
+			ops = atoi(argv[i] + 4);
+		}
+		else if (strncmp(argv[i], "records=", 8) == 0)
+		{
+			dbt_bench_records = atoi(argv[i] + 8);
+		}
+		else if (strncmp(argv[i], "threads=", 8) == 0)
+		{
+			nthreads = dbt_bench_parse_threads(argv[i] + 8,
+			    threads);
+		}
+		else if (strncmp(argv[i], "mix=", 4) == 0)
+		{
+			mix = argv[i] + 4;
+		}
+		else
+		{
+			// ht measures single insert pauses of ht_t, hash
+			// compares hash functions, vlist builds records,
+			// vtable sets mailspec vars of messages, var copies
+			// scalars
+			ht |= strcmp(argv[i], "ht") == 0;
+			hash |= strcmp(argv[i], "hash") == 0;
+			vlist |= strcmp(argv[i], "vlist") == 0;
+			vtable |= strcmp(argv[i], "vtable") == 0;
+			var |= strcmp(argv[i], "var") == 0;
+			++ndrivers;
+		}
+	}
+
+	if (ops <= 0 || dbt_bench_records <= 0 || nthreads <= 0 ||
+	    dbt_bench_parse_mix(mix))
+	{
+		log_error("usage: %s -B [ops=N] [records=N] "
+		    "[threads=N,...] [mix=op:weight,...] "
+		    "[driver|ht|hash|vlist|vtable|var ...]", BINNAME);
+		return EX_USAGE;
+	}
+
+	if (ht)
+	{
+		ht_bench(dbt_bench_records);
+	}
+
+	if (hash)
+	{
+		hash_bench(dbt_bench_records);
+	}
+
+	if (vlist)
+	{
+		vlist_bench(dbt_bench_records);
+	}
+
+	if (vtable)
+	{
+		vtable_bench(dbt_bench_records);
+	}
+
+	if (var)
+	{
+		var_bench(dbt_bench_records);
+	}
+
+	for (dbd = dbt_bench_drivers; dbd->dbd_name; ++dbd)
+	{
+		selected = ndrivers == 0 && dbd->dbd_default;
+
+		for (i = optind; i < argc && !selected; ++i)
+		{
+			selected = strcmp(argv[i], dbd->dbd_name) == 0;
+		}
+
+		if (!selected)
+		{
+			continue;
+		}
+
+		if (dbt_bench_open(dbd))
+		{
+			continue;
+		}
+
+		dbt_bench_time = time(NULL);
+
+		if (dbt_bench_load())
+		{
+			log_error("dbt_bench: %s: dbt_bench_load failed",
+			    dbd->dbd_name);
+			dbt_bench_close();
+			r = EX_SOFTWARE;
+			continue;
+		}
+
+		for (j = 0; j < nthreads; ++j)
+		{
+			if (dbt_bench_threads(dbd, threads[j], ops))
+			{
+				r = EX_SOFTWARE;
+			}
+		}
+
+		dbt_bench_close();
+	}
+
+	return r;
+}
+
+#endif
@@ -0,0 +1,862 @@
+#include <config.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <errno.h>
+
+#include <mopher.h>
+
+/*
+ * Circuit breaker defaults
+ */
+#define DBT_BREAKER_BUCKETS 1024
+#define DBT_BREAKER_LATENCY 1000
+#define DBT_BREAKER_TIMEOUT 30
+#define DBT_BREAKER_MEMORY (16 * 1024 * 1024)
+
+
+static hash_t
+dbt_journal_hash(dbt_journal_entry_t *dje)
+{
+	return HASH(dje->dje_vp->vp_key, dje->dje_vp->vp_klen);
+}
+
+
+static int
+dbt_journal_match(dbt_journal_entry_t *dje1, dbt_journal_entry_t *dje2)
+{
+	if (dje1->dje_vp->vp_klen != dje2->dje_vp->vp_klen)
+	{
+		return 0;
+	}
+
+	if (memcmp(dje1->dje_vp->vp_key, dje2->dje_vp->vp_key,
+	    dje1->dje_vp->vp_klen))
+	{
+		return 0;
+	}
+
+	return 1;
+}
+
+
+static void
+dbt_journal_entry_delete(dbt_journal_entry_t *dje)
+{
+	vp_delete(dje->dje_vp);
+	free(dje);
+
+	return;
+}
+
+
+static void
+dbt_journal_unlink(dbt_breaker_t *dbr, dbt_journal_entry_t *dje)
+{
+	if (dje->dje_prev)
+	{
+		dje->dje_prev->dje_next = dje->dje_next;
+	}
+	else
+	{
+		dbr->dbr_head = dje->dje_next;
+	}
+
+	if (dje->dje_next)
+	{
+		dje->dje_next->dje_prev = dje->dje_prev;
+	}
+	else
+	{
+		dbr->dbr_tail = dje->dje_prev;
+	}
+
+	dje->dje_prev = NULL;
+	dje->dje_next = NULL;
+
+	return;
+}
+
+
+/*
+ * Journaled records are replayed oldest first. A record that failed to
+ * replay is put back at the head.
+ */
+static void
+dbt_journal_link(dbt_breaker_t *dbr, dbt_journal_entry_t *dje, int head)
+{
+	if (head)
+	{
+		dje->dje_prev = NULL;
+		dje->dje_next = dbr->dbr_head;
+
+		if (dbr->dbr_head)
+		{
+			dbr->dbr_head->dje_prev = dje;
+		}
+		else
+		{
+			dbr->dbr_tail = dje;
+		}
+
+		dbr->dbr_head = dje;
+
+		return;
+	}
+
+	dje->dje_next = NULL;
+	dje->dje_prev = dbr->dbr_tail;
+
+	if (dbr->dbr_tail)
+	{
+		dbr->dbr_tail->dje_next = dje;
+	}
+	else
+	{
+		dbr->dbr_head = dje;
+	}
+
+	dbr->dbr_tail = dje;
+
+	return;
+}
+
+
+static int
+dbt_breaker_lock(dbt_breaker_t *dbr)
+{
+	if (pthread_mutex_lock(&dbr->dbr_mutex))
+	{
+		log_sys_error("dbt_breaker_lock: pthread_mutex_lock");
+		return -1;
+	}
+
+	return 0;
+}
+
+
+static void
+dbt_breaker_unlock(dbt_breaker_t *dbr)
+{
+	if (pthread_mutex_unlock(&dbr->dbr_mutex))
+	{
+		log_sys_error("dbt_breaker_unlock: pthread_mutex_unlock");
+	}
+
+	return;
+}
+
+
+/*
+ * Database errors are fatal only if no breaker handles them
+ */
+int
+dbt_breaker_enabled(dbt_t *dbt)
+{
+	return dbt->dbt_breaker.dbr_journal != NULL;
+}
+
+
+/*
+ * Bypasses the backend. Called with dbr_mutex held.
+ */
+static void
+dbt_breaker_open(dbt_t *dbt)
+{
+	dbt_breaker_t *dbr = &dbt->dbt_breaker;
+
+	if (dbr->dbr_state == DBT_BREAKER_CLOSED)
+	{
+		++dbr->dbr_trips;
+
+		log_warning("dbt_breaker: %s: backend failing. Using local journal "
+		    "for %d seconds", dbt->dbt_name, dbr->dbr_timeout);
+	}
+	else
+	{
+		log_warning("dbt_breaker: %s: backend still failing. %d records "
+		    "journaled", dbt->dbt_name, HT_RECORDS(dbr->dbr_journal));
+	}
+
+	dbr->dbr_state = DBT_BREAKER_OPEN;
+	dbr->dbr_opened = time(NULL);
+	dbr->dbr_failures = 0;
+
+	return;
+}
+
+
+int
+dbt_breaker_init(dbt_t *dbt)
+{
+	dbt_breaker_t *dbr = &dbt->dbt_breaker;
+
+	if (dbr->dbr_errors <= 0)
+	{
+		return 0;
+	}
+
+	if (dbr->dbr_latency <= 0)
+	{
+		dbr->dbr_latency = DBT_BREAKER_LATENCY;
+	}
+
+	if (dbr->dbr_timeout <= 0)
+	{
+		dbr->dbr_timeout = DBT_BREAKER_TIMEOUT;
+	}
+
+	if (dbr->dbr_memory_max <= 0)
+	{
+		dbr->dbr_memory_max = DBT_BREAKER_MEMORY;
+	}
+
+	dbr->dbr_journal = ht_create(DBT_BREAKER_BUCKETS,
+	    (ht_hash_t) dbt_journal_hash, (ht_match_t) dbt_journal_match,
+	    NULL);
+	if (dbr->dbr_journal == NULL)
+	{
+		log_error("dbt_breaker_init: ht_create failed");
+		return -1;
+	}
+
+	if (pthread_mutex_init(&dbr->dbr_mutex, NULL))
+	{
+		log_error("dbt_breaker_init: pthread_mutex_init failed");
+		ht_delete(dbr->dbr_journal);
+		dbr->dbr_journal = NULL;
+		return -1;
+	}
+
+	dbr->dbr_head = NULL;
+	dbr->dbr_tail = NULL;
+	dbr->dbr_state = DBT_BREAKER_CLOSED;
+	dbr->dbr_memory = 0;
+	dbr->dbr_failures = 0;
+	dbr->dbr_opened = 0;
+	dbr->dbr_trips = 0;
+	dbr->dbr_journaled = 0;
+	dbr->dbr_dropped = 0;
+	dbr->dbr_replayed = 0;
+
+	log_debug("dbt_breaker_init: %s: open after %d errors or operations "
+	    "slower than %dms, probe after %ds, journal %ld bytes",
+	    dbt->dbt_name, dbr->dbr_errors, dbr->dbr_latency,
+	    dbr->dbr_timeout, dbr->dbr_memory_max);
+
+	return 0;
+}
+
+
+/*
+ * Returns 1 if the backend holds a newer version of record, 0 if not and -1
+ * on error. Records are compared by expiry.
+ */
+static int
+dbt_journal_stale(dbt_t *dbt, dbt_t *conn, var_t *record)
+{
+	VAR_INT_T *expire, *current_expire;
+	var_t *current = NULL;
+	int r = 0;
+
+	expire = vlist_record_get(record, dbt->dbt_expire_field);
+	if (expire == NULL)
+	{
+		return 0;
+	}
+
+	if (dbt->dbt_driver->dd_get(conn, record, &current))
+	{
+		log_error("dbt_journal_stale: %s: dd_get failed",
+		    dbt->dbt_name);
+		return -1;
+	}
+
+	if (current == NULL)
+	{
+		return 0;
+	}
+
+	current_expire = vlist_record_get(current, dbt->dbt_expire_field);
+	if (current_expire && *current_expire > *expire)
+	{
+		r = 1;
+	}
+
+	var_delete(current);
+
+	return r;
+}
+
+
+/*
+ * Writes a journaled record to the backend. Returns 0 on success, 1 if the
+ * record was written slower than dbr_latency and -1 on error.
+ *
+ * The backend may have been updated through other paths while the breaker
+ * was open, e.g. by another mopherd sharing the database. A journaled write
+ * is skipped if the backend record expires later. Journaled deletes are
+ * replayed as is.
+ */
+static int
+dbt_journal_write(dbt_t *dbt, dbt_t *conn, var_t *record, int deleted)
+{
+	dbt_breaker_t *dbr = &dbt->dbt_breaker;
+	struct timespec start, stop;
+	int stale = 0;
+	int r;
+
+	dbt_stats_now(&start);
+
+	if (!deleted)
+	{
+		stale = dbt_journal_stale(dbt, conn, record);
+	}
+
+	if (stale == -1)
+	{
+		r = -1;
+	}
+	else if (stale)
+	{
+		log_debug("dbt_journal_write: %s: backend record is newer",
+		    dbt->dbt_name);
+		r = 0;
+	}
+	else if (deleted)
+	{
+		r = dbt->dbt_driver->dd_del(conn, record);
+	}
+	else
+	{
+		r = dbt->dbt_driver->dd_set(conn, record);
+	}
+
+	dbt_stats_now(&stop);
+
+	// See dbt_db_set
+	if (dbt->dbt_cache.dc_ht)
+	{
+		dbt_cache_del(dbt, record);
+	}
+
+	if (r == 0 && !stale && dbt->dbt_index.di_ht)
+	{
+		if (deleted)
+		{
+			dbt_index_del(dbt, record);
+		}
+		else
+		{
+			dbt_index_set(dbt, record);
+		}
+	}
+
+	if (r)
+	{
+		log_error("dbt_journal_write: %s: %s failed", dbt->dbt_name,
+		    deleted ? "dd_del" : "dd_set");
+		return -1;
+	}
+
+	if (dbt_stats_usec(&start, &stop) > dbr->dbr_latency * 1000L)
+	{
+		return 1;
+	}
+
+	return 0;
+}
+
+
+/*
+ * Writes all journaled records to the backend. Records journaled meanwhile
+ * are replayed as well. Closes the breaker and returns 0 if the journal
+ * was emptied. Otherwise the breaker is opened again and -1 is returned.
+ *
+ * Entries stay in the journal until they are written. Readers served by
+ * the journal never miss a record that is being replayed.
+ */
+static int
+dbt_breaker_replay(dbt_t *dbt)
+{
+	dbt_breaker_t *dbr = &dbt->dbt_breaker;
+	dbt_journal_entry_t *dje;
+	unsigned long replayed = 0;
+	unsigned long version;
+	var_t *record;
+	dbt_t *conn;
+	int deleted;
+	int r = -1;
+
+	conn = dbt_pool_checkout(dbt);
+	if (conn == NULL)
+	{
+		goto exit;
+	}
+
+	for (;;)
+	{
+		if (dbt_breaker_lock(dbr))
+		{
+			r = -1;
+			break;
+		}
+
+		dje = dbr->dbr_head;
+		if (dje == NULL)
+		{
+			dbr->dbr_state = DBT_BREAKER_CLOSED;
+			dbr->dbr_failures = 0;
+			dbr->dbr_replayed += replayed;
+			dbt_breaker_unlock(dbr);
+			r = 0;
+			break;
+		}
+
+		// dbt_journal_set replaces the record of an entry in place
+		record = vp_unpack(dje->dje_vp, dbt->dbt_scheme);
+		deleted = dje->dje_deleted;
+		version = dje->dje_version;
+
+		dbt_breaker_unlock(dbr);
+
+		if (record == NULL)
+		{
+			log_error("dbt_breaker_replay: vp_unpack failed");
+			r = -1;
+			break;
+		}
+
+		r = dbt_journal_write(dbt, conn, record, deleted);
+		var_delete(record);
+
+		if (r == -1)
+		{
+			break;
+		}
+
+		if (dbt_breaker_lock(dbr))
+		{
+			r = -1;
+			break;
+		}
+
+		// Journaled again meanwhile: the newer record is replayed next
+		if (dje->dje_version == version)
+		{
+			dbt_journal_unlink(dbr, dje);
+			ht_remove(dbr->dbr_journal, dje);
+			dbr->dbr_memory -= dje->dje_size;
+			dbt_journal_entry_delete(dje);
+		}
+
+		++replayed;
+
+		dbt_breaker_unlock(dbr);
+
+		// Slow writes succeeded but the backend is not healthy yet
+		if (r == 1)
+		{
+			r = -1;
+			break;
+		}
+	}
+
+	dbt_pool_checkin(dbt, conn);
+
+exit:
+	if (r == 0)
+	{
+		log_notice("dbt_breaker: %s: backend recovered. %lu records "
+		    "replayed", dbt->dbt_name, replayed);
+		return 0;
+	}
+
+	if (dbt_breaker_lock(dbr) == 0)
+	{
+		dbr->dbr_replayed += replayed;
+		dbt_breaker_open(dbt);
+		dbt_breaker_unlock(dbr);
+	}
+
+	return -1;
+}
+
+
+/*
+ * Returns DBT_BREAKER_CLOSED if the operation uses the backend and
+ * DBT_BREAKER_OPEN if it is served by the journal. After dbr_timeout a
+ * single thread gets DBT_BREAKER_PROBE. It replays the journal and uses
+ * the backend. Its operation decides whether the breaker stays closed.
+ */
+int
+dbt_breaker_check(dbt_t *dbt)
+{
+	dbt_breaker_t *dbr = &dbt->dbt_breaker;
+	int state;
+
+	// Unlocked. A stale state delays the switch by one operation.
+	if (dbr->dbr_journal == NULL || dbr->dbr_state == DBT_BREAKER_CLOSED)
+	{
+		return DBT_BREAKER_CLOSED;
+	}
+
+	if (dbt_breaker_lock(dbr))
+	{
+		return DBT_BREAKER_OPEN;
+	}
+
+	state = dbr->dbr_state;
+
+	if (state == DBT_BREAKER_OPEN &&
+	    time(NULL) >= dbr->dbr_opened + dbr->dbr_timeout)
+	{
+		dbr->dbr_state = DBT_BREAKER_PROBE;
+		state = DBT_BREAKER_PROBE;
+	}
+
+	// Another thread is probing
+	else if (state == DBT_BREAKER_PROBE)
+	{
+		state = DBT_BREAKER_OPEN;
+	}
+
+	dbt_breaker_unlock(dbr);
+
+	if (state == DBT_BREAKER_PROBE && dbt_breaker_replay(dbt))
+	{
+		return DBT_BREAKER_OPEN;
+	}
+
+	return state;
+}
+
+
+/*
+ * Records the result of a backend operation started at start. A failed
+ * probe opens the breaker at once.
+ */
+void
+dbt_breaker_update(dbt_t *dbt, int state, int r, struct timespec *start)
+{
+	dbt_breaker_t *dbr = &dbt->dbt_breaker;
+	struct timespec stop;
+	int failed;
+
+	if (dbr->dbr_journal == NULL)
+	{
+		return;
+	}
+
+	dbt_stats_now(&stop);
+
+	failed = r < 0 ||
+	    dbt_stats_usec(start, &stop) > dbr->dbr_latency * 1000L;
+
+	// Unlocked. Healthy tables don't take the lock.
+	if (!failed && dbr->dbr_failures == 0)
+	{
+		return;
+	}
+
+	if (dbt_breaker_lock(dbr))
+	{
+		return;
+	}
+
+	// Opened by another thread
+	if (dbr->dbr_state != DBT_BREAKER_CLOSED)
+	{
+		dbt_breaker_unlock(dbr);
+		return;
+	}
+
+	if (!failed)
+	{
+		dbr->dbr_failures = 0;
+	}
+	else if (state == DBT_BREAKER_PROBE ||
+	    ++dbr->dbr_failures >= dbr->dbr_errors)
+	{
+		dbt_breaker_open(dbt);
+	}
+
+	dbt_breaker_unlock(dbr);
+
+	return;
+}
+
+
+/*
+ * Returns 1 if the record is journaled, 0 if not and -1 on error. *result
+ * is NULL if the record was deleted.
+ */
+int
+dbt_journal_get(dbt_t *dbt, var_t *record, var_t **result)
+{
+	dbt_breaker_t *dbr = &dbt->dbt_breaker;
+	dbt_journal_entry_t lookup, *dje;
+	vp_key_t key;
+	int r = 0;
+
+	if (vp_pack_key(&key, record))
+	{
+		log_error("dbt_journal_get: vp_pack_key failed");
+		return -1;
+	}
+
+	lookup.dje_vp = &key.vk_vp;
+
+	if (dbt_breaker_lock(dbr))
+	{
+		vp_key_clear(&key);
+		return -1;
+	}
+
+	dje = ht_lookup(dbr->dbr_journal, &lookup);
+	if (dje && dje->dje_deleted)
+	{
+		r = 1;
+	}
+	else if (dje)
+	{
+		*result = vp_unpack(dje->dje_vp, dbt->dbt_scheme);
+		if (*result == NULL)
+		{
+			log_error("dbt_journal_get: vp_unpack failed");
+			r = -1;
+		}
+		else
+		{
+			r = 1;
+		}
+	}
+
+	dbt_breaker_unlock(dbr);
+	vp_key_clear(&key);
+
+	return r;
+}
+
+
+/*
+ * Journals a write or a delete. Fails if the journal is full. Increments
+ * (VF_SQL_SAFE_UPDATE) can't be replayed and fail as well. Returns 0 if the
+ * record was journaled, 1 if the breaker was closed meanwhile and the
+ * record needs to be written to the backend and -1 on error.
+ *
+ * The state is checked again under dbr_mutex. A prober closing the breaker
+ * after the caller's dbt_breaker_check would never replay the record.
+ */
+int
+dbt_journal_set(dbt_t *dbt, var_t *record, int deleted)
+{
+	dbt_breaker_t *dbr = &dbt->dbt_breaker;
+	dbt_journal_entry_t *dje, *old;
+	long size;
+	vp_t *vp;
+
+	if (dbt_queue_safe_update(record))
+	{
+		if (dbt_breaker_lock(dbr))
+		{
+			return -1;
+		}
+
+		if (dbr->dbr_state == DBT_BREAKER_CLOSED)
+		{
+			dbt_breaker_unlock(dbr);
+			return 1;
+		}
+
+		++dbr->dbr_dropped;
+		dbt_breaker_unlock(dbr);
+
+		return -1;
+	}
+
+	vp = vp_pack(record);
+	if (vp == NULL)
+	{
+		log_error("dbt_journal_set: vp_pack failed");
+		return -1;
+	}
+
+	dje = (dbt_journal_entry_t *) malloc(sizeof (dbt_journal_entry_t));
+	if (dje == NULL)
+	{
+		log_sys_error("dbt_journal_set: malloc");
+		vp_delete(vp);
+		return -1;
+	}
+
+	size = sizeof (dbt_journal_entry_t) + sizeof (vp_t) + vp->vp_dlen +
+	    vp->vp_klen;
+
+	dje->dje_vp = vp;
+	dje->dje_deleted = deleted;
+	dje->dje_size = size;
+	dje->dje_version = 0;
+	dje->dje_prev = NULL;
+	dje->dje_next = NULL;
+
+	if (dbt_breaker_lock(dbr))
+	{
+		dbt_journal_entry_delete(dje);
+		return -1;
+	}
+
+	if (dbr->dbr_state == DBT_BREAKER_CLOSED)
+	{
+		dbt_breaker_unlock(dbr);
+		dbt_journal_entry_delete(dje);
+		return 1;
+	}
+
+	old = ht_lookup(dbr->dbr_journal, dje);
+	if (old)
+	{
+		size -= old->dje_size;
+	}
+
+	if (size > 0 && dbr->dbr_memory + size > dbr->dbr_memory_max)
+	{
+		++dbr->dbr_dropped;
+		dbt_breaker_unlock(dbr);
+		dbt_journal_entry_delete(dje);
+		return -1;
+	}
+
+	++dbr->dbr_journaled;
+	dbr->dbr_memory += size;
+
+	// Coalesce: the journaled record is replaced in place
+	if (old)
+	{
+		vp_delete(old->dje_vp);
+		old->dje_vp = vp;
+		old->dje_deleted = deleted;
+		old->dje_size = dje->dje_size;
+		++old->dje_version;
+		free(dje);
+
+		dbt_breaker_unlock(dbr);
+		goto exit;
+	}
+
+	if (ht_insert(dbr->dbr_journal, dje))
+	{
+		log_error("dbt_journal_set: ht_insert failed");
+		dbr->dbr_memory -= size;
+		dbt_breaker_unlock(dbr);
+		dbt_journal_entry_delete(dje);
+		return -1;
+	}
+
+	dbt_journal_link(dbr, dje, 0);
+
+	dbt_breaker_unlock(dbr);
+
+exit:
+	if (dbt->dbt_cache.dc_ht)
+	{
+		dbt_cache_del(dbt, record);
+	}
+
+	return 0;
+}
+
+
+/*
+ * Replays the journal before the table is closed. Records that can't be
+ * written are lost.
+ */
+void
+dbt_breaker_clear(dbt_t *dbt)
+{
+	dbt_breaker_t *dbr = &dbt->dbt_breaker;
+	dbt_journal_entry_t *dje;
+
+	if (dbr->dbr_journal == NULL)
+	{
+		return;
+	}
+
+	if (dbr->dbr_head && dbt_breaker_replay(dbt))
+	{
+		log_error("dbt_breaker_clear: %s: %d journaled records lost",
+		    dbt->dbt_name, HT_RECORDS(dbr->dbr_journal));
+	}
+
+	while ((dje = dbr->dbr_head))
+	{
+		dbt_journal_unlink(dbr, dje);
+		dbt_journal_entry_delete(dje);
+	}
+
+	ht_delete(dbr->dbr_journal);
+	dbr->dbr_journal = NULL;
+
+	if (pthread_mutex_destroy(&dbr->dbr_mutex))
+	{
+		log_sys_error("dbt_breaker_clear: pthread_mutex_destroy");
+	}
+
+	return;
+}
+
+
+static char *dbt_breaker_states[] = { "closed", "open", "probe" };
+
+
+void
+dbt_breaker_log(dbt_t *dbt)
+{
+	dbt_breaker_t *dbr = &dbt->dbt_breaker;
+
+	if (dbr->dbr_journal == NULL)
+	{
+		return;
+	}
+
+	if (dbt_breaker_lock(dbr))
+	{
+		return;
+	}
+
+	log_info("dbt_breaker: %s: state=%s trips=%lu journal=%d "
+	    "journaled=%lu dropped=%lu replayed=%lu", dbt->dbt_name,
+	    dbt_breaker_states[dbr->dbr_state], dbr->dbr_trips,
+	    HT_RECORDS(dbr->dbr_journal), dbr->dbr_journaled,
+	    dbr->dbr_dropped, dbr->dbr_replayed);
+
+	dbt_breaker_unlock(dbr);
+
+	return;
+}
+
+
+int
+dbt_breaker_stats(dbt_t *dbt, char **buffer, int *len)
+{
+	dbt_breaker_t *dbr = &dbt->dbt_breaker;
+	int r;
+
+	if (dbr->dbr_journal == NULL || dbt_breaker_lock(dbr))
+	{
+		return 0;
+	}
+
+	r = dbt_stats_printf(buffer, len, "%s: breaker: state=%s trips=%lu "
+	    "failures=%d journal=%d memory=%ld/%ld journaled=%lu dropped=%lu "
+	    "replayed=%lu\n", dbt->dbt_name,
+	    dbt_breaker_states[dbr->dbr_state], dbr->dbr_trips,
+	    dbr->dbr_failures, HT_RECORDS(dbr->dbr_journal), dbr->dbr_memory,
+	    dbr->dbr_memory_max, dbr->dbr_journaled, dbr->dbr_dropped,
+	    dbr->dbr_replayed);
+
+	dbt_breaker_unlock(dbr);
+
+	return r;
+}
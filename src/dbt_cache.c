@@ -0,0 +1,500 @@
+#include <config.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <errno.h>
+
+#include <mopher.h>
+
+/*
+ * Record cache defaults
+ */
+#define DBT_CACHE_BUCKETS 1024
+#define DBT_CACHE_TTL 60
+
+
+static hash_t
+dbt_cache_hash(dbt_cache_entry_t *dce)
+{
+	return HASH(dce->dce_vp->vp_key, dce->dce_vp->vp_klen);
+}
+
+
+static int
+dbt_cache_match(dbt_cache_entry_t *dce1, dbt_cache_entry_t *dce2)
+{
+	if (dce1->dce_vp->vp_klen != dce2->dce_vp->vp_klen)
+	{
+		return 0;
+	}
+
+	if (memcmp(dce1->dce_vp->vp_key, dce2->dce_vp->vp_key,
+	    dce1->dce_vp->vp_klen))
+	{
+		return 0;
+	}
+
+	return 1;
+}
+
+
+static void
+dbt_cache_entry_delete(dbt_cache_entry_t *dce)
+{
+	vp_delete(dce->dce_vp);
+	free(dce);
+
+	return;
+}
+
+
+static void
+dbt_cache_unlink(dbt_cache_t *dc, dbt_cache_entry_t *dce)
+{
+	if (dce->dce_prev)
+	{
+		dce->dce_prev->dce_next = dce->dce_next;
+	}
+	else
+	{
+		dc->dc_head = dce->dce_next;
+	}
+
+	if (dce->dce_next)
+	{
+		dce->dce_next->dce_prev = dce->dce_prev;
+	}
+	else
+	{
+		dc->dc_tail = dce->dce_prev;
+	}
+
+	dce->dce_prev = NULL;
+	dce->dce_next = NULL;
+
+	return;
+}
+
+
+static void
+dbt_cache_link(dbt_cache_t *dc, dbt_cache_entry_t *dce)
+{
+	dce->dce_prev = NULL;
+	dce->dce_next = dc->dc_head;
+
+	if (dc->dc_head)
+	{
+		dc->dc_head->dce_prev = dce;
+	}
+	else
+	{
+		dc->dc_tail = dce;
+	}
+
+	dc->dc_head = dce;
+
+	return;
+}
+
+
+/*
+ * CAVEAT: dbt_cache_remove needs to run in locked context.
+ */
+static void
+dbt_cache_remove(dbt_cache_t *dc, dbt_cache_entry_t *dce)
+{
+	dbt_cache_unlink(dc, dce);
+
+	// ht_remove frees dce through dbt_cache_entry_delete
+	ht_remove(dc->dc_ht, dce);
+
+	return;
+}
+
+
+static int
+dbt_cache_lock(dbt_cache_t *dc)
+{
+	if (pthread_mutex_lock(&dc->dc_mutex))
+	{
+		log_sys_error("dbt_cache_lock: pthread_mutex_lock");
+		return -1;
+	}
+
+	return 0;
+}
+
+
+static void
+dbt_cache_unlock(dbt_cache_t *dc)
+{
+	if (pthread_mutex_unlock(&dc->dc_mutex))
+	{
+		log_sys_error("dbt_cache_unlock: pthread_mutex_unlock");
+	}
+
+	return;
+}
+
+
+int
+dbt_cache_init(dbt_t *dbt)
+{
+	dbt_cache_t *dc = &dbt->dbt_cache;
+
+	if (dc->dc_size <= 0)
+	{
+		return 0;
+	}
+
+	if (dc->dc_ttl <= 0)
+	{
+		dc->dc_ttl = DBT_CACHE_TTL;
+	}
+
+	dc->dc_ht = ht_create(DBT_CACHE_BUCKETS, (ht_hash_t) dbt_cache_hash,
+	    (ht_match_t) dbt_cache_match,
+	    (ht_delete_t) dbt_cache_entry_delete);
+	if (dc->dc_ht == NULL)
+	{
+		log_error("dbt_cache_init: ht_create failed");
+		return -1;
+	}
+
+	if (pthread_mutex_init(&dc->dc_mutex, NULL))
+	{
+		log_error("dbt_cache_init: pthread_mutex_init failed");
+		ht_delete(dc->dc_ht);
+		dc->dc_ht = NULL;
+		return -1;
+	}
+
+	dc->dc_head = NULL;
+	dc->dc_tail = NULL;
+	dc->dc_hits = 0;
+	dc->dc_misses = 0;
+	dc->dc_generation = 0;
+
+	log_debug("dbt_cache_init: %s: cache %d records for %d seconds",
+	    dbt->dbt_name, dc->dc_size, dc->dc_ttl);
+
+	return 0;
+}
+
+
+void
+dbt_cache_clear(dbt_t *dbt)
+{
+	dbt_cache_t *dc = &dbt->dbt_cache;
+
+	if (dc->dc_ht == NULL)
+	{
+		return;
+	}
+
+	ht_delete(dc->dc_ht);
+	dc->dc_ht = NULL;
+	dc->dc_head = NULL;
+	dc->dc_tail = NULL;
+
+	if (pthread_mutex_destroy(&dc->dc_mutex))
+	{
+		log_sys_error("dbt_cache_clear: pthread_mutex_destroy");
+	}
+
+	return;
+}
+
+
+/*
+ * Drop all cached records. Used if the backend deletes records the cache
+ * can't track, e.g. dd_expire.
+ */
+void
+dbt_cache_flush(dbt_t *dbt)
+{
+	dbt_cache_t *dc = &dbt->dbt_cache;
+
+	if (dc->dc_ht == NULL)
+	{
+		return;
+	}
+
+	if (dbt_cache_lock(dc))
+	{
+		return;
+	}
+
+	while (dc->dc_tail)
+	{
+		dbt_cache_remove(dc, dc->dc_tail);
+	}
+
+	++dc->dc_generation;
+
+	dbt_cache_unlock(dc);
+
+	return;
+}
+
+
+void
+dbt_cache_log(dbt_t *dbt)
+{
+	dbt_cache_t *dc = &dbt->dbt_cache;
+
+	if (dc->dc_ht == NULL)
+	{
+		return;
+	}
+
+	if (dbt_cache_lock(dc))
+	{
+		return;
+	}
+
+	log_info("dbt_cache: %s: records=%d hits=%lu misses=%lu",
+	    dbt->dbt_name, HT_RECORDS(dc->dc_ht), dc->dc_hits, dc->dc_misses);
+
+	dbt_cache_unlock(dc);
+
+	return;
+}
+
+
+int
+dbt_cache_stats(dbt_t *dbt, char **buffer, int *len)
+{
+	dbt_cache_t *dc = &dbt->dbt_cache;
+	int r;
+
+	if (dc->dc_ht == NULL || dbt_cache_lock(dc))
+	{
+		return 0;
+	}
+
+	r = dbt_stats_printf(buffer, len, "%s: cache: records=%d hits=%lu "
+	    "misses=%lu load=%.1f%% collisions=%.1f%%\n", dbt->dbt_name,
+	    HT_RECORDS(dc->dc_ht), dc->dc_hits, dc->dc_misses,
+	    HT_LOADFACTOR(dc->dc_ht),
+	    HT_RECORDS(dc->dc_ht) ? HT_COLLFACTOR(dc->dc_ht) : 0);
+
+	dbt_cache_unlock(dc);
+
+	return r;
+}
+
+
+/*
+ * Returns 1 on cache hit, 0 on miss and -1 on error. On a miss generation
+ * is set for dbt_cache_set.
+ */
+int
+dbt_cache_get(dbt_t *dbt, var_t *record, var_t **result,
+    unsigned long *generation)
+{
+	dbt_cache_t *dc = &dbt->dbt_cache;
+	dbt_cache_entry_t lookup, *dce;
+	vp_key_t key;
+	int r = 0;
+
+	if (vp_pack_key(&key, record))
+	{
+		log_error("dbt_cache_get: vp_pack_key failed");
+		return -1;
+	}
+
+	lookup.dce_vp = &key.vk_vp;
+
+	if (dbt_cache_lock(dc))
+	{
+		vp_key_clear(&key);
+		return -1;
+	}
+
+	dce = ht_lookup(dc->dc_ht, &lookup);
+	if (dce && dce->dce_expire < time(NULL))
+	{
+		dbt_cache_remove(dc, dce);
+		dce = NULL;
+	}
+
+	if (dce == NULL)
+	{
+		*generation = dc->dc_generation;
+		++dc->dc_misses;
+		goto exit;
+	}
+
+	*result = vp_unpack(dce->dce_vp, dbt->dbt_scheme);
+	if (*result == NULL)
+	{
+		log_error("dbt_cache_get: vp_unpack failed");
+		r = -1;
+		goto exit;
+	}
+
+	// Most recently used records are kept at the head
+	dbt_cache_unlink(dc, dce);
+	dbt_cache_link(dc, dce);
+
+	++dc->dc_hits;
+	r = 1;
+
+exit:
+	dbt_cache_unlock(dc);
+	vp_key_clear(&key);
+
+	return r;
+}
+
+
+/*
+ * Store a record fetched from the backend. The cache key is taken from the
+ * lookup record to make sure dbt_cache_del invalidates the same key.
+ *
+ * If the cache was invalidated since the lookup missed (generation changed),
+ * the record might be stale and is not stored.
+ */
+void
+dbt_cache_set(dbt_t *dbt, var_t *lookup, var_t *record,
+    unsigned long generation)
+{
+	dbt_cache_t *dc = &dbt->dbt_cache;
+	dbt_cache_entry_t *dce, *old;
+	vp_t *key = NULL, *vp = NULL;
+
+	key = vp_pack(lookup);
+	if (key == NULL)
+	{
+		log_error("dbt_cache_set: vp_pack failed");
+		goto error;
+	}
+
+	vp = vp_pack(record);
+	if (vp == NULL)
+	{
+		log_error("dbt_cache_set: vp_pack failed");
+		goto error;
+	}
+
+	free(vp->vp_key);
+	vp->vp_key = key->vp_key;
+	vp->vp_klen = key->vp_klen;
+	key->vp_key = NULL;
+
+	dce = (dbt_cache_entry_t *) malloc(sizeof (dbt_cache_entry_t));
+	if (dce == NULL)
+	{
+		log_sys_error("dbt_cache_set: malloc");
+		goto error;
+	}
+
+	dce->dce_vp = vp;
+	dce->dce_expire = time(NULL) + dc->dc_ttl;
+	dce->dce_prev = NULL;
+	dce->dce_next = NULL;
+
+	vp = NULL;
+
+	if (dbt_cache_lock(dc))
+	{
+		dbt_cache_entry_delete(dce);
+		goto error;
+	}
+
+	if (generation != dc->dc_generation)
+	{
+		dbt_cache_unlock(dc);
+		dbt_cache_entry_delete(dce);
+		goto error;
+	}
+
+	old = ht_lookup(dc->dc_ht, dce);
+	if (old)
+	{
+		dbt_cache_remove(dc, old);
+	}
+
+	if (ht_insert(dc->dc_ht, dce))
+	{
+		log_error("dbt_cache_set: ht_insert failed");
+		dbt_cache_unlock(dc);
+		dbt_cache_entry_delete(dce);
+		goto error;
+	}
+
+	dbt_cache_link(dc, dce);
+
+	// Evict least recently used records
+	while (HT_RECORDS(dc->dc_ht) > dc->dc_size)
+	{
+		dbt_cache_remove(dc, dc->dc_tail);
+	}
+
+	dbt_cache_unlock(dc);
+
+error:
+	if (key)
+	{
+		vp_delete(key);
+	}
+
+	if (vp)
+	{
+		vp_delete(vp);
+	}
+
+	return;
+}
+
+
+void
+dbt_cache_del_key(dbt_t *dbt, vp_t *key)
+{
+	dbt_cache_t *dc = &dbt->dbt_cache;
+	dbt_cache_entry_t lookup, *dce;
+
+	lookup.dce_vp = key;
+
+	if (dbt_cache_lock(dc))
+	{
+		return;
+	}
+
+	dce = ht_lookup(dc->dc_ht, &lookup);
+	if (dce)
+	{
+		dbt_cache_remove(dc, dce);
+	}
+
+	++dc->dc_generation;
+
+	dbt_cache_unlock(dc);
+
+	return;
+}
+
+
+void
+dbt_cache_del(dbt_t *dbt, var_t *record)
+{
+	vp_key_t key;
+
+	if (vp_pack_key(&key, record))
+	{
+		/*
+		 * Can't locate the cached record. Flush the cache to make sure
+		 * no stale record survives.
+		 */
+		log_error("dbt_cache_del: vp_pack_key failed");
+		dbt_cache_flush(dbt);
+		return;
+	}
+
+	dbt_cache_del_key(dbt, &key.vk_vp);
+	vp_key_clear(&key);
+
+	return;
+}
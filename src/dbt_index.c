@@ -0,0 +1,526 @@
+#include <config.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <errno.h>
+
+#include <mopher.h>
+
+/*
+ * Expiry index
+ *
+ * Drivers without dd_expire are cleaned up by walking the whole table.
+ * For tables using dbt_common_validate the index keeps the keys of all
+ * records in a min-heap ordered by expiry. The janitor visits expired
+ * records only.
+ */
+#define DBT_INDEX_BUCKETS 4096
+
+
+static hash_t
+dbt_index_hash(dbt_index_node_t *din)
+{
+	return HASH(din->din_key, din->din_klen);
+}
+
+
+static int
+dbt_index_match(dbt_index_node_t *din1, dbt_index_node_t *din2)
+{
+	if (din1->din_klen != din2->din_klen)
+	{
+		return 0;
+	}
+
+	if (memcmp(din1->din_key, din2->din_key, din1->din_klen))
+	{
+		return 0;
+	}
+
+	return 1;
+}
+
+
+void
+dbt_index_node_delete(dbt_index_node_t *din)
+{
+	free(din->din_key);
+	free(din);
+
+	return;
+}
+
+
+static void
+dbt_index_swap(dbt_index_t *di, int a, int b)
+{
+	dbt_index_node_t *din;
+
+	din = di->di_heap[a];
+	di->di_heap[a] = di->di_heap[b];
+	di->di_heap[b] = din;
+
+	di->di_heap[a]->din_pos = a;
+	di->di_heap[b]->din_pos = b;
+
+	return;
+}
+
+
+static void
+dbt_index_up(dbt_index_t *di, int pos)
+{
+	int parent;
+
+	while (pos > 0)
+	{
+		parent = (pos - 1) / 2;
+		if (di->di_heap[parent]->din_expire <= di->di_heap[pos]->din_expire)
+		{
+			break;
+		}
+
+		dbt_index_swap(di, parent, pos);
+		pos = parent;
+	}
+
+	return;
+}
+
+
+static void
+dbt_index_down(dbt_index_t *di, int pos)
+{
+	int child;
+
+	for (;;)
+	{
+		child = pos * 2 + 1;
+		if (child >= di->di_size)
+		{
+			break;
+		}
+
+		if (child + 1 < di->di_size && di->di_heap[child + 1]->din_expire <
+		    di->di_heap[child]->din_expire)
+		{
+			++child;
+		}
+
+		if (di->di_heap[pos]->din_expire <= di->di_heap[child]->din_expire)
+		{
+			break;
+		}
+
+		dbt_index_swap(di, pos, child);
+		pos = child;
+	}
+
+	return;
+}
+
+
+/*
+ * CAVEAT: dbt_index_unlink needs to run in locked context. The node is
+ * removed from heap and hash table but not freed.
+ */
+static void
+dbt_index_unlink(dbt_index_t *di, dbt_index_node_t *din)
+{
+	int pos = din->din_pos;
+
+	--di->di_size;
+
+	if (pos != di->di_size)
+	{
+		dbt_index_swap(di, pos, di->di_size);
+		dbt_index_up(di, pos);
+		dbt_index_down(di, pos);
+	}
+
+	ht_remove(di->di_ht, din);
+
+	return;
+}
+
+
+static int
+dbt_index_lock(dbt_index_t *di)
+{
+	if (pthread_mutex_lock(&di->di_mutex))
+	{
+		log_sys_error("dbt_index_lock: pthread_mutex_lock");
+		return -1;
+	}
+
+	return 0;
+}
+
+
+static void
+dbt_index_unlock(dbt_index_t *di)
+{
+	if (pthread_mutex_unlock(&di->di_mutex))
+	{
+		log_sys_error("dbt_index_unlock: pthread_mutex_unlock");
+	}
+
+	return;
+}
+
+
+/*
+ * Adds din to the heap. din is deleted on error. CAVEAT: Needs to run in
+ * locked context.
+ */
+static int
+dbt_index_insert(dbt_index_t *di, dbt_index_node_t *din)
+{
+	dbt_index_node_t **heap;
+
+	if (di->di_size == di->di_alloc)
+	{
+		heap = (dbt_index_node_t **) realloc(di->di_heap,
+		    di->di_alloc * 2 * sizeof (dbt_index_node_t *));
+		if (heap == NULL)
+		{
+			log_sys_error("dbt_index_insert: realloc");
+			dbt_index_node_delete(din);
+			return -1;
+		}
+
+		di->di_heap = heap;
+		di->di_alloc *= 2;
+	}
+
+	if (ht_insert(di->di_ht, din))
+	{
+		log_error("dbt_index_insert: ht_insert failed");
+		dbt_index_node_delete(din);
+		return -1;
+	}
+
+	din->din_pos = di->di_size++;
+	di->di_heap[din->din_pos] = din;
+	dbt_index_up(di, din->din_pos);
+
+	return 0;
+}
+
+
+int
+dbt_index_set(dbt_t *dbt, var_t *record)
+{
+	dbt_index_t *di = &dbt->dbt_index;
+	dbt_index_node_t *din, *old;
+	VAR_INT_T *expire;
+	vp_t *vp;
+	int r;
+
+	expire = vlist_record_get(record, dbt->dbt_expire_field);
+	if (expire == NULL)
+	{
+		log_error("dbt_index_set: %s: record has no %s",
+		    dbt->dbt_name, dbt->dbt_expire_field);
+		return -1;
+	}
+
+	vp = vp_pack(record);
+	if (vp == NULL)
+	{
+		log_error("dbt_index_set: vp_pack failed");
+		return -1;
+	}
+
+	din = (dbt_index_node_t *) malloc(sizeof (dbt_index_node_t));
+	if (din == NULL)
+	{
+		log_sys_error("dbt_index_set: malloc");
+		vp_delete(vp);
+		return -1;
+	}
+
+	// Only the key is kept
+	din->din_key = vp->vp_key;
+	din->din_klen = vp->vp_klen;
+	din->din_expire = *expire;
+	vp->vp_key = NULL;
+	vp_delete(vp);
+
+	if (dbt_index_lock(di))
+	{
+		dbt_index_node_delete(din);
+		return -1;
+	}
+
+	old = ht_lookup(di->di_ht, din);
+	if (old)
+	{
+		old->din_expire = din->din_expire;
+		dbt_index_up(di, old->din_pos);
+		dbt_index_down(di, old->din_pos);
+		dbt_index_unlock(di);
+		dbt_index_node_delete(din);
+		return 0;
+	}
+
+	r = dbt_index_insert(di, din);
+
+	dbt_index_unlock(di);
+
+	return r;
+}
+
+
+/*
+ * Puts a node returned by dbt_index_pop back into the index. The record
+ * is expired again after expire. If the record was indexed meanwhile the
+ * newer node is kept. din is consumed.
+ */
+int
+dbt_index_retry(dbt_t *dbt, dbt_index_node_t *din, VAR_INT_T expire)
+{
+	dbt_index_t *di = &dbt->dbt_index;
+	int r = 0;
+
+	din->din_expire = expire;
+
+	if (dbt_index_lock(di))
+	{
+		dbt_index_node_delete(din);
+		return -1;
+	}
+
+	if (ht_lookup(di->di_ht, din))
+	{
+		dbt_index_node_delete(din);
+	}
+	else
+	{
+		r = dbt_index_insert(di, din);
+	}
+
+	dbt_index_unlock(di);
+
+	return r;
+}
+
+
+void
+dbt_index_del(dbt_t *dbt, var_t *record)
+{
+	dbt_index_t *di = &dbt->dbt_index;
+	dbt_index_node_t lookup, *din;
+	vp_key_t key;
+
+	if (vp_pack_key(&key, record))
+	{
+		// The janitor skips records that no longer exist
+		log_error("dbt_index_del: vp_pack_key failed");
+		return;
+	}
+
+	lookup.din_key = key.vk_vp.vp_key;
+	lookup.din_klen = key.vk_vp.vp_klen;
+
+	if (dbt_index_lock(di) == 0)
+	{
+		din = ht_lookup(di->di_ht, &lookup);
+		if (din)
+		{
+			dbt_index_unlink(di, din);
+			dbt_index_node_delete(din);
+		}
+
+		dbt_index_unlock(di);
+	}
+
+	vp_key_clear(&key);
+
+	return;
+}
+
+
+/*
+ * Removes up to size nodes that expired before now from the index.
+ * Returns the number of nodes stored in batch.
+ */
+int
+dbt_index_pop(dbt_t *dbt, VAR_INT_T now, dbt_index_node_t **batch, int size)
+{
+	dbt_index_t *di = &dbt->dbt_index;
+	dbt_index_node_t *din;
+	int n = 0;
+
+	if (dbt_index_lock(di))
+	{
+		return 0;
+	}
+
+	while (n < size && di->di_size && di->di_heap[0]->din_expire < now)
+	{
+		din = di->di_heap[0];
+		dbt_index_unlink(di, din);
+		batch[n++] = din;
+	}
+
+	dbt_index_unlock(di);
+
+	return n;
+}
+
+
+/*
+ * Creates a lookup record from an index node. Non key fields are NULL.
+ */
+var_t *
+dbt_index_lookup(dbt_t *dbt, dbt_index_node_t *din)
+{
+	vp_t vp;
+
+	vp_init(&vp, din->din_key, din->din_klen, &dbt->dbt_index.di_nulls,
+	    sizeof (vp_null_t));
+
+	return vp_unpack(&vp, dbt->dbt_scheme);
+}
+
+
+static int
+dbt_index_walk(dbt_t *dbt, var_t *record)
+{
+	return dbt_index_set(dbt, record);
+}
+
+
+int
+dbt_index_init(dbt_t *dbt)
+{
+	dbt_index_t *di = &dbt->dbt_index;
+	dbt_driver_t *dd = dbt->dbt_driver;
+	ll_t *ll;
+	ll_entry_t *pos;
+	var_t *v;
+	int n;
+
+	if (dd->dd_expire || dd->dd_walk == NULL ||
+	    dbt->dbt_validate != dbt_common_validate)
+	{
+		return 0;
+	}
+
+	di->di_ht = ht_create(DBT_INDEX_BUCKETS, (ht_hash_t) dbt_index_hash,
+	    (ht_match_t) dbt_index_match, NULL);
+	if (di->di_ht == NULL)
+	{
+		log_error("dbt_index_init: ht_create failed");
+		return -1;
+	}
+
+	di->di_alloc = DBT_INDEX_BUCKETS;
+	di->di_size = 0;
+	di->di_heap = (dbt_index_node_t **) malloc(di->di_alloc *
+	    sizeof (dbt_index_node_t *));
+	if (di->di_heap == NULL)
+	{
+		log_sys_error("dbt_index_init: malloc");
+		goto error;
+	}
+
+	if (pthread_mutex_init(&di->di_mutex, NULL))
+	{
+		log_error("dbt_index_init: pthread_mutex_init failed");
+		goto error;
+	}
+
+	// Null mask for lookup records created by dbt_index_lookup
+	di->di_nulls = 0;
+	ll = dbt->dbt_scheme->v_data;
+	pos = LL_START(ll);
+	for (n = 0; (v = ll_next(ll, &pos)); ++n)
+	{
+		if ((v->v_flags & VF_KEY) == 0)
+		{
+			di->di_nulls |= (vp_null_t) 1 << n;
+		}
+	}
+
+	// Index records already stored, e.g. in bdb
+	if (dd->dd_walk(dbt, (dbt_db_callback_t) dbt_index_walk))
+	{
+		log_error("dbt_index_init: %s: dd_walk failed", dbt->dbt_name);
+		pthread_mutex_destroy(&di->di_mutex);
+		goto error;
+	}
+
+	log_debug("dbt_index_init: %s: %d records indexed", dbt->dbt_name,
+	    di->di_size);
+
+	return 0;
+
+error:
+	if (di->di_heap)
+	{
+		free(di->di_heap);
+		di->di_heap = NULL;
+	}
+
+	ht_delete(di->di_ht);
+	di->di_ht = NULL;
+
+	return -1;
+}
+
+
+void
+dbt_index_clear(dbt_t *dbt)
+{
+	dbt_index_t *di = &dbt->dbt_index;
+	int i;
+
+	if (di->di_ht == NULL)
+	{
+		return;
+	}
+
+	ht_delete(di->di_ht);
+	di->di_ht = NULL;
+
+	// Nodes are owned by the heap
+	for (i = 0; i < di->di_size; ++i)
+	{
+		dbt_index_node_delete(di->di_heap[i]);
+	}
+
+	free(di->di_heap);
+	di->di_heap = NULL;
+	di->di_size = 0;
+	di->di_alloc = 0;
+
+	if (pthread_mutex_destroy(&di->di_mutex))
+	{
+		log_sys_error("dbt_index_clear: pthread_mutex_destroy");
+	}
+
+	return;
+}
+
+
+int
+dbt_index_stats(dbt_t *dbt, char **buffer, int *len)
+{
+	dbt_index_t *di = &dbt->dbt_index;
+	int r;
+
+	if (di->di_ht == NULL || dbt_index_lock(di))
+	{
+		return 0;
+	}
+
+	r = dbt_stats_printf(buffer, len, "%s: index: records=%d\n",
+	    dbt->dbt_name, di->di_size);
+
+	dbt_index_unlock(di);
+
+	return r;
+}
@@ -0,0 +1,399 @@
+#include <config.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <errno.h>
+
+#include <mopher.h>
+
+
+/*
+ * Connections only carry what drivers read. Locks, cache, queue, breaker
+ * and statistics belong to the table and are not copied: pthread objects
+ * can't be copied and other threads update them concurrently. Configured
+ * fields don't change after dbt_configure.
+ */
+static dbt_t *
+dbt_pool_open(dbt_t *dbt)
+{
+	dbt_t *conn;
+
+	conn = (dbt_t *) calloc(1, sizeof (dbt_t));
+	if (conn == NULL)
+	{
+		log_sys_error("dbt_pool_open: calloc");
+		return NULL;
+	}
+
+	conn->dbt_name = dbt->dbt_name;
+	conn->dbt_path = dbt->dbt_path;
+	conn->dbt_host = dbt->dbt_host;
+	conn->dbt_port = dbt->dbt_port;
+	conn->dbt_user = dbt->dbt_user;
+	conn->dbt_pass = dbt->dbt_pass;
+	conn->dbt_database = dbt->dbt_database;
+	conn->dbt_scheme = dbt->dbt_scheme;
+	conn->dbt_expire_batch = dbt->dbt_expire_batch;
+	conn->dbt_expire_rate = dbt->dbt_expire_rate;
+	conn->dbt_validate = dbt->dbt_validate;
+	strcpy(conn->dbt_expire_field, dbt->dbt_expire_field);
+	conn->dbt_drivername = dbt->dbt_drivername;
+	conn->dbt_driver = dbt->dbt_driver;
+
+	if (conn->dbt_driver->dd_open(conn))
+	{
+		log_error("dbt_pool_open: %s: dd_open failed", dbt->dbt_name);
+		free(conn);
+		return NULL;
+	}
+
+	return conn;
+}
+
+
+/*
+ * Connection pool. Drivers flagged DBT_POOL may open several connections
+ * per table. Every connection is an exclusive copy of the table (dbt_t)
+ * holding its own dbt_handle. Walks and expiry stay on the primary
+ * connection opened by dbt_open_database.
+ */
+int
+dbt_pool_init(dbt_t *dbt)
+{
+	dbt_pool_t *dp = &dbt->dbt_pool;
+	dbt_t *conn;
+	int i;
+
+	if (dp->dp_size <= 0)
+	{
+		return 0;
+	}
+
+	if ((dbt->dbt_driver->dd_flags & DBT_POOL) == 0)
+	{
+		log_warning("dbt_pool_init: %s: driver \"%s\" doesn't support "
+		    "connection pooling", dbt->dbt_name,
+		    dbt->dbt_driver->dd_name);
+		dp->dp_size = 0;
+		return 0;
+	}
+
+	dp->dp_conns = (dbt_t **) malloc(dp->dp_size * sizeof (dbt_t *));
+	if (dp->dp_conns == NULL)
+	{
+		log_sys_error("dbt_pool_init: malloc");
+		return -1;
+	}
+
+	dp->dp_free = 0;
+	dp->dp_lost = 0;
+	dp->dp_in_use_max = 0;
+	dp->dp_checkouts = 0;
+	dp->dp_waits = 0;
+	dp->dp_wait_usec = 0;
+
+	for (i = 0; i < dp->dp_size; ++i)
+	{
+		conn = dbt_pool_open(dbt);
+		if (conn == NULL)
+		{
+			log_error("dbt_pool_init: %s: can't open connection %d",
+			    dbt->dbt_name, i);
+			goto error;
+		}
+
+		dp->dp_conns[dp->dp_free++] = conn;
+	}
+
+	if (pthread_mutex_init(&dp->dp_mutex, NULL))
+	{
+		log_error("dbt_pool_init: pthread_mutex_init failed");
+		goto error;
+	}
+
+	if (pthread_cond_init(&dp->dp_cond, NULL))
+	{
+		log_error("dbt_pool_init: pthread_cond_init failed");
+		pthread_mutex_destroy(&dp->dp_mutex);
+		goto error;
+	}
+
+	log_debug("dbt_pool_init: %s: %d connections", dbt->dbt_name,
+	    dp->dp_size);
+
+	return 0;
+
+error:
+	while (dp->dp_free)
+	{
+		conn = dp->dp_conns[--dp->dp_free];
+		dbt_db_close(conn);
+		free(conn);
+	}
+
+	free(dp->dp_conns);
+	dp->dp_conns = NULL;
+
+	return -1;
+}
+
+
+void
+dbt_pool_clear(dbt_t *dbt)
+{
+	dbt_pool_t *dp = &dbt->dbt_pool;
+	dbt_t *conn;
+
+	if (dp->dp_conns == NULL)
+	{
+		return;
+	}
+
+	if (dp->dp_free + dp->dp_lost != dp->dp_size)
+	{
+		log_error("dbt_pool_clear: %s: %d connections still in use",
+		    dbt->dbt_name, dp->dp_size - dp->dp_free - dp->dp_lost);
+	}
+
+	while (dp->dp_free)
+	{
+		conn = dp->dp_conns[--dp->dp_free];
+		dbt_db_close(conn);
+		free(conn);
+	}
+
+	free(dp->dp_conns);
+	dp->dp_conns = NULL;
+
+	if (pthread_cond_destroy(&dp->dp_cond))
+	{
+		log_sys_error("dbt_pool_clear: pthread_cond_destroy");
+	}
+
+	if (pthread_mutex_destroy(&dp->dp_mutex))
+	{
+		log_sys_error("dbt_pool_clear: pthread_mutex_destroy");
+	}
+
+	return;
+}
+
+
+/*
+ * Replaces a connection claimed from dp_lost. The claim is returned if
+ * the connection can't be opened.
+ */
+static dbt_t *
+dbt_pool_reopen(dbt_t *dbt)
+{
+	dbt_pool_t *dp = &dbt->dbt_pool;
+	dbt_t *conn;
+
+	conn = dbt_pool_open(dbt);
+	if (conn == NULL)
+	{
+		log_error("dbt_pool_reopen: %s: can't reopen connection",
+		    dbt->dbt_name);
+		__sync_fetch_and_add(&dp->dp_lost, 1);
+		return NULL;
+	}
+
+	log_info("dbt_pool_reopen: %s: connection reopened", dbt->dbt_name);
+
+	return conn;
+}
+
+
+/*
+ * Returns a connection for exclusive use. Tables without a pool are locked
+ * and returned as is. Connections lost by dbt_pool_checkin are reopened.
+ * Returns NULL on error or if no connection is checked in within
+ * DBT_POOL_TIMEOUT seconds.
+ */
+dbt_t *
+dbt_pool_checkout(dbt_t *dbt)
+{
+	dbt_pool_t *dp = &dbt->dbt_pool;
+	struct timespec start, stop, timeout;
+	dbt_t *conn;
+	int in_use, lost, r;
+
+	if (dp->dp_conns == NULL)
+	{
+		return dbt_lock(dbt) ? NULL : dbt;
+	}
+
+	if (pthread_mutex_lock(&dp->dp_mutex))
+	{
+		log_sys_error("dbt_pool_checkout: pthread_mutex_lock");
+		return NULL;
+	}
+
+	if (dp->dp_free == 0)
+	{
+		++dp->dp_waits;
+		util_now(&start);
+
+		timeout.tv_sec = start.tv_sec + DBT_POOL_TIMEOUT;
+		timeout.tv_nsec = start.tv_nsec;
+
+		while (dp->dp_free == 0)
+		{
+			/*
+			 * Claim a lost connection and reopen it unlocked.
+			 */
+			lost = dp->dp_lost;
+			if (lost && __sync_bool_compare_and_swap(&dp->dp_lost,
+			    lost, lost - 1))
+			{
+				++dp->dp_checkouts;
+				pthread_mutex_unlock(&dp->dp_mutex);
+				return dbt_pool_reopen(dbt);
+			}
+
+			r = pthread_cond_timedwait(&dp->dp_cond, &dp->dp_mutex,
+			    &timeout);
+			if (r == 0 || (r == ETIMEDOUT && dp->dp_lost))
+			{
+				continue;
+			}
+
+			if (r == ETIMEDOUT)
+			{
+				log_error("dbt_pool_checkout: %s: no connection "
+				    "available after %d seconds",
+				    dbt->dbt_name, DBT_POOL_TIMEOUT);
+			}
+			else
+			{
+				log_error("dbt_pool_checkout: "
+				    "pthread_cond_timedwait: %s", strerror(r));
+			}
+
+			pthread_mutex_unlock(&dp->dp_mutex);
+			return NULL;
+		}
+
+		util_now(&stop);
+		dp->dp_wait_usec += (stop.tv_sec - start.tv_sec) * 1000000 +
+		    (stop.tv_nsec - start.tv_nsec) / 1000;
+	}
+
+	conn = dp->dp_conns[--dp->dp_free];
+
+	++dp->dp_checkouts;
+	in_use = dp->dp_size - dp->dp_free - dp->dp_lost;
+	if (in_use > dp->dp_in_use_max)
+	{
+		dp->dp_in_use_max = in_use;
+	}
+
+	if (pthread_mutex_unlock(&dp->dp_mutex))
+	{
+		log_sys_error("dbt_pool_checkout: pthread_mutex_unlock");
+	}
+
+	return conn;
+}
+
+
+void
+dbt_pool_checkin(dbt_t *dbt, dbt_t *conn)
+{
+	dbt_pool_t *dp = &dbt->dbt_pool;
+
+	if (dp->dp_conns == NULL)
+	{
+		dbt_unlock(dbt);
+		return;
+	}
+
+	/*
+	 * The connection can't be returned. Close it instead of leaking it.
+	 * dp_lost is updated without the lock. The next checkout finding no
+	 * free connection opens a new one.
+	 */
+	if (pthread_mutex_lock(&dp->dp_mutex))
+	{
+		log_sys_error("dbt_pool_checkin: pthread_mutex_lock");
+		log_error("dbt_pool_checkin: %s: closing connection",
+		    dbt->dbt_name);
+		dbt_db_close(conn);
+		free(conn);
+		__sync_fetch_and_add(&dp->dp_lost, 1);
+		pthread_cond_signal(&dp->dp_cond);
+		return;
+	}
+
+	dp->dp_conns[dp->dp_free++] = conn;
+
+	if (pthread_cond_signal(&dp->dp_cond))
+	{
+		log_sys_error("dbt_pool_checkin: pthread_cond_signal");
+	}
+
+	if (pthread_mutex_unlock(&dp->dp_mutex))
+	{
+		log_sys_error("dbt_pool_checkin: pthread_mutex_unlock");
+	}
+
+	return;
+}
+
+
+void
+dbt_pool_log(dbt_t *dbt)
+{
+	dbt_pool_t *dp = &dbt->dbt_pool;
+
+	if (dp->dp_conns == NULL)
+	{
+		return;
+	}
+
+	if (pthread_mutex_lock(&dp->dp_mutex))
+	{
+		log_sys_error("dbt_pool_log: pthread_mutex_lock");
+		return;
+	}
+
+	log_info("dbt_pool: %s: size=%d in_use=%d lost=%d max_in_use=%d "
+	    "checkouts=%lu waits=%lu wait_avg=%luus", dbt->dbt_name,
+	    dp->dp_size, dp->dp_size - dp->dp_free - dp->dp_lost, dp->dp_lost,
+	    dp->dp_in_use_max, dp->dp_checkouts, dp->dp_waits,
+	    dp->dp_waits ? dp->dp_wait_usec / dp->dp_waits : 0);
+
+	// Utilization is reported per janitor cycle
+	dp->dp_in_use_max = dp->dp_size - dp->dp_free - dp->dp_lost;
+
+	if (pthread_mutex_unlock(&dp->dp_mutex))
+	{
+		log_sys_error("dbt_pool_log: pthread_mutex_unlock");
+	}
+
+	return;
+}
+
+
+int
+dbt_pool_stats(dbt_t *dbt, char **buffer, int *len)
+{
+	dbt_pool_t *dp = &dbt->dbt_pool;
+	int r;
+
+	if (dp->dp_conns == NULL || pthread_mutex_lock(&dp->dp_mutex))
+	{
+		return 0;
+	}
+
+	r = dbt_stats_printf(buffer, len, "%s: pool: size=%d in_use=%d "
+	    "lost=%d max_in_use=%d checkouts=%lu waits=%lu wait_avg=%luus\n",
+	    dbt->dbt_name, dp->dp_size, dp->dp_size - dp->dp_free -
+	    dp->dp_lost, dp->dp_lost, dp->dp_in_use_max, dp->dp_checkouts,
+	    dp->dp_waits, dp->dp_waits ? dp->dp_wait_usec / dp->dp_waits : 0);
+
+	pthread_mutex_unlock(&dp->dp_mutex);
+
+	return r;
+}
@@ -0,0 +1,985 @@
+#include <config.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <errno.h>
+
+#include <mopher.h>
+
+/*
+ * Write-behind queue defaults
+ */
+#define DBT_QUEUE_BUCKETS 1024
+#define DBT_QUEUE_BATCH 100
+#define DBT_QUEUE_LATENCY 1000
+
+/*
+ * Attempts to write a record before it is dropped
+ */
+#define DBT_QUEUE_RETRIES 3
+
+
+static hash_t
+dbt_queue_hash(dbt_queue_entry_t *dqe)
+{
+	return HASH(dqe->dqe_vp->vp_key, dqe->dqe_vp->vp_klen);
+}
+
+
+static int
+dbt_queue_match(dbt_queue_entry_t *dqe1, dbt_queue_entry_t *dqe2)
+{
+	if (dqe1->dqe_vp->vp_klen != dqe2->dqe_vp->vp_klen)
+	{
+		return 0;
+	}
+
+	if (memcmp(dqe1->dqe_vp->vp_key, dqe2->dqe_vp->vp_key,
+	    dqe1->dqe_vp->vp_klen))
+	{
+		return 0;
+	}
+
+	return 1;
+}
+
+
+static void
+dbt_queue_entry_delete(dbt_queue_entry_t *dqe)
+{
+	vp_delete(dqe->dqe_vp);
+	free(dqe);
+
+	return;
+}
+
+
+static void
+dbt_queue_unlink(dbt_queue_t *dq, dbt_queue_entry_t *dqe)
+{
+	if (dqe->dqe_prev)
+	{
+		dqe->dqe_prev->dqe_next = dqe->dqe_next;
+	}
+	else
+	{
+		dq->dq_head = dqe->dqe_next;
+	}
+
+	if (dqe->dqe_next)
+	{
+		dqe->dqe_next->dqe_prev = dqe->dqe_prev;
+	}
+	else
+	{
+		dq->dq_tail = dqe->dqe_prev;
+	}
+
+	dqe->dqe_prev = NULL;
+	dqe->dqe_next = NULL;
+
+	return;
+}
+
+
+/*
+ * Pending records are flushed oldest first. New records go to the tail.
+ */
+static void
+dbt_queue_append(dbt_queue_t *dq, dbt_queue_entry_t *dqe)
+{
+	dqe->dqe_next = NULL;
+	dqe->dqe_prev = dq->dq_tail;
+
+	if (dq->dq_tail)
+	{
+		dq->dq_tail->dqe_next = dqe;
+	}
+	else
+	{
+		dq->dq_head = dqe;
+	}
+
+	dq->dq_tail = dqe;
+
+	return;
+}
+
+
+static int
+dbt_queue_lock(dbt_queue_t *dq)
+{
+	if (pthread_mutex_lock(&dq->dq_mutex))
+	{
+		log_sys_error("dbt_queue_lock: pthread_mutex_lock");
+		return -1;
+	}
+
+	return 0;
+}
+
+
+static void
+dbt_queue_unlock(dbt_queue_t *dq)
+{
+	if (pthread_mutex_unlock(&dq->dq_mutex))
+	{
+		log_sys_error("dbt_queue_unlock: pthread_mutex_unlock");
+	}
+
+	return;
+}
+
+
+static void
+dbt_queue_log_record(dbt_t *dbt, var_t *record, char *message)
+{
+	char buffer[1024];
+
+	if (var_dump_data(record, buffer, sizeof buffer) == -1)
+	{
+		strcpy(buffer, "(unprintable)");
+	}
+
+	log_error("dbt_queue: %s: %s: %s", dbt->dbt_name, message, buffer);
+
+	return;
+}
+
+
+/*
+ * Writes each record of batch to conn. Failed entries are flagged with
+ * dqe_failed.
+ */
+static int
+dbt_queue_write_records(dbt_t *dbt, dbt_t *conn, dbt_queue_entry_t **batch,
+    int n)
+{
+	var_t *record;
+	int failed = 0;
+	int i;
+
+	for (i = 0; i < n; ++i)
+	{
+		batch[i]->dqe_failed = 1;
+
+		record = vp_unpack(batch[i]->dqe_vp, dbt->dbt_scheme);
+		if (record == NULL)
+		{
+			log_error("dbt_queue_write_records: vp_unpack failed");
+			++failed;
+			continue;
+		}
+
+		if (dbt->dbt_driver->dd_set(conn, record))
+		{
+			dbt_queue_log_record(dbt, record, "dd_set failed");
+			++failed;
+		}
+		else
+		{
+			batch[i]->dqe_failed = 0;
+
+			if (dbt->dbt_index.di_ht)
+			{
+				dbt_index_set(dbt, record);
+			}
+		}
+
+		var_delete(record);
+	}
+
+	return failed;
+}
+
+
+/*
+ * Journals the records of batch while the circuit breaker is open. Records
+ * not journaled because the breaker was closed meanwhile are moved to the
+ * front of batch. Returns their number. Failed entries are flagged with
+ * dqe_failed and counted in failed.
+ */
+static int
+dbt_queue_journal(dbt_t *dbt, dbt_queue_entry_t **batch, int n, int *failed)
+{
+	dbt_queue_entry_t *dqe;
+	var_t *record;
+	int m = 0;
+	int i, r;
+
+	for (i = 0; i < n; ++i)
+	{
+		batch[i]->dqe_failed = 1;
+
+		record = vp_unpack(batch[i]->dqe_vp, dbt->dbt_scheme);
+		if (record == NULL)
+		{
+			log_error("dbt_queue_journal: vp_unpack failed");
+			++*failed;
+			continue;
+		}
+
+		r = dbt_journal_set(dbt, record, 0);
+		if (r == -1)
+		{
+			dbt_queue_log_record(dbt, record,
+			    "dbt_journal_set failed");
+			++*failed;
+		}
+		else
+		{
+			batch[i]->dqe_failed = 0;
+		}
+
+		var_delete(record);
+
+		// Closed meanwhile. Swap to keep every entry in batch.
+		if (r == 1)
+		{
+			dqe = batch[m];
+			batch[m++] = batch[i];
+			batch[i] = dqe;
+		}
+	}
+
+	return m;
+}
+
+
+/*
+ * Write a batch of records. Uses a single transaction if the driver
+ * supports it. If the transaction fails the records are written one by
+ * one. Records are journaled while the circuit breaker is open. Returns
+ * the number of records that could not be written.
+ */
+static int
+dbt_queue_write(dbt_t *dbt, dbt_queue_entry_t **batch, int n)
+{
+	dbt_driver_t *dd = dbt->dbt_driver;
+	struct timespec start;
+	dbt_t *conn;
+	int breaker, failed, journal_failed = 0, i;
+
+	dbt_stats_now(&start);
+
+	breaker = dbt_breaker_check(dbt);
+	if (breaker == DBT_BREAKER_OPEN)
+	{
+		n = dbt_queue_journal(dbt, batch, n, &journal_failed);
+		if (n == 0)
+		{
+			return journal_failed;
+		}
+
+		breaker = DBT_BREAKER_CLOSED;
+	}
+
+	conn = dbt_pool_checkout(dbt);
+	if (conn == NULL)
+	{
+		log_error("dbt_queue_write: %s: dbt_pool_checkout failed",
+		    dbt->dbt_name);
+		dbt_breaker_update(dbt, breaker, -1, &start);
+
+		for (i = 0; i < n; ++i)
+		{
+			batch[i]->dqe_failed = 1;
+		}
+
+		return n + journal_failed;
+	}
+
+	if (n > 1 && dd->dd_begin && dd->dd_begin(conn) == 0)
+	{
+		failed = dbt_queue_write_records(dbt, conn, batch, n);
+		if (failed == 0 && dd->dd_commit(conn) == 0)
+		{
+			goto exit;
+		}
+
+		log_error("dbt_queue_write: %s: transaction failed. Writing "
+		    "%d records one by one", dbt->dbt_name, n);
+
+		dd->dd_rollback(conn);
+	}
+
+	failed = dbt_queue_write_records(dbt, conn, batch, n);
+
+exit:
+	dbt_pool_checkin(dbt, conn);
+
+	dbt_breaker_update(dbt, breaker, failed ? -1 : 0, &start);
+
+	if (failed && cf_dbt_fatal_errors && !dbt_breaker_enabled(dbt))
+	{
+		log_die(EX_SOFTWARE, "fatal database error");
+	}
+
+	return failed + journal_failed;
+}
+
+
+/*
+ * Finishes the write of dqe. Failed records are queued again unless they
+ * were superseded meanwhile or ran out of retries. CAVEAT: Needs to run in
+ * locked context.
+ */
+static void
+dbt_queue_done(dbt_t *dbt, dbt_queue_entry_t *dqe)
+{
+	dbt_queue_t *dq = &dbt->dbt_queue;
+	var_t *record;
+
+	// Superseded records were already replaced in dq_ht
+	if (ht_lookup(dq->dq_ht, dqe) != dqe)
+	{
+		dbt_queue_entry_delete(dqe);
+		return;
+	}
+
+	if (dqe->dqe_failed && ++dqe->dqe_retries < DBT_QUEUE_RETRIES)
+	{
+		dqe->dqe_flushing = 0;
+		util_now(&dqe->dqe_queued);
+		dbt_queue_append(dq, dqe);
+		++dq->dq_length;
+
+		if (pthread_cond_signal(&dq->dq_cond))
+		{
+			log_sys_error("dbt_queue_done: pthread_cond_signal");
+		}
+
+		return;
+	}
+
+	if (dqe->dqe_failed)
+	{
+		record = vp_unpack(dqe->dqe_vp, dbt->dbt_scheme);
+		if (record)
+		{
+			dbt_queue_log_record(dbt, record, "dropping record");
+			var_delete(record);
+		}
+		else
+		{
+			log_error("dbt_queue_done: %s: dropping record",
+			    dbt->dbt_name);
+		}
+	}
+
+	ht_remove(dq->dq_ht, dqe);
+	dbt_queue_entry_delete(dqe);
+
+	return;
+}
+
+
+static void *
+dbt_queue_flusher(dbt_t *dbt)
+{
+	dbt_queue_t *dq = &dbt->dbt_queue;
+	dbt_queue_entry_t **batch;
+	struct timespec now, ts;
+	int failed;
+	int n, i, r;
+
+	batch = (dbt_queue_entry_t **) malloc(dq->dq_batch *
+	    sizeof (dbt_queue_entry_t *));
+	if (batch == NULL)
+	{
+		log_sys_error("dbt_queue_flusher: malloc");
+		return NULL;
+	}
+
+	if (dbt_queue_lock(dq))
+	{
+		free(batch);
+		return NULL;
+	}
+
+	for (;;)
+	{
+		while (dq->dq_running && dq->dq_length == 0)
+		{
+			if (pthread_cond_wait(&dq->dq_cond, &dq->dq_mutex))
+			{
+				log_sys_error("dbt_queue_flusher: "
+				    "pthread_cond_wait");
+			}
+		}
+
+		// Stopped and drained
+		if (dq->dq_length == 0)
+		{
+			break;
+		}
+
+		/*
+		 * Wait for a full batch or until the oldest record reaches the
+		 * latency limit. Drain without delay on shutdown.
+		 */
+		if (dq->dq_running && dq->dq_length < dq->dq_batch)
+		{
+			ts = dq->dq_head->dqe_queued;
+			ts.tv_sec += dq->dq_latency / 1000;
+			ts.tv_nsec += (dq->dq_latency % 1000) * 1000000;
+			if (ts.tv_nsec >= 1000000000)
+			{
+				ts.tv_sec += 1;
+				ts.tv_nsec -= 1000000000;
+			}
+
+			util_now(&now);
+			if (now.tv_sec < ts.tv_sec || (now.tv_sec == ts.tv_sec
+			    && now.tv_nsec < ts.tv_nsec))
+			{
+				r = pthread_cond_timedwait(&dq->dq_cond,
+				    &dq->dq_mutex, &ts);
+				if (r && r != ETIMEDOUT)
+				{
+					log_error("dbt_queue_flusher: "
+					    "pthread_cond_timedwait failed");
+				}
+
+				continue;
+			}
+		}
+
+		/*
+		 * Flushing records stay in dq_ht until they are written.
+		 * dbt_db_get keeps seeing them.
+		 */
+		for (n = 0; n < dq->dq_batch && dq->dq_head; ++n)
+		{
+			batch[n] = dq->dq_head;
+			dbt_queue_unlink(dq, batch[n]);
+			batch[n]->dqe_flushing = 1;
+		}
+
+		dq->dq_length -= n;
+		dq->dq_flushing = 1;
+
+		// Make room for waiting writers
+		if (pthread_cond_broadcast(&dq->dq_done))
+		{
+			log_sys_error("dbt_queue_flusher: pthread_cond_broadcast");
+		}
+
+		dbt_queue_unlock(dq);
+
+		failed = dbt_queue_write(dbt, batch, n);
+
+		/*
+		 * A reader might have cached the old record while the batch
+		 * was in flight.
+		 */
+		if (dbt->dbt_cache.dc_ht)
+		{
+			for (i = 0; i < n; ++i)
+			{
+				dbt_cache_del_key(dbt, batch[i]->dqe_vp);
+			}
+		}
+
+		if (dbt_queue_lock(dq))
+		{
+			free(batch);
+			return NULL;
+		}
+
+		for (i = 0; i < n; ++i)
+		{
+			dbt_queue_done(dbt, batch[i]);
+		}
+
+		dq->dq_flushed += n - failed;
+		++dq->dq_batches;
+		dq->dq_flushing = 0;
+
+		if (pthread_cond_broadcast(&dq->dq_done))
+		{
+			log_sys_error("dbt_queue_flusher: pthread_cond_broadcast");
+		}
+	}
+
+	dbt_queue_unlock(dq);
+	free(batch);
+
+	log_debug("dbt_queue_flusher: %s: shutdown", dbt->dbt_name);
+
+	return NULL;
+}
+
+
+int
+dbt_queue_init(dbt_t *dbt)
+{
+	dbt_queue_t *dq = &dbt->dbt_queue;
+
+	if (dq->dq_size <= 0)
+	{
+		return 0;
+	}
+
+	if (dq->dq_batch <= 0)
+	{
+		dq->dq_batch = DBT_QUEUE_BATCH;
+	}
+
+	if (dq->dq_latency <= 0)
+	{
+		dq->dq_latency = DBT_QUEUE_LATENCY;
+	}
+
+	dq->dq_ht = ht_create(DBT_QUEUE_BUCKETS, (ht_hash_t) dbt_queue_hash,
+	    (ht_match_t) dbt_queue_match, NULL);
+	if (dq->dq_ht == NULL)
+	{
+		log_error("dbt_queue_init: ht_create failed");
+		return -1;
+	}
+
+	if (pthread_mutex_init(&dq->dq_mutex, NULL))
+	{
+		log_error("dbt_queue_init: pthread_mutex_init failed");
+		goto error;
+	}
+
+	if (pthread_cond_init(&dq->dq_cond, NULL))
+	{
+		log_error("dbt_queue_init: pthread_cond_init failed");
+		pthread_mutex_destroy(&dq->dq_mutex);
+		goto error;
+	}
+
+	if (pthread_cond_init(&dq->dq_done, NULL))
+	{
+		log_error("dbt_queue_init: pthread_cond_init failed");
+		pthread_cond_destroy(&dq->dq_cond);
+		pthread_mutex_destroy(&dq->dq_mutex);
+		goto error;
+	}
+
+	dq->dq_head = NULL;
+	dq->dq_tail = NULL;
+	dq->dq_length = 0;
+	dq->dq_flushing = 0;
+	dq->dq_queued = 0;
+	dq->dq_coalesced = 0;
+	dq->dq_flushed = 0;
+	dq->dq_batches = 0;
+	dq->dq_running = 1;
+
+	if (util_thread_create(&dq->dq_thread, dbt_queue_flusher, dbt))
+	{
+		log_error("dbt_queue_init: util_thread_create failed");
+		pthread_cond_destroy(&dq->dq_done);
+		pthread_cond_destroy(&dq->dq_cond);
+		pthread_mutex_destroy(&dq->dq_mutex);
+		goto error;
+	}
+
+	log_debug("dbt_queue_init: %s: queue %d records, batch %d, latency "
+	    "%dms", dbt->dbt_name, dq->dq_size, dq->dq_batch, dq->dq_latency);
+
+	return 0;
+
+error:
+	ht_delete(dq->dq_ht);
+	dq->dq_ht = NULL;
+
+	return -1;
+}
+
+
+/*
+ * Stops the flusher thread. Pending records are written before it exits.
+ */
+void
+dbt_queue_clear(dbt_t *dbt)
+{
+	dbt_queue_t *dq = &dbt->dbt_queue;
+
+	if (dq->dq_ht == NULL)
+	{
+		return;
+	}
+
+	if (dbt_queue_lock(dq) == 0)
+	{
+		dq->dq_running = 0;
+
+		if (pthread_cond_signal(&dq->dq_cond))
+		{
+			log_sys_error("dbt_queue_clear: pthread_cond_signal");
+		}
+
+		// Wake writers waiting for space. They write synchronously.
+		if (pthread_cond_broadcast(&dq->dq_done))
+		{
+			log_sys_error("dbt_queue_clear: pthread_cond_broadcast");
+		}
+
+		dbt_queue_unlock(dq);
+	}
+
+	util_thread_join(dq->dq_thread);
+
+	log_debug("dbt_queue_clear: %s: drained, %lu records flushed",
+	    dbt->dbt_name, dq->dq_flushed);
+
+	ht_delete(dq->dq_ht);
+	dq->dq_ht = NULL;
+
+	if (pthread_cond_destroy(&dq->dq_done))
+	{
+		log_sys_error("dbt_queue_clear: pthread_cond_destroy");
+	}
+
+	if (pthread_cond_destroy(&dq->dq_cond))
+	{
+		log_sys_error("dbt_queue_clear: pthread_cond_destroy");
+	}
+
+	if (pthread_mutex_destroy(&dq->dq_mutex))
+	{
+		log_sys_error("dbt_queue_clear: pthread_mutex_destroy");
+	}
+
+	return;
+}
+
+
+/*
+ * Removes the pending write of a record before it is modified
+ * synchronously. A running flush might contain the same record and is
+ * awaited. If write is set the pending record is written first. It stays
+ * visible to dbt_queue_get until the write is done and is queued again if
+ * the write fails.
+ */
+int
+dbt_queue_remove(dbt_t *dbt, var_t *record, int write)
+{
+	dbt_queue_t *dq = &dbt->dbt_queue;
+	dbt_queue_entry_t lookup, *dqe;
+	vp_key_t key;
+	int r = 0;
+
+	if (vp_pack_key(&key, record))
+	{
+		log_error("dbt_queue_remove: vp_pack_key failed");
+		return -1;
+	}
+
+	lookup.dqe_vp = &key.vk_vp;
+
+	if (dbt_queue_lock(dq))
+	{
+		vp_key_clear(&key);
+		return -1;
+	}
+
+	// Wait for the flusher and for other threads writing the record
+	for (;;)
+	{
+		dqe = ht_lookup(dq->dq_ht, &lookup);
+		if (!dq->dq_flushing && (dqe == NULL || !dqe->dqe_flushing))
+		{
+			break;
+		}
+
+		if (pthread_cond_wait(&dq->dq_done, &dq->dq_mutex))
+		{
+			log_sys_error("dbt_queue_remove: pthread_cond_wait");
+		}
+	}
+
+	vp_key_clear(&key);
+
+	if (dqe == NULL)
+	{
+		dbt_queue_unlock(dq);
+		return 0;
+	}
+
+	dbt_queue_unlink(dq, dqe);
+	--dq->dq_length;
+
+	if (!write)
+	{
+		ht_remove(dq->dq_ht, dqe);
+		dbt_queue_unlock(dq);
+		dbt_queue_entry_delete(dqe);
+
+		return 0;
+	}
+
+	dqe->dqe_flushing = 1;
+	dbt_queue_unlock(dq);
+
+	if (dbt_queue_write(dbt, &dqe, 1))
+	{
+		r = -1;
+	}
+
+	if (dbt->dbt_cache.dc_ht)
+	{
+		dbt_cache_del_key(dbt, dqe->dqe_vp);
+	}
+
+	if (dbt_queue_lock(dq))
+	{
+		// Leaks dqe. Freeing it would leave a dangling entry in dq_ht.
+		return -1;
+	}
+
+	dbt_queue_done(dbt, dqe);
+
+	if (pthread_cond_broadcast(&dq->dq_done))
+	{
+		log_sys_error("dbt_queue_remove: pthread_cond_broadcast");
+	}
+
+	dbt_queue_unlock(dq);
+
+	return r;
+}
+
+
+int
+dbt_queue_safe_update(var_t *record)
+{
+	ll_t *ll = record->v_data;
+	ll_entry_t *pos;
+	var_t *v;
+
+	pos = LL_START(ll);
+	while ((v = ll_next(ll, &pos)))
+	{
+		if (v->v_flags & VF_SQL_SAFE_UPDATE)
+		{
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+
+/*
+ * Queue a record for the flusher. Returns 0 if the record was queued, 1 if
+ * it needs to be written synchronously and -1 on error.
+ */
+int
+dbt_queue_set(dbt_t *dbt, var_t *record)
+{
+	dbt_queue_t *dq = &dbt->dbt_queue;
+	dbt_queue_entry_t *dqe, *old;
+	vp_t *vp;
+
+	/*
+	 * Increments can't be coalesced. Write them synchronously after
+	 * the pending record.
+	 */
+	if (dbt_queue_safe_update(record))
+	{
+		return dbt_queue_remove(dbt, record, 1) ? -1 : 1;
+	}
+
+	vp = vp_pack(record);
+	if (vp == NULL)
+	{
+		log_error("dbt_queue_set: vp_pack failed");
+		return -1;
+	}
+
+	dqe = (dbt_queue_entry_t *) malloc(sizeof (dbt_queue_entry_t));
+	if (dqe == NULL)
+	{
+		log_sys_error("dbt_queue_set: malloc");
+		vp_delete(vp);
+		return -1;
+	}
+
+	dqe->dqe_vp = vp;
+	dqe->dqe_flushing = 0;
+	dqe->dqe_failed = 0;
+	dqe->dqe_retries = 0;
+	dqe->dqe_prev = NULL;
+	dqe->dqe_next = NULL;
+	util_now(&dqe->dqe_queued);
+
+	if (dbt_queue_lock(dq))
+	{
+		dbt_queue_entry_delete(dqe);
+		return -1;
+	}
+
+	// Bounded queue: wait for the flusher
+	while (dq->dq_running && dq->dq_length >= dq->dq_size)
+	{
+		if (pthread_cond_signal(&dq->dq_cond))
+		{
+			log_sys_error("dbt_queue_set: pthread_cond_signal");
+		}
+
+		if (pthread_cond_wait(&dq->dq_done, &dq->dq_mutex))
+		{
+			log_sys_error("dbt_queue_set: pthread_cond_wait");
+		}
+	}
+
+	// Shutting down
+	if (!dq->dq_running)
+	{
+		dbt_queue_unlock(dq);
+		dbt_queue_entry_delete(dqe);
+		return 1;
+	}
+
+	++dq->dq_queued;
+
+	// Coalesce: the pending record is replaced in place
+	old = ht_lookup(dq->dq_ht, dqe);
+	if (old && !old->dqe_flushing)
+	{
+		vp_delete(old->dqe_vp);
+		old->dqe_vp = vp;
+		free(dqe);
+
+		++dq->dq_coalesced;
+		goto exit;
+	}
+
+	// The flusher frees records that are no longer in dq_ht
+	if (old)
+	{
+		ht_remove(dq->dq_ht, old);
+	}
+
+	if (ht_insert(dq->dq_ht, dqe))
+	{
+		log_error("dbt_queue_set: ht_insert failed");
+		dbt_queue_unlock(dq);
+		dbt_queue_entry_delete(dqe);
+		return -1;
+	}
+
+	dbt_queue_append(dq, dqe);
+	++dq->dq_length;
+
+	// Start the latency timer or flush a full batch
+	if (dq->dq_length == 1 || dq->dq_length >= dq->dq_batch)
+	{
+		if (pthread_cond_signal(&dq->dq_cond))
+		{
+			log_sys_error("dbt_queue_set: pthread_cond_signal");
+		}
+	}
+
+exit:
+	dbt_queue_unlock(dq);
+
+	// Readers check the queue first. Invalidate after queueing.
+	if (dbt->dbt_cache.dc_ht)
+	{
+		dbt_cache_del(dbt, record);
+	}
+
+	return 0;
+}
+
+
+/*
+ * Returns 1 if a pending record was found, 0 if not and -1 on error.
+ */
+int
+dbt_queue_get(dbt_t *dbt, var_t *record, var_t **result)
+{
+	dbt_queue_t *dq = &dbt->dbt_queue;
+	dbt_queue_entry_t lookup, *dqe;
+	vp_key_t key;
+	int r = 0;
+
+	if (vp_pack_key(&key, record))
+	{
+		log_error("dbt_queue_get: vp_pack_key failed");
+		return -1;
+	}
+
+	lookup.dqe_vp = &key.vk_vp;
+
+	if (dbt_queue_lock(dq))
+	{
+		vp_key_clear(&key);
+		return -1;
+	}
+
+	dqe = ht_lookup(dq->dq_ht, &lookup);
+	if (dqe)
+	{
+		*result = vp_unpack(dqe->dqe_vp, dbt->dbt_scheme);
+		if (*result == NULL)
+		{
+			log_error("dbt_queue_get: vp_unpack failed");
+			r = -1;
+		}
+		else
+		{
+			r = 1;
+		}
+	}
+
+	dbt_queue_unlock(dq);
+	vp_key_clear(&key);
+
+	return r;
+}
+
+
+void
+dbt_queue_log(dbt_t *dbt)
+{
+	dbt_queue_t *dq = &dbt->dbt_queue;
+
+	if (dq->dq_ht == NULL)
+	{
+		return;
+	}
+
+	if (dbt_queue_lock(dq))
+	{
+		return;
+	}
+
+	log_info("dbt_queue: %s: pending=%d queued=%lu coalesced=%lu "
+	    "flushed=%lu batches=%lu", dbt->dbt_name, dq->dq_length,
+	    dq->dq_queued, dq->dq_coalesced, dq->dq_flushed, dq->dq_batches);
+
+	dbt_queue_unlock(dq);
+
+	return;
+}
+
+
+int
+dbt_queue_stats(dbt_t *dbt, char **buffer, int *len)
+{
+	dbt_queue_t *dq = &dbt->dbt_queue;
+	int r;
+
+	if (dq->dq_ht == NULL || dbt_queue_lock(dq))
+	{
+		return 0;
+	}
+
+	r = dbt_stats_printf(buffer, len, "%s: queue: pending=%d queued=%lu "
+	    "coalesced=%lu flushed=%lu batches=%lu\n", dbt->dbt_name,
+	    dq->dq_length, dq->dq_queued, dq->dq_coalesced, dq->dq_flushed,
+	    dq->dq_batches);
+
+	dbt_queue_unlock(dq);
+
+	return r;
+}
@@ -0,0 +1,254 @@
+#include <config.h>
+
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <pthread.h>
+#include <errno.h>
+
+#include <mopher.h>
+
+#define BUFLEN 8192
+
+
+/*
+ * Operation statistics
+ */
+char *dbt_stats_ops[] = { "get", "set", "del", "mget", "mset",
+    "walk", "expire" };
+
+
+/*
+ * Latencies are measured on the monotonic clock. util_now follows the
+ * system time and may jump.
+ */
+void
+dbt_stats_now(struct timespec *ts)
+{
+	if (clock_gettime(CLOCK_MONOTONIC, ts))
+	{
+		log_sys_error("dbt_stats_now: clock_gettime");
+		ts->tv_sec = 0;
+		ts->tv_nsec = 0;
+	}
+
+	return;
+}
+
+
+long
+dbt_stats_usec(struct timespec *start, struct timespec *stop)
+{
+	return (stop->tv_sec - start->tv_sec) * 1000000 +
+	    (stop->tv_nsec - start->tv_nsec) / 1000;
+}
+
+
+int
+dbt_stats_init(dbt_t *dbt)
+{
+	dbt_stats_t *ds = &dbt->dbt_stats;
+
+	memset(ds->ds_ops, 0, sizeof ds->ds_ops);
+
+	return 0;
+}
+
+
+/*
+ * dbt_pool_checkout and dbt_lock. The time spent waiting is added to wait.
+ */
+dbt_t *
+dbt_stats_checkout(dbt_t *dbt, long *wait)
+{
+	struct timespec start, stop;
+	dbt_t *conn;
+
+	dbt_stats_now(&start);
+	conn = dbt_pool_checkout(dbt);
+	dbt_stats_now(&stop);
+
+	*wait += dbt_stats_usec(&start, &stop);
+
+	return conn;
+}
+
+
+int
+dbt_stats_lock(dbt_t *dbt, long *wait)
+{
+	struct timespec start, stop;
+	int r;
+
+	dbt_stats_now(&start);
+	r = dbt_lock(dbt);
+	dbt_stats_now(&stop);
+
+	*wait += dbt_stats_usec(&start, &stop);
+
+	return r;
+}
+
+
+void
+dbt_stats_update(dbt_t *dbt, int op, struct timespec *start, long wait,
+    int r)
+{
+	dbt_op_stats_t *dos = dbt->dbt_stats.ds_ops + op;
+	struct timespec stop;
+	unsigned long max;
+	long usec;
+	int bucket;
+
+	dbt_stats_now(&stop);
+
+	usec = dbt_stats_usec(start, &stop);
+	if (usec < 0)
+	{
+		usec = 0;
+	}
+
+	for (bucket = 0; bucket < DBT_LATENCY_BUCKETS - 1 &&
+	    usec >= 1L << bucket; ++bucket);
+
+	__sync_fetch_and_add(&dos->dos_count, 1);
+	__sync_fetch_and_add(&dos->dos_latency[bucket], 1);
+	__sync_fetch_and_add(&dos->dos_usec, usec);
+	__sync_fetch_and_add(&dos->dos_wait_usec, wait);
+
+	for (max = dos->dos_usec_max; usec > max; max = dos->dos_usec_max)
+	{
+		if (__sync_bool_compare_and_swap(&dos->dos_usec_max, max, usec))
+		{
+			break;
+		}
+	}
+
+	if (r < 0)
+	{
+		__sync_fetch_and_add(&dos->dos_errors, 1);
+	}
+
+	return;
+}
+
+
+int
+dbt_stats_printf(char **buffer, int *len, char *format, ...)
+{
+	char line[BUFLEN];
+	va_list ap;
+	char *p;
+	int n;
+
+	va_start(ap, format);
+	n = vsnprintf(line, sizeof line, format, ap);
+	va_end(ap);
+
+	if (n >= sizeof line)
+	{
+		log_error("dbt_stats_printf: buffer exhausted");
+		return -1;
+	}
+
+	p = realloc(*buffer, *len + n + 1);
+	if (p == NULL)
+	{
+		log_sys_error("dbt_stats_printf: realloc");
+		return -1;
+	}
+
+	memcpy(p + *len, line, n + 1);
+	*buffer = p;
+	*len += n;
+
+	return 0;
+}
+
+
+static int
+dbt_stats_op(dbt_t *dbt, int op, dbt_op_stats_t *dos, char **buffer,
+    int *len)
+{
+	char histogram[BUFLEN];
+	int i, n = 0;
+
+	for (i = 0; i < DBT_LATENCY_BUCKETS; ++i)
+	{
+		if (dos->dos_latency[i] == 0)
+		{
+			continue;
+		}
+
+		if (i < DBT_LATENCY_BUCKETS - 1)
+		{
+			n += snprintf(histogram + n, sizeof histogram - n,
+			    " <%luus=%lu", 1UL << i, dos->dos_latency[i]);
+		}
+		else
+		{
+			n += snprintf(histogram + n, sizeof histogram - n,
+			    " >=%luus=%lu", 1UL << (i - 1), dos->dos_latency[i]);
+		}
+	}
+
+	return dbt_stats_printf(buffer, len, "%s: %s: count=%lu errors=%lu "
+	    "avg=%luus max=%luus wait_avg=%luus latency:%s\n", dbt->dbt_name,
+	    dbt_stats_ops[op], dos->dos_count, dos->dos_errors,
+	    dos->dos_usec / dos->dos_count, dos->dos_usec_max,
+	    dos->dos_wait_usec / dos->dos_count, histogram);
+}
+
+
+int
+dbt_stats_table(dbt_t *dbt, char **buffer, int *len)
+{
+	dbt_op_stats_t ops[DBT_OP_MAX];
+	char driver[BUFLEN];
+	int i, r = 0;
+
+	if (!dbt->dbt_open)
+	{
+		return dbt_stats_printf(buffer, len, "%s: closed\n",
+		    dbt->dbt_name);
+	}
+
+	memcpy(ops, dbt->dbt_stats.ds_ops, sizeof ops);
+
+	r |= dbt_stats_printf(buffer, len, "%s: driver=%s\n", dbt->dbt_name,
+	    dbt->dbt_driver->dd_name);
+
+	for (i = 0; i < DBT_OP_MAX; ++i)
+	{
+		if (ops[i].dos_count)
+		{
+			r |= dbt_stats_op(dbt, i, ops + i, buffer, len);
+		}
+	}
+
+	r |= dbt_cache_stats(dbt, buffer, len);
+	r |= dbt_pool_stats(dbt, buffer, len);
+	r |= dbt_queue_stats(dbt, buffer, len);
+	r |= dbt_breaker_stats(dbt, buffer, len);
+	r |= dbt_index_stats(dbt, buffer, len);
+	r |= dbt_janitor_stats(dbt, buffer, len);
+
+	if (dbt->dbt_driver->dd_stats && dbt_lock(dbt) == 0)
+	{
+		if (dbt->dbt_driver->dd_stats(dbt, driver, sizeof driver))
+		{
+			log_error("dbt_stats_table: %s: dd_stats failed",
+			    dbt->dbt_name);
+		}
+		else
+		{
+			r |= dbt_stats_printf(buffer, len, "%s: %s: %s\n",
+			    dbt->dbt_name, dbt->dbt_driver->dd_name, driver);
+		}
+
+		dbt_unlock(dbt);
+	}
+
+	return r ? -1 : 0;
+}
+
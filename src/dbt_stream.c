@@ -0,0 +1,419 @@
+#include <config.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <errno.h>
+
+#include <mopher.h>
+
+#define BUFLEN 8192
+
+// Stream of the dbt_stream call running in this thread
+static __thread dbt_stream_t *dbt_stream_current;
+
+
+static int
+dbt_stream_format(dbt_t *dbt, var_t *record, char *buffer, int size)
+{
+	int len;
+
+	// Reserve space for the trailing newline
+	len = var_dump_data(record, buffer, size - 1);
+	if (len == -1)
+	{
+		log_error("dbt_stream_format: var_dump_data failed");
+		return -1;
+	}
+
+	buffer[len++] = '\n';
+	buffer[len] = 0;
+
+	return len;
+}
+
+
+/*
+ * Matches the first key field against dst_prefix and the expiry of the
+ * record against dst_expire.
+ */
+static int
+dbt_stream_match(dbt_t *dbt, dbt_stream_t *stream, var_t *record)
+{
+	char buffer[BUFLEN];
+	ll_t *ll = record->v_data;
+	ll_entry_t *pos;
+	VAR_INT_T *expire;
+	var_t *v;
+
+	if (stream->dst_expire)
+	{
+		expire = vlist_record_get(record, dbt->dbt_expire_field);
+		if (expire == NULL || *expire >= stream->dst_expire)
+		{
+			return 0;
+		}
+	}
+
+	if (stream->dst_prefix == NULL)
+	{
+		return 1;
+	}
+
+	pos = LL_START(ll);
+	while ((v = ll_next(ll, &pos)))
+	{
+		if (v->v_flags & VF_KEY)
+		{
+			break;
+		}
+	}
+
+	if (v == NULL || var_dump_data(v, buffer, sizeof buffer) == -1)
+	{
+		return 0;
+	}
+
+	return strncmp(buffer, stream->dst_prefix,
+	    strlen(stream->dst_prefix)) == 0;
+}
+
+
+static int
+dbt_stream_flush(dbt_stream_t *stream)
+{
+	if (stream->dst_len == 0)
+	{
+		return 0;
+	}
+
+	if (stream->dst_flush(stream->dst_data, stream->dst_buffer,
+	    stream->dst_len, stream->dst_token))
+	{
+		log_error("dbt_stream_flush: dst_flush failed");
+		return -1;
+	}
+
+	stream->dst_len = 0;
+
+	return 0;
+}
+
+
+/*
+ * CAVEAT: Runs in locked context. Flushes only if the driver walks the
+ * whole table in one go.
+ */
+static int
+dbt_stream_record(dbt_t *dbt, var_t *record)
+{
+	dbt_stream_t *stream = dbt_stream_current;
+	char *p;
+	int len;
+
+	if (!dbt_stream_match(dbt, stream, record))
+	{
+		return 0;
+	}
+
+	// Records formatted by dst_format are limited to BUFLEN bytes
+	if (stream->dst_size - stream->dst_len < BUFLEN)
+	{
+		p = realloc(stream->dst_buffer, stream->dst_size + BUFLEN);
+		if (p == NULL)
+		{
+			log_sys_error("dbt_stream_record: realloc");
+			return -1;
+		}
+
+		stream->dst_buffer = p;
+		stream->dst_size += BUFLEN;
+	}
+
+	len = stream->dst_format(dbt, record, stream->dst_buffer +
+	    stream->dst_len, BUFLEN);
+	if (len == -1 || len >= BUFLEN)
+	{
+		log_error("dbt_stream_record: dst_format failed");
+		return -1;
+	}
+
+	stream->dst_len += len;
+	++stream->dst_records;
+
+	if (dbt->dbt_driver->dd_scan == NULL &&
+	    stream->dst_len >= DBT_STREAM_CHUNK)
+	{
+		return dbt_stream_flush(stream);
+	}
+
+	return 0;
+}
+
+
+/*
+ * Resume tokens encode the cursor position after the last flushed chunk:
+ * 'p' followed by the driver position, 'k' followed by the base64 encoded
+ * last key or 'r' followed by the base64 encoded key of the last record.
+ */
+static int
+dbt_stream_token(dbt_cursor_t *cursor, char *buffer, int size)
+{
+	vp_key_t vk;
+	int r;
+
+	if (cursor->dc_record)
+	{
+		if (vp_pack_key(&vk, cursor->dc_record))
+		{
+			log_error("dbt_stream_token: vp_pack_key failed");
+			return -1;
+		}
+
+		buffer[0] = 'r';
+		r = base64_encode(buffer + 1, size - 1, vk.vk_vp.vp_key,
+		    vk.vk_vp.vp_klen);
+
+		vp_key_clear(&vk);
+	}
+	else if (cursor->dc_key)
+	{
+		buffer[0] = 'k';
+		r = base64_encode(buffer + 1, size - 1, cursor->dc_key,
+		    cursor->dc_klen);
+	}
+	else
+	{
+		r = snprintf(buffer, size, "p%ld", cursor->dc_pos);
+		if (r >= size)
+		{
+			r = -1;
+		}
+	}
+
+	if (r == -1)
+	{
+		log_error("dbt_stream_token: buffer exhausted");
+		return -1;
+	}
+
+	return 0;
+}
+
+
+static int
+dbt_stream_resume(dbt_t *dbt, dbt_cursor_t *cursor, char *token)
+{
+	unsigned char key[DBT_TOKEN_BUFLEN];
+	vp_null_t nulls = 0;
+	ll_t *ll;
+	ll_entry_t *pos;
+	var_t *record, *v;
+	char *end;
+	vp_t vp;
+	int klen, n;
+
+	switch (token[0])
+	{
+	case 'p':
+		cursor->dc_pos = strtol(token + 1, &end, 10);
+		if (*end || cursor->dc_pos < 0)
+		{
+			goto error;
+		}
+
+		return 0;
+
+	case 'k':
+	case 'r':
+		klen = base64_decode(key, sizeof key, token + 1);
+		if (klen <= 0)
+		{
+			goto error;
+		}
+		break;
+
+	default:
+		goto error;
+	}
+
+	if (token[0] == 'k')
+	{
+		return dbt_cursor_key(cursor, key, klen);
+	}
+
+	// Records restored from a token only hold the key fields
+	ll = dbt->dbt_scheme->v_data;
+	pos = LL_START(ll);
+	for (n = 0; (v = ll_next(ll, &pos)); ++n)
+	{
+		if ((v->v_flags & VF_KEY) == 0)
+		{
+			nulls |= (vp_null_t) 1 << n;
+		}
+	}
+
+	vp_init(&vp, key, klen, &nulls, sizeof nulls);
+
+	record = vp_unpack(&vp, dbt->dbt_scheme);
+	if (record == NULL)
+	{
+		log_error("dbt_stream_resume: vp_unpack failed");
+		return -1;
+	}
+
+	dbt_cursor_record(cursor, record);
+
+	return 0;
+
+error:
+	log_error("dbt_stream_resume: bad resume token: %s", token);
+
+	return -1;
+}
+
+
+/*
+ * Streams all records of dbt matching the filters of stream to
+ * stream->dst_flush. Drivers supporting dd_scan release the table lock
+ * between batches and chunks are flushed unlocked. The walk stops after
+ * dst_limit records and dst_token is set to resume it. A record may be
+ * streamed twice (see dbt_db_walk). Dumps are informational and nothing
+ * reads them back.
+ */
+int
+dbt_stream(dbt_t *dbt, dbt_stream_t *stream)
+{
+	struct timespec start;
+	dbt_cursor_t cursor;
+	long wait = 0;
+	int count, limit;
+	int r = -1;
+
+	dbt_stats_now(&start);
+
+	memset(&cursor, 0, sizeof cursor);
+	stream->dst_token[0] = 0;
+	stream->dst_records = 0;
+
+	if (stream->dst_format == NULL)
+	{
+		stream->dst_format = dbt_stream_format;
+	}
+
+	if (dbt->dbt_driver->dd_scan == NULL)
+	{
+		if (stream->dst_resume || stream->dst_limit)
+		{
+			log_error("dbt_stream: %s: driver %s does not support "
+			    "resume tokens", dbt->dbt_name,
+			    dbt->dbt_driver->dd_name);
+			goto exit;
+		}
+
+		if(dbt_stats_lock(dbt, &wait) == -1)
+		{
+			log_error("dbt_stream: dbt_lock failed");
+			goto exit;
+		}
+
+		dbt_stream_current = stream;
+		r = dbt->dbt_driver->dd_walk(dbt,
+		    (dbt_db_callback_t) dbt_stream_record);
+		dbt_stream_current = NULL;
+
+		dbt_unlock(dbt);
+
+		if (r == 0)
+		{
+			r = dbt_stream_flush(stream);
+		}
+
+		goto exit;
+	}
+
+	if (stream->dst_resume && dbt_stream_resume(dbt, &cursor,
+	    stream->dst_resume))
+	{
+		log_error("dbt_stream: dbt_stream_resume failed");
+		goto exit;
+	}
+
+	for (;;)
+	{
+		count = DBT_WALK_BATCH;
+		if (stream->dst_limit &&
+		    stream->dst_limit - stream->dst_records < count)
+		{
+			count = stream->dst_limit - stream->dst_records;
+		}
+
+		if(dbt_stats_lock(dbt, &wait) == -1)
+		{
+			log_error("dbt_stream: dbt_lock failed");
+			r = -1;
+			break;
+		}
+
+		dbt_stream_current = stream;
+		r = dbt->dbt_driver->dd_scan(dbt, &cursor, count,
+		    (dbt_db_callback_t) dbt_stream_record);
+		dbt_stream_current = NULL;
+
+		dbt_unlock(dbt);
+
+		if (r == -1)
+		{
+			break;
+		}
+
+		limit = stream->dst_limit &&
+		    stream->dst_records >= stream->dst_limit;
+
+		if (r > 0 && !limit && stream->dst_len < DBT_STREAM_CHUNK)
+		{
+			continue;
+		}
+
+		// Empty once the table is exhausted
+		stream->dst_token[0] = 0;
+		if (r > 0 && dbt_stream_token(&cursor, stream->dst_token,
+		    sizeof stream->dst_token))
+		{
+			r = -1;
+			break;
+		}
+
+		if (dbt_stream_flush(stream))
+		{
+			r = -1;
+			break;
+		}
+
+		if (r == 0 || limit)
+		{
+			r = 0;
+			break;
+		}
+	}
+
+	dbt_cursor_clear(&cursor);
+
+exit:
+	if (stream->dst_buffer)
+	{
+		free(stream->dst_buffer);
+		stream->dst_buffer = NULL;
+		stream->dst_size = 0;
+		stream->dst_len = 0;
+	}
+
+	if (r < 0)
+	{
+		log_error("dbt_stream: %s: stream failed", dbt->dbt_name);
+	}
+
+	dbt_stats_update(dbt, DBT_OP_WALK, &start, wait, r);
+
+	return r;
+}
@@ -15,6 +15,11 @@
 static sht_t *exp_defs;
 static ll_t *exp_garbage;
 
+/*
+ * Temporary results of this thread are allocated from exp_arena if set.
+ */
+static __thread arena_t *exp_arena;
+
 static VAR_INT_T exp_true_int  = 1;
 static VAR_INT_T exp_false_int = 0;
 
@@ -269,6 +274,20 @@ exp_function(char *id, exp_t *args)
 	return exp_create(EX_FUNCTION, ef);
 }
 
+/*
+ * Temporary results are allocated from arena until exp_arena_set is called
+ * again. The setting is per thread. The caller resets the arena after
+ * evaluation.
+ */
+void
+exp_arena_set(arena_t *arena)
+{
+	exp_arena = arena;
+
+	return;
+}
+
+
 void
 exp_free(var_t *v)
 {
@@ -309,6 +328,12 @@ exp_eval_list(exp_t *exp, var_t *mailspec)
 		goto error;
 	}
 
+	if (vlist_reserve(var_list, LL_SIZE(exp_list)))
+	{
+		log_error("exp_eval_list: vlist_reserve failed");
+		goto error;
+	}
+
 	pos = LL_START(exp_list);
 	while ((exp_item = ll_next(exp_list, &pos)))
 	{
@@ -585,11 +610,11 @@ exp_eval_macro(exp_t *exp, var_t *mailspec)
 		return EXP_EMPTY;
 	}
 
-	v = var_create(VT_STRING, exp->ex_data, value, VF_KEEPNAME |
-		VF_COPYDATA | VF_EXP_FREE);
+	v = var_arena_create(exp_arena, VT_STRING, exp->ex_data, value,
+		VF_KEEPNAME | VF_COPYDATA | VF_EXP_FREE);
 	if (v == NULL)
 	{
-		log_error("exp_eval_macro: var_create failed");
+		log_error("exp_eval_macro: var_arena_create failed");
 		return NULL;
 	}
 
@@ -842,10 +867,11 @@ exp_math_int(int op, var_t *left, var_t *right)
 		return NULL;
 	}
 
-	v = var_create(VT_INT, NULL, &x, VF_COPYDATA | VF_EXP_FREE);
+	v = var_arena_create(exp_arena, VT_INT, NULL, &x,
+	    VF_COPYDATA | VF_EXP_FREE);
 	if (v == NULL)
 	{
-		log_error("exp_math_int: var_create failed");
+		log_error("exp_math_int: var_arena_create failed");
 	}
 
 	return v;
@@ -879,10 +905,11 @@ exp_math_float(int op, var_t *left, var_t *right)
 		return NULL;
 	}
 
-	v = var_create(VT_FLOAT, NULL, &x, VF_COPYDATA | VF_EXP_FREE);
+	v = var_arena_create(exp_arena, VT_FLOAT, NULL, &x,
+	    VF_COPYDATA | VF_EXP_FREE);
 	if (v == NULL)
 	{
-		log_error("exp_math_float: var_create failed");
+		log_error("exp_math_float: var_arena_create failed");
 	}
 
 	return v;
@@ -922,10 +949,11 @@ exp_math_string(int op, var_t *left, var_t *right)
 		return NULL;
 	}
 
-	v = var_create(VT_STRING, NULL, x, VF_COPYDATA | VF_EXP_FREE);
+	v = var_arena_create(exp_arena, VT_STRING, NULL, x,
+	    VF_COPYDATA | VF_EXP_FREE);
 	if (v == NULL)
 	{
-		log_error("exp_math_string: var_create failed");
+		log_error("exp_math_string: var_arena_create failed");
 	}
 
 	return v;
@@ -7,14 +7,8 @@
 
 #include <mopher.h>
 
-#define DUMP_RECORD_BUFLEN 1024
-
 static dbt_t greylist_dbt;
 
-static char **greylist_dump_buffer;
-static int greylist_dump_buffer_size;
-static pthread_mutex_t greylist_dump_mutex = PTHREAD_MUTEX_INITIALIZER;
-
 /*
  * Greylist symbols and db translation
  */
@@ -409,7 +403,7 @@ append:
 
 static int
 greylist_add(greylist_t *gl, var_t *mailspec, char *origin, char *envfrom,
-    char *envrcpt, VAR_INT_T received)
+    char *envrcpt, VAR_INT_T received, var_t **update)
 {
 	var_t *record;
 	VAR_INT_T created = received;
@@ -456,14 +450,7 @@ greylist_add(greylist_t *gl, var_t *mailspec, char *origin, char *envfrom,
 		return -1;
 	}
 
-	if (dbt_db_set(&greylist_dbt, record))
-	{
-		log_error("greylist_add: dbt_db_set failed");
-		var_delete(record);
-		return -1;
-	}
-	
-	var_delete(record);
+	*update = record;
 
 	log_message(LOG_ERR, mailspec, "greylist: status=defer delay=0/%ld "
 	    "attempts=1/%ld", delay, attempts);
@@ -472,11 +459,33 @@ greylist_add(greylist_t *gl, var_t *mailspec, char *origin, char *envfrom,
 }
 
 
+static var_t *
+greylist_lookup(char *origin, char *envfrom, char *envrcpt)
+{
+	var_t *lookup;
+
+	lookup = vlist_record(greylist_dbt.dbt_scheme, origin, envfrom,
+	    envrcpt, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL);
+
+	if (lookup == NULL)
+	{
+		log_error("greylist_lookup: vlist_record failed");
+	}
+
+	return lookup;
+}
+
+
+/*
+ * Evaluates the stored record of a tuple (NULL if none exists). The record
+ * is consumed. The record to store is returned in update and left NULL if
+ * nothing needs to be written.
+ */
 static int
-greylist_recipient(greylist_t * gl, VAR_INT_T *delayed, var_t *mailspec,
-    char *origin, char *envfrom, char *envrcpt, VAR_INT_T received)
+greylist_update(greylist_t * gl, VAR_INT_T *delayed, var_t *mailspec,
+    char *origin, char *envfrom, char *envrcpt, VAR_INT_T received,
+    var_t *record, var_t **update)
 {
-	var_t *lookup = NULL, *record = NULL;
 	VAR_INT_T *created;
 	VAR_INT_T *updated;
 	VAR_INT_T *expire;
@@ -490,27 +499,7 @@ greylist_recipient(greylist_t * gl, VAR_INT_T *delayed, var_t *mailspec,
 	int passed_delay;
 
 	*delayed = 0;
-
-	/*
-	 * Lookup greylist record
-	 */
-	lookup = vlist_record(greylist_dbt.dbt_scheme, origin, envfrom,
-	    envrcpt, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL);
-
-	if (lookup == NULL)
-	{
-		log_error("greylist_recipient: vlist_record failed");
-		goto error;
-	}
-
-	if (dbt_db_get(&greylist_dbt, lookup, &record))
-	{
-		log_error("greylist_recipient: dbt_db_get failed");
-		goto error;
-	}
-
-	var_delete(lookup);
-	lookup = NULL;
+	*update = NULL;
 
 	/*
 	 * Dont't greylist if no record exists and gl is empty
@@ -536,7 +525,7 @@ greylist_recipient(greylist_t * gl, VAR_INT_T *delayed, var_t *mailspec,
 	    &expire, &connections, &deadline, &delay, &attempts, &visa,
 	    &passed))
 	{
-		log_error("greylist_recipient: vlist_dereference failed");
+		log_error("greylist_update: vlist_dereference failed");
 		goto error;
 	}
 
@@ -565,7 +554,7 @@ greylist_recipient(greylist_t * gl, VAR_INT_T *delayed, var_t *mailspec,
 	if (greylist_properties(gl, mailspec, created, expire, deadline,
 	    delay, attempts, visa))
 	{
-		log_error("greylist_recipient: greylist_properties failed");
+		log_error("greylist_update: greylist_properties failed");
 		goto error;
 	}
 
@@ -624,38 +613,213 @@ greylist_recipient(greylist_t * gl, VAR_INT_T *delayed, var_t *mailspec,
 update:
 
 	*updated = received;
+	*update = record;
 
-	if (dbt_db_set(&greylist_dbt, record))
-	{
-		log_error("greylist: dbt_db_set failed");
-		goto error;
-	}
+	return defer;
+
+
+add:
+
+	return greylist_add(gl, mailspec, origin, envfrom, envrcpt, received,
+	    update);
 
+
+error:
 	if (record)
 	{
 		var_delete(record);
 	}
 
-	return defer;
+	return -1;
+}
 
 
-add:
+static int
+greylist_recipient(greylist_t * gl, VAR_INT_T *delayed, var_t *mailspec,
+    char *origin, char *envfrom, char *envrcpt, VAR_INT_T received)
+{
+	var_t *lookup, *record, *update;
+	int defer;
 
-	return greylist_add(gl, mailspec, origin, envfrom, envrcpt, received);
+	*delayed = 0;
 
+	lookup = greylist_lookup(origin, envfrom, envrcpt);
+	if (lookup == NULL)
+	{
+		log_error("greylist_recipient: greylist_lookup failed");
+		return -1;
+	}
 
-error:
-	if (lookup)
+	if (dbt_db_get(&greylist_dbt, lookup, &record))
 	{
+		log_error("greylist_recipient: dbt_db_get failed");
 		var_delete(lookup);
+		return -1;
 	}
 
-	if (record)
+	var_delete(lookup);
+
+	defer = greylist_update(gl, delayed, mailspec, origin, envfrom,
+	    envrcpt, received, record, &update);
+
+	if (update == NULL)
 	{
-		var_delete(record);
+		return defer;
 	}
 
-	return -1;
+	if (dbt_db_set(&greylist_dbt, update))
+	{
+		log_error("greylist_recipient: dbt_db_set failed");
+		defer = -1;
+	}
+
+	var_delete(update);
+
+	return defer;
+}
+
+
+/*
+ * Message context: all records are fetched with a single dbt_db_mget and
+ * the updated records are stored with a single dbt_db_mset. Stops at the
+ * first recipient that needs to be greylisted.
+ */
+static int
+greylist_recipients(greylist_t *gl, VAR_INT_T *max_delay, var_t *mailspec,
+    char *origin, char *envfrom, ll_t *recipients, VAR_INT_T received)
+{
+	var_t **lookups = NULL, **records = NULL, **updates = NULL;
+	ll_entry_t *pos;
+	var_t *rcpt;
+	VAR_INT_T delay;
+	int n = 0, m = 0, i, j;
+	int defer = 0;
+
+	*max_delay = 0;
+
+	if (LL_SIZE(recipients) == 0)
+	{
+		return 0;
+	}
+
+	lookups = (var_t **) calloc(LL_SIZE(recipients), sizeof (var_t *));
+	records = (var_t **) calloc(LL_SIZE(recipients), sizeof (var_t *));
+	updates = (var_t **) calloc(LL_SIZE(recipients), sizeof (var_t *));
+	if (lookups == NULL || records == NULL || updates == NULL)
+	{
+		log_sys_error("greylist_recipients: calloc");
+		defer = -1;
+		goto exit;
+	}
+
+	pos = LL_START(recipients);
+	while ((rcpt = ll_next(recipients, &pos)))
+	{
+		/*
+		 * vlist stores var_t pointers!
+		 */
+		lookups[n] = greylist_lookup(origin, envfrom, rcpt->v_data);
+		if (lookups[n] == NULL)
+		{
+			log_error("greylist_recipients: greylist_lookup failed");
+			defer = -1;
+			goto exit;
+		}
+
+		/*
+		 * A recipient listed twice would be checked against the same
+		 * fetched record and its second update would overwrite the
+		 * first.
+		 */
+		for (j = 0; j < n; ++j)
+		{
+			if (dbt_key_match(lookups[j], lookups[n]))
+			{
+				break;
+			}
+		}
+
+		if (j < n)
+		{
+			var_delete(lookups[n]);
+			lookups[n] = NULL;
+			continue;
+		}
+
+		++n;
+	}
+
+	if (dbt_db_mget(&greylist_dbt, n, lookups, records))
+	{
+		log_error("greylist_recipients: dbt_db_mget failed");
+		defer = -1;
+		goto exit;
+	}
+
+	for (i = 0; i < n; ++i)
+	{
+		// Ownership of the record passes to greylist_update
+		defer = greylist_update(gl, &delay, mailspec, origin, envfrom,
+		    vlist_record_get(lookups[i], "envrcpt_addr"), received,
+		    records[i], &updates[m]);
+		records[i] = NULL;
+
+		if (updates[m])
+		{
+			++m;
+		}
+
+		/*
+		 * We are in message context! Greylist if any recipient
+		 * requires to. Errors are checked by the caller.
+		 */
+		if (defer)
+		{
+			break;
+		}
+
+		if (delay > *max_delay)
+		{
+			*max_delay = delay;
+		}
+	}
+
+	if (dbt_db_mset(&greylist_dbt, m, updates))
+	{
+		log_error("greylist_recipients: dbt_db_mset failed");
+		defer = -1;
+	}
+
+exit:
+	for (i = 0; i < n; ++i)
+	{
+		var_delete(lookups[i]);
+
+		if (records[i])
+		{
+			var_delete(records[i]);
+		}
+	}
+
+	for (i = 0; i < m; ++i)
+	{
+		var_delete(updates[i]);
+	}
+
+	if (lookups)
+	{
+		free(lookups);
+	}
+	if (records)
+	{
+		free(records);
+	}
+	if (updates)
+	{
+		free(updates);
+	}
+
+	return defer;
 }
 
 
@@ -668,11 +832,9 @@ greylist(milter_stage_t stage, char *stagename, var_t *mailspec, void *data,
 	char *envfrom;
 	char *envrcpt;
 	ll_t *recipients;
-	ll_entry_t *pos;
 	VAR_INT_T *received;
-	var_t *rcpt;
 	int defer;
-	VAR_INT_T delay = 0, max_delay = 0;
+	VAR_INT_T max_delay = 0;
 
 
 	/*
@@ -699,30 +861,8 @@ greylist(milter_stage_t stage, char *stagename, var_t *mailspec, void *data,
 
 	else
 	{
-		pos = LL_START(recipients);
-		while ((rcpt = ll_next(recipients, &pos)))
-		{
-			/*
-			 * vlist stores var_t pointers!
-			 */
-			envrcpt = rcpt->v_data;
-			defer = greylist_recipient(gl, &delay, mailspec,
-			    origin, envfrom, envrcpt, *received);
-
-			/*
-			 * We are in message context! Greylist if any recipient
-			 * requires to. Errors are checked below.
-			 */
-			if (defer)
-			{
-				break;
-			}
-
-			if (delay > max_delay)
-			{
-				max_delay = delay;
-			}
-		}
+		defer = greylist_recipients(gl, &max_delay, mailspec, origin,
+		    envfrom, recipients, *received);
 	}
 
 	if (defer == -1)
@@ -844,11 +984,10 @@ error:
 }
 
 /*
- * CAVEAT: greylist_dump_record is not thread safe. Needs to run in locked
- * context.
+ * Formats a greylist tuple for dbt_stream.
  */
 int
-greylist_dump_record(dbt_t *dbt, var_t *record)
+greylist_dump_record(dbt_t *dbt, var_t *record, char *buffer, int size)
 {
 	char *origin;
 	char *envfrom;
@@ -863,29 +1002,17 @@ greylist_dump_record(dbt_t *dbt, var_t *record)
 	VAR_INT_T *visa;
 	VAR_INT_T *passed;
 
-	char dump[DUMP_RECORD_BUFLEN];
-	char *p;
 	int len;
 	int expire_time;
 	int delay_time;
 	int now;
 
-	/*
-	 * Previous error
-	 */
-	if (greylist_dump_buffer_size == -1)
-	{
-		return -1;
-	}
-
 	if (vlist_dereference(record, &origin, &envfrom, &envrcpt, &created, &updated,
             &expire, &connections, &deadline, &delay, &attempts, &visa,
             &passed))
         {
                 log_sys_error("greylist_dump_record: vlist_dereference failed");
-		greylist_dump_buffer_size = -1;
 		return -1;
-		
         }
 
 	now = time(NULL);
@@ -893,97 +1020,32 @@ greylist_dump_record(dbt_t *dbt, var_t *record)
 	
 	if (*passed > 0)
 	{
-		len = snprintf(dump, sizeof dump,
+		len = snprintf(buffer, size,
 		    "%s: %s > %s: status=visa, messages=%ld, expires=%d\n",
 		    origin, envfrom, envrcpt, *passed, expire_time);
 	}
 	else
 	{
 		delay_time = now - *created;
-		len = snprintf(dump, sizeof dump, "%s: %s > %s: "
+		len = snprintf(buffer, size, "%s: %s > %s: "
 		    "status=defer, delay=%d/%ld, attempts=%ld/%ld, "
 		    "expires=%d\n", origin, envfrom, envrcpt, delay_time,
 		    *delay, *connections, *attempts, expire_time);
 	}
 
-	if (len >= sizeof dump)
+	if (len >= size)
 	{
 		log_error("greylist_dump_record: buffer exhausted");
-		greylist_dump_buffer_size = -1;
 		return -1;
 	}
 
-	greylist_dump_buffer_size += len;
-
-	p = realloc(*greylist_dump_buffer, greylist_dump_buffer_size + 1);
-	if (p == NULL)
-	{
-		greylist_dump_buffer_size = -1;
-		return -1;
-	}
-
-	/*
-         * First record
-         */
-	if (greylist_dump_buffer_size == len)
-	{
-		strcpy(p, dump);
-	}
-	else
-	{
-		strcat(p, dump);
-	}
-
-	*greylist_dump_buffer = p;
-
-	return 0;
+	return len;
 }
 
 int
-greylist_dump(char **dump)
+greylist_dump(dbt_stream_t *stream)
 {
-	/*
-	 * arguments to greylist_dump_record are passed through static globals
-	 * hence greylist_dump is mutex.
-	 */
-	if (pthread_mutex_lock(&greylist_dump_mutex))
-	{
-		log_sys_error("greylist_dump: pthread_mutex_lock");
-		return -1;
-	}
-
-	/*
-	 * For safety we require *dump to be NULL.
-	 */
-	if (*dump)
-	{
-		greylist_dump_buffer_size = -1;
-		goto error;
-	}
-
-	greylist_dump_buffer = dump;
-	greylist_dump_buffer_size = 0;
-
-	dbt_db_walk(&greylist_dbt, (dbt_db_callback_t) greylist_dump_record);
-
-	if (greylist_dump_buffer_size == -1)
-	{
-		if (*greylist_dump_buffer)
-		{
-			free(*greylist_dump_buffer);
-			*greylist_dump_buffer = NULL;
-		}
-
-		log_error("greylist_dump: greylist_dump_record failed");
-
-		goto error;
-	}
-
-error:
-	if (pthread_mutex_unlock(&greylist_dump_mutex))
-	{
-		log_sys_error("greylist_dump: pthread_mutex_unlock");
-	}
+	stream->dst_format = greylist_dump_record;
 
-	return greylist_dump_buffer_size;
+	return dbt_stream(&greylist_dbt, stream);
 }
@@ -1,9 +1,35 @@
 #include <config.h>
 
 #include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
 
 #include <hash.h>
 
+#ifdef DEBUG
+#include <stdio.h>
+#include <stdlib.h>
+#include <log.h>
+#endif
+
+/*
+ * Per process seed of hash_fast. Remote peers can't predict bucket
+ * positions of envelope addresses and craft collisions.
+ */
+static uint64_t hash_seed;
+static pthread_once_t hash_seed_once = PTHREAD_ONCE_INIT;
+
+/*
+ * wyhash constants
+ */
+static const uint64_t hash_secret[4] = {
+	0x2d358dccaa6c78a5ULL, 0x8bb84b93962eacc9ULL,
+	0x4b33a62ed433d4a3ULL, 0x4d5a2da51de1aa47ULL
+};
+
 hash_t
 hash_one_at_a_time(char *key, uint32_t len)
 {
@@ -54,3 +80,340 @@ hash_chain(void *key, uint32_t len)
 {
 	return hash_test(key, len) % 5;
 }
+
+/*
+ * Returns a random seed for hash_wy
+ */
+uint64_t
+hash_random_seed(void)
+{
+	uint64_t seed;
+	int fd, n = 0;
+
+	fd = open("/dev/urandom", O_RDONLY);
+	if (fd >= 0)
+	{
+		n = read(fd, &seed, sizeof seed);
+		close(fd);
+	}
+
+	if (n != sizeof seed)
+	{
+		seed = (uint64_t) time(NULL) << 32 ^ getpid() ^
+		    (uintptr_t) &n;
+	}
+
+	return seed;
+}
+
+static void
+hash_seed_init(void)
+{
+	hash_seed = hash_random_seed();
+
+	return;
+}
+
+/*
+ * 64x64 -> 128 bit multiplication. Returns low and high half in a and b.
+ */
+static inline void
+hash_mum(uint64_t *a, uint64_t *b)
+{
+#ifdef __SIZEOF_INT128__
+	__uint128_t r = *a;
+
+	r *= *b;
+	*a = (uint64_t) r;
+	*b = (uint64_t) (r >> 64);
+#else
+	uint64_t ha = *a >> 32, hb = *b >> 32;
+	uint64_t la = (uint32_t) *a, lb = (uint32_t) *b;
+	uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+	uint64_t t = rl + (rm0 << 32), c = t < rl, lo, hi;
+
+	lo = t + (rm1 << 32);
+	c += lo < t;
+	hi = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+	*a = lo;
+	*b = hi;
+#endif
+
+	return;
+}
+
+static inline uint64_t
+hash_mix(uint64_t a, uint64_t b)
+{
+	hash_mum(&a, &b);
+
+	return a ^ b;
+}
+
+static inline uint64_t
+hash_r8(const uint8_t *p)
+{
+	uint64_t v;
+
+	memcpy(&v, p, sizeof v);
+
+	return v;
+}
+
+static inline uint64_t
+hash_r4(const uint8_t *p)
+{
+	uint32_t v;
+
+	memcpy(&v, p, sizeof v);
+
+	return v;
+}
+
+/*
+ * wyhash (final version 4, public domain). Reads 8 bytes per step instead
+ * of one.
+ */
+uint64_t
+hash_wy(void *key, uint32_t len, uint64_t seed)
+{
+	const uint8_t *p = key;
+	const uint64_t *s = hash_secret;
+	uint64_t a, b, see1, see2;
+	uint32_t i = len;
+
+	seed ^= hash_mix(seed ^ s[0], s[1]);
+
+	if (len <= 16)
+	{
+		if (len >= 4)
+		{
+			a = hash_r4(p) << 32 | hash_r4(p + ((len >> 3) << 2));
+			b = hash_r4(p + len - 4) << 32 |
+			    hash_r4(p + len - 4 - ((len >> 3) << 2));
+		}
+		else if (len > 0)
+		{
+			a = (uint64_t) p[0] << 16 | (uint64_t) p[len >> 1] << 8 |
+			    p[len - 1];
+			b = 0;
+		}
+		else
+		{
+			a = b = 0;
+		}
+	}
+	else
+	{
+		if (i > 48)
+		{
+			see1 = see2 = seed;
+			do
+			{
+				seed = hash_mix(hash_r8(p) ^ s[1],
+				    hash_r8(p + 8) ^ seed);
+				see1 = hash_mix(hash_r8(p + 16) ^ s[2],
+				    hash_r8(p + 24) ^ see1);
+				see2 = hash_mix(hash_r8(p + 32) ^ s[3],
+				    hash_r8(p + 40) ^ see2);
+				p += 48;
+				i -= 48;
+			}
+			while (i > 48);
+
+			seed ^= see1 ^ see2;
+		}
+
+		while (i > 16)
+		{
+			seed = hash_mix(hash_r8(p) ^ s[1], hash_r8(p + 8) ^ seed);
+			i -= 16;
+			p += 16;
+		}
+
+		a = hash_r8(p + i - 16);
+		b = hash_r8(p + i - 8);
+	}
+
+	a ^= s[1];
+	b ^= seed;
+	hash_mum(&a, &b);
+
+	return hash_mix(a ^ s[0] ^ len, b ^ s[1]);
+}
+
+hash_t
+hash_fast(void *key, uint32_t len)
+{
+	pthread_once(&hash_seed_once, hash_seed_init);
+
+	return hash_wy(key, len, hash_seed);
+}
+
+#ifdef DEBUG
+
+#define HASH_BENCH_ROUNDS 20
+#define HASH_BENCH_KEYLEN 128
+
+typedef hash_t (*hash_func_t)(void *key, uint32_t len);
+
+typedef struct hash_bench_func {
+	char			*hbf_name;
+	hash_func_t		 hbf_func;
+} hash_bench_func_t;
+
+static hash_bench_func_t hash_bench_funcs[] = {
+	{ "fast",		hash_fast },
+	{ "one_at_a_time",	(hash_func_t) hash_one_at_a_time },
+	{ "djb",		hash_djb },
+	{ NULL,			NULL }
+};
+
+static char *hash_bench_shapes[] = { "greylist", "addr", "symbol", "int",
+    NULL };
+
+/*
+ * Writes key i of shape into buffer. Greylist keys look like packed
+ * origin, sender and recipient tuples of a few mail servers.
+ */
+static int
+hash_bench_key(char *shape, int i, char *buffer)
+{
+	int n;
+
+	if (strcmp(shape, "greylist") == 0)
+	{
+		n = snprintf(buffer, HASH_BENCH_KEYLEN,
+		    "192.0.2.%d%cnewsletter%d@mail.example.com%cuser%d@example.org",
+		    i % 16, 0, i / 256, 0, i % 256);
+		return n + 1;
+	}
+
+	if (strcmp(shape, "addr") == 0)
+	{
+		n = snprintf(buffer, HASH_BENCH_KEYLEN, "10.%d.%d.%d",
+		    i >> 16 & 0xff, i >> 8 & 0xff, i & 0xff);
+		return n + 1;
+	}
+
+	if (strcmp(shape, "symbol") == 0)
+	{
+		n = snprintf(buffer, HASH_BENCH_KEYLEN, "counter_relay_%d", i);
+		return n + 1;
+	}
+
+	memcpy(buffer, &i, sizeof i);
+
+	return sizeof i;
+}
+
+static double
+hash_bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * Hashes keys of several shapes with each function. Reports throughput
+ * and bucket collisions in a table with twice as many buckets as keys
+ * (ht_t resizes at 50% load) next to the expected number of collisions
+ * of a uniform hash.
+ */
+void
+hash_bench(int keys)
+{
+	hash_bench_func_t *hbf;
+	char **shape;
+	char *buffer = NULL;
+	uint32_t *len = NULL, *chain = NULL;
+	hash_t mask, sum = 0;
+	uint32_t max;
+	double start, seconds, bytes, empty, expected;
+	int i, r, buckets, collisions;
+
+	for (buckets = 16; buckets < keys * 2; buckets *= 2);
+	mask = buckets - 1;
+
+	buffer = malloc(keys * HASH_BENCH_KEYLEN);
+	len = malloc(keys * sizeof (uint32_t));
+	chain = malloc(buckets * sizeof (uint32_t));
+	if (buffer == NULL || len == NULL || chain == NULL)
+	{
+		log_sys_error("hash_bench: malloc");
+		goto exit;
+	}
+
+	// A bucket stays empty with probability (1 - 1 / buckets) ^ keys
+	for (i = 0, empty = 1; i < keys; ++i)
+	{
+		empty *= 1 - 1.0 / buckets;
+	}
+	expected = keys - buckets * (1 - empty);
+
+	for (shape = hash_bench_shapes; *shape; ++shape)
+	{
+		for (i = 0, bytes = 0; i < keys; ++i)
+		{
+			len[i] = hash_bench_key(*shape,
+			    i, buffer + i * HASH_BENCH_KEYLEN);
+			bytes += len[i];
+		}
+
+		for (hbf = hash_bench_funcs; hbf->hbf_name; ++hbf)
+		{
+			start = hash_bench_now();
+			for (r = 0; r < HASH_BENCH_ROUNDS; ++r)
+			{
+				for (i = 0; i < keys; ++i)
+				{
+					sum += hbf->hbf_func(buffer +
+					    i * HASH_BENCH_KEYLEN, len[i]);
+				}
+			}
+			seconds = hash_bench_now() - start;
+
+			memset(chain, 0, buckets * sizeof (uint32_t));
+			for (i = 0, collisions = 0, max = 0; i < keys; ++i)
+			{
+				r = hbf->hbf_func(buffer + i * HASH_BENCH_KEYLEN,
+				    len[i]) & mask;
+				collisions += chain[r]++ > 0;
+				max = chain[r] > max? chain[r]: max;
+			}
+
+			printf("hash=%s keys=%s n=%d ns_per_key=%.1f "
+			    "mb_per_sec=%.0f collisions=%d expected=%.0f "
+			    "max_chain=%u\n", hbf->hbf_name, *shape, keys,
+			    seconds * 1e9 / keys / HASH_BENCH_ROUNDS,
+			    bytes * HASH_BENCH_ROUNDS / seconds / 1e6,
+			    collisions, expected, max);
+		}
+	}
+
+	// Keep the compiler from dropping the loops
+	log_debug("hash_bench: checksum %lu", (unsigned long) sum);
+
+exit:
+	if (buffer)
+	{
+		free(buffer);
+	}
+
+	if (len)
+	{
+		free(len);
+	}
+
+	if (chain)
+	{
+		free(chain);
+	}
+
+	return;
+}
+
+#endif
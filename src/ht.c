@@ -9,6 +9,11 @@
 #include <hash.h>
 #include <log.h>
 
+#ifdef DEBUG
+#include <time.h>
+#include <test.h>
+#endif
+
 /*
  * Debug if collisions reach 20%
  */
@@ -19,6 +24,14 @@
  */
 #define MAX_LOAD 50
 
+/*
+ * Buckets moved to the resized table per insert or remove. Bounds the
+ * pause of a single operation. Migration has to finish before the next
+ * resize: the resized table takes ht_old_buckets / 2 inserts to reach
+ * MAX_LOAD again.
+ */
+#define MIGRATE_BUCKETS 64
+
 int
 ht_init(ht_t *ht, hash_t buckets, ht_hash_t hash, ht_match_t match,
 	ht_delete_t delete)
@@ -31,6 +44,9 @@ ht_init(ht_t *ht, hash_t buckets, ht_hash_t hash, ht_match_t match,
 	bzero(ht->ht_table, buckets * sizeof(ht_record_t *));
 
 	ht->ht_buckets = buckets;
+	ht->ht_old = NULL;
+	ht->ht_old_buckets = 0;
+	ht->ht_migrate = 0;
 	ht->ht_hash = hash;
 	ht->ht_match = match;
 	ht->ht_delete = delete;
@@ -61,15 +77,15 @@ ht_create(hash_t buckets, ht_hash_t hash, ht_match_t match, ht_delete_t delete)
 }
 
 
-void
-ht_clear(ht_t *ht)
+static void
+ht_clear_table(ht_t *ht, ht_record_t **table, hash_t buckets)
 {
 	ht_record_t *record;
 	ht_record_t *next;
 	hash_t i;
 
-	for(i = 0; i < ht->ht_buckets; ++i) {
-		for(record = ht->ht_table[i]; record != NULL; record = next) {
+	for(i = 0; i < buckets; ++i) {
+		for(record = table[i]; record != NULL; record = next) {
 			next = record->htr_next;
 			if(ht->ht_delete) {
 				ht->ht_delete(record->htr_data);
@@ -78,7 +94,22 @@ ht_clear(ht_t *ht)
 		}
 	}
 
-	free(ht->ht_table);
+	free(table);
+
+	return;
+}
+
+
+void
+ht_clear(ht_t *ht)
+{
+	if (ht->ht_old)
+	{
+		ht_clear_table(ht, ht->ht_old, ht->ht_old_buckets);
+		ht->ht_old = NULL;
+	}
+
+	ht_clear_table(ht, ht->ht_table, ht->ht_buckets);
 
 	return;
 }
@@ -94,24 +125,126 @@ ht_delete(ht_t *ht)
 }
 
 
-void *
-ht_lookup(ht_t *ht, void *data)
+/*
+ * Returns the chain holding records with hash. Old buckets are used until
+ * they are migrated.
+ */
+static ht_record_t **
+ht_chain(ht_t *ht, hash_t hash)
 {
-	ht_record_t *record;
 	hash_t bucket;
 
-	bucket = ht->ht_hash(data) % ht->ht_buckets;
+	if (ht->ht_old)
+	{
+		bucket = hash % ht->ht_old_buckets;
+		if (bucket >= ht->ht_migrate)
+		{
+			return ht->ht_old + bucket;
+		}
+	}
+
+	return ht->ht_table + hash % ht->ht_buckets;
+}
 
-	if(ht->ht_table[bucket] == NULL) {
-		return NULL;
+
+static void
+ht_link(ht_t *ht, ht_record_t *record)
+{
+	ht_record_t **chain;
+	hash_t bucket;
+
+	if (ht->ht_old &&
+	    (bucket = record->htr_hash % ht->ht_old_buckets) >= ht->ht_migrate)
+	{
+		chain = ht->ht_old + bucket;
+	}
+	else
+	{
+		bucket = record->htr_hash % ht->ht_buckets;
+		chain = ht->ht_table + bucket;
+
+		// ht_head is a lower bound of the first used bucket
+		if (bucket < ht->ht_head || ht->ht_records == 0) {
+			ht->ht_head = bucket;
+		}
 	}
 
-	for(record = ht->ht_table[bucket];
+	if (*chain != NULL) {
+		++ht->ht_collisions;
+	}
+
+	record->htr_next = *chain;
+	*chain = record;
+
+	return;
+}
+
+
+/*
+ * Moves up to n buckets of ht_old to ht_table. Records are relinked with
+ * their cached hash, hence migration neither hashes nor allocates.
+ */
+static void
+ht_migrate(ht_t *ht, hash_t n)
+{
+	ht_record_t *record;
+	ht_record_t *next;
+
+	for (; ht->ht_old && n > 0; --n)
+	{
+		record = ht->ht_old[ht->ht_migrate];
+		ht->ht_old[ht->ht_migrate] = NULL;
+
+		// Bucket is migrated: ht_link uses ht_table from now on
+		++ht->ht_migrate;
+
+		for (; record != NULL; record = next)
+		{
+			next = record->htr_next;
+
+			// Record leaves a collision chain
+			if (next != NULL)
+			{
+				--ht->ht_collisions;
+			}
+
+			ht_link(ht, record);
+		}
+
+		if (ht->ht_migrate < ht->ht_old_buckets)
+		{
+			continue;
+		}
+
+		free(ht->ht_old);
+		ht->ht_old = NULL;
+		ht->ht_old_buckets = 0;
+		ht->ht_migrate = 0;
+
+		log_info("ht_resize: successful, records=%d (%.1f%%), "
+		    "collisions=%d (%.1f%%)", ht->ht_records, HT_LOADFACTOR(ht),
+		    ht->ht_collisions, HT_COLLFACTOR(ht));
+	}
+
+	return;
+}
+
+
+/*
+ * Cached hashes reject most mismatches without calling ht_match.
+ */
+static ht_record_t *
+ht_find(ht_t *ht, void *data, hash_t hash)
+{
+	ht_record_t *record;
+
+	for(record = *ht_chain(ht, hash);
 		record != NULL;
 		record = record->htr_next)
 	{
-		if(ht->ht_match(data, record->htr_data)) {
-			return record->htr_data;
+		if(record->htr_hash == hash &&
+		    ht->ht_match(data, record->htr_data)) {
+			return record;
 		}
 	}
 
@@ -119,73 +252,128 @@ ht_lookup(ht_t *ht, void *data)
 }
 
 
+void *
+ht_lookup(ht_t *ht, void *data)
+{
+	ht_record_t *record;
+
+	/*
+	 * Lookups don't migrate buckets. Tables that are only read after
+	 * initialization are looked up by several threads without locking.
+	 */
+	record = ht_find(ht, data, ht->ht_hash(data));
+	if(record == NULL) {
+		return NULL;
+	}
+
+	return record->htr_data;
+}
+
+
+/*
+ * Returns the first used bucket of table in or after bucket.
+ */
+static hash_t
+ht_used(ht_record_t **table, hash_t buckets, hash_t bucket)
+{
+	for(; bucket < buckets && table[bucket] == NULL; ++bucket);
+
+	return bucket;
+}
+
+
+/*
+ * Iteration visits the remaining buckets of ht_old first. The table must
+ * not be modified while iterating.
+ */
 void
 ht_start(ht_t *ht, ht_pos_t *pos)
 {
-	if(ht->ht_records)
+	hash_t bucket;
+
+	if(ht->ht_records == 0)
 	{
-		pos->htp_bucket = ht->ht_head;
-		pos->htp_record = ht->ht_table[ht->ht_head];
+		ht_seek(ht, pos, ht->ht_buckets);
+		return;
 	}
-	else
+
+	if(ht->ht_old)
+	{
+		bucket = ht_used(ht->ht_old, ht->ht_old_buckets,
+		    ht->ht_migrate);
+		if (bucket < ht->ht_old_buckets)
+		{
+			pos->htp_bucket = bucket;
+			pos->htp_record = ht->ht_old[bucket];
+			pos->htp_old = 1;
+
+			return;
+		}
+	}
+
+	ht_seek(ht, pos, ht->ht_head);
+
+	return;
+}
+
+/*
+ * Position pos at the first record in or after bucket of ht_table.
+ */
+void
+ht_seek(ht_t *ht, ht_pos_t *pos, hash_t bucket)
+{
+	bucket = ht_used(ht->ht_table, ht->ht_buckets, bucket);
+
+	pos->htp_old = 0;
+
+	if(bucket >= ht->ht_buckets)
 	{
 		pos->htp_bucket = 0;
 		pos->htp_record = NULL;
+
+		return;
 	}
 
+	pos->htp_bucket = bucket;
+	pos->htp_record = ht->ht_table[bucket];
+
 	return;
 }
 
-int8_t
+static int8_t
 ht_resize(ht_t *ht)
 {
-	ht_t new;
-	ht_record_t *record;
-	uint32_t i, buckets;
-	
+	ht_record_t **table;
+	hash_t buckets;
+
+	// Only one resize at a time
+	if (ht->ht_old)
+	{
+		ht_migrate(ht, ht->ht_old_buckets);
+	}
+
 	buckets = ht->ht_buckets * 2;
 
 	log_error("ht_resize: load exceeded %.1f %% resize from %d to %d",
 	    HT_LOADFACTOR(ht), ht->ht_buckets, buckets);
 
-	/*
-	 * Create the new hash table. ht_delete is set to NULL to prevent data
-	 * loss in case of an error.
-	 */
-	if (ht_init(&new, buckets, ht->ht_hash, ht->ht_match, NULL))
+	table = calloc(buckets, sizeof (ht_record_t *));
+	if (table == NULL)
 	{
-		log_error("ht_resize: ht_init failed");
+		log_sys_error("ht_resize: calloc");
 		return -1;
 	}
 
-	for(i = 0; i < ht->ht_buckets; ++i)
-	{
-		for (record = ht->ht_table[i];
-		    record != NULL;
-		    record = record->htr_next)
-		{
-			if(ht_insert(&new, record->htr_data))
-			{
-				log_error("ht_resize: ht_insert failed");
-				ht_clear(&new);
-				return -1;
-			}
-		}
-	}
-
 	/*
-	 * Swap ht_delete
+	 * Records are moved by ht_migrate. The new table is empty, ht_head
+	 * points past its end.
 	 */
-	new.ht_delete = ht->ht_delete;
-	ht->ht_delete = NULL;
-
-	ht_clear(ht);
-
-	memcpy(ht, &new, sizeof(ht_t));
-
-	log_info("ht_resize: successful, records=%d (%.1f%%), collisions=%d "
-	    "(%.1f%%)", ht->ht_records, HT_LOADFACTOR(ht), ht->ht_collisions,
-	    HT_COLLFACTOR(ht));
+	ht->ht_old = ht->ht_table;
+	ht->ht_old_buckets = ht->ht_buckets;
+	ht->ht_migrate = 0;
+	ht->ht_table = table;
+	ht->ht_buckets = buckets;
+	ht->ht_head = buckets;
 
 	return 0;
 }
@@ -194,15 +382,17 @@ int8_t
 ht_insert(ht_t *ht, void *data)
 {
 	ht_record_t *record;
-	hash_t bucket;
+	hash_t hash;
 	float cf;
 
-	if(ht_lookup(ht, data) != NULL) {
+	hash = ht->ht_hash(data);
+
+	if(ht_find(ht, data, hash) != NULL) {
 		log_debug("ht_insert: duplicate entry");
 		return -1;
 	}
 
-	bucket = ht->ht_hash(data) % ht->ht_buckets;
+	ht_migrate(ht, MIGRATE_BUCKETS);
 
 	if((record = malloc(sizeof (ht_record_t))) == NULL) {
 		log_sys_warning("ht_insert: malloc");
@@ -210,19 +400,9 @@ ht_insert(ht_t *ht, void *data)
 	}
 
 	record->htr_data = data;
-	record->htr_next =
-		ht->ht_table[bucket] != NULL ? ht->ht_table[bucket] : NULL;
+	record->htr_hash = hash;
 
-	if(ht->ht_table[bucket] != NULL) {
-		++ht->ht_collisions;
-	}
-
-
-	if(bucket < ht->ht_head || ht->ht_records == 0) {
-		ht->ht_head = bucket;
-	}
-
-	ht->ht_table[bucket] = record;
+	ht_link(ht, record);
 	++ht->ht_records;
 
 	cf = HT_COLLFACTOR(ht);
@@ -251,32 +431,20 @@ ht_remove(ht_t *ht, void *data)
 {
 	ht_record_t *record;
 	ht_record_t **prev;
-	hash_t bucket;
-	int collision = 0;
+	ht_record_t **chain;
+	hash_t hash;
 
-	bucket = ht->ht_hash(data) % ht->ht_buckets;
+	ht_migrate(ht, MIGRATE_BUCKETS);
 
-	if(ht->ht_table[bucket] == NULL) {
-		log_debug("ht_remove: record not found");
-		return;
-	}
-	
-	record = ht->ht_table[bucket];
-	prev = &ht->ht_table[bucket];
+	hash = ht->ht_hash(data);
+	chain = ht_chain(ht, hash);
 
-	if (record->htr_next != NULL)
+	for (prev = chain; (record = *prev) != NULL; prev = &record->htr_next)
 	{
-		collision = 1;
-	}
-
-	while (record != NULL)
-	{
-		if(ht->ht_match(data, record->htr_data)) {
+		if(record->htr_hash == hash &&
+		    ht->ht_match(data, record->htr_data)) {
 			break;
 		}
-
-		record = record->htr_next;
-		prev = &(*prev)->htr_next;
 	}
 
 	/*
@@ -286,7 +454,15 @@ ht_remove(ht_t *ht, void *data)
 		log_debug("ht_remove: record not found");
 		return;
 	}
-	
+
+	/*
+	 * Adjust collision counter
+	 */
+	if ((*chain)->htr_next != NULL)
+	{
+		--ht->ht_collisions;
+	}
+
 	if(ht->ht_delete) {
 		ht->ht_delete(record->htr_data);
 	}
@@ -294,38 +470,22 @@ ht_remove(ht_t *ht, void *data)
 	*prev = record->htr_next;
 	free(record);
 
-	if(ht->ht_table[bucket] != NULL) {
-		--ht->ht_collisions;
-	}
 	--ht->ht_records;
 
-	/*
-	 * Adjust collision counter
-	 */
-	if (collision)
-	{
-		--ht->ht_collisions;
-	}
-
 	return;
 }
 
 
-void
-ht_dump(ht_t *ht, void (*print_data)(void *data))
+static void
+ht_dump_table(ht_record_t **table, hash_t buckets,
+    void (*print_data)(void *data))
 {
 	ht_record_t *record;
 	hash_t i;
 
-	printf("HASHTABLE DUMP\n");
-	printf("%4lu buckets\n", (unsigned long) ht->ht_buckets);
-	printf("%4lu records\n", (unsigned long) ht->ht_records);
-	printf("%4lu collisions\n", (unsigned long) ht->ht_collisions);
-	printf("\nTABLE RECORDS\n");
-
-	for(i = 0; i < ht->ht_buckets; ++i) {
-		printf("%4lu %p", (unsigned long) i, ht->ht_table[i]);
-		for(record = ht->ht_table[i];
+	for(i = 0; i < buckets; ++i) {
+		printf("%4lu %p", (unsigned long) i, table[i]);
+		for(record = table[i];
 			record != NULL;
 			record = record->htr_next)
 		{
@@ -336,6 +496,29 @@ ht_dump(ht_t *ht, void (*print_data)(void *data))
 		printf("\n");
 	}
 
+	return;
+}
+
+
+void
+ht_dump(ht_t *ht, void (*print_data)(void *data))
+{
+	printf("HASHTABLE DUMP\n");
+	printf("%4lu buckets\n", (unsigned long) ht->ht_buckets);
+	printf("%4lu records\n", (unsigned long) ht->ht_records);
+	printf("%4lu collisions\n", (unsigned long) ht->ht_collisions);
+
+	if (ht->ht_old)
+	{
+		printf("\nOLD TABLE RECORDS (%lu/%lu migrated)\n",
+		    (unsigned long) ht->ht_migrate,
+		    (unsigned long) ht->ht_old_buckets);
+		ht_dump_table(ht->ht_old, ht->ht_old_buckets, print_data);
+	}
+
+	printf("\nTABLE RECORDS\n");
+	ht_dump_table(ht->ht_table, ht->ht_buckets, print_data);
+
 	printf("\n");
 
 	return;
@@ -345,19 +528,16 @@ ht_dump(ht_t *ht, void (*print_data)(void *data))
 int
 ht_walk(ht_t *ht, int (*callback)(void *data))
 {
-	ht_record_t *record;
-	hash_t i;
+	ht_pos_t pos;
+	void *data;
 	int r;
 
-	for(i = 0; i < ht->ht_buckets; ++i) {
-		for(record = ht->ht_table[i];
-			record != NULL;
-			record = record->htr_next)
-		{
-			if((r = callback(record->htr_data))) {
-				log_debug("ht_walk: callback returned %d", r);
-				return r;
-			}
+	ht_start(ht, &pos);
+	while ((data = ht_next(ht, &pos)))
+	{
+		if((r = callback(data))) {
+			log_debug("ht_walk: callback returned %d", r);
+			return r;
 		}
 	}
 
@@ -396,25 +576,258 @@ ht_next(ht_t *ht, ht_pos_t *pos)
 	}
 
 	/*
-	 * Next bucket
+	 * Next bucket of ht_table
 	 */
-	for(i = pos->htp_bucket + 1;
-	    i < ht->ht_buckets && ht->ht_table[i] == NULL;
-	    ++i);
+	if(!pos->htp_old)
+	{
+		ht_seek(ht, pos, pos->htp_bucket + 1);
+
+		return record->htr_data;
+	}
 
 	/*
-	 * Last record
+	 * Next bucket of ht_old or first bucket of ht_table
 	 */
-	if(i == ht->ht_buckets)
+	i = ht_used(ht->ht_old, ht->ht_old_buckets, pos->htp_bucket + 1);
+	if(i == ht->ht_old_buckets)
 	{
-		pos->htp_bucket = 0;
-		pos->htp_record = NULL;
+		ht_seek(ht, pos, ht->ht_head);
 
 		return record->htr_data;
 	}
 
 	pos->htp_bucket = i;
-	pos->htp_record = ht->ht_table[i];
+	pos->htp_record = ht->ht_old[i];
 
 	return record->htr_data;
 }
+
+#ifdef DEBUG
+
+#define HT_TEST_RECORDS 20000
+
+static hash_t
+ht_test_hash(int *i)
+{
+	return HASH((char *) i, sizeof *i);
+}
+
+static int
+ht_test_match(int *i1, int *i2)
+{
+	return *i1 == *i2;
+}
+
+static int
+ht_test_count(ht_t *ht)
+{
+	ht_pos_t pos;
+	int n = 0;
+
+	ht_start(ht, &pos);
+	while (ht_next(ht, &pos))
+	{
+		++n;
+	}
+
+	return n;
+}
+
+/*
+ * Returns the number of buckets migrated by the last operation. old and
+ * before are ht_old and ht_migrate before the operation.
+ */
+static hash_t
+ht_test_step(ht_t *ht, ht_record_t **old, hash_t buckets, hash_t before)
+{
+	if (old == NULL)
+	{
+		return 0;
+	}
+
+	// Migration finished
+	if (ht->ht_old != old)
+	{
+		return buckets - before;
+	}
+
+	return ht->ht_migrate - before;
+}
+
+void
+ht_test(int n)
+{
+	ht_t ht;
+	ht_record_t **old, **checked = NULL;
+	hash_t buckets, before, step, max_step = 0;
+	int *values;
+	int i, j, found;
+
+	// The migration state is read before the first insert
+	memset(&ht, 0, sizeof ht);
+
+	values = (int *) malloc(HT_TEST_RECORDS * sizeof (int));
+	TEST_ASSERT(values != NULL);
+	TEST_ASSERT(ht_init(&ht, 16, (ht_hash_t) ht_test_hash,
+	    (ht_match_t) ht_test_match, NULL) == 0);
+
+	for (i = 0; i < HT_TEST_RECORDS; ++i)
+	{
+		values[i] = n * HT_TEST_RECORDS + i;
+
+		old = ht.ht_old;
+		buckets = ht.ht_old_buckets;
+		before = ht.ht_migrate;
+		TEST_ASSERT(ht_insert(&ht, values + i) == 0);
+
+		step = ht_test_step(&ht, old, buckets, before);
+		max_step = step > max_step? step: max_step;
+
+		// Check every resize once half of the buckets are migrated
+		if (ht.ht_old == NULL || ht.ht_old == checked ||
+		    ht.ht_migrate < ht.ht_old_buckets / 2)
+		{
+			continue;
+		}
+
+		checked = ht.ht_old;
+
+		TEST_ASSERT(ht_test_count(&ht) == i + 1);
+		TEST_ASSERT(ht_insert(&ht, values) == -1);
+
+		for (j = 0, found = 0; j <= i; ++j)
+		{
+			found += ht_lookup(&ht, values + j) == values + j;
+		}
+		TEST_ASSERT(found == i + 1);
+	}
+
+	TEST_ASSERT(ht.ht_buckets >= HT_TEST_RECORDS * 100 / MAX_LOAD);
+	TEST_ASSERT(ht_test_count(&ht) == HT_TEST_RECORDS);
+
+	// Remove every second record
+	for (i = 0; i < HT_TEST_RECORDS; i += 2)
+	{
+		old = ht.ht_old;
+		buckets = ht.ht_old_buckets;
+		before = ht.ht_migrate;
+		ht_remove(&ht, values + i);
+
+		step = ht_test_step(&ht, old, buckets, before);
+		max_step = step > max_step? step: max_step;
+	}
+
+	TEST_ASSERT(HT_RECORDS(&ht) == HT_TEST_RECORDS / 2);
+	TEST_ASSERT(ht_test_count(&ht) == HT_TEST_RECORDS / 2);
+	TEST_ASSERT(ht.ht_collisions >= 0 &&
+	    ht.ht_collisions < HT_RECORDS(&ht));
+
+	for (i = 0, found = 0; i < HT_TEST_RECORDS; ++i)
+	{
+		found += (ht_lookup(&ht, values + i) != NULL) == (i % 2);
+	}
+	TEST_ASSERT(found == HT_TEST_RECORDS);
+
+	// No operation migrated more than MIGRATE_BUCKETS buckets
+	TEST_ASSERT(max_step <= MIGRATE_BUCKETS);
+
+	ht_clear(&ht);
+	free(values);
+
+	return;
+}
+
+static int
+ht_bench_compare(const void *a, const void *b)
+{
+	unsigned long x = *(unsigned long *) a;
+	unsigned long y = *(unsigned long *) b;
+
+	return x < y? -1: x > y;
+}
+
+static unsigned long
+ht_bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+/*
+ * Inserts records into an ht_t and reports the pause of single inserts.
+ * full_rehash_us is the time it takes to move all buckets at once, i.e.
+ * the pause without incremental resizing.
+ */
+void
+ht_bench(int records)
+{
+	ht_t ht;
+	unsigned long *latency, start, total;
+	int *values;
+	int i;
+
+	values = (int *) malloc(records * sizeof (int));
+	latency = (unsigned long *) malloc(records * sizeof (unsigned long));
+	if (values == NULL || latency == NULL)
+	{
+		log_sys_error("ht_bench: malloc");
+		goto exit;
+	}
+
+	if (ht_init(&ht, 16, (ht_hash_t) ht_test_hash,
+	    (ht_match_t) ht_test_match, NULL))
+	{
+		log_error("ht_bench: ht_init failed");
+		goto exit;
+	}
+
+	total = ht_bench_now();
+
+	for (i = 0; i < records; ++i)
+	{
+		values[i] = i;
+
+		start = ht_bench_now();
+		ht_insert(&ht, values + i);
+		latency[i] = ht_bench_now() - start;
+	}
+
+	total = ht_bench_now() - total;
+
+	qsort(latency, records, sizeof (unsigned long), ht_bench_compare);
+
+	// Stop-the-world rehash of the same table for comparison
+	ht_migrate(&ht, ht.ht_old_buckets);
+	ht_resize(&ht);
+	start = ht_bench_now();
+	ht_migrate(&ht, ht.ht_old_buckets);
+	start = ht_bench_now() - start;
+
+	printf("table=ht records=%d buckets=%lu inserts_per_sec=%.0f "
+	    "p50_us=%.1f p99_us=%.1f p999_us=%.1f max_us=%.1f "
+	    "full_rehash_us=%.1f\n", records, (unsigned long) ht.ht_buckets,
+	    records / (total / 1e9), latency[records / 2] / 1e3,
+	    latency[(int) (records * 0.99)] / 1e3,
+	    latency[(int) (records * 0.999)] / 1e3,
+	    latency[records - 1] / 1e3, start / 1e3);
+
+	ht_clear(&ht);
+
+exit:
+	if (values)
+	{
+		free(values);
+	}
+
+	if (latency)
+	{
+		free(latency);
+	}
+
+	return;
+}
+
+#endif
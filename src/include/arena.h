@@ -0,0 +1,46 @@
+#ifndef _ARENA_H_
+#define _ARENA_H_
+
+/*
+ * Includes
+ */
+
+#include <sys/types.h>
+
+/*
+ * Types
+ */
+
+/*
+ * Arenas hand out memory from chunks and release it in bulk. There's no
+ * per allocation free. Arenas are not thread safe.
+ */
+#define ARENA_CHUNK	4096
+#define ARENA_ALIGN	16
+
+typedef struct arena_chunk {
+	struct arena_chunk	*ac_next;
+	size_t			 ac_size;
+	size_t			 ac_used;
+} arena_chunk_t;
+
+typedef struct arena {
+	arena_chunk_t		*a_chunks;
+	size_t			 a_chunk_size;
+	unsigned long		 a_allocs;
+} arena_t;
+
+/*
+ * Prototypes
+ */
+
+void arena_init(arena_t *arena, size_t chunk_size);
+void * arena_alloc(arena_t *arena, size_t size);
+void * arena_memdup(arena_t *arena, void *data, size_t size);
+char * arena_strdup(arena_t *arena, char *str);
+int arena_owns(arena_t *arena, void *p);
+void arena_reset(arena_t *arena);
+void arena_clear(arena_t *arena);
+void arena_test(int n);
+
+#endif /* _ARENA_H_ */
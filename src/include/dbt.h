@@ -4,12 +4,27 @@
 #include <pthread.h>
 
 #include <var.h>
+#include <vp.h>
 #include <sql.h>
+#include <dbt_cache.h>
+#include <dbt_pool.h>
+#include <dbt_index.h>
+#include <dbt_queue.h>
+#include <dbt_breaker.h>
+#include <dbt_stats.h>
+#include <dbt_stream.h>
 
 
 #define DBT_LOCK	1<<0
+#define DBT_POOL	1<<1
+#define DBT_SYNC_SELF	1<<2	/* dd_sync takes dbt_lock itself */
 #define DBT_FIELD_MAX   256
 
+/*
+ * Records visited per lock acquisition by dbt_db_walk and dbt_stream
+ */
+#define DBT_WALK_BATCH 64
+
 typedef void (*dbt_db_init_t)(void);
 typedef void (*dbt_db_cleanup_t)(void);
 typedef int (*dbt_db_open_t)(void *dbt);
@@ -17,10 +32,32 @@ typedef void (*dbt_db_close_t)(void *dbt);
 typedef int (*dbt_db_sync_t)(void *dbt);
 typedef int (*dbt_db_callback_t)(void *dbt, var_t *record);
 typedef int (*dbt_db_walk_t)(void *dbt, dbt_db_callback_t callback);
+
+/*
+ * Position of a batched table walk. Drivers resume from the last key
+ * (dc_key), a driver specific position (dc_pos) or the last record
+ * (dc_record). Positions need not be stable: memdb may visit records twice
+ * or not at all if the table is resized between batches.
+ */
+typedef struct dbt_cursor {
+	void			*dc_key;
+	int			 dc_klen;
+	int			 dc_size;
+	long			 dc_pos;
+	var_t			*dc_record;
+} dbt_cursor_t;
+
+typedef int (*dbt_db_scan_t)(void *dbt, dbt_cursor_t *cursor, int count,
+    dbt_db_callback_t callback);
 typedef int (*dbt_db_get_t)(void *dbt, var_t *record, var_t **result);
 typedef int (*dbt_db_set_t)(void *dbt, var_t *record);
 typedef int (*dbt_db_del_t)(void *dbt, var_t *record);
+typedef int (*dbt_db_mget_t)(void *dbt, int n, var_t **records,
+    var_t **results);
+typedef int (*dbt_db_mset_t)(void *dbt, int n, var_t **records);
 typedef int (*dbt_db_expire_t)(void *dbt);
+typedef int (*dbt_db_trans_t)(void *dbt);
+typedef int (*dbt_db_stats_t)(void *dbt, char *buffer, int size);
 
 typedef struct dbt_driver {
 	char			*dd_name;
@@ -31,9 +68,16 @@ typedef struct dbt_driver {
 	dbt_db_set_t		 dd_set;
 	dbt_db_get_t		 dd_get;
 	dbt_db_del_t		 dd_del;
+	dbt_db_mget_t		 dd_mget;
+	dbt_db_mset_t		 dd_mset;
 	dbt_db_walk_t		 dd_walk;
+	dbt_db_scan_t		 dd_scan;
 	dbt_db_expire_t	 	 dd_expire;
 	dbt_db_sync_t	 	 dd_sync;
+	dbt_db_stats_t		 dd_stats;
+	dbt_db_trans_t		 dd_begin;
+	dbt_db_trans_t		 dd_commit;
+	dbt_db_trans_t		 dd_rollback;
 	int			 dd_flags;
 	int			 dd_use_sql;
 	sql_t		 	 dd_sql;
@@ -52,12 +96,29 @@ typedef struct dbt {
 	int			  dbt_cleanup_interval;
 	int			  dbt_cleanup_schedule;
 	int			  dbt_cleanup_deleted;
+	int			  dbt_cleanup_running;
+	int			  dbt_cleanup_started;
+	long			  dbt_cleanup_duration;
+	int			  dbt_cleanup_last_deleted;
+	int			  dbt_expire_batch;
+	int			  dbt_expire_rate;
+	int			  dbt_fsync_interval;
+	int			  dbt_snapshot_interval;
 	int			(*dbt_validate)(struct dbt *, var_t *);
 	char			  dbt_expire_field[DBT_FIELD_MAX + 1];
 	char			 *dbt_drivername;
 	dbt_driver_t		 *dbt_driver;
 	void			 *dbt_handle;
 	int			  dbt_open;
+	dbt_cache_t		  dbt_cache;
+	dbt_pool_t		  dbt_pool;
+	sql_stmt_t		  dbt_stmt[SQL_STMT_MAX];
+	dbt_queue_t		  dbt_queue;
+	dbt_breaker_t		  dbt_breaker;
+	dbt_index_t		  dbt_index;
+	dbt_stats_t		  dbt_stats;
+	var_t			 *dbt_config;
+	struct dbt		 *dbt_parent;
 
 	pthread_mutex_t		  dbt_mutex;
 	pthread_mutexattr_t	  dbt_mutexattr;
@@ -69,35 +130,68 @@ typedef int (*dbt_validate_t)(dbt_t *dbt, var_t *record);
 #define DBT_DB_CLOSE(DBT) (dbt)->dbt_driver->dd_close(dbt)
 #define DBT_VALIDATE(dbt, var) (dbt)->dbt_validate(dbt, var)
 
+extern int dbt_sync;
+
 /*
  * Prototypes
  */
 void dbt_driver_register(dbt_driver_t *dd);
+int dbt_lock(dbt_t *dbt);
+void dbt_unlock(dbt_t *dbt);
+void dbt_db_close(dbt_t *dbt);
 int dbt_db_get(dbt_t *dbt, var_t *record, var_t **result);
 int dbt_db_set(dbt_t *dbt, var_t *record);
 int dbt_db_del(dbt_t *dbt, var_t *record);
+int dbt_db_mget(dbt_t *dbt, int n, var_t **records, var_t **results);
+int dbt_db_mset(dbt_t *dbt, int n, var_t **records);
+int dbt_key_match(var_t *lookup, var_t *record);
 int dbt_db_walk(dbt_t *dbt, dbt_db_callback_t callback);
+int dbt_db_scan(dbt_t *dbt, dbt_cursor_t *cursor, int count,
+    dbt_db_callback_t callback);
+int dbt_cursor_key(dbt_cursor_t *cursor, void *key, int klen);
+void dbt_cursor_record(dbt_cursor_t *cursor, var_t *record);
+void dbt_cursor_clear(dbt_cursor_t *cursor);
+hash_t dbt_scheme_hash(var_t *scheme);
 int dbt_db_sync(dbt_t *dbt);
 int dbt_db_cleanup(dbt_t *dbt);
+int dbt_janitor_stats(dbt_t *dbt, char **buffer, int *len);
 int dbt_db_get_from_table(dbt_t *dbt, var_t *attrs, var_t **record);
 int dbt_db_load_into_table(dbt_t *dbt, var_t *table);
+int dbt_configure(dbt_t *dbt, char *name, var_t *config);
 int dbt_register(char *name, dbt_t *dbt);
 int dbt_common_validate(dbt_t *dbt, var_t *record);
 int dbt_open_database(dbt_t *dbt);
+void dbt_close_database(dbt_t *dbt);
 void dbt_open_databases(void);
 void dbt_init(int start_threads);
 void dbt_clear();
 dbt_t * dbt_lookup(char *name);
-int dbt_dump(char **dump, char *tablename);
+int dbt_stats(char **dump, char *tablename);
 
 int dbt_test_memdb_init(void);
+int dbt_test_memdb_persist_init(void);
+int dbt_test_mmapdb_init(void);
+int dbt_test_cache_init(void);
+int dbt_test_queue_init(void);
 int dbt_test_bdb_init(void);
 int dbt_test_lite_init(void);
+int dbt_test_lite_mget_init(void);
 int dbt_test_pgsql_init(void);
 int dbt_test_mysql_init(void);
 int dbt_test_mongodb_init(void);
+int dbt_test_mongodb_mget_init(void);
+int dbt_test_tiered_init(void);
+int dbt_test_tiered_mget_init(void);
+int dbt_test_race_init(void);
+int dbt_test_mmapdb_driver_init(void);
+int dbt_test_breaker_init(void);
 void dbt_test_stage1(int n);
 void dbt_test_stage2(int n);
+void dbt_test_mget(int n);
+void dbt_test_expire(int n);
+void dbt_test_race(int n);
+void dbt_test_driver(int n);
+void dbt_test_breaker(int n);
 void dbt_test_clear(void);
 
 
@@ -0,0 +1,9 @@
+#ifndef _DBT_BENCH_H_
+#define _DBT_BENCH_H_
+
+/*
+ * Prototypes
+ */
+int dbt_bench(int optind, int argc, char **argv);
+
+#endif /* _DBT_BENCH_H_ */
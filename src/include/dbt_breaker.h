@@ -0,0 +1,63 @@
+#ifndef _DBT_BREAKER_H_
+#define _DBT_BREAKER_H_
+
+#include <pthread.h>
+#include <time.h>
+
+#include <var.h>
+#include <vp.h>
+
+/*
+ * Circuit breaker. After dbr_errors consecutive failed or slow operations
+ * the backend is bypassed. Writes are kept in a journal that is replayed
+ * once a probe after dbr_timeout seconds succeeds.
+ */
+#define DBT_BREAKER_CLOSED	0
+#define DBT_BREAKER_OPEN	1
+#define DBT_BREAKER_PROBE	2
+
+typedef struct dbt_journal_entry {
+	vp_t				 *dje_vp;
+	int				  dje_deleted;
+	long				  dje_size;
+	unsigned long			  dje_version;
+	struct dbt_journal_entry	 *dje_prev;
+	struct dbt_journal_entry	 *dje_next;
+} dbt_journal_entry_t;
+
+typedef struct dbt_breaker {
+	ht_t			 *dbr_journal;
+	dbt_journal_entry_t	 *dbr_head;
+	dbt_journal_entry_t	 *dbr_tail;
+	int			  dbr_state;
+	int			  dbr_errors;
+	int			  dbr_latency;
+	int			  dbr_timeout;
+	long			  dbr_memory;
+	long			  dbr_memory_max;
+	int			  dbr_failures;
+	time_t			  dbr_opened;
+	unsigned long		  dbr_trips;
+	unsigned long		  dbr_journaled;
+	unsigned long		  dbr_dropped;
+	unsigned long		  dbr_replayed;
+	pthread_mutex_t		  dbr_mutex;
+} dbt_breaker_t;
+
+/*
+ * Prototypes
+ */
+struct dbt;
+
+int dbt_breaker_init(struct dbt *dbt);
+void dbt_breaker_clear(struct dbt *dbt);
+void dbt_breaker_log(struct dbt *dbt);
+int dbt_breaker_stats(struct dbt *dbt, char **buffer, int *len);
+int dbt_breaker_enabled(struct dbt *dbt);
+int dbt_breaker_check(struct dbt *dbt);
+void dbt_breaker_update(struct dbt *dbt, int state, int r,
+    struct timespec *start);
+int dbt_journal_get(struct dbt *dbt, var_t *record, var_t **result);
+int dbt_journal_set(struct dbt *dbt, var_t *record, int deleted);
+
+#endif /* _DBT_BREAKER_H_ */
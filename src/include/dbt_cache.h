@@ -0,0 +1,49 @@
+#ifndef _DBT_CACHE_H_
+#define _DBT_CACHE_H_
+
+#include <pthread.h>
+
+#include <var.h>
+#include <vp.h>
+
+/*
+ * Record cache. Up to dc_size records are kept for dc_ttl seconds. The
+ * least recently used records are evicted first.
+ */
+typedef struct dbt_cache_entry {
+	vp_t				 *dce_vp;
+	time_t				  dce_expire;
+	struct dbt_cache_entry		 *dce_prev;
+	struct dbt_cache_entry		 *dce_next;
+} dbt_cache_entry_t;
+
+typedef struct dbt_cache {
+	ht_t			 *dc_ht;
+	dbt_cache_entry_t	 *dc_head;
+	dbt_cache_entry_t	 *dc_tail;
+	int			  dc_size;
+	int			  dc_ttl;
+	unsigned long		  dc_hits;
+	unsigned long		  dc_misses;
+	unsigned long		  dc_generation;
+	pthread_mutex_t		  dc_mutex;
+} dbt_cache_t;
+
+/*
+ * Prototypes
+ */
+struct dbt;
+
+int dbt_cache_init(struct dbt *dbt);
+void dbt_cache_clear(struct dbt *dbt);
+void dbt_cache_flush(struct dbt *dbt);
+void dbt_cache_log(struct dbt *dbt);
+int dbt_cache_stats(struct dbt *dbt, char **buffer, int *len);
+int dbt_cache_get(struct dbt *dbt, var_t *record, var_t **result,
+    unsigned long *generation);
+void dbt_cache_set(struct dbt *dbt, var_t *lookup, var_t *record,
+    unsigned long generation);
+void dbt_cache_del_key(struct dbt *dbt, vp_t *key);
+void dbt_cache_del(struct dbt *dbt, var_t *record);
+
+#endif /* _DBT_CACHE_H_ */
@@ -0,0 +1,45 @@
+#ifndef _DBT_INDEX_H_
+#define _DBT_INDEX_H_
+
+#include <pthread.h>
+
+#include <var.h>
+#include <vp.h>
+
+/*
+ * Expiry index. A min-heap of record keys ordered by expiry.
+ */
+typedef struct dbt_index_node {
+	void				 *din_key;
+	int				  din_klen;
+	VAR_INT_T			  din_expire;
+	int				  din_pos;
+} dbt_index_node_t;
+
+typedef struct dbt_index {
+	ht_t			 *di_ht;
+	dbt_index_node_t	**di_heap;
+	int			  di_size;
+	int			  di_alloc;
+	vp_null_t		  di_nulls;
+	pthread_mutex_t		  di_mutex;
+} dbt_index_t;
+
+/*
+ * Prototypes
+ */
+struct dbt;
+
+int dbt_index_init(struct dbt *dbt);
+void dbt_index_clear(struct dbt *dbt);
+int dbt_index_stats(struct dbt *dbt, char **buffer, int *len);
+void dbt_index_node_delete(dbt_index_node_t *din);
+int dbt_index_set(struct dbt *dbt, var_t *record);
+void dbt_index_del(struct dbt *dbt, var_t *record);
+int dbt_index_retry(struct dbt *dbt, dbt_index_node_t *din,
+    VAR_INT_T expire);
+int dbt_index_pop(struct dbt *dbt, VAR_INT_T now, dbt_index_node_t **batch,
+    int size);
+var_t * dbt_index_lookup(struct dbt *dbt, dbt_index_node_t *din);
+
+#endif /* _DBT_INDEX_H_ */
@@ -0,0 +1,41 @@
+#ifndef _DBT_POOL_H_
+#define _DBT_POOL_H_
+
+#include <pthread.h>
+
+/*
+ * Seconds dbt_pool_checkout waits for a connection
+ */
+#define DBT_POOL_TIMEOUT 10
+
+/*
+ * Connection pool. dp_conns holds dp_size connections, dp_free of them
+ * are checked in. dp_lost connections were closed by dbt_pool_checkin and
+ * are reopened on demand.
+ */
+typedef struct dbt_pool {
+	struct dbt		**dp_conns;
+	int			  dp_size;
+	int			  dp_free;
+	int			  dp_lost;
+	int			  dp_in_use_max;
+	unsigned long		  dp_checkouts;
+	unsigned long		  dp_waits;
+	unsigned long		  dp_wait_usec;
+	pthread_mutex_t		  dp_mutex;
+	pthread_cond_t		  dp_cond;
+} dbt_pool_t;
+
+/*
+ * Prototypes
+ */
+struct dbt;
+
+int dbt_pool_init(struct dbt *dbt);
+void dbt_pool_clear(struct dbt *dbt);
+struct dbt * dbt_pool_checkout(struct dbt *dbt);
+void dbt_pool_checkin(struct dbt *dbt, struct dbt *conn);
+void dbt_pool_log(struct dbt *dbt);
+int dbt_pool_stats(struct dbt *dbt, char **buffer, int *len);
+
+#endif /* _DBT_POOL_H_ */
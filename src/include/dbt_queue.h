@@ -0,0 +1,58 @@
+#ifndef _DBT_QUEUE_H_
+#define _DBT_QUEUE_H_
+
+#include <pthread.h>
+#include <time.h>
+
+#include <var.h>
+#include <vp.h>
+
+/*
+ * Write-behind queue. Pending writes are coalesced by key and flushed in
+ * batches of dq_batch records by dq_thread.
+ */
+typedef struct dbt_queue_entry {
+	vp_t				 *dqe_vp;
+	struct timespec			  dqe_queued;
+	int				  dqe_flushing;
+	int				  dqe_failed;
+	int				  dqe_retries;
+	struct dbt_queue_entry		 *dqe_prev;
+	struct dbt_queue_entry		 *dqe_next;
+} dbt_queue_entry_t;
+
+typedef struct dbt_queue {
+	ht_t			 *dq_ht;
+	dbt_queue_entry_t	 *dq_head;
+	dbt_queue_entry_t	 *dq_tail;
+	int			  dq_length;
+	int			  dq_size;
+	int			  dq_batch;
+	int			  dq_latency;
+	int			  dq_running;
+	int			  dq_flushing;
+	unsigned long		  dq_queued;
+	unsigned long		  dq_coalesced;
+	unsigned long		  dq_flushed;
+	unsigned long		  dq_batches;
+	pthread_t		  dq_thread;
+	pthread_mutex_t		  dq_mutex;
+	pthread_cond_t		  dq_cond;
+	pthread_cond_t		  dq_done;
+} dbt_queue_t;
+
+/*
+ * Prototypes
+ */
+struct dbt;
+
+int dbt_queue_init(struct dbt *dbt);
+void dbt_queue_clear(struct dbt *dbt);
+void dbt_queue_log(struct dbt *dbt);
+int dbt_queue_stats(struct dbt *dbt, char **buffer, int *len);
+int dbt_queue_safe_update(var_t *record);
+int dbt_queue_remove(struct dbt *dbt, var_t *record, int write);
+int dbt_queue_set(struct dbt *dbt, var_t *record);
+int dbt_queue_get(struct dbt *dbt, var_t *record, var_t **result);
+
+#endif /* _DBT_QUEUE_H_ */
@@ -0,0 +1,53 @@
+#ifndef _DBT_STATS_H_
+#define _DBT_STATS_H_
+
+#include <time.h>
+
+/*
+ * Operation statistics. Latency bucket n counts operations that took less
+ * than 2^n microseconds, the last bucket counts all slower operations.
+ * Counters are updated atomically. Readers copy them without locking and
+ * may see a count that is ahead of its sums.
+ */
+#define DBT_OP_GET	0
+#define DBT_OP_SET	1
+#define DBT_OP_DEL	2
+#define DBT_OP_MGET	3
+#define DBT_OP_MSET	4
+#define DBT_OP_WALK	5
+#define DBT_OP_EXPIRE	6
+#define DBT_OP_MAX	7
+
+#define DBT_LATENCY_BUCKETS 24
+
+typedef struct dbt_op_stats {
+	unsigned long		  dos_count;
+	unsigned long		  dos_errors;
+	unsigned long		  dos_usec;
+	unsigned long		  dos_usec_max;
+	unsigned long		  dos_wait_usec;
+	unsigned long		  dos_latency[DBT_LATENCY_BUCKETS];
+} dbt_op_stats_t;
+
+typedef struct dbt_stats {
+	dbt_op_stats_t		  ds_ops[DBT_OP_MAX];
+} dbt_stats_t;
+
+extern char *dbt_stats_ops[];
+
+/*
+ * Prototypes
+ */
+struct dbt;
+
+void dbt_stats_now(struct timespec *ts);
+long dbt_stats_usec(struct timespec *start, struct timespec *stop);
+int dbt_stats_init(struct dbt *dbt);
+struct dbt * dbt_stats_checkout(struct dbt *dbt, long *wait);
+int dbt_stats_lock(struct dbt *dbt, long *wait);
+void dbt_stats_update(struct dbt *dbt, int op, struct timespec *start,
+    long wait, int r);
+int dbt_stats_printf(char **buffer, int *len, char *format, ...);
+int dbt_stats_table(struct dbt *dbt, char **buffer, int *len);
+
+#endif /* _DBT_STATS_H_ */
@@ -0,0 +1,44 @@
+#ifndef _DBT_STREAM_H_
+#define _DBT_STREAM_H_
+
+#include <time.h>
+
+#include <var.h>
+
+/*
+ * Streaming dump (dbt_stream). Records matching the key prefix and expiry
+ * filters are formatted by dst_format and handed to dst_flush in chunks of
+ * about DBT_STREAM_CHUNK bytes. dst_token resumes the stream after the last
+ * flushed chunk and is empty once the table is exhausted.
+ */
+#define DBT_STREAM_CHUNK 65536
+#define DBT_TOKEN_BUFLEN 2048
+
+struct dbt;
+
+typedef int (*dbt_stream_format_t)(struct dbt *dbt, var_t *record,
+    char *buffer, int size);
+typedef int (*dbt_stream_flush_t)(void *data, char *buffer, int len,
+    char *token);
+
+typedef struct dbt_stream {
+	char			 *dst_prefix;
+	time_t			  dst_expire;
+	char			 *dst_resume;
+	int			  dst_limit;
+	dbt_stream_format_t	  dst_format;
+	dbt_stream_flush_t	  dst_flush;
+	void			 *dst_data;
+	char			 *dst_buffer;
+	int			  dst_len;
+	int			  dst_size;
+	int			  dst_records;
+	char			  dst_token[DBT_TOKEN_BUFLEN];
+} dbt_stream_t;
+
+/*
+ * Prototypes
+ */
+int dbt_stream(struct dbt *dbt, dbt_stream_t *stream);
+
+#endif /* _DBT_STREAM_H_ */
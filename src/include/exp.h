@@ -73,6 +73,7 @@ exp_t * exp_constant(var_type_t type, void *data, int flags);
 exp_t * exp_operation(int operator, exp_t *op1, exp_t *op2);
 exp_t * exp_function(char *id, exp_t *args);
 exp_t * exp_ternary_cond(exp_t *condition, exp_t *cond_true, exp_t *cond_false);
+void exp_arena_set(arena_t *arena);
 void exp_free_list(ll_t *list);
 void exp_free(var_t *v);
 var_t * exp_math_int(int op, var_t *left, var_t *right);
@@ -45,7 +45,7 @@ void greylist_delete(greylist_t *gl);
 void greylist_init(void);
 acl_action_type_t greylist(milter_stage_t stage, char *stagename, var_t *mailspec, void *data, int depth);
 int greylist_pass(char *source, char *envfrom, char *envrcpt);
-int greylist_dump_record(dbt_t *dbt, var_t *record);
-int greylist_dump(char **dump);
+int greylist_dump_record(dbt_t *dbt, var_t *record, char *buffer, int size);
+int greylist_dump(dbt_stream_t *stream);
 
 #endif /* _GREYLIST_H_ */
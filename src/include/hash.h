@@ -9,10 +9,22 @@ hash_t hash_one_at_a_time(char *key, uint32_t len);
 hash_t hash_djb(void *key, uint32_t len);
 hash_t hash_test(void *key, uint32_t len);
 hash_t hash_chain(void *key, uint32_t len);
+uint64_t hash_wy(void *key, uint32_t len, uint64_t seed);
+uint64_t hash_random_seed(void);
+hash_t hash_fast(void *key, uint32_t len);
+void hash_bench(int keys);
 
-#define HASH hash_one_at_a_time
+#define HASH hash_fast
+//#define HASH hash_one_at_a_time
 //#define HASH hash_djb
 //#define HASH hash_test
 //#define HASH hash_chain
 
+/*
+ * HASH is seeded per process. Hash tables stored on disk keep their own
+ * seed and use hash_wy. HASH_STABLE is not seeded and only used for
+ * scheme hashes and checksums.
+ */
+#define HASH_STABLE hash_one_at_a_time
+
 #endif
@@ -18,11 +18,19 @@ typedef void (*ht_delete_t)(void *data);
 typedef struct ht_record {
 	void			*htr_data;
 	struct ht_record	*htr_next;
+	hash_t			 htr_hash;
 } ht_record_t;
 
+/*
+ * While the table is resized, records are moved from ht_old to ht_table a
+ * few buckets at a time. Buckets of ht_old below ht_migrate are empty.
+ */
 typedef struct ht {
 	ht_record_t		**ht_table;
 	hash_t			  ht_buckets;
+	ht_record_t		**ht_old;
+	hash_t			  ht_old_buckets;
+	hash_t			  ht_migrate;
 	int			  ht_records;
 	int		 	  ht_collisions;
 	int		 	  ht_resize_lower;
@@ -35,6 +43,7 @@ typedef struct ht {
 typedef struct ht_pos {
 	int			  htp_bucket;
 	ht_record_t		 *htp_record;
+	int			  htp_old;
 } ht_pos_t;
 
 /*
@@ -47,11 +56,14 @@ void ht_clear(ht_t *ht);
 void ht_delete(ht_t *ht);
 void * ht_lookup(ht_t *ht, void *data);
 void ht_start(ht_t *ht, ht_pos_t *pos);
+void ht_seek(ht_t *ht, ht_pos_t *pos, hash_t bucket);
 int8_t ht_insert(ht_t *ht, void *data);
 void ht_remove(ht_t *ht, void *data);
 void ht_dump(ht_t *ht, void (*print_data)(void *data));
 int ht_walk(ht_t *ht, int (*callback)(void *data));
 void * ht_next(ht_t *ht, ht_pos_t *pos);
+void ht_test(int n);
+void ht_bench(int records);
 
 /*
  * Macros
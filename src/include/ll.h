@@ -11,15 +11,23 @@
  * Types
  */
 
+/*
+ * Lists are ring buffers of entries. Up to LL_SMALL entries are stored in
+ * the list itself, larger lists use ll_entries. ll_capacity is a power of
+ * two. Positions point to entries and are invalidated by inserts.
+ */
+#define LL_SMALL	4
+
 typedef struct ll_entry {
 	void			*lle_data;
-	struct ll_entry	*lle_next;
 } ll_entry_t;
 
 typedef struct ll {
 	uint32_t	ll_size;
-	ll_entry_t	*ll_head;
-	ll_entry_t	*ll_tail;
+	uint32_t	ll_head;
+	uint32_t	ll_capacity;
+	ll_entry_t	*ll_entries;
+	ll_entry_t	ll_small[LL_SMALL];
 } ll_t;
 
 typedef void (*ll_delete_t)(void *data);
@@ -30,6 +38,7 @@ typedef void (*ll_delete_t)(void *data);
 
 void ll_init(ll_t * ll);
 ll_t * ll_create();
+int32_t ll_reserve(ll_t * ll, uint32_t size);
 void ll_walk(ll_t * ll, void (*callback) (void *item, void *item_data), void *data);
 void ll_clear(ll_t * ll, void (*destroy) (void *data));
 void ll_delete(ll_t * ll, void (*destroy) (void *data));
@@ -42,14 +51,16 @@ void ll_test(int n);
 /*
  * Macros
  */
+#define LL_ENTRIES(ll)	((ll)->ll_entries? (ll)->ll_entries: (ll)->ll_small)
+#define LL_INDEX(ll, i)	(((ll)->ll_head + (i)) & ((ll)->ll_capacity - 1))
 #define LL_SIZE(ll)	((ll)->ll_size)
-#define LL_HEAD(ll)	((ll)->ll_head->lle_data)
-#define LL_TAIL(ll)	((ll)->ll_tail->lle_data)
+#define LL_HEAD(ll)	(LL_ENTRIES(ll)[(ll)->ll_head].lle_data)
+#define LL_TAIL(ll)	(LL_ENTRIES(ll)[LL_INDEX(ll, (ll)->ll_size - 1)].lle_data)
 #define LL_INSERT	ll_insert_tail
 #define	LL_ENQUEUE	ll_insert_tail
 #define LL_DEQUEUE	ll_remove_head
 #define LL_PUSH		ll_insert_head
 #define LL_POP		ll_remove_head
-#define LL_START(ll)	((ll)->ll_head)
+#define LL_START(ll)	((ll)->ll_size? LL_ENTRIES(ll) + (ll)->ll_head: NULL)
 
 #endif /* _LL_H_ */
@@ -48,6 +48,9 @@ typedef struct milter_priv {
     char      *mp_body;
     VAR_INT_T  mp_bodylen;
     VAR_INT_T  mp_eom_complete;
+    arena_t    mp_conn_arena;
+    arena_t    mp_msg_arena;
+    arena_t    mp_exp_arena;
 } milter_priv_t;
 
 typedef struct milter_macro {
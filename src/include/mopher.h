@@ -7,8 +7,10 @@
 
 #include <defs.h>
 #include <acl.h>
+#include <arena.h>
 #include <cf.h>
 #include <dbt.h>
+#include <dbt_bench.h>
 #include <greylist.h>
 #include <hash.h>
 #include <ht.h>
@@ -14,6 +14,7 @@ typedef struct {
 int server_reply(int sock, char *message, ...);
 int server_cmd(int sock, char *cmd);
 int server_data_cmd(int sock, char *cmd, char **buffer);
+int server_stream_cmd(int sock, char *cmd, FILE *fp, char *token, int size);
 int server_init();
 void server_clear(void);
 int server_dummy(int sock, int argc, char **argv);
@@ -22,5 +23,6 @@ int server_quit(int sock, int argc, char **argv);
 int server_greylist_dump(int sock, int argc, char **argv);
 int server_greylist_pass(int sock, int argc, char **argv);
 int server_table_dump(int sock, int argc, char **argv);
+int server_table_stats(int sock, int argc, char **argv);
 
 #endif /* _SERVER_H_ */
@@ -15,6 +15,7 @@ struct sht_record
 {
 	char	*sr_key;
 	void	*sr_data;
+	hash_t	 sr_hash;
 };
 
 typedef struct sht_record sht_record_t;
@@ -5,6 +5,25 @@
 #define SQL_VALUES	1<<1
 #define SQL_ALL		(SQL_KEYS | SQL_VALUES)
 
+#define SQL_PREPARE_READ	1<<0
+#define SQL_PREPARE_WRITE	1<<1
+
+#define SQL_PARAM_MAX	256
+
+/*
+ * Prepared upserts are cached by a bitmask of the VF_SQL_SAFE_UPDATE
+ * fields. Wider schemes are rejected by sql_open.
+ */
+#define SQL_FIELDS_MAX	(sizeof (unsigned long) * 8)
+
+/*
+ * Cached prepared statements (per table and connection)
+ */
+#define SQL_STMT_SELECT	0
+#define SQL_STMT_UPSERT	1
+#define SQL_STMT_DELETE	2
+#define SQL_STMT_MAX	3
+
 
 /*
  * Types
@@ -13,9 +32,22 @@ typedef int (*sql_escape_t)(void *conn, char *buffer, int size, char *value);
 
 typedef int (*sql_exec_t)(void *handle, void **result, char *query, int *tuples, int *affected);
 typedef int (*sql_table_exists_t)(void *handle, char *table);
+typedef int (*sql_index_exists_t)(void *handle, char *table, char *column);
 typedef void (*sql_free_result_t)(void *result);
 typedef void *(*sql_get_row_t)(void *handle, void *result, int nrow);
 typedef char *(*sql_get_value_t)(void *handle, void *row, int nrow, int field);
+typedef int (*sql_upsert_t)(void *conn, char *buffer, int size, char *keys, char *set);
+typedef int (*sql_cleanup_batch_t)(void *conn, char *buffer, int size, char *table, char *expire, unsigned long now, int limit);
+typedef void *(*sql_prepare_t)(void *conn, char *query);
+typedef int (*sql_exec_prepared_t)(void *conn, void *stmt, void **result, int nparams, char **params, int *tuples, int *affected);
+typedef void (*sql_release_t)(void *conn, void *stmt, void *result);
+typedef void (*sql_finalize_t)(void *conn, void *stmt);
+
+typedef struct sql_stmt {
+	void			*ss_handle;
+	int			 ss_nparams;
+	unsigned long		 ss_safe_update;
+} sql_stmt_t;
 
 typedef struct sql {
 	char			*sql_t_int;
@@ -33,13 +65,37 @@ typedef struct sql {
 	sql_get_row_t	 	 sql_get_row;
 	sql_get_value_t	 	 sql_get_value;
 
+	// Optional: appends the dialect specific conflict clause to an INSERT
+	sql_upsert_t		 sql_upsert;
+
+	// Optional: DELETE of at most limit expired rows (chunked expiry)
+	sql_cleanup_batch_t	 sql_cleanup_batch;
+
+	// Optional: returns 1 if an index on table starts with column, 0 if
+	// not and -1 if it can't be checked. Used to verify secondary
+	// indexes of existing tables.
+	sql_index_exists_t	 sql_index_exists;
+
+	// Optional: prepared statements with bound parameters. sql_param is
+	// the placeholder format, e.g. "$%d" or "?". sql_prepare_ops selects
+	// which statements are prepared (SQL_PREPARE_READ/WRITE). Results of
+	// sql_exec_prepared must work with sql_get_row and sql_get_value and
+	// are released with sql_release instead of sql_free_result.
+	char			*sql_param;
+	int			 sql_prepare_ops;
+	sql_prepare_t		 sql_prepare;
+	sql_exec_prepared_t	 sql_exec_prepared;
+	sql_release_t		 sql_release;
+	sql_finalize_t		 sql_finalize;
+
 	void			*sql_handle;
 } sql_t;
 
 /*
  * Prototypes
  */
-void sql_open(sql_t *sql, void *conn, var_t *scheme);
+void sql_open(sql_t *sql, void *conn, var_t *scheme, char *expire);
+void sql_close(sql_t *sql, void *conn, sql_stmt_t *stmts);
 void sql_test(int n);
 
 #endif /* _SQL_H_ */
@@ -5,10 +5,12 @@
 
 #include <hash.h>
 #include <ht.h>
+#include <arena.h>
 
 #define VAR_INT_T long
 #define VAR_FLOAT_T double
 #define VAR_STRING_BUFFER_LEN 1024
+#define VAR_INLINE_LEN 16
 
 #define VF_REF		0
 #define VF_COPYNAME	1<<0
@@ -33,6 +35,17 @@
  */
 #define VF_SQL_SAFE_UPDATE	1<<7
 
+/*
+ * VF_INDEX marks scheme fields that get a secondary index in SQL databases
+ * (e.g. the dblog fields messages are looked up by)
+ */
+#define VF_INDEX	1<<8
+
+/*
+ * VF_ARENA marks vars allocated by var_arena_create. var_delete ignores them.
+ */
+#define VF_ARENA	1<<9
+
 
 #define VF_KEEP		VF_KEEPNAME | VF_KEEPDATA
 #define VF_COPY		VF_COPYNAME | VF_COPYDATA
@@ -47,14 +60,24 @@ typedef struct sockaddr_storage var_sockaddr_t;
 typedef enum var_type { VT_NULL = 0, VT_TABLE, VT_LIST, VT_ADDR, VT_INT,
     VT_FLOAT, VT_POINTER, VT_STRING, VT_BLOB, VT_MAX = VT_BLOB } var_type_t;
 
+/*
+ * Copies of small values (ints, floats, short strings and blobs) are stored
+ * in v_inline. v_data points to v_inline in that case.
+ */
 typedef struct var {
     var_type_t   v_type;
     char        *v_name;
     void        *v_data;
     int		 v_flags;
+    union {
+	VAR_INT_T	 vi_int;
+	VAR_FLOAT_T	 vi_float;
+	char		 vi_buffer[VAR_INLINE_LEN];
+    } v_inline;
 } var_t;
 
 #define VAR_COPY(v) var_create(v->v_type, v->v_name, v->v_data, VF_COPY)
+#define VAR_INLINE(v) ((v)->v_data == (void *) &(v)->v_inline)
 #define VAR_MAX_TYPE(v1, v2) ((v1)->v_type > (v2)->v_type ? (v1)->v_type : (v2)->v_type)
 
 /*
@@ -68,6 +91,8 @@ VAR_INT_T var_data_size(var_t *v);
 void var_rename(var_t *v, char *name, int flags);
 int var_init(var_t *v, var_type_t type, char *name, void *data, int flags);
 var_t * var_create(var_type_t type, char *name, void *data, int flags);
+var_t * var_arena_create(arena_t *arena, var_type_t type, char *name,
+    void *data, int flags);
 void * var_scan_data(var_type_t type, char *str);
 var_t * var_scan(var_type_t type, char *name, char *str);
 var_t * var_scan_scheme(var_t *scheme, char *str);
@@ -79,5 +104,7 @@ int var_dump(var_t * v, char *buffer, int size);
 int var_dump_stdout(var_t * v);
 var_t * var_cast_copy(var_type_t type, var_t *v);
 VAR_INT_T var_intval(var_t *v);
+void var_test(int n);
+void var_bench(int records);
 
 #endif /* _VAR_H_ */
@@ -8,6 +8,7 @@
  */
 
 var_t * vlist_create(char *name, int flags);
+int vlist_reserve(var_t *list, int size);
 int vlist_append(var_t *list, var_t *item);
 int vlist_append_new(var_t *list, var_type_t type, char *name, void *data,int flags);
 int vlist_dereference(var_t *list, ...);
@@ -18,4 +19,5 @@ var_t * vlist_record_lookup(var_t *record, char *key);
 void * vlist_record_get(var_t *record, char *key);
 void * vlist_record_get_combine_key(var_t *record, ...);
 int vlist_record_keys_missing(var_t *record, var_t *table);
+void vlist_bench(int records);
 #endif /* _VLIST_H_ */
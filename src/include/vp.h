@@ -2,6 +2,7 @@
 #define _VP_H_
 
 #define VP_FIELD_LIMIT (sizeof (vp_null_t) * 8)
+#define VP_KEY_BUFLEN 512
 
 typedef unsigned long long vp_null_t;
 
@@ -14,6 +15,14 @@ typedef struct vp {
 	void			*vp_fields;
 } vp_t;
 
+/*
+ * Lookup key packed without allocation. vk_vp holds the key only.
+ */
+typedef struct vp_key {
+	vp_t			 vk_vp;
+	char			 vk_buffer[VP_KEY_BUFLEN];
+} vp_key_t;
+
 /*
  * Prototypes
  */
@@ -21,6 +30,8 @@ void vp_init(vp_t *vp, void *key, int klen, void *data, int dlen);
 void vp_delete(vp_t *vp);
 vp_t * vp_pack(var_t *v);
 var_t * vp_unpack(vp_t *vp, var_t *scheme);
+void vp_key_clear(vp_key_t *vk);
+int vp_pack_key(vp_key_t *vk, var_t *record);
 void vp_test(int n);
 
 #endif /* _VP_H_ */
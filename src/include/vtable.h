@@ -17,6 +17,7 @@ int vtable_insert(var_t *table, var_t *v);
 int vtable_set(var_t *table, var_t *v);
 void vtable_remove(var_t *table, char *name);
 void vtable_remv(var_t *table, ...);
+void vtable_arena_set(var_t *table, arena_t *arena);
 int vtable_set_new(var_t *table, var_type_t type, char *name, void *data, int flags);
 int vtable_setv(var_t *table, ...);
 int vtable_rename(var_t *table, char *old, char *new);
@@ -27,4 +28,5 @@ int vtable_dereference(var_t *table, ...);
 int vtable_add_record(var_t *table, var_t *record);
 int vtable_set_null(var_t *table, char *name, int flags);
 int vtable_is_null(var_t *table, char *name);
+void vtable_bench(int messages);
 #endif /* _VTABLE_H_ */
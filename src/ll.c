@@ -9,8 +9,9 @@ void
 ll_init(ll_t * ll)
 {
 	ll->ll_size = 0;
-	ll->ll_head = NULL;
-	ll->ll_tail = NULL;
+	ll->ll_head = 0;
+	ll->ll_capacity = LL_SMALL;
+	ll->ll_entries = NULL;
 }
 
 ll_t *
@@ -26,13 +27,50 @@ ll_create()
 	return ll;
 }
 
+/*
+ * Makes room for size entries. Entries are moved to a new array starting
+ * at index 0.
+ */
+int32_t
+ll_reserve(ll_t * ll, uint32_t size)
+{
+	ll_entry_t *entries, *old;
+	uint32_t capacity, i;
+
+	if (size <= ll->ll_capacity) {
+		return 0;
+	}
+
+	for (capacity = ll->ll_capacity; capacity < size; capacity *= 2);
+
+	if ((entries = malloc(capacity * sizeof(ll_entry_t))) == NULL) {
+		return -1;
+	}
+
+	old = LL_ENTRIES(ll);
+	for (i = 0; i < ll->ll_size; ++i) {
+		entries[i] = old[LL_INDEX(ll, i)];
+	}
+
+	if (ll->ll_entries) {
+		free(ll->ll_entries);
+	}
+
+	ll->ll_entries = entries;
+	ll->ll_capacity = capacity;
+	ll->ll_head = 0;
+
+	return 0;
+}
+
 void
 ll_walk(ll_t * ll, void (*callback) (void *item, void *item_data), void *data)
 {
-	ll_entry_t *entry;
+	ll_entry_t *entries = LL_ENTRIES(ll);
+	uint32_t i;
 
-	for (entry = ll->ll_head; entry; entry = entry->lle_next) {
-		callback(entry->lle_data, data);
+	for (i = 0; i < ll->ll_size; ++i) {
+		callback(entries[LL_INDEX(ll, i)].lle_data, data);
 	}
 
 	return;
@@ -41,16 +79,17 @@ ll_walk(ll_t * ll, void (*callback) (void *item, void *item_data), void *data)
 void
 ll_clear(ll_t * ll, void (*destroy)(void *data))
 {
-	ll_entry_t *entry;
-	ll_entry_t *next;
-
-	for (entry = ll->ll_head; entry; entry = next) {
-		next = entry->lle_next;
-		if (destroy != NULL)
-		{
-			destroy(entry->lle_data);
+	ll_entry_t *entries = LL_ENTRIES(ll);
+	uint32_t i;
+
+	if (destroy != NULL) {
+		for (i = 0; i < ll->ll_size; ++i) {
+			destroy(entries[LL_INDEX(ll, i)].lle_data);
 		}
-		free(entry);
+	}
+
+	if (ll->ll_entries) {
+		free(ll->ll_entries);
 	}
 
 	/*
@@ -71,20 +110,13 @@ ll_delete(ll_t * ll, void (*destroy) (void *data))
 int32_t
 ll_insert_head(ll_t * ll, void *data)
 {
-	ll_entry_t *entry;
-
-	if ((entry = malloc(sizeof(ll_entry_t))) == NULL) {
+	if (ll->ll_size == ll->ll_capacity &&
+	    ll_reserve(ll, ll->ll_capacity * 2)) {
 		return -1;
 	}
 
-	entry->lle_data = data;
-	entry->lle_next = ll->ll_head;
-
-	ll->ll_head = entry;
-
-	if (ll->ll_tail == NULL) {
-		ll->ll_tail = ll->ll_head;
-	}
+	ll->ll_head = (ll->ll_head - 1) & (ll->ll_capacity - 1);
+	LL_ENTRIES(ll)[ll->ll_head].lle_data = data;
 
 	++ll->ll_size;
 
@@ -94,24 +126,12 @@ ll_insert_head(ll_t * ll, void *data)
 int32_t
 ll_insert_tail(ll_t * ll, void *data)
 {
-	ll_entry_t *entry;
-
-	if ((entry = malloc(sizeof(ll_entry_t))) == NULL) {
+	if (ll->ll_size == ll->ll_capacity &&
+	    ll_reserve(ll, ll->ll_capacity * 2)) {
 		return -1;
 	}
 
-	entry->lle_data = data;
-	entry->lle_next = NULL;
-
-	if (ll->ll_tail != NULL) {
-		ll->ll_tail->lle_next = entry;
-	}
-
-	ll->ll_tail = entry;
-
-	if (ll->ll_head == NULL) {
-		ll->ll_head = ll->ll_tail;
-	}
+	LL_ENTRIES(ll)[LL_INDEX(ll, ll->ll_size)].lle_data = data;
 
 	++ll->ll_size;
 
@@ -121,26 +141,26 @@ ll_insert_tail(ll_t * ll, void *data)
 void *
 ll_remove_head(ll_t * ll)
 {
-	ll_entry_t *entry;
 	void *data;
 
 	if (ll->ll_size == 0) {
 		return NULL;
 	}
 
-	entry = ll->ll_head;
+	data = LL_ENTRIES(ll)[ll->ll_head].lle_data;
 
-	ll->ll_head = ll->ll_head->lle_next;
-
-	if (ll->ll_head == NULL) {
-		ll->ll_tail = NULL;
-	}
-
-	data = entry->lle_data;
-	free(entry);
+	ll->ll_head = LL_INDEX(ll, 1);
 
 	--ll->ll_size;
 
+	/*
+	 * Like the nodes before, an empty list owns no memory. Lists that
+	 * are drained without ll_clear() don't leak the entry array.
+	 */
+	if (ll->ll_size == 0 && ll->ll_entries) {
+		ll_clear(ll, NULL);
+	}
+
 	return data;
 }
 
@@ -148,7 +168,8 @@ ll_remove_head(ll_t * ll)
 void *
 ll_next(ll_t * ll, ll_entry_t **position)
 {
-	ll_entry_t *entry;
+	ll_entry_t *entry, *entries;
+	uint32_t i;
 
 	/*
 	 * List end
@@ -158,8 +179,14 @@ ll_next(ll_t * ll, ll_entry_t **position)
 	}
 
 	entry = *position;
+	entries = LL_ENTRIES(ll);
+
+	/*
+	 * Next index in the ring. The tail follows the last entry.
+	 */
+	i = (entry - entries + 1) & (ll->ll_capacity - 1);
 
-	*position = (*position)->lle_next;
+	*position = i == LL_INDEX(ll, ll->ll_size)? NULL: entries + i;
 
 	return entry->lle_data;
 }
@@ -181,6 +208,7 @@ ll_test(int n)
 {
 	ll_t ll;
 	ll_t *pll;
+	ll_entry_t *pos;
 	int *p;
 	int i = 0;
 	int index = 0;
@@ -213,6 +241,39 @@ ll_test(int n)
 	}
 	TEST_ASSERT(pll->ll_size == 0);
 	ll_delete(pll, NULL);
+
+	/*
+	 * Ring wrap-around: push 10..1 and keep the list rotating through
+	 * growth of the entry array.
+	 */
+	ll_init(&ll);
+	for (i = 9; i >= 0; --i)
+	{
+		TEST_ASSERT(LL_PUSH(&ll, test_array + i) > 0);
+	}
+
+	for (i = 0; i < 25; ++i)
+	{
+		p = LL_POP(&ll);
+		TEST_ASSERT(*p == i % 10 + 1);
+		TEST_ASSERT(LL_INSERT(&ll, p) == 10);
+		TEST_ASSERT(*(int *) LL_TAIL(&ll) == *p);
+	}
+
+	index = 5;
+	pos = LL_START(&ll);
+	while ((p = ll_next(&ll, &pos)))
+	{
+		TEST_ASSERT(*p == index % 10 + 1);
+		++index;
+	}
+	TEST_ASSERT(index == 15);
+
+	TEST_ASSERT(ll_reserve(&ll, 100) == 0);
+	TEST_ASSERT(ll.ll_capacity == 128 && ll.ll_size == 10);
+	TEST_ASSERT(*(int *) LL_HEAD(&ll) == 6);
+	ll_clear(&ll, NULL);
+	TEST_ASSERT(LL_START(&ll) == NULL);
 }
 
 #endif
@@ -256,24 +256,127 @@ milter_acl(milter_stage_t stage, char *stagename, milter_priv_t * mp)
 }
 
 
+/*
+ * Mailspec vars set in a stage are allocated from the arena returned here.
+ * Vars set in message stages are released at the end of the message, vars
+ * set on connect and close with the connection. HELO and unknown commands
+ * may repeat and use the heap.
+ */
+static arena_t *
+milter_arena(milter_priv_t *mp, milter_stage_t stage)
+{
+	switch (stage)
+	{
+	case MS_INIT:
+	case MS_CONNECT:
+	case MS_CLOSE:
+		return &mp->mp_conn_arena;
+
+	case MS_HELO:
+	case MS_UNKNOWN:
+		return NULL;
+
+	default:
+		return &mp->mp_msg_arena;
+	}
+}
+
+
+/*
+ * Moves var from the message arena to the heap.
+ */
+static int
+milter_priv_keep(milter_priv_t *mp, var_t *v)
+{
+	var_t *copy;
+	int flags;
+
+	flags = v->v_flags & ~(VF_COPY | VF_KEEP | VF_ARENA);
+	flags |= arena_owns(&mp->mp_msg_arena, v->v_name)?
+	    VF_COPYNAME: VF_KEEPNAME;
+	flags |= arena_owns(&mp->mp_msg_arena, v->v_data)?
+	    VF_COPYDATA: VF_KEEPDATA;
+
+	copy = var_create(v->v_type, v->v_name, v->v_data, flags);
+	if (copy == NULL)
+	{
+		log_error("milter_priv_keep: var_create failed");
+		return -1;
+	}
+
+	if (vtable_set(mp->mp_table, copy))
+	{
+		log_error("milter_priv_keep: vtable_set failed");
+		var_delete(copy);
+		return -1;
+	}
+
+	return 0;
+}
+
+
 static void
 milter_priv_clear_msg(milter_priv_t *mp)
 {
-	milter_symbol_t *ms;
+	ht_t *ht = mp->mp_table->v_data;
+	ht_pos_t ht_pos;
+	ll_t vars;
+	ll_entry_t *pos;
+	acl_symbol_t *as;
 	milter_stage_t stages;
+	var_t *v;
+	int reset = 1;
 
 	stages = MS_CONNECT | MS_UNKNOWN | MS_HELO;
 
-	for (ms = milter_symbols; ms->ms_name; ++ms)
+	ll_init(&vars);
+
+	ht_start(ht, &ht_pos);
+	while ((v = ht_next(ht, &ht_pos)))
 	{
-		if (ms->ms_stage | stages)
+		if (LL_INSERT(&vars, v) == -1)
+		{
+			log_error("milter_priv_clear_msg: LL_INSERT failed");
+			reset = 0;
+			break;
+		}
+	}
+
+	/*
+	 * Remove symbols of message stages. Other vars allocated in the
+	 * message arena are moved to the heap.
+	 */
+	pos = LL_START(&vars);
+	while (reset && (v = ll_next(&vars, &pos)))
+	{
+		as = acl_symbol_lookup(v->v_name);
+		if (as && (as->as_stages & stages) == 0)
+		{
+			ht_remove(ht, v);
+			continue;
+		}
+
+		if (!arena_owns(&mp->mp_msg_arena, v))
 		{
 			continue;
 		}
 
-		vtable_remove(mp->mp_table, ms->ms_name);
+		if (milter_priv_keep(mp, v))
+		{
+			log_error("milter_priv_clear_msg: milter_priv_keep "
+			    "failed");
+			reset = 0;
+		}
+	}
+
+	ll_clear(&vars, NULL);
+
+	// Memory is released with the connection if a var couldn't be moved
+	if (reset)
+	{
+		arena_reset(&mp->mp_msg_arena);
 	}
-	
+
 	if (mp->mp_header)
 	{
 		free(mp->mp_header);
@@ -312,6 +415,10 @@ milter_priv_delete(milter_priv_t * mp)
 		var_delete(mp->mp_table);
 	}
 
+	arena_clear(&mp->mp_conn_arena);
+	arena_clear(&mp->mp_msg_arena);
+	arena_clear(&mp->mp_exp_arena);
+
 	free(mp);
 
 	return;
@@ -332,6 +439,10 @@ milter_priv_create(void)
 
 	memset(mp, 0, sizeof(milter_priv_t));
 
+	arena_init(&mp->mp_conn_arena, 0);
+	arena_init(&mp->mp_msg_arena, 0);
+	arena_init(&mp->mp_exp_arena, 0);
+
 	mp->mp_table = vtable_create("mp_table", VF_KEEPNAME);
 	if (mp->mp_table == NULL)
 	{
@@ -374,6 +485,13 @@ milter_common_init(SMFICTX *ctx, VAR_INT_T stage, char *stagename)
 		goto error;
 	}
 
+	/*
+	 * Mailspec vars and expression results of this callback are
+	 * allocated from the arenas of the connection.
+	 */
+	vtable_arena_set(mp->mp_table, milter_arena(mp, stage));
+	exp_arena_set(&mp->mp_exp_arena);
+
 	/*
 	 * Call smfi_setpriv on connect
 	 */
@@ -445,6 +563,9 @@ error:
 	 */
 	if (mp)
 	{
+		vtable_arena_set(NULL, NULL);
+		exp_arena_set(NULL);
+
 		milter_priv_delete(mp);
 		smfi_setpriv(ctx, NULL);
 	}
@@ -456,6 +577,9 @@ error:
 static void
 milter_common_fini(SMFICTX *ctx, milter_priv_t *mp, milter_stage_t stage)
 {
+	vtable_arena_set(NULL, NULL);
+	exp_arena_set(NULL);
+
 	/*
 	 * If mp is null theres no lock and nothing to free.
 	 */
@@ -465,6 +589,9 @@ milter_common_fini(SMFICTX *ctx, milter_priv_t *mp, milter_stage_t stage)
 		return;
 	}
 
+	// Expression results don't outlive the callback
+	arena_reset(&mp->mp_exp_arena);
+
 	/*
 	 * Free resources at close
 	 */
@@ -1020,7 +1147,10 @@ milter_eom(SMFICTX * ctx)
 exit:
 	milter_common_fini(ctx, mp, MS_EOM);
 
-	milter_priv_clear_msg(mp);
+	if (mp)
+	{
+		milter_priv_clear_msg(mp);
+	}
 
 	return stat;
 }
@@ -1045,7 +1175,10 @@ milter_abort(SMFICTX * ctx)
 exit:
 	milter_common_fini(ctx, mp, MS_ABORT);
 
-	milter_priv_clear_msg(mp);
+	if (mp)
+	{
+		milter_priv_clear_msg(mp);
+	}
 
 	return SMFIS_CONTINUE;
 }
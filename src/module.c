@@ -278,6 +278,34 @@ module_init(int glob, ...)
 }
 
 
+/*
+ * Returns symbol name_suffix of the loaded module name (e.g. "memdb.so") or
+ * NULL.
+ */
+void *
+module_symbol(char *name, char *suffix)
+{
+	module_t *mod;
+	ll_entry_t *pos;
+
+	if (module_list == NULL)
+	{
+		return NULL;
+	}
+
+	pos = LL_START(module_list);
+	while ((mod = ll_next(module_list, &pos)))
+	{
+		if (strcmp(mod->mod_name, name) == 0)
+		{
+			return module_symbol_load(mod->mod_handle,
+			    mod->mod_path, suffix, 0);
+		}
+	}
+
+	return NULL;
+}
+
 static void
 module_delete(module_t *mod)
 {
@@ -53,23 +53,22 @@ bdb_get(dbt_t *dbt, var_t *record, var_t **result)
 {
 	DB *db = dbt->dbt_handle;
 	DBT k, d;
-	vp_t *lookup = NULL;
+	vp_key_t lookup;
 	vp_t rec;
 	int r;
 
 	*result = NULL;
 
-	lookup = vp_pack(record);
-	if (lookup == NULL) {
-		log_warning("bdb_get: vp_pack failed");
-		goto error;
+	if (vp_pack_key(&lookup, record)) {
+		log_warning("bdb_get: vp_pack_key failed");
+		return -1;
 	}
 
 	memset(&k, 0, sizeof(k));
 	memset(&d, 0, sizeof(d));
 
-	k.data = lookup->vp_key;
-	k.size = lookup->vp_klen;
+	k.data = lookup.vk_vp.vp_key;
+	k.size = lookup.vk_vp.vp_klen;
 
 	r = db->get(db, &k, &d, 0);
 	switch (r) {
@@ -92,15 +91,12 @@ bdb_get(dbt_t *dbt, var_t *record, var_t **result)
 	}
 
 exit:
-	vp_delete(lookup);
+	vp_key_clear(&lookup);
 
 	return 0;
 
 error:
-
-	if (lookup) {
-		vp_delete(lookup);
-	}
+	vp_key_clear(&lookup);
 
 	return -1;
 }
@@ -151,41 +147,29 @@ static int
 bdb_del(dbt_t *dbt, var_t *v)
 {
 	DB *db =dbt->dbt_handle;
-	DBT k, d;
-	vp_t *vp;
+	DBT k;
+	vp_key_t key;
 	int r;
 
-	vp = vp_pack(v);
-	if (vp == NULL) {
-		log_warning("bdb_del: vp_pack failed");
-		goto error;
+	if (vp_pack_key(&key, v)) {
+		log_warning("bdb_del: vp_pack_key failed");
+		return -1;
 	}
 
 	memset(&k, 0, sizeof k);
-	memset(&d, 0, sizeof d);
 
-	k.data = vp->vp_key;
-	k.size = vp->vp_klen;
-	d.data = vp->vp_data;
-	d.size = vp->vp_dlen;
+	k.data = key.vk_vp.vp_key;
+	k.size = key.vk_vp.vp_klen;
 
 	r = db->del(db, &k, 0);
+	vp_key_clear(&key);
+
 	if (r) {
 		log_warning("bdb_del: DB->del failed");
-		goto error;
+		return -1;
 	}
 
-	vp_delete(vp);
-
 	return 0;
-
-
-error:
-	if (vp) {
-		vp_delete(vp);
-	}
-
-	return -1;
 }
 
 
@@ -227,6 +211,76 @@ bdb_walk(dbt_t *dbt, dbt_db_callback_t callback)
 }
 
 
+/*
+ * Btree keys are ordered. The cursor holds the last visited key.
+ */
+int
+bdb_scan(dbt_t *dbt, dbt_cursor_t *cursor, int count,
+    dbt_db_callback_t callback)
+{
+	DB *db = dbt->dbt_handle;
+	DBT k, d;
+	int r;
+	vp_t vp;
+	var_t *record;
+	int flags;
+	int n = 0;
+
+	memset(&k, 0, sizeof(k));
+	memset(&d, 0, sizeof(d));
+
+	if (cursor->dc_key == NULL)
+	{
+		flags = R_FIRST;
+	}
+	else
+	{
+		// Returns the smallest key greater than or equal to dc_key
+		k.data = cursor->dc_key;
+		k.size = cursor->dc_klen;
+		flags = R_CURSOR;
+	}
+
+	for(; n < count && (r = db->seq(db, &k, &d, flags)) == 0; flags = R_NEXT)
+	{
+		// Skip the last key of the previous batch
+		if (flags == R_CURSOR && k.size == cursor->dc_klen &&
+		    memcmp(k.data, cursor->dc_key, k.size) == 0)
+		{
+			continue;
+		}
+
+		// Copied before the callback may delete the record
+		if (dbt_cursor_key(cursor, k.data, k.size))
+		{
+			log_warning("bdb_scan: dbt_cursor_key failed");
+			return -1;
+		}
+
+		vp_init(&vp, k.data, k.size, d.data, d.size);
+
+		record = vp_unpack(&vp, dbt->dbt_scheme);
+		if (record == NULL) {
+			log_warning("bdb_scan: vp_unpack failed");
+			return -1;
+		}
+
+		if(callback(dbt, record)) {
+			log_warning("bdb_scan: callback failed");
+		}
+
+		var_delete(record);
+		++n;
+	}
+	if(n < count && r != 1) {
+		log_warning("bdb_scan: DB->seq failed");
+		return -1;
+	}
+
+	return n;
+}
+
+
 static int
 bdb_sync(dbt_t *dbt)
 {
@@ -251,6 +305,7 @@ bdb_init(void)
 	dbt_driver.dd_set = (dbt_db_set_t) bdb_set;
 	dbt_driver.dd_del = (dbt_db_del_t) bdb_del;
 	dbt_driver.dd_walk = (dbt_db_walk_t) bdb_walk;
+	dbt_driver.dd_scan = (dbt_db_scan_t) bdb_scan;
 	dbt_driver.dd_sync = (dbt_db_sync_t) bdb_sync;
 	dbt_driver.dd_flags = DBT_LOCK;
 
@@ -97,7 +97,7 @@ dblog_init(void)
 
 	scheme = vlist_scheme("dblog",
 		"id",			VT_STRING,	VF_KEEPNAME | VF_KEY,
-		"received",		VT_INT,		VF_KEEPNAME,
+		"received",		VT_INT,		VF_KEEPNAME | VF_INDEX,
 		"hostaddr_str",		VT_STRING,	VF_KEEPNAME,
 		"hostname",		VT_STRING,	VF_KEEPNAME,
 		"helo",			VT_STRING,	VF_KEEPNAME,
@@ -107,8 +107,8 @@ dblog_init(void)
 		"recipients",		VT_INT,		VF_KEEPNAME,
 		"recipient_list_str",	VT_STRING,	VF_KEEPNAME,
 		"message_size",		VT_INT,		VF_KEEPNAME,
-		"queue_id",		VT_STRING,	VF_KEEPNAME,
-		"message_id",		VT_STRING,	VF_KEEPNAME,
+		"queue_id",		VT_STRING,	VF_KEEPNAME | VF_INDEX,
+		"message_id",		VT_STRING,	VF_KEEPNAME | VF_INDEX,
 		"acl_matched",		VT_INT,		VF_KEEPNAME,
 		"acl_stage_matched",	VT_INT,		VF_KEEPNAME,
 		"acl_rule",		VT_INT,		VF_KEEPNAME,
@@ -53,6 +53,92 @@ error:
 	return -1;
 }
 
+static sqlite3_stmt *
+lite_prepare(sqlite3 *db, char *query)
+{
+	sqlite3_stmt *stmt = NULL;
+
+	if (sqlite3_prepare_v2(db, query, -1, &stmt, NULL) != SQLITE_OK)
+	{
+		log_error("lite_prepare: %s", sqlite3_errmsg(db));
+		return NULL;
+	}
+
+	return stmt;
+}
+
+static int
+lite_exec_prepared(sqlite3 *db, sqlite3_stmt *stmt, sqlite3_stmt **result,
+    int nparams, char **params, int *tuples, int *affected)
+{
+	int i, r;
+
+	*result = NULL;
+	*tuples = 0;
+	*affected = 0;
+
+	sqlite3_reset(stmt);
+	sqlite3_clear_bindings(stmt);
+
+	for (i = 0; i < nparams; ++i)
+	{
+		if (params[i] == NULL)
+		{
+			r = sqlite3_bind_null(stmt, i + 1);
+		}
+		else
+		{
+			r = sqlite3_bind_text(stmt, i + 1, params[i], -1,
+				SQLITE_TRANSIENT);
+		}
+
+		if (r != SQLITE_OK)
+		{
+			log_error("lite_exec_prepared: %s", sqlite3_errmsg(db));
+			return -1;
+		}
+	}
+
+	switch(sqlite3_step(stmt))
+	{
+	case SQLITE_DONE:
+		*tuples = 0;
+		break;
+
+	case SQLITE_ROW:
+		// See lite_exec
+		*tuples = 1;
+		break;
+
+	default:
+		log_error("lite_exec_prepared: %s", sqlite3_errmsg(db));
+		sqlite3_reset(stmt);
+		return -1;
+	}
+
+	*affected = sqlite3_changes(db);
+	*result = stmt;
+
+	return 0;
+}
+
+static void
+lite_release(sqlite3 *db, sqlite3_stmt *stmt, sqlite3_stmt *result)
+{
+	// The statement is cached. Reset it for the next execution.
+	sqlite3_reset(stmt);
+
+	return;
+}
+
+static void
+lite_finalize(sqlite3 *db, sqlite3_stmt *stmt)
+{
+	sqlite3_finalize(stmt);
+
+	return;
+}
+
 static sqlite3_stmt *
 lite_get_row(sqlite3 *db, sqlite3_stmt *stmt, int nrow)
 {
@@ -93,12 +179,12 @@ lite_open(dbt_t *dbt)
 
 	if (sqlite3_open_v2(dbt->dbt_path, &db, flags, NULL))
 	{
-		log_error("lite_open: %s: %s", dbt->dbt_table,
+		log_error("lite_open: %s: %s", dbt->dbt_name,
 			sqlite3_errmsg(db));
 		goto error;
 	}
 
-	log_debug("lite_open: %s: connection ok", dbt->dbt_table);
+	log_debug("lite_open: %s: connection ok", dbt->dbt_name);
 
 	dbt->dbt_handle = db;
 
@@ -176,6 +262,78 @@ lite_table_exists(sqlite3 *conn, char *table)
 	return tuples;
 }
 
+static int
+lite_index_exists(sqlite3 *conn, char *table, char *column)
+{
+	sqlite3_stmt *res;
+	char query[BUFLEN];
+	int tuples, affected;
+	int n;
+
+	n = snprintf(query, sizeof query,
+		"SELECT m.name FROM sqlite_master m, pragma_index_info(m.name) i "
+		"WHERE m.type='index' AND m.tbl_name='%s' AND i.seqno=0 "
+		"AND i.name='%s';", table, column);
+	if (n >= sizeof query)
+	{
+		log_warning("lite_index_exists: buffer exhausted");
+		return -1;
+	}
+
+	// pragma_index_info needs sqlite 3.16
+	if (lite_exec(conn, &res, query, &tuples, &affected))
+	{
+		log_warning("lite_index_exists: lite_exec failed: can't verify "
+		    "index on %s.%s", table, column);
+		return -1;
+	}
+	sqlite3_finalize(res);
+
+	return tuples;
+}
+
+static int
+lite_upsert(sqlite3 *conn, char *buffer, int size, char *keys, char *set)
+{
+	int n;
+
+	if (*set)
+	{
+		n = snprintf(buffer, size, " ON CONFLICT (%s) DO UPDATE SET %s", keys, set);
+	}
+	else
+	{
+		n = snprintf(buffer, size, " ON CONFLICT (%s) DO NOTHING", keys);
+	}
+
+	if (n >= size)
+	{
+		log_error("lite_upsert: buffer exhausted");
+		return -1;
+	}
+
+	return 0;
+}
+
+static int
+lite_cleanup_batch(sqlite3 *conn, char *buffer, int size, char *table,
+    char *expire, unsigned long now, int limit)
+{
+	int n;
+
+	// DELETE ... LIMIT requires SQLITE_ENABLE_UPDATE_DELETE_LIMIT
+	n = snprintf(buffer, size, "DELETE FROM %s WHERE rowid IN "
+		"(SELECT rowid FROM %s WHERE %s < %lu LIMIT %d)", table, table,
+		expire, now, limit);
+	if (n >= size)
+	{
+		log_error("lite_cleanup_batch: buffer exhausted");
+		return -1;
+	}
+
+	return 0;
+}
+
 static void
 lite_close(dbt_t *dbt)
 {
@@ -212,9 +370,18 @@ lite_init(void)
 	dbt_driver.dd_sql.sql_esc_value      = (sql_escape_t) lite_esc_value;
 	dbt_driver.dd_sql.sql_exec           = (sql_exec_t) lite_exec;
 	dbt_driver.dd_sql.sql_table_exists   = (sql_table_exists_t) lite_table_exists;
+	dbt_driver.dd_sql.sql_index_exists   = (sql_index_exists_t) lite_index_exists;
 	dbt_driver.dd_sql.sql_free_result    = (sql_free_result_t) sqlite3_finalize;
 	dbt_driver.dd_sql.sql_get_row        = (sql_get_row_t) lite_get_row;
 	dbt_driver.dd_sql.sql_get_value      = (sql_get_value_t) lite_get_value;
+	dbt_driver.dd_sql.sql_upsert         = (sql_upsert_t) lite_upsert;
+	dbt_driver.dd_sql.sql_cleanup_batch  = (sql_cleanup_batch_t) lite_cleanup_batch;
+	dbt_driver.dd_sql.sql_param          = "?%d";
+	dbt_driver.dd_sql.sql_prepare_ops    = SQL_PREPARE_READ | SQL_PREPARE_WRITE;
+	dbt_driver.dd_sql.sql_prepare        = (sql_prepare_t) lite_prepare;
+	dbt_driver.dd_sql.sql_exec_prepared  = (sql_exec_prepared_t) lite_exec_prepared;
+	dbt_driver.dd_sql.sql_release        = (sql_release_t) lite_release;
+	dbt_driver.dd_sql.sql_finalize       = (sql_finalize_t) lite_finalize;
 
 	dbt_driver_register(&dbt_driver);
 
@@ -2,38 +2,1092 @@
 #include <stdlib.h>
 #include <errno.h>
 #include <stdio.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/uio.h>
 
 #include <mopher.h>
 
 
-#define MEMDB_BUCKETS 4096
+#define MEMDB_SLOTS 4096
+#define BUFLEN 8192
+
+/*
+ * Persistence
+ */
+#define MEMDB_MAGIC 0x3142444d
+#define MEMDB_SET 'S'
+#define MEMDB_DEL 'D'
+#define MEMDB_LOG_SUFFIX ".log"
+#define MEMDB_TMP_SUFFIX ".tmp"
+#define MEMDB_OLD_SUFFIX ".old"
+
+#define MEMDB_PERSISTENT(dbt) (((memdb_t *) (dbt)->dbt_handle)->md_path != NULL)
+
+/*
+ * Slab size classes are multiples of MEMDB_SLAB_QUANTUM
+ */
+#define MEMDB_SLAB_CHUNK (64 * 1024)
+#define MEMDB_SLAB_QUANTUM 16
+#define MEMDB_SLAB_MAX 1024
+#define MEMDB_SLAB_CLASSES (MEMDB_SLAB_MAX / MEMDB_SLAB_QUANTUM)
+#define MEMDB_SLAB_ALIGN(n) \
+	(((n) + MEMDB_SLAB_QUANTUM - 1) & ~(MEMDB_SLAB_QUANTUM - 1))
+#define MEMDB_SLAB_CLASS(n) (MEMDB_SLAB_ALIGN(n) / MEMDB_SLAB_QUANTUM - 1)
+#define MEMDB_SLAB_SIZE(class) (((class) + 1) * MEMDB_SLAB_QUANTUM)
+
+/*
+ * Records hold the key followed by the data. Data is 8 byte aligned for
+ * vp_unpack.
+ */
+#define MEMDB_KEY_ALIGN(klen) (((klen) + 7) & ~7)
+#define MEMDB_RECORD_SIZE(klen, dlen) \
+	((int) sizeof (memdb_record_t) + MEMDB_KEY_ALIGN(klen) + (dlen))
+#define MEMDB_RECORD_KEY(mr) ((char *) (mr) + sizeof (memdb_record_t))
+#define MEMDB_RECORD_DATA(mr) \
+	(MEMDB_RECORD_KEY(mr) + MEMDB_KEY_ALIGN((mr)->mr_klen))
+
+typedef struct memdb_record {
+	uint32_t	 mr_klen;
+	uint32_t	 mr_dlen;
+} memdb_record_t;
+
+typedef struct memdb_slot {
+	uint32_t	 ms_hash;
+	uint32_t	 ms_prefix;
+	memdb_record_t	*ms_record;
+} memdb_slot_t;
+
+typedef struct memdb_slab_free {
+	struct memdb_slab_free	*mf_next;
+} memdb_slab_free_t;
+
+typedef struct memdb_slab {
+	memdb_slab_free_t	*ms_free[MEMDB_SLAB_CLASSES];
+	void			*ms_chunks;
+	char			*ms_next;
+	int			 ms_left;
+} memdb_slab_t;
+
+typedef struct memdb {
+	memdb_slot_t	*md_slots;
+	uint32_t	 md_size;
+	uint32_t	 md_used;
+	uint32_t	 md_filled;
+	memdb_slab_t	 md_slab;
+	char		*md_path;
+	char		*md_log_path;
+	char		*md_old_path;
+	int		 md_log;
+	int		 md_snapshotting;
+	uint32_t	 md_scheme;
+	time_t		 md_snapshot;
+	time_t		 md_fsync;
+} memdb_t;
+
+typedef struct memdb_header {
+	uint32_t	 mh_magic;
+	uint32_t	 mh_scheme;
+	uint32_t	 mh_records;
+} memdb_header_t;
+
+typedef struct memdb_entry {
+	uint32_t	 me_op;
+	uint32_t	 me_klen;
+	uint32_t	 me_dlen;
+} memdb_entry_t;
 
 
 static dbt_driver_t dbt_driver;
 
-static hash_t
-memdb_record_hash(vp_t *vp)
-{
-	return HASH(vp->vp_key, vp->vp_klen);
+static int memdb_snapshot(dbt_t *dbt);
+
+/*
+ * Marks deleted slots. Lookups continue probing, inserts reuse them.
+ */
+static memdb_record_t memdb_tombstone;
+
+
+/*
+ * Slab allocator
+ *
+ * Records up to MEMDB_SLAB_MAX bytes are carved from MEMDB_SLAB_CHUNK
+ * sized chunks. Freed records are kept on a free list per size class.
+ * Chunks are released when the table is closed. Larger records are
+ * malloc'd.
+ */
+static void *
+memdb_slab_alloc(memdb_slab_t *slab, int size)
+{
+	memdb_slab_free_t *mf;
+	void *chunk;
+	int class;
+
+	if (size > MEMDB_SLAB_MAX)
+	{
+		return malloc(size);
+	}
+
+	class = MEMDB_SLAB_CLASS(size);
+
+	mf = slab->ms_free[class];
+	if (mf)
+	{
+		slab->ms_free[class] = mf->mf_next;
+		return mf;
+	}
+
+	size = MEMDB_SLAB_SIZE(class);
+
+	if (slab->ms_left < size)
+	{
+		chunk = malloc(MEMDB_SLAB_CHUNK);
+		if (chunk == NULL)
+		{
+			return NULL;
+		}
+
+		// Chunks are linked through their first word
+		*(void **) chunk = slab->ms_chunks;
+		slab->ms_chunks = chunk;
+		slab->ms_next = (char *) chunk + MEMDB_SLAB_ALIGN(sizeof (void *));
+		slab->ms_left = MEMDB_SLAB_CHUNK -
+		    MEMDB_SLAB_ALIGN(sizeof (void *));
+	}
+
+	chunk = slab->ms_next;
+	slab->ms_next += size;
+	slab->ms_left -= size;
+
+	return chunk;
+}
+
+
+static void
+memdb_slab_release(memdb_slab_t *slab, void *p, int size)
+{
+	memdb_slab_free_t *mf = p;
+	int class;
+
+	if (size > MEMDB_SLAB_MAX)
+	{
+		free(p);
+		return;
+	}
+
+	class = MEMDB_SLAB_CLASS(size);
+
+	mf->mf_next = slab->ms_free[class];
+	slab->ms_free[class] = mf;
+
+	return;
+}
+
+
+static void
+memdb_slab_clear(memdb_slab_t *slab)
+{
+	void *chunk, *next;
+
+	for (chunk = slab->ms_chunks; chunk; chunk = next)
+	{
+		next = *(void **) chunk;
+		free(chunk);
+	}
+
+	memset(slab, 0, sizeof (memdb_slab_t));
+
+	return;
+}
+
+
+/*
+ * Record table
+ *
+ * Open addressing with linear probing. Slots hold the hash and the first
+ * bytes of the key, hence most mismatches are rejected without touching
+ * the record.
+ */
+static uint32_t
+memdb_prefix(void *key, int klen)
+{
+	uint32_t prefix = 0;
+
+	memcpy(&prefix, key, klen < sizeof prefix ? klen : sizeof prefix);
+
+	return prefix;
+}
+
+
+static void
+memdb_record_free(memdb_t *md, memdb_record_t *mr)
+{
+	memdb_slab_release(&md->md_slab, mr,
+	    MEMDB_RECORD_SIZE(mr->mr_klen, mr->mr_dlen));
+
+	return;
+}
+
+
+static int
+memdb_table_create(memdb_t *md, uint32_t records)
+{
+	uint32_t size;
+
+	// Load 25% after creation or resize
+	for (size = MEMDB_SLOTS; size < records * 4; size *= 2);
+
+	md->md_slots = (memdb_slot_t *) calloc(size, sizeof (memdb_slot_t));
+	if (md->md_slots == NULL)
+	{
+		log_sys_error("memdb_table_create: calloc");
+		return -1;
+	}
+
+	md->md_size = size;
+	md->md_used = 0;
+	md->md_filled = 0;
+
+	return 0;
+}
+
+
+static void
+memdb_table_clear(memdb_t *md)
+{
+	if (md->md_slots)
+	{
+		free(md->md_slots);
+	}
+
+	memdb_slab_clear(&md->md_slab);
+
+	return;
+}
+
+
+/*
+ * Returns 1 and the slot of key if found. Otherwise returns 0 and the
+ * first free slot.
+ */
+static int
+memdb_find(memdb_t *md, void *key, int klen, uint32_t hash, uint32_t *slot)
+{
+	memdb_slot_t *ms;
+	memdb_record_t *mr;
+	uint32_t mask = md->md_size - 1;
+	uint32_t prefix = memdb_prefix(key, klen);
+	uint32_t i;
+	int tombstone = 0;
+
+	for (i = hash & mask;; i = (i + 1) & mask)
+	{
+		ms = md->md_slots + i;
+		mr = ms->ms_record;
+
+		if (mr == NULL)
+		{
+			if (!tombstone)
+			{
+				*slot = i;
+			}
+
+			return 0;
+		}
+
+		if (mr == &memdb_tombstone)
+		{
+			if (!tombstone)
+			{
+				*slot = i;
+				tombstone = 1;
+			}
+
+			continue;
+		}
+
+		if (ms->ms_hash != hash || ms->ms_prefix != prefix)
+		{
+			continue;
+		}
+
+		if (mr->mr_klen == klen &&
+		    memcmp(MEMDB_RECORD_KEY(mr), key, klen) == 0)
+		{
+			*slot = i;
+			return 1;
+		}
+	}
+}
+
+
+/*
+ * Rehashes all records into a new slot array. Drops tombstones and
+ * shrinks the table after mass deletions.
+ */
+static int
+memdb_table_resize(memdb_t *md)
+{
+	memdb_slot_t *slots = md->md_slots, *ms;
+	uint32_t size = md->md_size, used = md->md_used, i, slot;
+	memdb_record_t *mr;
+
+	if (memdb_table_create(md, used + 1))
+	{
+		log_error("memdb_table_resize: memdb_table_create failed");
+		md->md_slots = slots;
+		return -1;
+	}
+
+	for (i = 0; i < size; ++i)
+	{
+		mr = slots[i].ms_record;
+		if (mr == NULL || mr == &memdb_tombstone)
+		{
+			continue;
+		}
+
+		memdb_find(md, MEMDB_RECORD_KEY(mr), mr->mr_klen,
+		    slots[i].ms_hash, &slot);
+
+		ms = md->md_slots + slot;
+		ms->ms_hash = slots[i].ms_hash;
+		ms->ms_prefix = slots[i].ms_prefix;
+		ms->ms_record = mr;
+	}
+
+	md->md_used = used;
+	md->md_filled = used;
+
+	free(slots);
+
+	return 0;
+}
+
+
+static int
+memdb_put(memdb_t *md, void *key, int klen, void *data, int dlen)
+{
+	memdb_slot_t *ms;
+	memdb_record_t *mr;
+	uint32_t hash, slot;
+	int found;
+
+	// Maximum load 50% including tombstones
+	if ((md->md_filled + 1) * 2 > md->md_size && memdb_table_resize(md))
+	{
+		log_error("memdb_put: memdb_table_resize failed");
+		return -1;
+	}
+
+	hash = HASH(key, klen);
+	found = memdb_find(md, key, klen, hash, &slot);
+	ms = md->md_slots + slot;
+
+	// Update in place if the size class does not change
+	if (found)
+	{
+		mr = ms->ms_record;
+		if (MEMDB_RECORD_SIZE(klen, dlen) <= MEMDB_SLAB_MAX &&
+		    MEMDB_SLAB_CLASS(MEMDB_RECORD_SIZE(klen, dlen)) ==
+		    MEMDB_SLAB_CLASS(MEMDB_RECORD_SIZE(klen, mr->mr_dlen)))
+		{
+			memcpy(MEMDB_RECORD_DATA(mr), data, dlen);
+			mr->mr_dlen = dlen;
+			return 0;
+		}
+	}
+
+	mr = memdb_slab_alloc(&md->md_slab, MEMDB_RECORD_SIZE(klen, dlen));
+	if (mr == NULL)
+	{
+		log_sys_error("memdb_put: memdb_slab_alloc");
+		return -1;
+	}
+
+	mr->mr_klen = klen;
+	mr->mr_dlen = dlen;
+	memcpy(MEMDB_RECORD_KEY(mr), key, klen);
+	memcpy(MEMDB_RECORD_DATA(mr), data, dlen);
+
+	if (found)
+	{
+		memdb_record_free(md, ms->ms_record);
+	}
+	else
+	{
+		if (ms->ms_record == NULL)
+		{
+			++md->md_filled;
+		}
+
+		++md->md_used;
+	}
+
+	ms->ms_hash = hash;
+	ms->ms_prefix = memdb_prefix(key, klen);
+	ms->ms_record = mr;
+
+	return 0;
+}
+
+
+static void
+memdb_remove(memdb_t *md, void *key, int klen)
+{
+	memdb_slot_t *ms;
+	uint32_t slot;
+
+	if (!memdb_find(md, key, klen, HASH(key, klen), &slot))
+	{
+		return;
+	}
+
+	ms = md->md_slots + slot;
+
+	memdb_record_free(md, ms->ms_record);
+	ms->ms_record = &memdb_tombstone;
+	--md->md_used;
+
+	return;
+}
+
+
+static void
+memdb_record_vp(memdb_record_t *mr, vp_t *vp)
+{
+	vp_init(vp, MEMDB_RECORD_KEY(mr), mr->mr_klen, MEMDB_RECORD_DATA(mr),
+	    mr->mr_dlen);
+
+	return;
+}
+
+
+/*
+ * Persistence
+ *
+ * If path is set the table is written to a snapshot file periodically.
+ * Writes between two snapshots are appended to a log (path.log). On open
+ * the snapshot is loaded and the log replayed. Both files start with a
+ * memdb_header_t followed by memdb_entry_t records (key and data as
+ * produced by vp_pack). The files are not portable between hosts.
+ *
+ * Periodic snapshots are copied in memory while the table is locked and
+ * written without the lock. The log is moved to path.log.old meanwhile
+ * and removed once the snapshot is on disk.
+ */
+static int
+memdb_log_append(dbt_t *dbt, uint32_t op, vp_t *vp)
+{
+	memdb_t *md = dbt->dbt_handle;
+	memdb_entry_t me;
+	struct iovec iov[3];
+	ssize_t len, n;
+	off_t offset;
+	time_t now;
+
+	me.me_op = op;
+	me.me_klen = vp->vp_klen;
+	me.me_dlen = op == MEMDB_SET ? vp->vp_dlen : 0;
+
+	iov[0].iov_base = &me;
+	iov[0].iov_len = sizeof me;
+	iov[1].iov_base = vp->vp_key;
+	iov[1].iov_len = me.me_klen;
+	iov[2].iov_base = vp->vp_data;
+	iov[2].iov_len = me.me_dlen;
+
+	len = sizeof me + me.me_klen + me.me_dlen;
+
+	// Writers hold the table lock. The offset stays valid.
+	offset = lseek(md->md_log, 0, SEEK_END);
+	if (offset == -1)
+	{
+		log_sys_error("memdb_log_append: %s: lseek", md->md_log_path);
+		return -1;
+	}
+
+	n = writev(md->md_log, iov, 3);
+	if (n == len)
+	{
+		goto sync;
+	}
+
+	log_sys_error("memdb_log_append: %s: writev", md->md_log_path);
+
+	if (n <= 0)
+	{
+		return -1;
+	}
+
+	/*
+	 * Replay stops at a torn entry. Later appends would be lost. Cut the
+	 * entry off or replace the log by a snapshot.
+	 */
+	if (ftruncate(md->md_log, offset))
+	{
+		log_sys_error("memdb_log_append: %s: ftruncate",
+		    md->md_log_path);
+
+		if (memdb_snapshot(dbt))
+		{
+			log_error("memdb_log_append: %s: memdb_snapshot failed",
+			    md->md_log_path);
+		}
+	}
+
+	return -1;
+
+sync:
+
+	/*
+	 * fsync_interval: 0 syncs every write, -1 leaves it to the system
+	 */
+	if (dbt->dbt_fsync_interval < 0)
+	{
+		return 0;
+	}
+
+	now = time(NULL);
+	if (now - md->md_fsync < dbt->dbt_fsync_interval)
+	{
+		return 0;
+	}
+
+	if (fdatasync(md->md_log))
+	{
+		log_sys_error("memdb_log_append: %s: fdatasync",
+		    md->md_log_path);
+		return -1;
+	}
+
+	md->md_fsync = now;
+
+	return 0;
+}
+
+
+static int
+memdb_log_reset(memdb_t *md)
+{
+	memdb_header_t mh;
+
+	if (ftruncate(md->md_log, 0))
+	{
+		log_sys_error("memdb_log_reset: %s: ftruncate", md->md_log_path);
+		return -1;
+	}
+
+	mh.mh_magic = MEMDB_MAGIC;
+	mh.mh_scheme = md->md_scheme;
+	mh.mh_records = 0;
+
+	// Log is opened with O_APPEND
+	if (write(md->md_log, &mh, sizeof mh) != sizeof mh)
+	{
+		log_sys_error("memdb_log_reset: %s: write", md->md_log_path);
+		return -1;
+	}
+
+	return 0;
+}
+
+
+/*
+ * Copies all records into a single buffer in snapshot file format.
+ * Returns the size of the buffer.
+ * CAVEAT: Needs to run in locked context.
+ */
+static ssize_t
+memdb_snapshot_copy(memdb_t *md, char **buffer)
+{
+	memdb_header_t mh;
+	memdb_entry_t me;
+	memdb_record_t *mr;
+	size_t size;
+	uint32_t i;
+	char *p;
+
+	size = sizeof mh;
+	for (i = 0; i < md->md_size; ++i)
+	{
+		mr = md->md_slots[i].ms_record;
+		if (mr == NULL || mr == &memdb_tombstone)
+		{
+			continue;
+		}
+
+		size += sizeof me + mr->mr_klen + mr->mr_dlen;
+	}
+
+	*buffer = malloc(size);
+	if (*buffer == NULL)
+	{
+		log_sys_error("memdb_snapshot_copy: malloc");
+		return -1;
+	}
+
+	mh.mh_magic = MEMDB_MAGIC;
+	mh.mh_scheme = md->md_scheme;
+	mh.mh_records = md->md_used;
+
+	memcpy(*buffer, &mh, sizeof mh);
+	p = *buffer + sizeof mh;
+
+	me.me_op = MEMDB_SET;
+
+	for (i = 0; i < md->md_size; ++i)
+	{
+		mr = md->md_slots[i].ms_record;
+		if (mr == NULL || mr == &memdb_tombstone)
+		{
+			continue;
+		}
+
+		me.me_klen = mr->mr_klen;
+		me.me_dlen = mr->mr_dlen;
+
+		memcpy(p, &me, sizeof me);
+		p += sizeof me;
+		memcpy(p, MEMDB_RECORD_KEY(mr), mr->mr_klen);
+		p += mr->mr_klen;
+		memcpy(p, MEMDB_RECORD_DATA(mr), mr->mr_dlen);
+		p += mr->mr_dlen;
+	}
+
+	return size;
+}
+
+
+/*
+ * Writes a snapshot buffer to path.tmp and renames it to path. Uses
+ * nothing but md_path and may run unlocked.
+ */
+static int
+memdb_snapshot_write(memdb_t *md, char *buffer, size_t size)
+{
+	char tmp[BUFLEN];
+	size_t done;
+	ssize_t n;
+	int fd;
+
+	if (util_concat(tmp, sizeof tmp, md->md_path, MEMDB_TMP_SUFFIX, NULL)
+	    == -1)
+	{
+		log_error("memdb_snapshot_write: util_concat failed");
+		return -1;
+	}
+
+	fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0660);
+	if (fd == -1)
+	{
+		log_sys_error("memdb_snapshot_write: open %s", tmp);
+		return -1;
+	}
+
+	for (done = 0; done < size; done += n)
+	{
+		n = write(fd, buffer + done, size - done);
+		if (n == -1)
+		{
+			if (errno == EINTR)
+			{
+				n = 0;
+				continue;
+			}
+
+			goto error;
+		}
+	}
+
+	if (fsync(fd))
+	{
+		goto error;
+	}
+
+	n = close(fd);
+	fd = -1;
+	if (n)
+	{
+		goto error;
+	}
+
+	if (rename(tmp, md->md_path))
+	{
+		log_sys_error("memdb_snapshot_write: rename %s", tmp);
+		unlink(tmp);
+		return -1;
+	}
+
+	return 0;
+
+error:
+	log_sys_error("memdb_snapshot_write: write %s", tmp);
+
+	if (fd != -1)
+	{
+		close(fd);
+	}
+
+	unlink(tmp);
+
+	return -1;
+}
+
+
+/*
+ * Moves the log to path.log.old and starts a new one. If path.log.old
+ * exists, the snapshot that should have replaced it failed. It is still
+ * needed and the log is kept as well.
+ * CAVEAT: Needs to run in locked context.
+ */
+static int
+memdb_log_rotate(memdb_t *md)
+{
+	int fd;
+
+	if (access(md->md_old_path, F_OK) == 0)
+	{
+		return 0;
+	}
+
+	if (rename(md->md_log_path, md->md_old_path))
+	{
+		log_sys_error("memdb_log_rotate: rename %s", md->md_log_path);
+		return -1;
+	}
+
+	fd = open(md->md_log_path, O_RDWR | O_CREAT | O_APPEND, 0660);
+	if (fd == -1)
+	{
+		log_sys_error("memdb_log_rotate: open %s", md->md_log_path);
+
+		if (rename(md->md_old_path, md->md_log_path))
+		{
+			log_sys_error("memdb_log_rotate: rename %s",
+			    md->md_old_path);
+		}
+
+		return -1;
+	}
+
+	close(md->md_log);
+	md->md_log = fd;
+
+	if (memdb_log_reset(md))
+	{
+		log_error("memdb_log_rotate: memdb_log_reset failed");
+		return -1;
+	}
+
+	return 0;
+}
+
+
+/*
+ * Writes all records to path.tmp and renames it to path. The log is
+ * truncated afterwards. A crash in between replays records that are in
+ * the snapshot already, which is harmless. Used on close and to replace
+ * a damaged log.
+ * CAVEAT: Needs to run in locked context.
+ */
+static int
+memdb_snapshot(dbt_t *dbt)
+{
+	memdb_t *md = dbt->dbt_handle;
+	char *buffer;
+	ssize_t size;
+	int r;
+
+	// The tmp file is in use
+	if (md->md_snapshotting)
+	{
+		log_error("memdb_snapshot: %s: snapshot in progress",
+		    dbt->dbt_name);
+		return -1;
+	}
+
+	size = memdb_snapshot_copy(md, &buffer);
+	if (size == -1)
+	{
+		log_error("memdb_snapshot: memdb_snapshot_copy failed");
+		return -1;
+	}
+
+	r = memdb_snapshot_write(md, buffer, size);
+	free(buffer);
+
+	if (r)
+	{
+		log_error("memdb_snapshot: memdb_snapshot_write failed");
+		return -1;
+	}
+
+	if (unlink(md->md_old_path) && errno != ENOENT)
+	{
+		log_sys_error("memdb_snapshot: unlink %s", md->md_old_path);
+	}
+
+	if (memdb_log_reset(md))
+	{
+		log_error("memdb_snapshot: memdb_log_reset failed");
+		return -1;
+	}
+
+	md->md_snapshot = time(NULL);
+
+	log_debug("memdb_snapshot: %s: %u records written to %s",
+	    dbt->dbt_name, md->md_used, md->md_path);
+
+	return 0;
 }
 
 
+/*
+ * Applies the records of a snapshot or log file. Returns the number of
+ * valid bytes. A truncated last entry (e.g. after a crash) is ignored.
+ */
 static int
-memdb_record_match(vp_t *vp1, vp_t *vp2)
+memdb_load_file(dbt_t *dbt, char *path, char *buffer, int size)
 {
-	if (memcmp(vp1->vp_key, vp2->vp_key, vp1->vp_klen))
+	memdb_t *md = dbt->dbt_handle;
+	memdb_header_t *mh;
+	memdb_entry_t me;
+	char *key, *data;
+	int offset;
+
+	if (size < sizeof (memdb_header_t))
 	{
+		log_warning("memdb_load_file: %s: file too short", path);
 		return 0;
 	}
 
-	return 1;
+	mh = (memdb_header_t *) buffer;
+	if (mh->mh_magic != MEMDB_MAGIC || mh->mh_scheme != md->md_scheme)
+	{
+		log_warning("memdb_load_file: %s: bad magic or table scheme "
+		    "changed. Ignored.", path);
+		return 0;
+	}
+
+	for (offset = sizeof (memdb_header_t); offset < size;)
+	{
+		if ((long) offset + sizeof (memdb_entry_t) > size)
+		{
+			break;
+		}
+
+		/*
+		 * Entries follow each other without padding. The header is
+		 * copied instead of being read in place.
+		 */
+		memcpy(&me, buffer + offset, sizeof me);
+		if (size - offset - sizeof (memdb_entry_t) <
+		    (long) me.me_klen + me.me_dlen)
+		{
+			break;
+		}
+
+		key = buffer + offset + sizeof (memdb_entry_t);
+		data = key + me.me_klen;
+
+		switch (me.me_op)
+		{
+		case MEMDB_SET:
+			if (memdb_put(md, key, me.me_klen, data, me.me_dlen))
+			{
+				log_error("memdb_load_file: memdb_put failed");
+				return -1;
+			}
+			break;
+
+		case MEMDB_DEL:
+			memdb_remove(md, key, me.me_klen);
+			break;
+
+		default:
+			log_error("memdb_load_file: %s: bad record at offset %d",
+			    path, offset);
+			return offset;
+		}
+
+		offset += sizeof (memdb_entry_t) + me.me_klen + me.me_dlen;
+	}
+
+	if (offset < size)
+	{
+		log_warning("memdb_load_file: %s: ignoring truncated record at "
+		    "offset %d", path, offset);
+	}
+
+	return offset;
+}
+
+
+static int
+memdb_load(dbt_t *dbt)
+{
+	memdb_t *md = dbt->dbt_handle;
+	char *buffer = NULL;
+	memdb_header_t *mh;
+	uint32_t records = 0;
+	int size, valid;
+
+	/*
+	 * Snapshot. The table is sized to avoid resizes while loading.
+	 */
+	if (util_file_exists(md->md_path) == 1)
+	{
+		size = util_file(md->md_path, &buffer);
+		if (size == -1)
+		{
+			log_error("memdb_load: util_file failed");
+			return -1;
+		}
+
+		mh = (memdb_header_t *) buffer;
+		if (size >= sizeof (memdb_header_t))
+		{
+			records = mh->mh_records;
+		}
+	}
+	else
+	{
+		size = 0;
+	}
+
+	if (memdb_table_create(md, records))
+	{
+		log_error("memdb_load: memdb_table_create failed");
+		goto error;
+	}
+
+	if (size > 0 && memdb_load_file(dbt, md->md_path, buffer, size) == -1)
+	{
+		log_error("memdb_load: memdb_load_file failed");
+		goto error;
+	}
+
+	if (buffer)
+	{
+		free(buffer);
+		buffer = NULL;
+	}
+
+	/*
+	 * Log of a snapshot that did not complete
+	 */
+	if (util_file_exists(md->md_old_path) == 1)
+	{
+		size = util_file(md->md_old_path, &buffer);
+		if (size == -1)
+		{
+			log_error("memdb_load: util_file failed");
+			goto error;
+		}
+
+		if (size > 0 &&
+		    memdb_load_file(dbt, md->md_old_path, buffer, size) == -1)
+		{
+			log_error("memdb_load: memdb_load_file failed");
+			goto error;
+		}
+
+		free(buffer);
+		buffer = NULL;
+	}
+
+	/*
+	 * Replay log
+	 */
+	md->md_log = open(md->md_log_path, O_RDWR | O_CREAT | O_APPEND, 0660);
+	if (md->md_log == -1)
+	{
+		log_sys_error("memdb_load: open %s", md->md_log_path);
+		goto error;
+	}
+
+	size = util_file(md->md_log_path, &buffer);
+	if (size == -1)
+	{
+		log_error("memdb_load: util_file failed");
+		goto error;
+	}
+
+	valid = 0;
+	if (size > 0)
+	{
+		valid = memdb_load_file(dbt, md->md_log_path, buffer, size);
+		if (valid == -1)
+		{
+			log_error("memdb_load: memdb_load_file failed");
+			goto error;
+		}
+	}
+
+	// New, foreign or damaged log
+	if (valid < sizeof (memdb_header_t))
+	{
+		if (memdb_log_reset(md))
+		{
+			goto error;
+		}
+	}
+	else if (valid < size && ftruncate(md->md_log, valid))
+	{
+		log_sys_error("memdb_load: ftruncate %s", md->md_log_path);
+		goto error;
+	}
+
+	if (buffer)
+	{
+		free(buffer);
+	}
+
+	md->md_snapshot = md->md_fsync = time(NULL);
+
+	log_info("memdb_load: %s: %u records loaded", dbt->dbt_name,
+	    md->md_used);
+
+	return 0;
+
+error:
+	if (buffer)
+	{
+		free(buffer);
+	}
+
+	return -1;
 }
 
 
 static void
-memdb_record_delete(vp_t *vp)
+memdb_free(memdb_t *md)
 {
-	vp_delete(vp);
+	memdb_table_clear(md);
+
+	if (md->md_log != -1)
+	{
+		close(md->md_log);
+	}
+
+	if (md->md_path)
+	{
+		free(md->md_path);
+	}
+
+	if (md->md_log_path)
+	{
+		free(md->md_log_path);
+	}
+
+	if (md->md_old_path)
+	{
+		free(md->md_old_path);
+	}
+
+	free(md);
 
 	return;
 }
@@ -42,69 +1096,267 @@ memdb_record_delete(vp_t *vp)
 static int
 memdb_open(dbt_t *dbt)
 {
-	ht_t *ht;
-
-	ht = ht_create(MEMDB_BUCKETS, (ht_hash_t) memdb_record_hash,
-	    (ht_match_t) memdb_record_match,
-	    (ht_delete_t) memdb_record_delete);
+	memdb_t *md;
+	char log_path[BUFLEN], old_path[BUFLEN];
 
-	if (ht == NULL)
+	md = (memdb_t *) malloc(sizeof (memdb_t));
+	if (md == NULL)
 	{
-		log_error("memdb_open: ht_create failed");
+		log_sys_error("memdb_open: malloc");
 		return -1;
 	}
 
-	dbt->dbt_handle = ht;
+	memset(md, 0, sizeof (memdb_t));
+	md->md_log = -1;
+
+	dbt->dbt_handle = md;
+
+	// Not persistent
+	if (dbt->dbt_path == NULL)
+	{
+		if (memdb_table_create(md, 0))
+		{
+			log_error("memdb_open: memdb_table_create failed");
+			goto error;
+		}
+
+		return 0;
+	}
+
+	if (util_concat(log_path, sizeof log_path, dbt->dbt_path,
+	    MEMDB_LOG_SUFFIX, NULL) == -1)
+	{
+		log_error("memdb_open: util_concat failed");
+		goto error;
+	}
+
+	if (util_concat(old_path, sizeof old_path, log_path,
+	    MEMDB_OLD_SUFFIX, NULL) == -1)
+	{
+		log_error("memdb_open: util_concat failed");
+		goto error;
+	}
+
+	md->md_path = strdup(dbt->dbt_path);
+	md->md_log_path = strdup(log_path);
+	md->md_old_path = strdup(old_path);
+	if (md->md_path == NULL || md->md_log_path == NULL ||
+	    md->md_old_path == NULL)
+	{
+		log_sys_error("memdb_open: strdup");
+		goto error;
+	}
+
+	md->md_scheme = dbt_scheme_hash(dbt->dbt_scheme);
+
+	if (memdb_load(dbt))
+	{
+		log_error("memdb_open: %s: memdb_load failed", dbt->dbt_name);
+		goto error;
+	}
 
 	return 0;
+
+error:
+	memdb_free(md);
+	dbt->dbt_handle = NULL;
+
+	return -1;
 }
 
 
 static void
 memdb_close(dbt_t *dbt)
 {
-	ht_t *ht = dbt->dbt_handle;
+	memdb_t *md = dbt->dbt_handle;
+
+	if (md->md_path && memdb_snapshot(dbt))
+	{
+		log_error("memdb_close: %s: memdb_snapshot failed",
+		    dbt->dbt_name);
+	}
 
-	ht_delete(ht);
+	memdb_free(md);
 
 	return;
 }
 
+
+/*
+ * Called by the janitor after each cleanup and by dbt_db_sync. Takes the
+ * table lock itself (DBT_SYNC_SELF): disk writes run unlocked.
+ */
+static int
+memdb_sync(dbt_t *dbt)
+{
+	memdb_t *md = dbt->dbt_handle;
+	char *buffer;
+	ssize_t size;
+	int fd, r;
+
+	if (md->md_path == NULL)
+	{
+		return 0;
+	}
+
+	if (dbt_lock(dbt))
+	{
+		return -1;
+	}
+
+	if (md->md_snapshotting ||
+	    time(NULL) - md->md_snapshot < dbt->dbt_snapshot_interval)
+	{
+		// The log may be rotated once the lock is released
+		fd = dup(md->md_log);
+		dbt_unlock(dbt);
+
+		if (fd == -1)
+		{
+			log_sys_error("memdb_sync: %s: dup", md->md_log_path);
+			return -1;
+		}
+
+		r = fdatasync(fd);
+		if (r)
+		{
+			log_sys_error("memdb_sync: %s: fdatasync",
+			    md->md_log_path);
+		}
+
+		close(fd);
+
+		return r;
+	}
+
+	size = memdb_snapshot_copy(md, &buffer);
+	if (size == -1)
+	{
+		log_error("memdb_sync: memdb_snapshot_copy failed");
+		dbt_unlock(dbt);
+		return -1;
+	}
+
+	if (memdb_log_rotate(md))
+	{
+		log_error("memdb_sync: memdb_log_rotate failed");
+		dbt_unlock(dbt);
+		free(buffer);
+		return -1;
+	}
+
+	md->md_snapshotting = 1;
+	dbt_unlock(dbt);
+
+	r = memdb_snapshot_write(md, buffer, size);
+	free(buffer);
+
+	if (dbt_lock(dbt))
+	{
+		md->md_snapshotting = 0;
+		return -1;
+	}
+
+	md->md_snapshotting = 0;
+
+	if (r)
+	{
+		log_error("memdb_sync: %s: memdb_snapshot_write failed. Keeping "
+		    "%s", dbt->dbt_name, md->md_old_path);
+		dbt_unlock(dbt);
+		return -1;
+	}
+
+	if (unlink(md->md_old_path) && errno != ENOENT)
+	{
+		log_sys_error("memdb_sync: unlink %s", md->md_old_path);
+	}
+
+	md->md_snapshot = time(NULL);
+
+	log_debug("memdb_sync: %s: %ld bytes written to %s", dbt->dbt_name,
+	    (long) size, md->md_path);
+
+	dbt_unlock(dbt);
+
+	return 0;
+}
+
+
+/*
+ * Load includes tombstones. Probes is the average number of slots visited
+ * to find a record.
+ */
+static int
+memdb_stats(dbt_t *dbt, char *buffer, int size)
+{
+	memdb_t *md = dbt->dbt_handle;
+	memdb_record_t *mr;
+	uint32_t mask = md->md_size - 1;
+	unsigned long probes = 0;
+	uint32_t i;
+	int n;
+
+	for (i = 0; i < md->md_size; ++i)
+	{
+		mr = md->md_slots[i].ms_record;
+		if (mr == NULL || mr == &memdb_tombstone)
+		{
+			continue;
+		}
+
+		probes += ((i - md->md_slots[i].ms_hash) & mask) + 1;
+	}
+
+	n = snprintf(buffer, size, "records=%u slots=%u tombstones=%u "
+	    "load=%.1f%% probes=%.2f", md->md_used, md->md_size,
+	    md->md_filled - md->md_used,
+	    (float) 100 * md->md_filled / md->md_size,
+	    md->md_used ? (float) probes / md->md_used : 0);
+	if (n >= size)
+	{
+		log_error("memdb_stats: buffer exhausted");
+		return -1;
+	}
+
+	return 0;
+}
+
 static int
 memdb_get(dbt_t *dbt, var_t *record, var_t **result)
 {
-	ht_t *ht = dbt->dbt_handle;
-	vp_t *key = NULL, *data;
+	memdb_t *md = dbt->dbt_handle;
+	vp_key_t key;
+	vp_t data;
+	uint32_t slot;
 
-	key = vp_pack(record);
-	if (key == NULL) {
-		log_error("memdb_get: vp_pack failed");
-		goto error;
+	if (vp_pack_key(&key, record)) {
+		log_error("memdb_get: vp_pack_key failed");
+		return -1;
 	}
 
-	data = ht_lookup(ht, key);
-	if (data == NULL)
+	if (!memdb_find(md, key.vk_vp.vp_key, key.vk_vp.vp_klen,
+	    HASH(key.vk_vp.vp_key, key.vk_vp.vp_klen), &slot))
 	{
 		log_debug("memdb_get: no record found");
 		goto exit;
 	}
 
-	*result = vp_unpack(data, dbt->dbt_scheme);
+	memdb_record_vp(md->md_slots[slot].ms_record, &data);
+
+	*result = vp_unpack(&data, dbt->dbt_scheme);
 	if (*result == NULL) {
 		log_error("memdb_get: vp_unpack failed");
 		goto error;
 	}
 
 exit:
-	vp_delete(key);
+	vp_key_clear(&key);
 
 	return 0;
 
 error:
-
-	if (key) {
-		vp_delete(key);
-	}
+	vp_key_clear(&key);
 
 	return -1;
 }
@@ -112,7 +1364,7 @@ error:
 static int
 memdb_set(dbt_t *dbt, var_t *record)
 {
-	ht_t *ht = dbt->dbt_handle;
+	memdb_t *md = dbt->dbt_handle;
 	vp_t *vp = NULL;
 
 	vp = vp_pack(record);
@@ -121,13 +1373,20 @@ memdb_set(dbt_t *dbt, var_t *record)
 		goto error;
 	}
 
-	ht_remove(ht, vp);
-	if (ht_insert(ht, vp))
+	if (MEMDB_PERSISTENT(dbt) && memdb_log_append(dbt, MEMDB_SET, vp))
 	{
-		log_error("memdb_set: ht_insert failed");
+		log_error("memdb_set: memdb_log_append failed");
 		goto error;
 	}
 
+	if (memdb_put(md, vp->vp_key, vp->vp_klen, vp->vp_data, vp->vp_dlen))
+	{
+		log_error("memdb_set: memdb_put failed");
+		goto error;
+	}
+
+	vp_delete(vp);
+
 	return 0;
 
 error:
@@ -142,55 +1401,109 @@ error:
 static int
 memdb_del(dbt_t *dbt, var_t *record)
 {
-	ht_t *ht = dbt->dbt_handle;
-	vp_t *vp = NULL;
+	memdb_t *md = dbt->dbt_handle;
+	vp_key_t key;
 
-	vp = vp_pack(record);
-	if (vp == NULL) {
-		log_error("memdb_set: vp_pack failed");
-		goto error;
+	if (vp_pack_key(&key, record)) {
+		log_error("memdb_del: vp_pack_key failed");
+		return -1;
 	}
 
-	ht_remove(ht, vp);
-	vp_delete(vp);
+	if (MEMDB_PERSISTENT(dbt) &&
+	    memdb_log_append(dbt, MEMDB_DEL, &key.vk_vp))
+	{
+		log_error("memdb_del: memdb_log_append failed");
+		vp_key_clear(&key);
+		return -1;
+	}
+
+	memdb_remove(md, key.vk_vp.vp_key, key.vk_vp.vp_klen);
+	vp_key_clear(&key);
 
 	return 0;
+}
 
 
-error:
-	if (vp) {
-		vp_delete(vp);
+/*
+ * Unpacks the record in slot and calls callback. Returns 1 if the slot
+ * holds a record, 0 if not and -1 on error.
+ */
+static int
+memdb_visit(dbt_t *dbt, uint32_t slot, dbt_db_callback_t callback)
+{
+	memdb_t *md = dbt->dbt_handle;
+	memdb_record_t *mr = md->md_slots[slot].ms_record;
+	var_t *record;
+	vp_t vp;
+
+	if (mr == NULL || mr == &memdb_tombstone)
+	{
+		return 0;
 	}
 
-	return -1;
+	memdb_record_vp(mr, &vp);
+
+	record = vp_unpack(&vp, dbt->dbt_scheme);
+	if (record == NULL) {
+		log_error("memdb_visit: vp_unpack failed");
+		return -1;
+	}
+
+	// Callbacks may delete records but must not insert
+	if(callback(dbt, record)) {
+		log_error("memdb_visit: callback failed");
+	}
+
+	var_delete(record);
+
+	return 1;
 }
 
 
 int
 memdb_walk(dbt_t *dbt, dbt_db_callback_t callback)
 {
-	ht_t *ht = dbt->dbt_handle;
-	ht_pos_t pos;
-	vp_t *vp;
-	var_t *record;
+	memdb_t *md = dbt->dbt_handle;
+	uint32_t i;
 
-	ht_start(ht, &pos);
-	while ((vp = ht_next(ht, &pos)))
+	for (i = 0; i < md->md_size; ++i)
 	{
-		record = vp_unpack(vp, dbt->dbt_scheme);
-		if (record == NULL) {
-			log_error("memdb_walk: vp_unpack failed");
+		if (memdb_visit(dbt, i, callback) == -1)
+		{
+			log_error("memdb_walk: memdb_visit failed");
 			return -1;
 		}
+	}
+
+	return 0;
+}
+
+
+/*
+ * The cursor holds the next slot. If the table is resized between two
+ * batches some records may be visited twice or not at all. Records
+ * deleted meanwhile are never visited again. See dbt_db_walk.
+ */
+int
+memdb_scan(dbt_t *dbt, dbt_cursor_t *cursor, int count,
+    dbt_db_callback_t callback)
+{
+	memdb_t *md = dbt->dbt_handle;
+	int n = 0, r;
 
-		if(callback(dbt, record)) {
-			log_error("memdb_walk: callback failed");
+	for (; cursor->dc_pos < md->md_size && n < count; ++cursor->dc_pos)
+	{
+		r = memdb_visit(dbt, cursor->dc_pos, callback);
+		if (r == -1)
+		{
+			log_error("memdb_scan: memdb_visit failed");
+			return -1;
 		}
 
-		var_delete(record);
+		n += r;
 	}
 
-	return 0;
+	return n;
 }
 
 
@@ -204,7 +1517,10 @@ memdb_init(void)
 	dbt_driver.dd_set	= (dbt_db_set_t)	memdb_set;
 	dbt_driver.dd_del	= (dbt_db_del_t)	memdb_del;
 	dbt_driver.dd_walk	= (dbt_db_walk_t)	memdb_walk;
-	dbt_driver.dd_flags	= DBT_LOCK;
+	dbt_driver.dd_scan	= (dbt_db_scan_t)	memdb_scan;
+	dbt_driver.dd_sync	= (dbt_db_sync_t)	memdb_sync;
+	dbt_driver.dd_stats	= (dbt_db_stats_t)	memdb_stats;
+	dbt_driver.dd_flags	= DBT_LOCK | DBT_SYNC_SELF;
 
 	dbt_driver_register(&dbt_driver);
 
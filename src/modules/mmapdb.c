@@ -0,0 +1,1131 @@
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <mopher.h>
+
+
+#define BUFLEN 8192
+
+#define MMAPDB_MAGIC 0x32444d4d
+#define MMAPDB_MAGIC_V1 0x31444d4d
+#define MMAPDB_SLOTS 4096
+#define MMAPDB_DATA (1024 * 1024)
+#define MMAPDB_TMP_SUFFIX ".tmp"
+
+/*
+ * Slot offsets below MMAPDB_RESERVED are no records
+ */
+#define MMAPDB_EMPTY 0
+#define MMAPDB_TOMBSTONE 1
+#define MMAPDB_RESERVED 2
+
+#define MMAPDB_LIVE 1
+
+/*
+ * Compact if more than half of the data area (and at least
+ * MMAPDB_COMPACT bytes) is taken by dead records.
+ */
+#define MMAPDB_COMPACT (1024 * 1024)
+
+#define MMAPDB_ALIGN(n) (((uint64_t) (n) + 7) & ~((uint64_t) 7))
+#define MMAPDB_RECORD_SIZE(klen, size) \
+	(sizeof (mmapdb_record_t) + MMAPDB_ALIGN(klen) + (uint64_t) (size))
+#define MMAPDB_RECORD(md, offset) \
+	((mmapdb_record_t *) ((md)->mm_map + (offset)))
+#define MMAPDB_KEY(mr) ((char *) (mr) + sizeof (mmapdb_record_t))
+#define MMAPDB_DATA_OF(mr) (MMAPDB_KEY(mr) + MMAPDB_ALIGN((mr)->mr_klen))
+
+/*
+ * File layout:
+ *
+ * mmapdb_header_t
+ * mmapdb_slot_t[mh_slots]	open addressing, linear probing
+ * mmapdb_record_t ...		appended at mh_end, aligned to 8 bytes
+ *
+ * A record is followed by its key and data as produced by vp_pack. Live
+ * records are never modified. An update appends the new version and marks
+ * the old one dead afterwards. Records are flagged live and checksummed
+ * after they were written. If the file was not closed cleanly it is rebuilt
+ * from all live records with a valid checksum. If an update was torn, the
+ * old version is still live. If both versions are, the later one wins.
+ *
+ * Slots are hashed with hash_wy and a random seed stored in the header
+ * (mh_seed). Files written before the seed was added (MMAPDB_MAGIC_V1) are
+ * rebuilt on open.
+ *
+ * The file is not portable between hosts.
+ */
+typedef struct mmapdb_header {
+	uint32_t	 mh_magic;
+	uint32_t	 mh_scheme;
+	uint32_t	 mh_slots;
+	uint32_t	 mh_clean;
+	uint64_t	 mh_used;
+	uint64_t	 mh_filled;
+	uint64_t	 mh_data;
+	uint64_t	 mh_end;
+	uint64_t	 mh_dead;
+	uint64_t	 mh_seed;
+} mmapdb_header_t;
+
+#define MMAPDB_HEADER_V1 offsetof(mmapdb_header_t, mh_seed)
+
+typedef struct mmapdb_slot {
+	uint64_t	 ms_offset;
+	uint32_t	 ms_hash;
+	uint32_t	 ms_pad;
+} mmapdb_slot_t;
+
+typedef struct mmapdb_record {
+	uint32_t	 mr_klen;
+	uint32_t	 mr_dlen;
+	uint32_t	 mr_size;
+	uint32_t	 mr_flags;
+	uint32_t	 mr_check;
+	uint32_t	 mr_pad;
+} mmapdb_record_t;
+
+typedef struct mmapdb {
+	int		 mm_fd;
+	char		*mm_map;
+	uint64_t	 mm_size;
+	mmapdb_header_t	*mm_header;
+	mmapdb_slot_t	*mm_slots;
+	int		 mm_legacy;
+} mmapdb_t;
+
+
+static dbt_driver_t dbt_driver;
+
+
+static uint32_t
+mmapdb_check(mmapdb_record_t *mr)
+{
+	return HASH_STABLE(MMAPDB_KEY(mr), MMAPDB_ALIGN(mr->mr_klen) + mr->mr_dlen);
+}
+
+
+/*
+ * Slot hash. The seed is chosen when the file is created.
+ */
+static uint32_t
+mmapdb_hash(mmapdb_t *md, void *key, uint32_t klen)
+{
+	return hash_wy(key, klen, md->mm_header->mh_seed);
+}
+
+
+static void
+mmapdb_free(mmapdb_t *md)
+{
+	if (md->mm_map)
+	{
+		munmap(md->mm_map, md->mm_size);
+	}
+
+	if (md->mm_fd != -1)
+	{
+		close(md->mm_fd);
+	}
+
+	free(md);
+
+	return;
+}
+
+
+/*
+ * Maps size bytes of the file. The file is extended if necessary. All
+ * pointers into the previous mapping become invalid.
+ */
+static int
+mmapdb_map(mmapdb_t *md, uint64_t size)
+{
+	struct stat st;
+	char *map;
+
+	if (fstat(md->mm_fd, &st))
+	{
+		log_sys_error("mmapdb_map: fstat");
+		return -1;
+	}
+
+	if (st.st_size < size && ftruncate(md->mm_fd, size))
+	{
+		log_sys_error("mmapdb_map: ftruncate");
+		return -1;
+	}
+
+	map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, md->mm_fd,
+	    0);
+	if (map == MAP_FAILED)
+	{
+		log_sys_error("mmapdb_map: mmap");
+		return -1;
+	}
+
+	if (md->mm_map)
+	{
+		munmap(md->mm_map, md->mm_size);
+	}
+
+	md->mm_map = map;
+	md->mm_size = size;
+	md->mm_header = (mmapdb_header_t *) map;
+	md->mm_slots = (mmapdb_slot_t *) (map + sizeof (mmapdb_header_t));
+
+	return 0;
+}
+
+
+static mmapdb_t *
+mmapdb_handle(int fd)
+{
+	mmapdb_t *md;
+
+	md = (mmapdb_t *) malloc(sizeof (mmapdb_t));
+	if (md == NULL)
+	{
+		log_sys_error("mmapdb_handle: malloc");
+		return NULL;
+	}
+
+	memset(md, 0, sizeof (mmapdb_t));
+	md->mm_fd = fd;
+
+	return md;
+}
+
+
+/*
+ * Creates an empty file. slots must be a power of 2.
+ */
+static mmapdb_t *
+mmapdb_create(char *path, uint32_t scheme, uint32_t slots, uint64_t data)
+{
+	mmapdb_t *md = NULL;
+	mmapdb_header_t *mh;
+	uint64_t offset;
+	int fd;
+
+	fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0660);
+	if (fd == -1)
+	{
+		log_sys_error("mmapdb_create: open '%s'", path);
+		return NULL;
+	}
+
+	md = mmapdb_handle(fd);
+	if (md == NULL)
+	{
+		log_error("mmapdb_create: mmapdb_handle failed");
+		close(fd);
+		return NULL;
+	}
+
+	offset = MMAPDB_ALIGN(sizeof (mmapdb_header_t) +
+	    (uint64_t) slots * sizeof (mmapdb_slot_t));
+
+	if (mmapdb_map(md, offset + data))
+	{
+		log_error("mmapdb_create: mmapdb_map failed");
+		mmapdb_free(md);
+		return NULL;
+	}
+
+	mh = md->mm_header;
+	mh->mh_magic = MMAPDB_MAGIC;
+	mh->mh_scheme = scheme;
+	mh->mh_slots = slots;
+	mh->mh_data = offset;
+	mh->mh_end = offset;
+	mh->mh_seed = hash_random_seed();
+
+	return md;
+}
+
+
+/*
+ * Maps an existing file. Returns NULL if the file is damaged or was
+ * written for a different scheme. Files without a seed are flagged
+ * mm_legacy. Their slots can't be used: only the records are read.
+ */
+static mmapdb_t *
+mmapdb_load(char *path, uint32_t scheme)
+{
+	mmapdb_t *md = NULL;
+	mmapdb_header_t *mh;
+	struct stat st;
+	uint64_t header;
+	int fd;
+
+	fd = open(path, O_RDWR);
+	if (fd == -1)
+	{
+		log_sys_error("mmapdb_load: open '%s'", path);
+		return NULL;
+	}
+
+	md = mmapdb_handle(fd);
+	if (md == NULL)
+	{
+		log_error("mmapdb_load: mmapdb_handle failed");
+		close(fd);
+		return NULL;
+	}
+
+	if (fstat(fd, &st))
+	{
+		log_sys_error("mmapdb_load: fstat");
+		goto error;
+	}
+
+	if (st.st_size < MMAPDB_HEADER_V1)
+	{
+		log_error("mmapdb_load: %s: file truncated", path);
+		goto error;
+	}
+
+	if (mmapdb_map(md, st.st_size))
+	{
+		log_error("mmapdb_load: mmapdb_map failed");
+		goto error;
+	}
+
+	mh = md->mm_header;
+
+	if (mh->mh_magic == MMAPDB_MAGIC)
+	{
+		header = sizeof (mmapdb_header_t);
+	}
+	else if (mh->mh_magic == MMAPDB_MAGIC_V1)
+	{
+		header = MMAPDB_HEADER_V1;
+		md->mm_legacy = 1;
+	}
+	else
+	{
+		log_error("mmapdb_load: %s: bad magic", path);
+		goto error;
+	}
+
+	if (mh->mh_scheme != scheme)
+	{
+		log_error("mmapdb_load: %s: scheme changed", path);
+		goto error;
+	}
+
+	if (mh->mh_slots == 0 || (mh->mh_slots & (mh->mh_slots - 1)) ||
+	    mh->mh_data != MMAPDB_ALIGN(header +
+	    (uint64_t) mh->mh_slots * sizeof (mmapdb_slot_t)) ||
+	    mh->mh_end < mh->mh_data || mh->mh_end > md->mm_size)
+	{
+		log_error("mmapdb_load: %s: bad header", path);
+		goto error;
+	}
+
+	return md;
+
+error:
+	mmapdb_free(md);
+
+	return NULL;
+}
+
+
+/*
+ * Returns 1 and the slot of key if found. Otherwise returns 0 and the
+ * first free slot.
+ */
+static int
+mmapdb_find(mmapdb_t *md, void *key, uint32_t klen, uint32_t hash,
+    uint32_t *slot)
+{
+	mmapdb_slot_t *ms;
+	mmapdb_record_t *mr;
+	uint32_t mask = md->mm_header->mh_slots - 1;
+	uint32_t i;
+	int tombstone = 0;
+
+	for (i = hash & mask;; i = (i + 1) & mask)
+	{
+		ms = md->mm_slots + i;
+
+		if (ms->ms_offset == MMAPDB_EMPTY)
+		{
+			if (!tombstone)
+			{
+				*slot = i;
+			}
+
+			return 0;
+		}
+
+		if (ms->ms_offset == MMAPDB_TOMBSTONE)
+		{
+			if (!tombstone)
+			{
+				*slot = i;
+				tombstone = 1;
+			}
+
+			continue;
+		}
+
+		if (ms->ms_hash != hash)
+		{
+			continue;
+		}
+
+		mr = MMAPDB_RECORD(md, ms->ms_offset);
+		if (mr->mr_klen == klen && memcmp(MMAPDB_KEY(mr), key, klen) == 0)
+		{
+			*slot = i;
+			return 1;
+		}
+	}
+}
+
+
+/*
+ * Appends a record and returns its offset or 0 on error. The mapping may
+ * move.
+ */
+static uint64_t
+mmapdb_append(mmapdb_t *md, void *key, uint32_t klen, void *data,
+    uint32_t dlen)
+{
+	mmapdb_record_t *mr;
+	uint64_t offset, len, size;
+
+	offset = md->mm_header->mh_end;
+	len = MMAPDB_RECORD_SIZE(klen, MMAPDB_ALIGN(dlen));
+
+	if (offset + len > md->mm_size)
+	{
+		for (size = md->mm_size * 2; offset + len > size; size *= 2);
+
+		if (mmapdb_map(md, size))
+		{
+			log_error("mmapdb_append: mmapdb_map failed");
+			return 0;
+		}
+	}
+
+	mr = MMAPDB_RECORD(md, offset);
+	mr->mr_klen = klen;
+	mr->mr_dlen = dlen;
+	mr->mr_size = MMAPDB_ALIGN(dlen);
+	mr->mr_flags = 0;
+
+	memset(MMAPDB_KEY(mr), 0, MMAPDB_ALIGN(klen));
+	memcpy(MMAPDB_KEY(mr), key, klen);
+	memcpy(MMAPDB_DATA_OF(mr), data, dlen);
+
+	mr->mr_check = mmapdb_check(mr);
+	mr->mr_flags = MMAPDB_LIVE;
+
+	md->mm_header->mh_end += len;
+
+	return offset;
+}
+
+
+static void
+mmapdb_kill(mmapdb_t *md, uint64_t offset)
+{
+	mmapdb_record_t *mr = MMAPDB_RECORD(md, offset);
+
+	mr->mr_flags = 0;
+	md->mm_header->mh_dead += MMAPDB_RECORD_SIZE(mr->mr_klen, mr->mr_size);
+
+	return;
+}
+
+
+/*
+ * Inserts or updates a record. The caller makes sure a free slot is
+ * available (mmapdb_full).
+ */
+static int
+mmapdb_store(mmapdb_t *md, void *key, uint32_t klen, void *data,
+    uint32_t dlen)
+{
+	mmapdb_header_t *mh;
+	mmapdb_slot_t *ms;
+	uint32_t hash, slot;
+	uint64_t offset;
+	int found;
+
+	if (klen == 0)
+	{
+		log_error("mmapdb_store: empty key");
+		return -1;
+	}
+
+	hash = mmapdb_hash(md, key, klen);
+	found = mmapdb_find(md, key, klen, hash, &slot);
+
+	// Copy on write. The old version is killed once the new one is live.
+	offset = mmapdb_append(md, key, klen, data, dlen);
+	if (offset == 0)
+	{
+		log_error("mmapdb_store: mmapdb_append failed");
+		return -1;
+	}
+
+	// The mapping may have moved
+	mh = md->mm_header;
+	ms = md->mm_slots + slot;
+
+	if (found)
+	{
+		mmapdb_kill(md, ms->ms_offset);
+	}
+	else
+	{
+		if (ms->ms_offset == MMAPDB_EMPTY)
+		{
+			++mh->mh_filled;
+		}
+
+		++mh->mh_used;
+	}
+
+	ms->ms_hash = hash;
+	ms->ms_offset = offset;
+
+	return 0;
+}
+
+
+/*
+ * Returns the next live record with a valid checksum between offset and
+ * end.
+ */
+static mmapdb_record_t *
+mmapdb_next(mmapdb_t *md, uint64_t *offset, uint64_t end)
+{
+	mmapdb_record_t *mr;
+	uint64_t len;
+
+	while (*offset + sizeof (mmapdb_record_t) <= end)
+	{
+		mr = MMAPDB_RECORD(md, *offset);
+
+		if (mr->mr_klen == 0 || mr->mr_dlen > mr->mr_size ||
+		    mr->mr_size != MMAPDB_ALIGN(mr->mr_size))
+		{
+			return NULL;
+		}
+
+		len = MMAPDB_RECORD_SIZE(mr->mr_klen, mr->mr_size);
+		if (*offset + len > end)
+		{
+			return NULL;
+		}
+
+		*offset += len;
+
+		if (mr->mr_flags == MMAPDB_LIVE &&
+		    mr->mr_check == mmapdb_check(mr))
+		{
+			return mr;
+		}
+	}
+
+	return NULL;
+}
+
+
+/*
+ * Writes all live records to a new file and replaces the table file. Used
+ * to grow the slot table, to compact dead records and to recover a file
+ * that was not closed cleanly (recover scans the whole mapping instead of
+ * trusting mh_end).
+ */
+static int
+mmapdb_rebuild(dbt_t *dbt, int recover)
+{
+	mmapdb_t *md = dbt->dbt_handle, *new = NULL;
+	mmapdb_record_t *mr;
+	char path[BUFLEN];
+	uint64_t offset, end, records = 0, size = 0;
+	uint32_t slots;
+
+	end = recover ? md->mm_size : md->mm_header->mh_end;
+
+	for (offset = md->mm_header->mh_data; (mr = mmapdb_next(md, &offset, end));)
+	{
+		++records;
+		size += MMAPDB_RECORD_SIZE(mr->mr_klen, mr->mr_size);
+	}
+
+	// Load 25% after the rebuild
+	for (slots = MMAPDB_SLOTS; slots < records * 4; slots *= 2);
+
+	if (util_concat(path, sizeof path, dbt->dbt_path, MMAPDB_TMP_SUFFIX,
+	    NULL) == -1)
+	{
+		log_error("mmapdb_rebuild: util_concat failed");
+		return -1;
+	}
+
+	new = mmapdb_create(path, md->mm_header->mh_scheme, slots,
+	    size * 2 > MMAPDB_DATA ? size * 2 : MMAPDB_DATA);
+	if (new == NULL)
+	{
+		log_error("mmapdb_rebuild: mmapdb_create failed");
+		return -1;
+	}
+
+	for (offset = md->mm_header->mh_data; (mr = mmapdb_next(md, &offset, end));)
+	{
+		if (mmapdb_store(new, MMAPDB_KEY(mr), mr->mr_klen,
+		    MMAPDB_DATA_OF(mr), mr->mr_dlen))
+		{
+			log_error("mmapdb_rebuild: mmapdb_store failed");
+			goto error;
+		}
+	}
+
+	if (msync(new->mm_map, new->mm_size, MS_SYNC))
+	{
+		log_sys_error("mmapdb_rebuild: msync");
+		goto error;
+	}
+
+	if (rename(path, dbt->dbt_path))
+	{
+		log_sys_error("mmapdb_rebuild: rename '%s'", path);
+		goto error;
+	}
+
+	log_debug("mmapdb_rebuild: %s: %lu records, %u slots", dbt->dbt_name,
+	    (unsigned long) new->mm_header->mh_used, slots);
+
+	mmapdb_free(md);
+	dbt->dbt_handle = new;
+
+	return 0;
+
+error:
+	mmapdb_free(new);
+	unlink(path);
+
+	return -1;
+}
+
+
+/*
+ * Grows the slot table or compacts the file if necessary
+ */
+static int
+mmapdb_maintain(dbt_t *dbt)
+{
+	mmapdb_t *md = dbt->dbt_handle;
+	mmapdb_header_t *mh = md->mm_header;
+
+	if ((mh->mh_filled + 1) * 2 > mh->mh_slots)
+	{
+		return mmapdb_rebuild(dbt, 0);
+	}
+
+	if (mh->mh_dead > MMAPDB_COMPACT &&
+	    mh->mh_dead * 2 > mh->mh_end - mh->mh_data)
+	{
+		return mmapdb_rebuild(dbt, 0);
+	}
+
+	return 0;
+}
+
+
+static int
+mmapdb_open(dbt_t *dbt)
+{
+	mmapdb_t *md = NULL;
+	uint32_t scheme;
+
+	if (dbt->dbt_path == NULL)
+	{
+		log_error("mmapdb_open: %s: path not set", dbt->dbt_name);
+		return -1;
+	}
+
+	scheme = dbt_scheme_hash(dbt->dbt_scheme);
+
+	if (util_file_exists(dbt->dbt_path) == 1)
+	{
+		md = mmapdb_load(dbt->dbt_path, scheme);
+		if (md == NULL)
+		{
+			log_error("mmapdb_open: %s: mmapdb_load failed",
+			    dbt->dbt_name);
+			return -1;
+		}
+	}
+	else
+	{
+		md = mmapdb_create(dbt->dbt_path, scheme, MMAPDB_SLOTS,
+		    MMAPDB_DATA);
+		if (md == NULL)
+		{
+			log_error("mmapdb_open: %s: mmapdb_create failed",
+			    dbt->dbt_name);
+			return -1;
+		}
+
+		md->mm_header->mh_clean = 1;
+	}
+
+	dbt->dbt_handle = md;
+
+	if (md->mm_legacy && md->mm_header->mh_clean)
+	{
+		log_notice("mmapdb_open: %s: %s has no hash seed: rebuilding",
+		    dbt->dbt_name, dbt->dbt_path);
+
+		if (mmapdb_rebuild(dbt, 0))
+		{
+			log_error("mmapdb_open: %s: mmapdb_rebuild failed",
+			    dbt->dbt_name);
+			goto error;
+		}
+
+		md = dbt->dbt_handle;
+	}
+
+	if (!md->mm_header->mh_clean)
+	{
+		log_notice("mmapdb_open: %s: %s was not closed cleanly: "
+		    "recovering", dbt->dbt_name, dbt->dbt_path);
+
+		if (mmapdb_rebuild(dbt, 1))
+		{
+			log_error("mmapdb_open: %s: mmapdb_rebuild failed",
+			    dbt->dbt_name);
+			goto error;
+		}
+
+		md = dbt->dbt_handle;
+	}
+
+	md->mm_header->mh_clean = 0;
+
+	return 0;
+
+error:
+	mmapdb_free(dbt->dbt_handle);
+	dbt->dbt_handle = NULL;
+
+	return -1;
+}
+
+
+static void
+mmapdb_close(dbt_t *dbt)
+{
+	mmapdb_t *md = dbt->dbt_handle;
+
+	md->mm_header->mh_clean = 1;
+
+	if (msync(md->mm_map, md->mm_size, MS_SYNC))
+	{
+		log_sys_error("mmapdb_close: msync");
+	}
+
+	mmapdb_free(md);
+
+	return;
+}
+
+
+/*
+ * Records are unpacked straight from the mapping.
+ */
+static int
+mmapdb_get(dbt_t *dbt, var_t *record, var_t **result)
+{
+	mmapdb_t *md = dbt->dbt_handle;
+	mmapdb_record_t *mr;
+	vp_key_t key;
+	vp_t vp;
+	uint32_t slot;
+
+	*result = NULL;
+
+	if (vp_pack_key(&key, record)) {
+		log_error("mmapdb_get: vp_pack_key failed");
+		return -1;
+	}
+
+	if (!mmapdb_find(md, key.vk_vp.vp_key, key.vk_vp.vp_klen,
+	    mmapdb_hash(md, key.vk_vp.vp_key, key.vk_vp.vp_klen), &slot))
+	{
+		log_debug("mmapdb_get: no record found");
+		goto exit;
+	}
+
+	mr = MMAPDB_RECORD(md, md->mm_slots[slot].ms_offset);
+	vp_init(&vp, MMAPDB_KEY(mr), mr->mr_klen, MMAPDB_DATA_OF(mr),
+	    mr->mr_dlen);
+
+	*result = vp_unpack(&vp, dbt->dbt_scheme);
+	if (*result == NULL) {
+		log_error("mmapdb_get: vp_unpack failed");
+		goto error;
+	}
+
+exit:
+	vp_key_clear(&key);
+
+	return 0;
+
+error:
+	vp_key_clear(&key);
+
+	return -1;
+}
+
+
+static int
+mmapdb_set(dbt_t *dbt, var_t *record)
+{
+	mmapdb_t *md;
+	vp_t *vp = NULL;
+
+	vp = vp_pack(record);
+	if (vp == NULL) {
+		log_error("mmapdb_set: vp_pack failed");
+		goto error;
+	}
+
+	if (mmapdb_maintain(dbt))
+	{
+		log_error("mmapdb_set: mmapdb_maintain failed");
+		goto error;
+	}
+
+	// mmapdb_maintain may replace the handle
+	md = dbt->dbt_handle;
+
+	if (mmapdb_store(md, vp->vp_key, vp->vp_klen, vp->vp_data,
+	    vp->vp_dlen))
+	{
+		log_error("mmapdb_set: mmapdb_store failed");
+		goto error;
+	}
+
+	vp_delete(vp);
+
+	return 0;
+
+error:
+	if (vp) {
+		vp_delete(vp);
+	}
+
+	return -1;
+}
+
+
+static int
+mmapdb_del(dbt_t *dbt, var_t *record)
+{
+	mmapdb_t *md = dbt->dbt_handle;
+	mmapdb_slot_t *ms;
+	vp_key_t key;
+	uint32_t slot;
+
+	if (vp_pack_key(&key, record)) {
+		log_error("mmapdb_del: vp_pack_key failed");
+		return -1;
+	}
+
+	if (mmapdb_find(md, key.vk_vp.vp_key, key.vk_vp.vp_klen,
+	    mmapdb_hash(md, key.vk_vp.vp_key, key.vk_vp.vp_klen), &slot))
+	{
+		ms = md->mm_slots + slot;
+
+		mmapdb_kill(md, ms->ms_offset);
+		ms->ms_offset = MMAPDB_TOMBSTONE;
+		--md->mm_header->mh_used;
+	}
+
+	vp_key_clear(&key);
+
+	return 0;
+}
+
+
+/*
+ * Unpacks the record in slot and calls callback. Returns 1 if the slot
+ * holds a record, 0 if not and -1 on error.
+ */
+static int
+mmapdb_visit(dbt_t *dbt, uint32_t slot, dbt_db_callback_t callback)
+{
+	mmapdb_t *md = dbt->dbt_handle;
+	mmapdb_record_t *mr;
+	var_t *record;
+	vp_t vp;
+
+	if (md->mm_slots[slot].ms_offset < MMAPDB_RESERVED)
+	{
+		return 0;
+	}
+
+	mr = MMAPDB_RECORD(md, md->mm_slots[slot].ms_offset);
+	vp_init(&vp, MMAPDB_KEY(mr), mr->mr_klen, MMAPDB_DATA_OF(mr),
+	    mr->mr_dlen);
+
+	record = vp_unpack(&vp, dbt->dbt_scheme);
+	if (record == NULL) {
+		log_error("mmapdb_visit: vp_unpack failed");
+		return -1;
+	}
+
+	// Callbacks may only delete records
+	if(callback(dbt, record)) {
+		log_error("mmapdb_visit: callback failed");
+	}
+
+	var_delete(record);
+
+	return 1;
+}
+
+
+int
+mmapdb_walk(dbt_t *dbt, dbt_db_callback_t callback)
+{
+	mmapdb_t *md = dbt->dbt_handle;
+	uint32_t i;
+
+	for (i = 0; i < md->mm_header->mh_slots; ++i)
+	{
+		if (mmapdb_visit(dbt, i, callback) == -1)
+		{
+			log_error("mmapdb_walk: mmapdb_visit failed");
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+
+/*
+ * The cursor holds the next slot. If the file is rebuilt between two
+ * batches some records may be visited twice or not at all.
+ */
+int
+mmapdb_scan(dbt_t *dbt, dbt_cursor_t *cursor, int count,
+    dbt_db_callback_t callback)
+{
+	mmapdb_t *md = dbt->dbt_handle;
+	int n = 0, r;
+
+	for (; cursor->dc_pos < md->mm_header->mh_slots && n < count;
+	    ++cursor->dc_pos)
+	{
+		r = mmapdb_visit(dbt, cursor->dc_pos, callback);
+		if (r == -1)
+		{
+			log_error("mmapdb_scan: mmapdb_visit failed");
+			return -1;
+		}
+
+		n += r;
+	}
+
+	return n;
+}
+
+
+static int
+mmapdb_sync(dbt_t *dbt)
+{
+	mmapdb_t *md = dbt->dbt_handle;
+
+	if (msync(md->mm_map, md->mm_size, MS_SYNC))
+	{
+		log_sys_error("mmapdb_sync: msync");
+		return -1;
+	}
+
+	return 0;
+}
+
+
+/*
+ * See memdb_stats
+ */
+static int
+mmapdb_stats(dbt_t *dbt, char *buffer, int size)
+{
+	mmapdb_t *md = dbt->dbt_handle;
+	mmapdb_header_t *mh = md->mm_header;
+	mmapdb_slot_t *ms;
+	uint32_t mask = mh->mh_slots - 1;
+	unsigned long probes = 0;
+	uint32_t i;
+	int n;
+
+	for (i = 0; i < mh->mh_slots; ++i)
+	{
+		ms = md->mm_slots + i;
+		if (ms->ms_offset < MMAPDB_RESERVED)
+		{
+			continue;
+		}
+
+		probes += ((i - ms->ms_hash) & mask) + 1;
+	}
+
+	n = snprintf(buffer, size, "records=%lu slots=%u tombstones=%lu "
+	    "load=%.1f%% probes=%.2f size=%lu dead=%lu",
+	    (unsigned long) mh->mh_used, mh->mh_slots,
+	    (unsigned long) (mh->mh_filled - mh->mh_used),
+	    (float) 100 * mh->mh_filled / mh->mh_slots,
+	    mh->mh_used ? (float) probes / mh->mh_used : 0,
+	    (unsigned long) mh->mh_end, (unsigned long) mh->mh_dead);
+	if (n >= size)
+	{
+		log_error("mmapdb_stats: buffer exhausted");
+		return -1;
+	}
+
+	return 0;
+}
+
+
+#ifdef DEBUG
+
+/*
+ * Returns 1 if key is stored with value
+ */
+static int
+mmapdb_test_value(mmapdb_t *md, char *key, char *value)
+{
+	mmapdb_record_t *mr;
+	uint32_t slot;
+
+	if (!mmapdb_find(md, key, strlen(key),
+	    mmapdb_hash(md, key, strlen(key)), &slot))
+	{
+		return 0;
+	}
+
+	mr = MMAPDB_RECORD(md, md->mm_slots[slot].ms_offset);
+
+	return mr->mr_dlen == strlen(value) + 1 &&
+	    strcmp(MMAPDB_DATA_OF(mr), value) == 0;
+}
+
+/*
+ * Simulates a crash: the file is left with mh_clean = 0 and reopened.
+ */
+static mmapdb_t *
+mmapdb_test_crash(dbt_t *dbt)
+{
+	mmapdb_t *md = dbt->dbt_handle;
+
+	TEST_ASSERT(md->mm_header->mh_clean == 0);
+	TEST_ASSERT(mmapdb_sync(dbt) == 0);
+	mmapdb_free(md);
+
+	TEST_ASSERT(mmapdb_open(dbt) == 0);
+
+	return dbt->dbt_handle;
+}
+
+/*
+ * Recovery after a crash. Called by dbt_test_driver with the test table.
+ */
+void
+mmapdb_test(dbt_t *table, int n)
+{
+	dbt_t dbt;
+	mmapdb_t *md;
+	mmapdb_record_t *mr;
+	char path[BUFLEN];
+	uint64_t offset;
+
+	snprintf(path, sizeof path, "/tmp/mopher_test.recover.%d.mmapdb", n);
+	unlink(path);
+
+	memcpy(&dbt, table, sizeof dbt);
+	dbt.dbt_path = path;
+	dbt.dbt_handle = NULL;
+
+	TEST_ASSERT(mmapdb_open(&dbt) == 0);
+	md = dbt.dbt_handle;
+
+	TEST_ASSERT(mmapdb_store(md, "a", 1, "old", 4) == 0);
+	TEST_ASSERT(mmapdb_store(md, "b", 1, "b", 2) == 0);
+
+	// Torn update: the new version is flagged live but incomplete
+	offset = mmapdb_append(md, "a", 1, "new", 4);
+	TEST_ASSERT(offset != 0);
+	mr = MMAPDB_RECORD(md, offset);
+	MMAPDB_DATA_OF(mr)[0] = 'N';
+
+	md = mmapdb_test_crash(&dbt);
+	TEST_ASSERT(md->mm_header->mh_used == 2);
+	TEST_ASSERT(mmapdb_test_value(md, "a", "old"));
+	TEST_ASSERT(mmapdb_test_value(md, "b", "b"));
+
+	// Crash before the old version was killed: the later one wins
+	TEST_ASSERT(mmapdb_append(md, "a", 1, "new", 4) != 0);
+
+	md = mmapdb_test_crash(&dbt);
+	TEST_ASSERT(md->mm_header->mh_used == 2);
+	TEST_ASSERT(mmapdb_test_value(md, "a", "new"));
+
+	// Completed updates survive
+	TEST_ASSERT(mmapdb_store(md, "a", 1, "newer", 6) == 0);
+	TEST_ASSERT(mmapdb_store(md, "c", 1, "c", 2) == 0);
+
+	md = mmapdb_test_crash(&dbt);
+	TEST_ASSERT(md->mm_header->mh_used == 3);
+	TEST_ASSERT(mmapdb_test_value(md, "a", "newer"));
+	TEST_ASSERT(mmapdb_test_value(md, "c", "c"));
+
+	mmapdb_close(&dbt);
+	unlink(path);
+
+	return;
+}
+
+#endif
+
+
+int
+mmapdb_init(void)
+{
+	dbt_driver.dd_name	= "mmapdb";
+	dbt_driver.dd_open	= (dbt_db_open_t)	mmapdb_open;
+	dbt_driver.dd_close	= (dbt_db_close_t)	mmapdb_close;
+	dbt_driver.dd_get	= (dbt_db_get_t)	mmapdb_get;
+	dbt_driver.dd_set	= (dbt_db_set_t)	mmapdb_set;
+	dbt_driver.dd_del	= (dbt_db_del_t)	mmapdb_del;
+	dbt_driver.dd_walk	= (dbt_db_walk_t)	mmapdb_walk;
+	dbt_driver.dd_scan	= (dbt_db_scan_t)	mmapdb_scan;
+	dbt_driver.dd_sync	= (dbt_db_sync_t)	mmapdb_sync;
+	dbt_driver.dd_stats	= (dbt_db_stats_t)	mmapdb_stats;
+	dbt_driver.dd_flags	= DBT_LOCK;
+
+	dbt_driver_register(&dbt_driver);
+
+	return 0;
+}
@@ -413,6 +413,216 @@ error:
 	return -1;
 }
 
+/*
+ * Fetches n records with a single $or query. Documents are assigned to
+ * their lookups by key. Repeated lookups are fetched one by one.
+ */
+static int
+mongodb_mget(dbt_t *dbt, int n, var_t **records, var_t **results)
+{
+	mongodb_t *mng;
+	mongoc_collection_t *collection;
+	mongoc_cursor_t *cursor = NULL;
+	bson_error_t error;
+	bson_t *query = NULL;
+	bson_t *key;
+	bson_t array;
+	const bson_t *doc;
+	var_t *record;
+	char index[16];
+	int i, j;
+
+	mng = dbt->dbt_handle;
+	collection = mng->mng_collection;
+
+	for (i = 0; i < n; ++i)
+	{
+		results[i] = NULL;
+	}
+
+	query = bson_new();
+	if (query == NULL)
+	{
+		log_error("mongodb_mget: bson_new failed");
+		goto error;
+	}
+
+	if (!BSON_APPEND_ARRAY_BEGIN(query, "$or", &array))
+	{
+		log_error("mongodb_mget: BSON_APPEND_ARRAY_BEGIN failed");
+		goto error;
+	}
+
+	for (i = 0; i < n; ++i)
+	{
+		key = mongodb_create_bson(records[i], 1);
+		if (key == NULL)
+		{
+			log_error("mongodb_mget: mongodb_create_bson failed");
+			goto error;
+		}
+
+		snprintf(index, sizeof index, "%d", i);
+		if (!BSON_APPEND_DOCUMENT(&array, index, key))
+		{
+			log_error("mongodb_mget: BSON_APPEND_DOCUMENT failed");
+			bson_destroy(key);
+			goto error;
+		}
+
+		bson_destroy(key);
+	}
+
+	if (!bson_append_array_end(query, &array))
+	{
+		log_error("mongodb_mget: bson_append_array_end failed");
+		goto error;
+	}
+
+	cursor = mongoc_collection_find(collection, MONGOC_QUERY_NONE, 0, 0, 0, query, NULL, NULL);
+	while (mongoc_cursor_next(cursor, &doc))
+	{
+		if (mongodb_bson_as_record(dbt->dbt_scheme, doc, &record)) {
+			log_error("mongodb_mget: mongodb_bson_as_record failed");
+			goto error;
+		}
+
+		for (j = 0; j < n; ++j)
+		{
+			if (results[j] == NULL && dbt_key_match(records[j], record))
+			{
+				results[j] = record;
+				break;
+			}
+		}
+
+		if (j == n)
+		{
+			var_delete(record);
+		}
+	}
+
+	if (mongoc_cursor_error (cursor, &error)) {
+		log_error("mongodb_mget: mongodb_cursor_next failed: %s", error.message);
+		goto error;
+	}
+
+	for (j = 0; j < n; ++j)
+	{
+		if (results[j])
+		{
+			continue;
+		}
+
+		for (i = 0; i < j; ++i)
+		{
+			if (results[i] && dbt_key_match(records[j], results[i]))
+			{
+				break;
+			}
+		}
+
+		if (i < j && mongodb_get(dbt, records[j], &results[j]))
+		{
+			log_error("mongodb_mget: mongodb_get failed");
+			goto error;
+		}
+	}
+
+	bson_destroy(query);
+	mongoc_cursor_destroy(cursor);
+
+	return 0;
+
+error:
+	for (i = 0; i < n; ++i)
+	{
+		if (results[i])
+		{
+			var_delete(results[i]);
+			results[i] = NULL;
+		}
+	}
+	if (query)
+	{
+		bson_destroy(query);
+	}
+	if (cursor)
+	{
+		mongoc_cursor_destroy(cursor);
+	}
+
+	return -1;
+}
+
+/*
+ * Upserts n records with a single unordered bulk operation.
+ */
+static int
+mongodb_mset(dbt_t *dbt, int n, var_t **records)
+{
+	mongodb_t *mng;
+	mongoc_collection_t *collection;
+	mongoc_bulk_operation_t *bulk = NULL;
+	bson_error_t error;
+	bson_t *query = NULL;
+	bson_t *doc = NULL;
+	int i;
+
+	mng = dbt->dbt_handle;
+	collection = mng->mng_collection;
+
+	bulk = mongoc_collection_create_bulk_operation(collection, false, NULL);
+	if (bulk == NULL)
+	{
+		log_error("mongodb_mset: mongoc_collection_create_bulk_operation failed");
+		goto error;
+	}
+
+	for (i = 0; i < n; ++i)
+	{
+		query = mongodb_create_bson(records[i], 1);
+		doc = mongodb_create_bson(records[i], 0);
+		if (query == NULL || doc == NULL)
+		{
+			log_error("mongodb_mset: mongodb_create_bson failed");
+			goto error;
+		}
+
+		mongoc_bulk_operation_replace_one(bulk, query, doc, true);
+
+		bson_destroy(query);
+		bson_destroy(doc);
+		query = doc = NULL;
+	}
+
+	if (!mongoc_bulk_operation_execute(bulk, NULL, &error)) {
+		log_error("mongodb_mset: mongoc_bulk_operation_execute failed: %s", error.message);
+		goto error;
+	}
+
+	mongoc_bulk_operation_destroy(bulk);
+
+	return 0;
+
+error:
+	if(query)
+	{
+		bson_destroy(query);
+	}
+	if(doc)
+	{
+		bson_destroy(doc);
+	}
+	if(bulk)
+	{
+		mongoc_bulk_operation_destroy(bulk);
+	}
+
+	return -1;
+}
+
+
 static int
 mongodb_walk(dbt_t *dbt, dbt_db_callback_t callback)
 {
@@ -468,6 +678,196 @@ error:
 	return -1;
 }
 
+/*
+ * Documents are visited in _id order. The cursor holds the last ObjectId.
+ */
+static int
+mongodb_scan(dbt_t *dbt, dbt_cursor_t *dbt_cursor, int count,
+    dbt_db_callback_t callback)
+{
+	mongodb_t *mng;
+	mongoc_collection_t *collection;
+	mongoc_cursor_t *cursor = NULL;
+	bson_error_t error;
+	bson_t *query = NULL;
+	bson_iter_t iter;
+	bson_oid_t oid;
+	var_t *record = NULL;
+	const bson_t *doc;
+	int n = 0;
+
+	mng = dbt->dbt_handle;
+	collection = mng->mng_collection;
+
+	if (dbt_cursor->dc_key == NULL)
+	{
+		query = BCON_NEW("$query", "{", "}",
+		    "$orderby", "{", "_id", BCON_INT32(1), "}");
+	}
+	else
+	{
+		bson_oid_init_from_data(&oid, dbt_cursor->dc_key);
+		query = BCON_NEW("$query", "{", "_id", "{", "$gt", BCON_OID(&oid),
+		    "}", "}", "$orderby", "{", "_id", BCON_INT32(1), "}");
+	}
+
+	cursor = mongoc_collection_find(collection, MONGOC_QUERY_NONE, 0, count, 0, query, NULL, NULL);
+
+	while(mongoc_cursor_next(cursor, &doc))
+	{
+		if (!bson_iter_init_find(&iter, doc, "_id") ||
+		    !BSON_ITER_HOLDS_OID(&iter))
+		{
+			log_error("mongodb_scan: document without ObjectId");
+			goto error;
+		}
+
+		if (dbt_cursor_key(dbt_cursor, (void *) bson_iter_oid(&iter)->bytes,
+		    sizeof oid.bytes))
+		{
+			log_error("mongodb_scan: dbt_cursor_key failed");
+			goto error;
+		}
+
+		if (mongodb_bson_as_record(dbt->dbt_scheme, doc, &record)) {
+			log_error("mongodb_scan: mongodb_bson_as_record failed");
+			goto error;
+		}
+
+		if (callback(dbt, record))
+		{
+			log_error("mongodb_scan: callback failed");
+			goto error;
+		}
+
+		var_delete(record);
+		record = NULL;
+		++n;
+	}
+
+	if (mongoc_cursor_error(cursor, &error))
+	{
+		log_error("mongodb_scan: mongoc_cursor_next failed: %s", error.message);
+		goto error;
+	}
+
+	bson_destroy(query);
+	mongoc_cursor_destroy(cursor);
+
+	return n;
+
+error:
+	if (record)
+	{
+		var_delete(record);
+	}
+	if (query)
+	{
+		bson_destroy(query);
+	}
+	if (cursor)
+	{
+		mongoc_cursor_destroy(cursor);
+	}
+
+	return -1;
+}
+
+/*
+ * Deletes at most dbt_expire_batch expired documents. The _ids of a chunk
+ * are selected first and removed with $in.
+ */
+static int
+mongodb_expire_batch(dbt_t *dbt)
+{
+	mongodb_t *mng;
+	mongoc_collection_t *collection;
+	mongoc_cursor_t *cursor = NULL;
+	bson_error_t error;
+	bson_t *query = NULL;
+	bson_t *fields = NULL;
+	bson_t *selector = NULL;
+	bson_t in, ids;
+	bson_iter_t iter;
+	const bson_t *doc;
+	const char *key;
+	char buffer[16];
+	long now = time(NULL);
+	int n = 0;
+
+	mng = dbt->dbt_handle;
+	collection = mng->mng_collection;
+
+	query = BCON_NEW(BCON_UTF8(dbt->dbt_expire_field), "{", "$lt", BCON_INT32(now), "}");
+	fields = BCON_NEW("_id", BCON_INT32(1));
+	selector = bson_new();
+	if (query == NULL || fields == NULL || selector == NULL)
+	{
+		log_error("mongodb_expire_batch: bson_new failed");
+		goto error;
+	}
+
+	cursor = mongoc_collection_find(collection, MONGOC_QUERY_NONE, 0,
+	    dbt->dbt_expire_batch, 0, query, fields, NULL);
+
+	bson_append_document_begin(selector, "_id", -1, &in);
+	bson_append_array_begin(&in, "$in", -1, &ids);
+
+	while(mongoc_cursor_next(cursor, &doc))
+	{
+		if (!bson_iter_init_find(&iter, doc, "_id"))
+		{
+			continue;
+		}
+
+		bson_uint32_to_string(n, &key, buffer, sizeof buffer);
+		bson_append_value(&ids, key, -1, bson_iter_value(&iter));
+		++n;
+	}
+
+	bson_append_array_end(&in, &ids);
+	bson_append_document_end(selector, &in);
+
+	if (mongoc_cursor_error(cursor, &error))
+	{
+		log_error("mongodb_expire_batch: mongoc_cursor_next failed: %s", error.message);
+		goto error;
+	}
+
+	if (n && !mongoc_collection_remove(collection, MONGOC_REMOVE_NONE, selector, NULL, &error))
+	{
+		log_error("mongodb_expire_batch: mongoc_collection_remove failed: %s", error.message);
+		goto error;
+	}
+
+	mongoc_cursor_destroy(cursor);
+	bson_destroy(query);
+	bson_destroy(fields);
+	bson_destroy(selector);
+
+	return n;
+
+error:
+	if (cursor)
+	{
+		mongoc_cursor_destroy(cursor);
+	}
+	if (query)
+	{
+		bson_destroy(query);
+	}
+	if (fields)
+	{
+		bson_destroy(fields);
+	}
+	if (selector)
+	{
+		bson_destroy(selector);
+	}
+
+	return -1;
+}
+
 static int
 mongodb_expire(dbt_t *dbt)
 {
@@ -477,7 +877,12 @@ mongodb_expire(dbt_t *dbt)
 	bson_t *query = NULL;
 	long now = time(NULL);
 	long count = -1;
-	
+
+	if (dbt->dbt_expire_batch > 0)
+	{
+		return mongodb_expire_batch(dbt);
+	}
+
 	mng = dbt->dbt_handle;
 	collection = mng->mng_collection;
 
@@ -513,9 +918,12 @@ mongodb_init(void)
 	dbt_driver.dd_get	= (dbt_db_get_t)	mongodb_get;
 	dbt_driver.dd_set	= (dbt_db_set_t)	mongodb_set;
 	dbt_driver.dd_del	= (dbt_db_del_t)	mongodb_del;
+	dbt_driver.dd_mget	= (dbt_db_mget_t)	mongodb_mget;
+	dbt_driver.dd_mset	= (dbt_db_mset_t)	mongodb_mset;
 	dbt_driver.dd_walk	= (dbt_db_walk_t)	mongodb_walk;
+	dbt_driver.dd_scan	= (dbt_db_scan_t)	mongodb_scan;
 	dbt_driver.dd_expire	= (dbt_db_expire_t)	mongodb_expire;
-	dbt_driver.dd_flags	= DBT_LOCK;
+	dbt_driver.dd_flags	= DBT_LOCK | DBT_POOL;
 
 	dbt_driver_register(&dbt_driver);
 
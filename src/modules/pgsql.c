@@ -7,6 +7,7 @@
 #include <mopher.h>
 
 #define BUFLEN 4096
+#define PGSQL_STMT_NAME 32
 
 
 static dbt_driver_t dbt_driver;
@@ -48,6 +49,102 @@ error:
 	return -1;
 }
 
+static char *
+pgsql_prepare(PGconn *conn, char *query)
+{
+	PGresult *result = NULL;
+	char *name;
+
+	name = (char *) malloc(PGSQL_STMT_NAME);
+	if (name == NULL)
+	{
+		log_sys_error("pgsql_prepare: malloc");
+		return NULL;
+	}
+
+	// Names only need to be unique per connection
+	snprintf(name, PGSQL_STMT_NAME, "mopher_%lx", (unsigned long) name);
+
+	result = PQprepare(conn, name, query, 0, NULL);
+	if (PQresultStatus(result) != PGRES_COMMAND_OK)
+	{
+		log_error("pgsql_prepare: %s", PQerrorMessage(conn));
+		PQclear(result);
+		free(name);
+		return NULL;
+	}
+
+	PQclear(result);
+
+	return name;
+}
+
+static int
+pgsql_exec_prepared(PGconn *conn, char *name, PGresult **result, int nparams,
+    char **params, int *tuples, int *affected)
+{
+	*tuples = 0;
+	*affected = 0;
+
+	*result = PQexecPrepared(conn, name, nparams,
+		(const char * const *) params, NULL, NULL, 0);
+	switch (PQresultStatus(*result))
+	{
+	case PGRES_COMMAND_OK:
+		*affected = atoi(PQcmdTuples(*result));
+		break;
+
+	case PGRES_TUPLES_OK:
+		*tuples = PQntuples(*result);
+		break;
+	default:
+		log_error("pgsql_exec_prepared: %s", PQerrorMessage(conn));
+		goto error;
+	}
+
+	return 0;
+
+error:
+	if (*result != NULL)
+	{
+		PQclear(*result);
+		*result = NULL;
+	}
+
+	return -1;
+}
+
+static void
+pgsql_release(PGconn *conn, char *name, PGresult *result)
+{
+	if (result)
+	{
+		PQclear(result);
+	}
+
+	return;
+}
+
+static void
+pgsql_finalize(PGconn *conn, char *name)
+{
+	char query[BUFLEN];
+	PGresult *result;
+
+	snprintf(query, sizeof query, "DEALLOCATE %s", name);
+
+	result = PQexec(conn, query);
+	if (PQresultStatus(result) != PGRES_COMMAND_OK)
+	{
+		log_error("pgsql_finalize: %s", PQerrorMessage(conn));
+	}
+
+	PQclear(result);
+	free(name);
+
+	return;
+}
+
 static PGresult *
 pgsql_get_row(PGconn *conn, PGresult *result, int row)
 {
@@ -232,6 +329,75 @@ pgsql_table_exists(PGconn *conn, char *table)
 	return tuples;
 }
 
+static int
+pgsql_index_exists(PGconn *conn, char *table, char *column)
+{
+	PGresult *res;
+	char query[BUFLEN];
+	int tuples, affected;
+	int n;
+
+	n = snprintf(query, sizeof query, "SELECT i.indexrelid FROM pg_catalog.pg_index i JOIN pg_catalog.pg_class c ON c.oid = i.indrelid JOIN pg_catalog.pg_namespace n ON n.oid = c.relnamespace JOIN pg_catalog.pg_attribute a ON a.attrelid = c.oid AND a.attnum = i.indkey[0] WHERE n.nspname=\'public\' AND c.relname=\'%s\' AND a.attname=\'%s\'", table, column);
+	if (n >= sizeof query)
+	{
+		log_warning("pgsql_index_exists: buffer exhausted");
+		return -1;
+	}
+
+	// The role may lack access to the catalog
+	if (pgsql_exec(conn, &res, query, &tuples, &affected))
+	{
+		log_warning("pgsql_index_exists: pgsql_exec failed: can't verify "
+		    "index on %s.%s", table, column);
+		return -1;
+	}
+	PQclear(res);
+
+	return tuples;
+}
+
+static int
+pgsql_upsert(PGconn *conn, char *buffer, int size, char *keys, char *set)
+{
+	int n;
+
+	if (*set)
+	{
+		n = snprintf(buffer, size, " ON CONFLICT (%s) DO UPDATE SET %s", keys, set);
+	}
+	else
+	{
+		n = snprintf(buffer, size, " ON CONFLICT (%s) DO NOTHING", keys);
+	}
+
+	if (n >= size)
+	{
+		log_error("pgsql_upsert: buffer exhausted");
+		return -1;
+	}
+
+	return 0;
+}
+
+static int
+pgsql_cleanup_batch(PGconn *conn, char *buffer, int size, char *table,
+    char *expire, unsigned long now, int limit)
+{
+	int n;
+
+	// PostgreSQL has no DELETE ... LIMIT. Rows are addressed by ctid.
+	n = snprintf(buffer, size, "DELETE FROM %s WHERE ctid = ANY(ARRAY("
+		"SELECT ctid FROM %s WHERE %s < %lu LIMIT %d))", table, table,
+		expire, now, limit);
+	if (n >= size)
+	{
+		log_error("pgsql_cleanup_batch: buffer exhausted");
+		return -1;
+	}
+
+	return 0;
+}
+
 static void
 pgsql_close(dbt_t *dbt)
 {
@@ -251,7 +417,7 @@ pgsql_init(void)
 	dbt_driver.dd_name    = "postgresql";
 	dbt_driver.dd_open    = (dbt_db_open_t) pgsql_open;
 	dbt_driver.dd_close   = (dbt_db_close_t) pgsql_close;
-	dbt_driver.dd_flags	= DBT_LOCK;
+	dbt_driver.dd_flags	= DBT_LOCK | DBT_POOL;
 
 	// SQL driver
 	dbt_driver.dd_use_sql                = 1;
@@ -264,9 +430,18 @@ pgsql_init(void)
 	dbt_driver.dd_sql.sql_esc_value      = (sql_escape_t) pgsql_esc_value;
 	dbt_driver.dd_sql.sql_exec           = (sql_exec_t) pgsql_exec;
 	dbt_driver.dd_sql.sql_table_exists   = (sql_table_exists_t) pgsql_table_exists;
+	dbt_driver.dd_sql.sql_index_exists   = (sql_index_exists_t) pgsql_index_exists;
 	dbt_driver.dd_sql.sql_free_result    = (sql_free_result_t) PQclear;
 	dbt_driver.dd_sql.sql_get_row        = (sql_get_row_t) pgsql_get_row;
 	dbt_driver.dd_sql.sql_get_value      = (sql_get_value_t) pgsql_get_value;
+	dbt_driver.dd_sql.sql_upsert         = (sql_upsert_t) pgsql_upsert;
+	dbt_driver.dd_sql.sql_cleanup_batch  = (sql_cleanup_batch_t) pgsql_cleanup_batch;
+	dbt_driver.dd_sql.sql_param          = "$%d";
+	dbt_driver.dd_sql.sql_prepare_ops    = SQL_PREPARE_READ | SQL_PREPARE_WRITE;
+	dbt_driver.dd_sql.sql_prepare        = (sql_prepare_t) pgsql_prepare;
+	dbt_driver.dd_sql.sql_exec_prepared  = (sql_exec_prepared_t) pgsql_exec_prepared;
+	dbt_driver.dd_sql.sql_release        = (sql_release_t) pgsql_release;
+	dbt_driver.dd_sql.sql_finalize       = (sql_finalize_t) pgsql_finalize;
 
 	dbt_driver_register(&dbt_driver);
 
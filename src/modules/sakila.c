@@ -150,6 +150,165 @@ sakila_table_exists(MYSQL *conn, char *table)
 	return tuples;
 }
 
+static int
+sakila_index_exists(MYSQL *conn, char *table, char *column)
+{
+	MYSQL_RES *res;
+	char query[BUFLEN];
+	int tuples, affected;
+	int n;
+
+	n = snprintf(query, sizeof query, "SHOW INDEX FROM `%s` WHERE Column_name='%s' AND Seq_in_index=1", table, column);
+	if (n >= sizeof query)
+	{
+		log_warning("sakila_index_exists: buffer exhausted");
+		return -1;
+	}
+
+	// SHOW INDEX needs privileges on the table
+	if (sakila_exec(conn, &res, query, &tuples, &affected))
+	{
+		log_warning("sakila_index_exists: sakila_exec failed: can't verify "
+		    "index on %s.%s", table, column);
+		return -1;
+	}
+	mysql_free_result(res);
+
+	return tuples;
+}
+
+static int
+sakila_upsert(MYSQL *conn, char *buffer, int size, char *keys, char *set)
+{
+	int n;
+
+	if (*set == 0)
+	{
+		log_error("sakila_upsert: no value columns to update");
+		return -1;
+	}
+
+	n = snprintf(buffer, size, " ON DUPLICATE KEY UPDATE %s", set);
+	if (n >= size)
+	{
+		log_error("sakila_upsert: buffer exhausted");
+		return -1;
+	}
+
+	return 0;
+}
+
+static int
+sakila_cleanup_batch(MYSQL *conn, char *buffer, int size, char *table,
+    char *expire, unsigned long now, int limit)
+{
+	int n;
+
+	n = snprintf(buffer, size, "DELETE FROM %s WHERE %s < %lu LIMIT %d",
+		table, expire, now, limit);
+	if (n >= size)
+	{
+		log_error("sakila_cleanup_batch: buffer exhausted");
+		return -1;
+	}
+
+	return 0;
+}
+
+static MYSQL_STMT *
+sakila_prepare(MYSQL *conn, char *query)
+{
+	MYSQL_STMT *stmt;
+
+	stmt = mysql_stmt_init(conn);
+	if (stmt == NULL)
+	{
+		log_error("sakila_prepare: mysql_stmt_init: %s",
+			mysql_error(conn));
+		return NULL;
+	}
+
+	if (mysql_stmt_prepare(stmt, query, strlen(query)))
+	{
+		log_error("sakila_prepare: %s", mysql_stmt_error(stmt));
+		mysql_stmt_close(stmt);
+		return NULL;
+	}
+
+	return stmt;
+}
+
+static int
+sakila_exec_prepared(MYSQL *conn, MYSQL_STMT *stmt, void **result,
+    int nparams, char **params, int *tuples, int *affected)
+{
+	MYSQL_BIND *bind;
+	int i;
+	int r = -1;
+
+	*result = NULL;
+	*tuples = 0;
+	*affected = 0;
+
+	bind = (MYSQL_BIND *) calloc(nparams, sizeof (MYSQL_BIND));
+	if (bind == NULL)
+	{
+		log_sys_error("sakila_exec_prepared: calloc");
+		return -1;
+	}
+
+	for (i = 0; i < nparams; ++i)
+	{
+		if (params[i] == NULL)
+		{
+			bind[i].buffer_type = MYSQL_TYPE_NULL;
+			continue;
+		}
+
+		bind[i].buffer_type = MYSQL_TYPE_STRING;
+		bind[i].buffer = params[i];
+		bind[i].buffer_length = strlen(params[i]);
+	}
+
+	if (mysql_stmt_bind_param(stmt, bind))
+	{
+		log_error("sakila_exec_prepared: %s", mysql_stmt_error(stmt));
+		goto exit;
+	}
+
+	if (mysql_stmt_execute(stmt))
+	{
+		log_error("sakila_exec_prepared: %s", mysql_stmt_error(stmt));
+		goto exit;
+	}
+
+	*affected = mysql_stmt_affected_rows(stmt);
+
+	// Success
+	r = 0;
+
+exit:
+	free(bind);
+
+	return r;
+}
+
+static void
+sakila_release(MYSQL *conn, MYSQL_STMT *stmt, void *result)
+{
+	mysql_stmt_free_result(stmt);
+
+	return;
+}
+
+static void
+sakila_finalize(MYSQL *conn, MYSQL_STMT *stmt)
+{
+	mysql_stmt_close(stmt);
+
+	return;
+}
+
 static MYSQL_ROW
 sakila_get_row(MYSQL *conn, MYSQL_RES *result)
 {
@@ -181,7 +340,7 @@ sakila_init(void)
 	dbt_driver.dd_name    = "mysql";
 	dbt_driver.dd_open    = (dbt_db_open_t) sakila_open;
 	dbt_driver.dd_close   = (dbt_db_close_t) sakila_close;
-	dbt_driver.dd_flags   = DBT_LOCK;
+	dbt_driver.dd_flags   = DBT_LOCK | DBT_POOL;
 
 	// SQL driver
 	dbt_driver.dd_use_sql                = 1;
@@ -194,9 +353,21 @@ sakila_init(void)
 	dbt_driver.dd_sql.sql_esc_value      = (sql_escape_t) sakila_esc_value;
 	dbt_driver.dd_sql.sql_exec           = (sql_exec_t) sakila_exec;
 	dbt_driver.dd_sql.sql_table_exists   = (sql_table_exists_t) sakila_table_exists;
+	dbt_driver.dd_sql.sql_index_exists   = (sql_index_exists_t) sakila_index_exists;
 	dbt_driver.dd_sql.sql_free_result    = (sql_free_result_t) mysql_free_result;
 	dbt_driver.dd_sql.sql_get_row        = (sql_get_row_t) sakila_get_row;
 	dbt_driver.dd_sql.sql_get_value      = (sql_get_value_t) sakila_get_value;
+	dbt_driver.dd_sql.sql_upsert         = (sql_upsert_t) sakila_upsert;
+	dbt_driver.dd_sql.sql_cleanup_batch  = (sql_cleanup_batch_t) sakila_cleanup_batch;
+
+	// Prepared results are not MYSQL_RES and can't be read with
+	// sakila_get_row. Only writes are prepared.
+	dbt_driver.dd_sql.sql_param          = "?";
+	dbt_driver.dd_sql.sql_prepare_ops    = SQL_PREPARE_WRITE;
+	dbt_driver.dd_sql.sql_prepare        = (sql_prepare_t) sakila_prepare;
+	dbt_driver.dd_sql.sql_exec_prepared  = (sql_exec_prepared_t) sakila_exec_prepared;
+	dbt_driver.dd_sql.sql_release        = (sql_release_t) sakila_release;
+	dbt_driver.dd_sql.sql_finalize       = (sql_finalize_t) sakila_finalize;
 
 	dbt_driver_register(&dbt_driver);
 
@@ -0,0 +1,1307 @@
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <pthread.h>
+
+#include <mopher.h>
+
+#define TIERED_BUCKETS 4096
+#define TIERED_HOT_MEMORY (64 * 1024 * 1024)
+#define TIERED_WRITE_QUEUE 10000
+
+/*
+ * Composite driver. Records are read from the hot table first and from the
+ * cold table on a miss. Records read from the cold table are promoted to the
+ * hot table. Writes go to both tables. The write queue of the cold table
+ * (write_queue) propagates them asynchronously in batches.
+ *
+ * The hot table is a cache of the cold table. Records are tracked in LRU
+ * order and evicted from the hot table if hot_memory is exceeded.
+ *
+ * Entries being promoted are marked. Writers wait for the mark before they
+ * touch the hot table. Entries whose hot copy could not be deleted are
+ * marked stale. Lookups skip their hot copy and retry the delete.
+ */
+typedef struct tiered_entry {
+	void			*te_key;
+	int			 te_klen;
+	int			 te_size;
+	VAR_INT_T		 te_expire;
+	int			 te_promoting;
+	int			 te_stale;
+	struct tiered_entry	*te_prev;
+	struct tiered_entry	*te_next;
+} tiered_entry_t;
+
+typedef struct tiered {
+	dbt_t			 td_hot;
+	dbt_t			 td_cold;
+	ht_t			*td_ht;
+	tiered_entry_t		*td_head;
+	tiered_entry_t		*td_tail;
+	vp_null_t		 td_nulls;
+	long			 td_memory;
+	long			 td_limit;
+	unsigned long		 td_generation;
+	int			 td_writers;
+	unsigned long		 td_hits;
+	unsigned long		 td_misses;
+	unsigned long		 td_promotions;
+	unsigned long		 td_evictions;
+	tiered_entry_t		*td_loaded;
+	pthread_mutex_t		 td_mutex;
+	pthread_cond_t		 td_cond;
+} tiered_t;
+
+static dbt_driver_t dbt_driver;
+
+// Callback of the walk running in this thread
+static __thread dbt_db_callback_t tiered_walk_callback;
+
+
+static hash_t
+tiered_entry_hash(tiered_entry_t *te)
+{
+	return HASH(te->te_key, te->te_klen);
+}
+
+
+static int
+tiered_entry_match(tiered_entry_t *te1, tiered_entry_t *te2)
+{
+	if (te1->te_klen != te2->te_klen)
+	{
+		return 0;
+	}
+
+	return memcmp(te1->te_key, te2->te_key, te1->te_klen) == 0;
+}
+
+
+static void
+tiered_entry_delete(tiered_entry_t *te)
+{
+	free(te->te_key);
+	free(te);
+
+	return;
+}
+
+
+static int
+tiered_lock(tiered_t *td)
+{
+	if (pthread_mutex_lock(&td->td_mutex))
+	{
+		log_sys_error("tiered_lock: pthread_mutex_lock");
+		return -1;
+	}
+
+	return 0;
+}
+
+
+static void
+tiered_unlock(tiered_t *td)
+{
+	if (pthread_mutex_unlock(&td->td_mutex))
+	{
+		log_sys_error("tiered_unlock: pthread_mutex_unlock");
+	}
+
+	return;
+}
+
+
+static void
+tiered_unlink(tiered_t *td, tiered_entry_t *te)
+{
+	if (te->te_prev)
+	{
+		te->te_prev->te_next = te->te_next;
+	}
+	else
+	{
+		td->td_head = te->te_next;
+	}
+
+	if (te->te_next)
+	{
+		te->te_next->te_prev = te->te_prev;
+	}
+	else
+	{
+		td->td_tail = te->te_prev;
+	}
+
+	te->te_prev = NULL;
+	te->te_next = NULL;
+
+	td->td_memory -= te->te_size;
+
+	return;
+}
+
+
+static void
+tiered_push(tiered_t *td, tiered_entry_t *te)
+{
+	te->te_prev = NULL;
+	te->te_next = td->td_head;
+
+	if (td->td_head)
+	{
+		td->td_head->te_prev = te;
+	}
+	else
+	{
+		td->td_tail = te;
+	}
+
+	td->td_head = te;
+	td->td_memory += te->te_size;
+
+	return;
+}
+
+
+/*
+ * Memory used by a record in the hot table: packed key and data plus the
+ * tracking entry.
+ */
+static int
+tiered_record_size(var_t *record)
+{
+	ll_t *ll = record->v_data;
+	ll_entry_t *pos;
+	var_t *v;
+	int size = sizeof (tiered_entry_t) + sizeof (vp_null_t);
+
+	pos = LL_START(ll);
+	while ((v = ll_next(ll, &pos)))
+	{
+		if (v->v_data)
+		{
+			size += var_data_size(v);
+		}
+	}
+
+	return size;
+}
+
+
+/*
+ * Returns the entry tracking record or NULL. CAVEAT: Needs to run in locked
+ * context.
+ */
+static tiered_entry_t *
+tiered_lookup(dbt_t *dbt, var_t *record)
+{
+	tiered_t *td = dbt->dbt_handle;
+	tiered_entry_t lookup, *te;
+	vp_key_t vk;
+
+	if (vp_pack_key(&vk, record))
+	{
+		log_error("tiered_lookup: vp_pack_key failed");
+		return NULL;
+	}
+
+	lookup.te_key = vk.vk_vp.vp_key;
+	lookup.te_klen = vk.vk_vp.vp_klen;
+
+	te = ht_lookup(td->td_ht, &lookup);
+
+	vp_key_clear(&vk);
+
+	return te;
+}
+
+
+/*
+ * Moves record to the head of the LRU list and returns its entry. Entries
+ * exceeding td_limit are unlinked and returned in victims (linked by
+ * te_next). Entries being promoted or marked stale are kept. CAVEAT: Needs
+ * to run in locked context.
+ */
+static tiered_entry_t *
+tiered_track(dbt_t *dbt, var_t *record, tiered_entry_t **victims)
+{
+	tiered_t *td = dbt->dbt_handle;
+	tiered_entry_t lookup, *te, *victim, *prev;
+	VAR_INT_T *expire;
+	vp_key_t vk;
+
+	if (vp_pack_key(&vk, record))
+	{
+		log_error("tiered_track: vp_pack_key failed");
+		return NULL;
+	}
+
+	lookup.te_key = vk.vk_vp.vp_key;
+	lookup.te_klen = vk.vk_vp.vp_klen;
+
+	te = ht_lookup(td->td_ht, &lookup);
+	if (te)
+	{
+		tiered_unlink(td, te);
+	}
+	else
+	{
+		te = (tiered_entry_t *) malloc(sizeof (tiered_entry_t));
+		if (te == NULL)
+		{
+			log_sys_error("tiered_track: malloc");
+			goto error;
+		}
+
+		te->te_key = malloc(lookup.te_klen);
+		if (te->te_key == NULL)
+		{
+			log_sys_error("tiered_track: malloc");
+			free(te);
+			goto error;
+		}
+
+		memcpy(te->te_key, lookup.te_key, lookup.te_klen);
+		te->te_klen = lookup.te_klen;
+		te->te_promoting = 0;
+		te->te_stale = 0;
+
+		if (ht_insert(td->td_ht, te))
+		{
+			log_error("tiered_track: ht_insert failed");
+			tiered_entry_delete(te);
+			goto error;
+		}
+	}
+
+	vp_key_clear(&vk);
+
+	expire = vlist_record_get(record, dbt->dbt_expire_field);
+	te->te_expire = expire ? *expire : 0;
+	te->te_size = tiered_record_size(record);
+
+	tiered_push(td, te);
+
+	// The record just tracked is never evicted
+	for (victim = td->td_tail; victim && victim != te &&
+	    td->td_memory > td->td_limit; victim = prev)
+	{
+		prev = victim->te_prev;
+
+		if (victim->te_promoting || victim->te_stale)
+		{
+			continue;
+		}
+
+		tiered_unlink(td, victim);
+		ht_remove(td->td_ht, victim);
+
+		victim->te_next = *victims;
+		*victims = victim;
+
+		++td->td_evictions;
+	}
+
+	return te;
+
+error:
+	vp_key_clear(&vk);
+
+	return NULL;
+}
+
+
+static void
+tiered_untrack(dbt_t *dbt, var_t *record)
+{
+	tiered_t *td = dbt->dbt_handle;
+	tiered_entry_t *te;
+
+	te = tiered_lookup(dbt, record);
+	if (te)
+	{
+		tiered_unlink(td, te);
+		ht_remove(td->td_ht, te);
+		tiered_entry_delete(te);
+	}
+
+	return;
+}
+
+
+/*
+ * Deletes evicted records from the hot table. The cold table holds every
+ * record, hence evicting a record that was updated meanwhile is safe.
+ */
+static void
+tiered_evict(dbt_t *dbt, tiered_entry_t *victims)
+{
+	tiered_t *td = dbt->dbt_handle;
+	tiered_entry_t *te;
+	var_t *lookup;
+	vp_t vp;
+
+	while ((te = victims))
+	{
+		victims = te->te_next;
+
+		vp_init(&vp, te->te_key, te->te_klen, &td->td_nulls,
+		    sizeof (vp_null_t));
+
+		lookup = vp_unpack(&vp, dbt->dbt_scheme);
+		if (lookup == NULL)
+		{
+			log_error("tiered_evict: vp_unpack failed");
+		}
+		else
+		{
+			if (dbt_db_del(&td->td_hot, lookup))
+			{
+				log_error("tiered_evict: %s: dbt_db_del failed",
+				    dbt->dbt_name);
+			}
+
+			var_delete(lookup);
+		}
+
+		tiered_entry_delete(te);
+	}
+
+	return;
+}
+
+
+/*
+ * Returns 1 if the hot copy of record is stale and must not be used.
+ */
+static int
+tiered_hit(dbt_t *dbt, var_t *record)
+{
+	tiered_t *td = dbt->dbt_handle;
+	tiered_entry_t *victims = NULL, *te;
+
+	if (tiered_lock(td))
+	{
+		return 0;
+	}
+
+	te = tiered_lookup(dbt, record);
+	if (te && te->te_stale)
+	{
+		tiered_unlock(td);
+		return 1;
+	}
+
+	++td->td_hits;
+
+	if (tiered_track(dbt, record, &victims) == NULL)
+	{
+		log_error("tiered_hit: tiered_track failed");
+	}
+
+	tiered_unlock(td);
+
+	tiered_evict(dbt, victims);
+
+	return 0;
+}
+
+
+static unsigned long
+tiered_miss(dbt_t *dbt, int n)
+{
+	tiered_t *td = dbt->dbt_handle;
+	unsigned long generation;
+
+	if (tiered_lock(td))
+	{
+		return 0;
+	}
+
+	td->td_misses += n;
+	generation = td->td_generation;
+
+	tiered_unlock(td);
+
+	return generation;
+}
+
+
+/*
+ * Removes the hot copy of record. Used if the hot table may hold an outdated
+ * or unwritten record. The cold table is read on the next lookup. If the
+ * delete fails the entry is marked stale: lookups ignore the hot copy and
+ * retry until it is deleted or overwritten by a write.
+ */
+static void
+tiered_drop(dbt_t *dbt, var_t *record)
+{
+	tiered_t *td = dbt->dbt_handle;
+	tiered_entry_t *victims = NULL, *te;
+	int failed;
+
+	failed = dbt_db_del(&td->td_hot, record);
+	if (failed)
+	{
+		log_error("tiered_drop: %s: dbt_db_del failed. Hot copy marked "
+		    "stale", dbt->dbt_name);
+	}
+
+	if (tiered_lock(td))
+	{
+		return;
+	}
+
+	if (!failed)
+	{
+		tiered_untrack(dbt, record);
+	}
+	else
+	{
+		te = tiered_track(dbt, record, &victims);
+		if (te == NULL)
+		{
+			log_error("tiered_drop: tiered_track failed");
+		}
+		else
+		{
+			te->te_stale = 1;
+		}
+	}
+
+	tiered_unlock(td);
+
+	tiered_evict(dbt, victims);
+
+	return;
+}
+
+
+/*
+ * Copies a record read from the cold table into the hot table. Skipped if a
+ * write started after the cold table was read (generation) or is still
+ * running, as the record might be outdated. The hot table is written
+ * unlocked. The entry is marked meanwhile: writers starting later wait for
+ * the mark and overwrite the promoted copy.
+ */
+static void
+tiered_promote(dbt_t *dbt, var_t *record, unsigned long generation)
+{
+	tiered_t *td = dbt->dbt_handle;
+	tiered_entry_t *victims = NULL, *te;
+	int r;
+
+	if (tiered_lock(td))
+	{
+		return;
+	}
+
+	if (td->td_generation != generation || td->td_writers)
+	{
+		tiered_unlock(td);
+		return;
+	}
+
+	// Promoted by another lookup or waiting for a delete
+	te = tiered_lookup(dbt, record);
+	if (te && (te->te_promoting || te->te_stale))
+	{
+		tiered_unlock(td);
+		return;
+	}
+
+	te = tiered_track(dbt, record, &victims);
+	if (te == NULL)
+	{
+		log_error("tiered_promote: tiered_track failed");
+		tiered_unlock(td);
+		tiered_evict(dbt, victims);
+		return;
+	}
+
+	te->te_promoting = 1;
+
+	tiered_unlock(td);
+
+	tiered_evict(dbt, victims);
+
+	r = dbt_db_set(&td->td_hot, record);
+
+	// Marked entries are neither evicted nor untracked
+	if (tiered_lock(td))
+	{
+		return;
+	}
+
+	te->te_promoting = 0;
+
+	if (r == 0)
+	{
+		++td->td_promotions;
+	}
+
+	if (pthread_cond_broadcast(&td->td_cond))
+	{
+		log_sys_error("tiered_promote: pthread_cond_broadcast");
+	}
+
+	tiered_unlock(td);
+
+	if (r)
+	{
+		log_error("tiered_promote: %s: dbt_db_set failed",
+		    dbt->dbt_name);
+		tiered_drop(dbt, record);
+	}
+
+	return;
+}
+
+
+/*
+ * Writers bump td_generation when they start and finish. Promotions that
+ * have not started yet are skipped. Promotions of records are waited for.
+ */
+static int
+tiered_write_begin(dbt_t *dbt, int n, var_t **records)
+{
+	tiered_t *td = dbt->dbt_handle;
+	tiered_entry_t *te;
+	int i;
+
+	if (tiered_lock(td))
+	{
+		return -1;
+	}
+
+	++td->td_generation;
+	++td->td_writers;
+
+	for (i = 0; i < n; ++i)
+	{
+		while ((te = tiered_lookup(dbt, records[i])) && te->te_promoting)
+		{
+			if (pthread_cond_wait(&td->td_cond, &td->td_mutex))
+			{
+				log_sys_error("tiered_write_begin: "
+				    "pthread_cond_wait");
+				break;
+			}
+		}
+	}
+
+	tiered_unlock(td);
+
+	return 0;
+}
+
+
+static void
+tiered_write_end(tiered_t *td)
+{
+	if (tiered_lock(td))
+	{
+		return;
+	}
+
+	++td->td_generation;
+	--td->td_writers;
+
+	tiered_unlock(td);
+
+	return;
+}
+
+
+/*
+ * Retries the delete of a stale hot copy. Runs as a writer: record is not
+ * promoted meanwhile.
+ */
+static void
+tiered_purge(dbt_t *dbt, var_t *record)
+{
+	if (tiered_write_begin(dbt, 1, &record))
+	{
+		return;
+	}
+
+	tiered_drop(dbt, record);
+
+	tiered_write_end(dbt->dbt_handle);
+
+	return;
+}
+
+
+static int
+tiered_get(dbt_t *dbt, var_t *record, var_t **result)
+{
+	tiered_t *td = dbt->dbt_handle;
+	unsigned long generation;
+
+	if (dbt_db_get(&td->td_hot, record, result))
+	{
+		log_error("tiered_get: %s: hot table failed", dbt->dbt_name);
+		return -1;
+	}
+
+	if (*result)
+	{
+		if (tiered_hit(dbt, *result) == 0)
+		{
+			return 0;
+		}
+
+		var_delete(*result);
+		*result = NULL;
+
+		tiered_purge(dbt, record);
+	}
+
+	generation = tiered_miss(dbt, 1);
+
+	if (dbt_db_get(&td->td_cold, record, result))
+	{
+		log_error("tiered_get: %s: cold table failed", dbt->dbt_name);
+		return -1;
+	}
+
+	if (*result)
+	{
+		tiered_promote(dbt, *result, generation);
+	}
+
+	return 0;
+}
+
+
+static int
+tiered_set(dbt_t *dbt, var_t *record)
+{
+	tiered_t *td = dbt->dbt_handle;
+	tiered_entry_t *victims = NULL, *te;
+	int r = -1;
+
+	if (tiered_write_begin(dbt, 1, &record))
+	{
+		return -1;
+	}
+
+	// The cold table keeps the old record. Drop a partial hot write.
+	if (dbt_db_set(&td->td_hot, record))
+	{
+		log_error("tiered_set: %s: hot table failed", dbt->dbt_name);
+		tiered_drop(dbt, record);
+		goto exit;
+	}
+
+	// The hot table must not serve a record the cold table doesn't hold
+	if (dbt_db_set(&td->td_cold, record))
+	{
+		log_error("tiered_set: %s: cold table failed", dbt->dbt_name);
+		tiered_drop(dbt, record);
+		goto exit;
+	}
+
+	// The hot copy is current again
+	if (tiered_lock(td) == 0)
+	{
+		te = tiered_track(dbt, record, &victims);
+		if (te == NULL)
+		{
+			log_error("tiered_set: tiered_track failed");
+		}
+		else
+		{
+			te->te_stale = 0;
+		}
+
+		tiered_unlock(td);
+	}
+
+	r = 0;
+
+exit:
+	tiered_write_end(td);
+
+	tiered_evict(dbt, victims);
+
+	return r;
+}
+
+
+static int
+tiered_del(dbt_t *dbt, var_t *record)
+{
+	tiered_t *td = dbt->dbt_handle;
+	int r = -1;
+
+	if (tiered_write_begin(dbt, 1, &record))
+	{
+		return -1;
+	}
+
+	if (dbt_db_del(&td->td_hot, record))
+	{
+		log_error("tiered_del: %s: hot table failed", dbt->dbt_name);
+		goto exit;
+	}
+
+	if (tiered_lock(td) == 0)
+	{
+		tiered_untrack(dbt, record);
+		tiered_unlock(td);
+	}
+
+	/*
+	 * The hot copy is gone already. If the cold table fails it keeps the
+	 * record and lookups read it from there.
+	 */
+	if (dbt_db_del(&td->td_cold, record))
+	{
+		log_error("tiered_del: %s: cold table failed", dbt->dbt_name);
+		goto exit;
+	}
+
+	r = 0;
+
+exit:
+	tiered_write_end(td);
+
+	return r;
+}
+
+
+static int
+tiered_mget(dbt_t *dbt, int n, var_t **records, var_t **results)
+{
+	tiered_t *td = dbt->dbt_handle;
+	var_t **lookups = NULL, **found;
+	unsigned long generation;
+	int *index = NULL;
+	int misses = 0;
+	int i, r = -1;
+
+	if (dbt_db_mget(&td->td_hot, n, records, results))
+	{
+		log_error("tiered_mget: %s: hot table failed", dbt->dbt_name);
+		return -1;
+	}
+
+	lookups = (var_t **) malloc(2 * n * sizeof (var_t *));
+	index = (int *) malloc(n * sizeof (int));
+	if (lookups == NULL || index == NULL)
+	{
+		log_sys_error("tiered_mget: malloc");
+		goto exit;
+	}
+
+	found = lookups + n;
+
+	for (i = 0; i < n; ++i)
+	{
+		if (results[i] && tiered_hit(dbt, results[i]) == 0)
+		{
+			continue;
+		}
+
+		// Stale hot copy
+		if (results[i])
+		{
+			var_delete(results[i]);
+			results[i] = NULL;
+
+			tiered_purge(dbt, records[i]);
+		}
+
+		lookups[misses] = records[i];
+		index[misses++] = i;
+	}
+
+	if (misses == 0)
+	{
+		r = 0;
+		goto exit;
+	}
+
+	generation = tiered_miss(dbt, misses);
+
+	if (dbt_db_mget(&td->td_cold, misses, lookups, found))
+	{
+		log_error("tiered_mget: %s: cold table failed", dbt->dbt_name);
+		goto exit;
+	}
+
+	for (i = 0; i < misses; ++i)
+	{
+		results[index[i]] = found[i];
+
+		if (found[i])
+		{
+			tiered_promote(dbt, found[i], generation);
+		}
+	}
+
+	r = 0;
+
+exit:
+	if (r == -1)
+	{
+		for (i = 0; i < n; ++i)
+		{
+			if (results[i])
+			{
+				var_delete(results[i]);
+				results[i] = NULL;
+			}
+		}
+	}
+
+	if (lookups)
+	{
+		free(lookups);
+	}
+
+	if (index)
+	{
+		free(index);
+	}
+
+	return r;
+}
+
+
+static int
+tiered_mset(dbt_t *dbt, int n, var_t **records)
+{
+	tiered_t *td = dbt->dbt_handle;
+	tiered_entry_t *victims = NULL, *te;
+	int i, r = -1;
+
+	if (tiered_write_begin(dbt, n, records))
+	{
+		return -1;
+	}
+
+	// See tiered_set
+	if (dbt_db_mset(&td->td_hot, n, records))
+	{
+		log_error("tiered_mset: %s: hot table failed", dbt->dbt_name);
+		goto drop;
+	}
+
+	if (dbt_db_mset(&td->td_cold, n, records))
+	{
+		log_error("tiered_mset: %s: cold table failed", dbt->dbt_name);
+		goto drop;
+	}
+
+	if (tiered_lock(td) == 0)
+	{
+		for (i = 0; i < n; ++i)
+		{
+			te = tiered_track(dbt, records[i], &victims);
+			if (te == NULL)
+			{
+				log_error("tiered_mset: tiered_track failed");
+				continue;
+			}
+
+			te->te_stale = 0;
+		}
+
+		tiered_unlock(td);
+	}
+
+	r = 0;
+	goto exit;
+
+drop:
+	for (i = 0; i < n; ++i)
+	{
+		tiered_drop(dbt, records[i]);
+	}
+
+exit:
+	tiered_write_end(td);
+
+	tiered_evict(dbt, victims);
+
+	return r;
+}
+
+
+/*
+ * Walks are served by the cold table. Callbacks receive the tiered table.
+ */
+static int
+tiered_visit(dbt_t *cold, var_t *record)
+{
+	return tiered_walk_callback(cold->dbt_parent, record);
+}
+
+
+static int
+tiered_walk(dbt_t *dbt, dbt_db_callback_t callback)
+{
+	tiered_t *td = dbt->dbt_handle;
+	int r;
+
+	tiered_walk_callback = callback;
+	r = dbt_db_walk(&td->td_cold, (dbt_db_callback_t) tiered_visit);
+	tiered_walk_callback = NULL;
+
+	return r;
+}
+
+
+static int
+tiered_scan(dbt_t *dbt, dbt_cursor_t *cursor, int count,
+    dbt_db_callback_t callback)
+{
+	tiered_t *td = dbt->dbt_handle;
+	int r;
+
+	tiered_walk_callback = callback;
+	r = dbt_db_scan(&td->td_cold, cursor, count,
+	    (dbt_db_callback_t) tiered_visit);
+	tiered_walk_callback = NULL;
+
+	return r;
+}
+
+
+/*
+ * Both tables are cleaned up. Records expired in the hot table are dropped
+ * from the LRU list.
+ */
+static int
+tiered_expire(dbt_t *dbt)
+{
+	tiered_t *td = dbt->dbt_handle;
+	tiered_entry_t *te, *next;
+	int deleted, hot;
+
+	td->td_hot.dbt_cleanup_schedule = dbt->dbt_cleanup_schedule;
+	td->td_cold.dbt_cleanup_schedule = dbt->dbt_cleanup_schedule;
+
+	hot = dbt_db_cleanup(&td->td_hot);
+	if (hot == -1)
+	{
+		log_error("tiered_expire: %s: hot table cleanup failed",
+		    dbt->dbt_name);
+	}
+
+	deleted = dbt_db_cleanup(&td->td_cold);
+	if (deleted == -1)
+	{
+		log_error("tiered_expire: %s: cold table cleanup failed",
+		    dbt->dbt_name);
+	}
+
+	if (tiered_lock(td))
+	{
+		return deleted;
+	}
+
+	for (te = td->td_head; te; te = next)
+	{
+		next = te->te_next;
+
+		// Stale entries are kept unless the cleanup deleted the copy
+		if (te->te_promoting || (te->te_stale && hot == -1))
+		{
+			continue;
+		}
+
+		if (te->te_expire && te->te_expire < dbt->dbt_cleanup_schedule)
+		{
+			tiered_unlink(td, te);
+			ht_remove(td->td_ht, te);
+			tiered_entry_delete(te);
+		}
+	}
+
+	tiered_unlock(td);
+
+	return deleted;
+}
+
+
+static int
+tiered_sync(dbt_t *dbt)
+{
+	tiered_t *td = dbt->dbt_handle;
+	int r = 0;
+
+	if (dbt_db_sync(&td->td_hot))
+	{
+		log_error("tiered_sync: %s: hot table failed", dbt->dbt_name);
+		r = -1;
+	}
+
+	if (dbt_db_sync(&td->td_cold))
+	{
+		log_error("tiered_sync: %s: cold table failed", dbt->dbt_name);
+		r = -1;
+	}
+
+	return r;
+}
+
+
+static int
+tiered_stats(dbt_t *dbt, char *buffer, int size)
+{
+	tiered_t *td = dbt->dbt_handle;
+	int n;
+
+	if (tiered_lock(td))
+	{
+		return -1;
+	}
+
+	n = snprintf(buffer, size, "hot=%s cold=%s records=%d memory=%ld/%ld "
+	    "hits=%lu misses=%lu promotions=%lu evictions=%lu",
+	    td->td_hot.dbt_driver->dd_name, td->td_cold.dbt_driver->dd_name,
+	    HT_RECORDS(td->td_ht), td->td_memory, td->td_limit, td->td_hits,
+	    td->td_misses, td->td_promotions, td->td_evictions);
+
+	tiered_unlock(td);
+
+	if (n >= size)
+	{
+		log_error("tiered_stats: buffer exhausted");
+		return -1;
+	}
+
+	return 0;
+}
+
+
+/*
+ * Tracks records already stored in a persistent hot table. Records evicted
+ * meanwhile are deleted after the walk.
+ */
+static int
+tiered_load(dbt_t *hot, var_t *record)
+{
+	dbt_t *dbt = hot->dbt_parent;
+	tiered_t *td = dbt->dbt_handle;
+
+	if (tiered_track(dbt, record, &td->td_loaded) == NULL)
+	{
+		log_error("tiered_load: tiered_track failed");
+		return -1;
+	}
+
+	return 0;
+}
+
+
+static int
+tiered_child(dbt_t *dbt, dbt_t *child, var_t *config)
+{
+	if (dbt_configure(child, dbt->dbt_name, config))
+	{
+		log_error("tiered_child: dbt_configure failed");
+		return -1;
+	}
+
+	child->dbt_scheme = VAR_COPY(dbt->dbt_scheme);
+	if (child->dbt_scheme == NULL)
+	{
+		log_error("tiered_child: VAR_COPY failed");
+		return -1;
+	}
+
+	child->dbt_validate = dbt->dbt_validate;
+	child->dbt_parent = dbt;
+	strcpy(child->dbt_expire_field, dbt->dbt_expire_field);
+
+	return 0;
+}
+
+
+static void
+tiered_close(dbt_t *dbt)
+{
+	tiered_t *td = dbt->dbt_handle;
+
+	if (td == NULL)
+	{
+		return;
+	}
+
+	// Flushes the write queue
+	dbt_close_database(&td->td_cold);
+	dbt_close_database(&td->td_hot);
+
+	if (td->td_ht)
+	{
+		ht_delete(td->td_ht);
+	}
+
+	pthread_cond_destroy(&td->td_cond);
+	pthread_mutex_destroy(&td->td_mutex);
+
+	free(td);
+
+	dbt->dbt_handle = NULL;
+
+	return;
+}
+
+
+static int
+tiered_open(dbt_t *dbt)
+{
+	tiered_t *td;
+	var_t *hot, *cold;
+	VAR_INT_T *hot_memory = NULL;
+	ll_t *ll;
+	ll_entry_t *pos;
+	var_t *v;
+	int n;
+
+	hot = vtable_getv(VT_TABLE, dbt->dbt_config, "hot", NULL);
+	cold = vtable_getv(VT_TABLE, dbt->dbt_config, "cold", NULL);
+	if (hot == NULL || cold == NULL)
+	{
+		log_error("tiered_open: %s: hot and cold tables required",
+		    dbt->dbt_name);
+		return -1;
+	}
+
+	vtable_dereference(dbt->dbt_config, "hot_memory", &hot_memory, NULL);
+
+	td = (tiered_t *) malloc(sizeof (tiered_t));
+	if (td == NULL)
+	{
+		log_sys_error("tiered_open: malloc");
+		return -1;
+	}
+
+	memset(td, 0, sizeof (tiered_t));
+
+	if (pthread_mutex_init(&td->td_mutex, NULL))
+	{
+		log_sys_error("tiered_open: pthread_mutex_init");
+		free(td);
+		return -1;
+	}
+
+	if (pthread_cond_init(&td->td_cond, NULL))
+	{
+		log_sys_error("tiered_open: pthread_cond_init");
+		pthread_mutex_destroy(&td->td_mutex);
+		free(td);
+		return -1;
+	}
+
+	dbt->dbt_handle = td;
+
+	td->td_limit = hot_memory ? *hot_memory : TIERED_HOT_MEMORY;
+
+	td->td_ht = ht_create(TIERED_BUCKETS, (ht_hash_t) tiered_entry_hash,
+	    (ht_match_t) tiered_entry_match, NULL);
+	if (td->td_ht == NULL)
+	{
+		log_error("tiered_open: ht_create failed");
+		goto error;
+	}
+
+	// Null mask for lookup records created by tiered_evict
+	ll = dbt->dbt_scheme->v_data;
+	pos = LL_START(ll);
+	for (n = 0; (v = ll_next(ll, &pos)); ++n)
+	{
+		if ((v->v_flags & VF_KEY) == 0)
+		{
+			td->td_nulls |= (vp_null_t) 1 << n;
+		}
+	}
+
+	if (tiered_child(dbt, &td->td_hot, hot) ||
+	    tiered_child(dbt, &td->td_cold, cold))
+	{
+		log_error("tiered_open: %s: tiered_child failed",
+		    dbt->dbt_name);
+		goto error;
+	}
+
+	// Writes reach the cold table through its write queue
+	if (td->td_cold.dbt_queue.dq_size <= 0)
+	{
+		td->td_cold.dbt_queue.dq_size = TIERED_WRITE_QUEUE;
+	}
+
+	if (dbt_open_database(&td->td_hot))
+	{
+		log_error("tiered_open: %s: can't open hot table",
+		    dbt->dbt_name);
+		goto error;
+	}
+
+	if (dbt_open_database(&td->td_cold))
+	{
+		log_error("tiered_open: %s: can't open cold table",
+		    dbt->dbt_name);
+		goto error;
+	}
+
+	if (dbt_db_walk(&td->td_hot, (dbt_db_callback_t) tiered_load))
+	{
+		log_error("tiered_open: %s: dbt_db_walk failed",
+		    dbt->dbt_name);
+		goto error;
+	}
+
+	tiered_evict(dbt, td->td_loaded);
+	td->td_loaded = NULL;
+
+	log_debug("tiered_open: %s: %d hot records (%ld bytes)", dbt->dbt_name,
+	    HT_RECORDS(td->td_ht), td->td_memory);
+
+	return 0;
+
+error:
+	if (td->td_hot.dbt_open == 0 && td->td_hot.dbt_scheme)
+	{
+		var_delete(td->td_hot.dbt_scheme);
+	}
+
+	if (td->td_cold.dbt_open == 0 && td->td_cold.dbt_scheme)
+	{
+		var_delete(td->td_cold.dbt_scheme);
+	}
+
+	tiered_close(dbt);
+
+	return -1;
+}
+
+
+int
+tiered_init(void)
+{
+	dbt_driver.dd_name	= "tiered";
+	dbt_driver.dd_open	= (dbt_db_open_t)	tiered_open;
+	dbt_driver.dd_close	= (dbt_db_close_t)	tiered_close;
+	dbt_driver.dd_get	= (dbt_db_get_t)	tiered_get;
+	dbt_driver.dd_set	= (dbt_db_set_t)	tiered_set;
+	dbt_driver.dd_del	= (dbt_db_del_t)	tiered_del;
+	dbt_driver.dd_mget	= (dbt_db_mget_t)	tiered_mget;
+	dbt_driver.dd_mset	= (dbt_db_mset_t)	tiered_mset;
+	dbt_driver.dd_walk	= (dbt_db_walk_t)	tiered_walk;
+	dbt_driver.dd_scan	= (dbt_db_scan_t)	tiered_scan;
+	dbt_driver.dd_expire	= (dbt_db_expire_t)	tiered_expire;
+	dbt_driver.dd_sync	= (dbt_db_sync_t)	tiered_sync;
+	dbt_driver.dd_stats	= (dbt_db_stats_t)	tiered_stats;
+
+	dbt_driver_register(&dbt_driver);
+
+	return 0;
+}
@@ -18,6 +18,10 @@ static char *moctl_config;
 static char *moctl_server;
 static int   moctl_socket;
 
+#define MOCTL_NODATA 0
+#define MOCTL_DATA 1
+#define MOCTL_STREAM 2
+
 typedef struct moctl_command {
 	char	*mc_cmdline;
 	char	*mc_srvcmd;
@@ -25,10 +29,15 @@ typedef struct moctl_command {
 	int	 mc_data;
 } moctl_command_t;
 
+/*
+ * Streams accept dump options after mc_args arguments.
+ */
 static moctl_command_t moctl_commands[] = {
-	{"dump", "table_dump", 2, 1},
-	{"greylist dump", "greylist_dump", 2, 1},
-	{"greylist pass", "greylist_pass", 5, 0},
+	{"dump", "table_dump", 2, MOCTL_STREAM},
+	{"stats", "table_stats", 1, MOCTL_DATA},
+	{"stats", "table_stats", 2, MOCTL_DATA},
+	{"greylist dump", "greylist_dump", 2, MOCTL_STREAM},
+	{"greylist pass", "greylist_pass", 5, MOCTL_NODATA},
 	{NULL, NULL, 0}
 };
 
@@ -54,12 +63,29 @@ moctl_usage(void)
 	log_error("");
 	log_error("Available commands are:");
 	log_error("");
-	log_error("dump <table>");
+	log_error("dump <table> [options]");
 	log_error("        Print raw content of table.");
 	log_error("");
-	log_error("greylist dump");
+	log_error("stats [table]");
+	log_error("        Print operation statistics of all tables or table.");
+	log_error("");
+	log_error("greylist dump [options]");
 	log_error("        Print formatted content of the greylist-table.");
 	log_error("");
+	log_error("Dump options are:");
+	log_error("");
+	log_error("prefix=<prefix>");
+	log_error("        Print records whose first key starts with prefix.");
+	log_error("");
+	log_error("expire=<seconds>");
+	log_error("        Print records expiring within seconds.");
+	log_error("");
+	log_error("limit=<records>");
+	log_error("        Stop after records and print a resume token.");
+	log_error("");
+	log_error("resume=<token>");
+	log_error("        Continue a dump stopped by limit.");
+	log_error("");
 	log_error("greylist pass <origin> <from> <rcpt>");
 	log_error("        Temporarily whitelist triplet.");
 	log_error("");
@@ -120,6 +146,7 @@ main(int argc, char **argv)
 	int args;
 	int r;
 	char *dump = NULL;
+	char token[BUFLEN];
 
 	memset(cmdline, 0, sizeof cmdline);
 	memset(srvcmd, 0, sizeof srvcmd);
@@ -170,7 +197,7 @@ main(int argc, char **argv)
 		len = strlen(cmdline);
 		strncat(cmdline, argv[i], sizeof cmdline - len - 1);
 	}
-	args = i - 1;
+	args = argc - optind;
 
 	// Translate argv into server command
 	for (cmd = moctl_commands; cmd->mc_cmdline != NULL; ++cmd)
@@ -181,9 +208,11 @@ main(int argc, char **argv)
 			continue;
 		}
 
-		if (args != cmd->mc_args)
+		// Commands may be listed once per number of arguments
+		if (args != cmd->mc_args &&
+		    !(cmd->mc_data == MOCTL_STREAM && args > cmd->mc_args))
 		{
-			moctl_usage();
+			continue;
 		}
 
 		snprintf(srvcmd, sizeof srvcmd, "%s%s", cmd->mc_srvcmd,
@@ -198,13 +227,26 @@ main(int argc, char **argv)
 
 	moctl_init();
 
-	if (cmd->mc_data)
+	switch (cmd->mc_data)
 	{
+	case MOCTL_STREAM:
+		r = server_stream_cmd(moctl_socket, srvcmd, stdout, token,
+		    sizeof token);
+
+		// Records up to token were printed
+		if (strlen(token))
+		{
+			log_error("resume=%s", token);
+		}
+		break;
+
+	case MOCTL_DATA:
 		r = server_data_cmd(moctl_socket, srvcmd, &dump);
-	}
-	else
-	{
+		break;
+
+	default:
 		r = server_cmd(moctl_socket, srvcmd);
+		break;
 	}
 
 	if (r)
@@ -22,6 +22,17 @@ mopherd_test(int optind, int argc, char **argv)
 #endif
 }
 
+static int
+mopherd_bench(int optind, int argc, char **argv)
+{
+#ifndef DEBUG
+	fprintf(stderr, "Benchmark not available. Rebuild mopher with -DDEBUG.\n");
+	exit(EX_SOFTWARE);
+#else
+	return dbt_bench(optind, argc, argv);
+#endif
+}
+
 void
 mopherd_cleanup(void)
 {
@@ -52,14 +63,15 @@ mopherd_cleanup(void)
 int
 main(int argc, char **argv)
 {
-	int r, opt, foreground, loglevel, check_config, test;
+	int r, opt, foreground, loglevel, check_config, test, bench;
 
 	check_config = 0;
 	foreground = 0;
 	test = 0;
+	bench = 0;
 	loglevel = LOG_WARNING;
 
-	while ((opt = getopt(argc, argv, "?hvfCTd:c:p:")) != -1) {
+	while ((opt = getopt(argc, argv, "?hvfCTBd:c:p:")) != -1) {
 		switch(opt) {
 		case 'v':
 			printf("%s-%s\n", BINNAME, PACKAGE_VERSION);
@@ -88,6 +100,10 @@ main(int argc, char **argv)
 		case 'T':
 			test = 1;
 			break;
+
+		case 'B':
+			bench = 1;
+			break;
 			
 
 		default:
@@ -102,6 +118,7 @@ main(int argc, char **argv)
 			fprintf(stderr, "  -h         Show this message\n");
 			fprintf(stderr, "  -p file    Write PID to file\n");
 			fprintf(stderr, "  -T         Run mopher unit tests\n");
+			fprintf(stderr, "  -B         Run database benchmark\n");
 			fprintf(stderr, "  -v         Show version information\n");
 			fprintf(stderr, "\nTry man %s (8) for more information.\n", BINNAME);
 
@@ -117,6 +134,14 @@ main(int argc, char **argv)
 		return mopherd_test(optind, argc, argv);
 	}
 
+	/*
+	 * Run benchmark
+	 */
+	if (bench)
+	{
+		return mopherd_bench(optind, argc, argv);
+	}
+
 	/*
 	 * Daemonize
 	 */
@@ -7,6 +7,7 @@
 #include <errno.h>
 #include <signal.h>
 #include <string.h>
+#include <time.h>
 
 #include <mopher.h>
 
@@ -19,6 +20,7 @@
 
 static server_function_t server_functions[] = {
 	{ "table_dump",	        "Dump table",		        server_table_dump },
+	{ "table_stats",	"Print table statistics",	server_table_stats },
 	{ "greylist_dump",	"Dump greylist tuples",		server_greylist_dump },
 	{ "greylist_pass",	"Let tuple pass greylistung",	server_greylist_pass },
 	{ "help",		"Print this message",		server_help },
@@ -224,6 +226,100 @@ server_data_cmd(int sock, char *cmd, char **buffer)
 }
 
 
+/*
+ * Reads a stream of chunks. Every chunk is announced by a line holding its
+ * size and an optional resume token. An empty chunk ends the stream. The
+ * last resume token is copied to token.
+ */
+int
+server_stream_cmd(int sock, char *cmd, FILE *fp, char *token, int size)
+{
+	char recv[RECV_BUFFER];
+	char *p;
+	int n, len, completed;
+
+	log_debug("server_stream_cmd: command '%s'", cmd);
+	if (server_reply(sock, cmd) == -1)
+	{
+		log_error("server_stream_cmd: server_reply failed");
+		return -1;
+	}
+
+	token[0] = 0;
+
+	do
+	{
+		n = read(sock, recv, sizeof recv - 1);
+		if (n == -1)
+		{
+			log_sys_error("server_stream_cmd: read");
+			return -1;
+		}
+
+		recv[n] = 0;
+
+		// ERROR or CLOSE
+		if (n == 0 || recv[0] < '0' || recv[0] > '9')
+		{
+			log_error("server_stream_cmd: bad chunk header");
+			return -1;
+		}
+
+		len = strtol(recv, &p, 10);
+		if (len > MAX_BUFFER)
+		{
+			log_error("server_stream_cmd: bad chunk size");
+			return -1;
+		}
+
+		if (*p == ' ')
+		{
+			snprintf(token, size, "%s", p + 1);
+			token[strcspn(token, "\n")] = 0;
+		}
+		else
+		{
+			token[0] = 0;
+		}
+
+		if (server_ok(sock))
+		{
+			log_error("server_stream_cmd: server_ok failed");
+			return -1;
+		}
+
+		for (completed = 0; len > completed; completed += n)
+		{
+			n = len - completed;
+			if (n > sizeof recv)
+			{
+				n = sizeof recv;
+			}
+
+			n = read(sock, recv, n);
+			if (n <= 0)
+			{
+				log_sys_error("server_stream_cmd: read");
+				return -1;
+			}
+
+			fwrite(recv, 1, n, fp);
+		}
+
+		fflush(fp);
+	}
+	while (len);
+
+	if (server_check(sock))
+	{
+		log_error("server_stream_cmd: server_check failed");
+		return -1;
+	}
+
+	return 0;
+}
+
+
 int
 server_help(int sock, int argc, char **argv)
 {
@@ -246,64 +342,151 @@ server_help(int sock, int argc, char **argv)
 }
 
 
+static int
+server_stream_chunk(int sock, char *buffer, int len, char *token)
+{
+	int n, completed;
+
+	if (server_reply(sock, *token ? "%d %s" : "%d", len, token) == -1)
+	{
+		log_error("server_stream_chunk: server_reply failed");
+		return -1;
+	}
+
+	if (server_check(sock))
+	{
+		log_error("server_stream_chunk: server_check failed");
+		return -1;
+	}
+
+	for (completed = 0; len > completed; completed += n)
+	{
+		n = write(sock, buffer + completed, len - completed);
+		if (n == -1)
+		{
+			log_sys_error("server_stream_chunk: write");
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+
+static int
+server_stream_flush(int *sock, char *buffer, int len, char *token)
+{
+	return server_stream_chunk(*sock, buffer, len, token);
+}
+
+
+/*
+ * Dump options: prefix=<key prefix>, expire=<seconds>, resume=<token> and
+ * limit=<records>.
+ */
+static int
+server_stream_options(dbt_stream_t *stream, int *sock, int argc, char **argv)
+{
+	int i;
+
+	memset(stream, 0, sizeof (dbt_stream_t));
+	stream->dst_flush = (dbt_stream_flush_t) server_stream_flush;
+	stream->dst_data = sock;
+
+	for (i = 0; i < argc; ++i)
+	{
+		if (strncmp(argv[i], "prefix=", 7) == 0)
+		{
+			stream->dst_prefix = argv[i] + 7;
+		}
+		else if (strncmp(argv[i], "expire=", 7) == 0)
+		{
+			stream->dst_expire = time(NULL) + atol(argv[i] + 7);
+		}
+		else if (strncmp(argv[i], "resume=", 7) == 0)
+		{
+			stream->dst_resume = argv[i] + 7;
+		}
+		else if (strncmp(argv[i], "limit=", 6) == 0)
+		{
+			stream->dst_limit = atoi(argv[i] + 6);
+			if (stream->dst_limit <= 0)
+			{
+				log_error("server_stream_options: bad limit: %s",
+				    argv[i] + 6);
+				return -1;
+			}
+		}
+		else
+		{
+			log_error("server_stream_options: bad option: %s",
+			    argv[i]);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+
 int
 server_table_dump(int sock, int argc, char **argv)
 {
-	char *dump = NULL;
-	int len;
-	int r = -1;
-	
-	if (argc != 2)
+	dbt_stream_t stream;
+	dbt_t *dbt;
+
+	if (argc < 2)
 	{
-		log_error("server_table_dump: server_table_dump needs exactly 2 arguments");
-		goto error;
+		log_error("server_table_dump: server_table_dump needs a table");
+		return -1;
 	}
-		
-	len = dbt_dump(&dump, argv[1]);
 
-	log_debug("server_table_dump: table size: %d bytes", len);
-
-	switch(len)
+	dbt = dbt_lookup(argv[1]);
+	if (dbt == NULL)
 	{
-	case 0:
-		server_output(sock, server_table_empty, sizeof server_table_empty);
-		return 1;
-	case -1:
-		log_error("server_table_dump: dbt_dump failed");
-		goto error;
-	default:
-		break;
+		log_error("server_table_dump: unknown table: %s", argv[1]);
+		return -1;
 	}
 
-	if(server_output(sock, dump, len) == -1)
+	if (server_stream_options(&stream, &sock, argc - 2, argv + 2))
 	{
-		log_sys_error("server_table_dump: write");
+		log_error("server_table_dump: server_stream_options failed");
+		return -1;
 	}
-	else
+
+	if (dbt_stream(dbt, &stream))
 	{
-		r = 1; //OK
+		log_error("server_table_dump: dbt_stream failed");
+		return -1;
 	}
 
-error:
-	if (dump)
+	log_debug("server_table_dump: %d records", stream.dst_records);
+
+	// Empty chunk ends the stream
+	if (server_stream_chunk(sock, NULL, 0, stream.dst_token))
 	{
-		free(dump);
+		log_error("server_table_dump: server_stream_chunk failed");
+		return -1;
 	}
-	
-	return r;
+
+	return 1;
 }
 
 
 int
-server_greylist_dump(int sock, int argc, char **argv)
+server_table_stats(int sock, int argc, char **argv)
 {
 	char *dump = NULL;
 	int len;
 	int r = -1;
 
-	len = greylist_dump(&dump);
+	if (argc > 2)
+	{
+		server_reply(sock, "Usage: %s [table]", argv[0]);
+		return -1;
+	}
 
-	log_debug("server_greylist_dump: greylist size: %d bytes", len);
+	len = dbt_stats(&dump, argc == 2 ? argv[1] : NULL);
 
 	switch(len)
 	{
@@ -311,7 +494,7 @@ server_greylist_dump(int sock, int argc, char **argv)
 		server_output(sock, server_table_empty, sizeof server_table_empty);
 		return 1;
 	case -1:
-		log_error("server_greylist_dump: greylist_dump failed");
+		log_error("server_table_stats: dbt_stats failed");
 		goto error;
 	default:
 		break;
@@ -319,7 +502,7 @@ server_greylist_dump(int sock, int argc, char **argv)
 
 	if(server_output(sock, dump, len) == -1)
 	{
-		log_sys_error("server_greylist_dump: write");
+		log_sys_error("server_table_stats: write");
 	}
 	else
 	{
@@ -331,11 +514,40 @@ error:
 	{
 		free(dump);
 	}
-	
+
 	return r;
 }
 
 
+int
+server_greylist_dump(int sock, int argc, char **argv)
+{
+	dbt_stream_t stream;
+
+	if (server_stream_options(&stream, &sock, argc - 1, argv + 1))
+	{
+		log_error("server_greylist_dump: server_stream_options failed");
+		return -1;
+	}
+
+	if (greylist_dump(&stream))
+	{
+		log_error("server_greylist_dump: greylist_dump failed");
+		return -1;
+	}
+
+	log_debug("server_greylist_dump: %d tuples", stream.dst_records);
+
+	if (server_stream_chunk(sock, NULL, 0, stream.dst_token))
+	{
+		log_error("server_greylist_dump: server_stream_chunk failed");
+		return -1;
+	}
+
+	return 1;
+}
+
+
 int
 server_greylist_pass(int sock, int argc, char **argv)
 {
@@ -42,10 +42,13 @@ sht_delete(sht_t *sht)
 	return;
 }
 
+/*
+ * The key hash is computed once by sht_record_create and for lookups
+ */
 static hash_t
 sht_record_hash(sht_record_t *sr)
 {
-	return HASH(sr->sr_key, strlen(sr->sr_key));
+	return sr->sr_hash;
 }
 
 
@@ -96,6 +99,7 @@ sht_record_create(char *key, void *data)
 	}
 
 	sr->sr_data = data;
+	sr->sr_hash = HASH(key, strlen(key));
 
 	return sr;
 
@@ -198,6 +202,7 @@ sht_lookup(sht_t *sht, char *key)
 	sht_record_t *sr, lookup;
 
 	lookup.sr_key = key;
+	lookup.sr_hash = HASH(key, strlen(key));
 	sr = ht_lookup(sht->sht_ht, &lookup);
 	if (sr == NULL)
 	{
@@ -214,6 +219,7 @@ sht_remove(sht_t *sht, char *key)
 	sht_record_t *sr, lookup;
 
 	lookup.sr_key = key;
+	lookup.sr_hash = HASH(key, strlen(key));
 	sr = ht_lookup(sht->sht_ht, &lookup);
 	if (sr == NULL)
 	{
@@ -1,3 +1,4 @@
+#include <stdlib.h>
 #include <string.h>
 
 // Required for testing
@@ -6,6 +7,9 @@
 #include <mopher.h>
 
 #define BUFLEN 8192
+#define SQL_MGET_BUFLEN (BUFLEN * 4)
+
+#define SQL_PREPARED(sql, ops) ((sql)->sql_prepare && ((sql)->sql_prepare_ops & (ops)))
 
 static int
 sql_columns(sql_t *sql, void *handle, char *buffer, int size, int types, char *join,
@@ -66,17 +70,79 @@ sql_columns(sql_t *sql, void *handle, char *buffer, int size, int types, char *j
 }
 
 static int
-sql_values(sql_t *sql, void *conn, char *buffer, int size, char *join,
-    var_t *record)
+sql_placeholder(sql_t *sql, char *buffer, int size, int *param)
+{
+	int n;
+
+	// Parameter numbers start at 1. Dialects using plain '?' ignore it.
+	n = snprintf(buffer, size, sql->sql_param, ++(*param));
+	if (n >= size)
+	{
+		log_error("sql_placeholder: buffer exhausted");
+		return -1;
+	}
+
+	return 0;
+}
+
+static int
+sql_value(sql_t *sql, void *conn, char *buffer, int size, int *param, var_t *v)
+{
+	char value_raw[BUFLEN];
+	char *vp;
+
+	// Prepared statements bind the value on execution
+	if (param)
+	{
+		return sql_placeholder(sql, buffer, size, param);
+	}
+
+	// Cast value to string
+	if (v->v_data == NULL)
+	{
+		if (size < 5)
+		{
+			log_error("sql_value: buffer exhausted");
+			return -1;
+		}
+
+		strcpy(buffer, "NULL");
+		return 0;
+	}
+
+	if (v->v_type == VT_STRING)
+	{
+		vp = v->v_data;
+	}
+	else
+	{
+		if (var_dump_data(v, value_raw, sizeof value_raw) == -1)
+		{
+			log_error("sql_value: var_dump_data failed");
+			return -1;
+		}
+		vp = value_raw;
+	}
+
+	// Escape value
+	if (sql->sql_esc_value(conn, buffer, size, vp))
+	{
+		log_error("sql_value: escape value for '%s' failed", vp);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int
+sql_values(sql_t *sql, void *conn, char *buffer, int size, int types,
+    char *join, int *param, var_t *record)
 {
 	ll_t *ll;
 	ll_entry_t *pos;
 	char value[BUFLEN];
-	char value_raw[BUFLEN];
 	var_t *v;
-	char *vp;
 	int n = 0;
-	int isnull;
 
 	if(record->v_type != VT_LIST) {
 		log_error("sql_values: bad v_type");
@@ -88,35 +154,22 @@ sql_values(sql_t *sql, void *conn, char *buffer, int size, char *join,
 	pos = LL_START(ll);
 	while ((v = ll_next(ll, &pos)) != NULL)
 	{
-		isnull = 0;
-		// Cast value to string
-		if (v->v_data == NULL)
-		{
-			strcpy(value, "NULL");
-			isnull = 1;
-		}
-		else if (v->v_type == VT_STRING)
+		// Only key fields
+		if ((types & SQL_VALUES) == 0 && (v->v_flags & VF_KEY) == 0)
 		{
-			vp = v->v_data;
+			continue;
 		}
-		else
+
+		// Only value fields
+		if ((types & SQL_KEYS) == 0 && (v->v_flags & VF_KEY))
 		{
-			if (var_dump_data(v, value_raw, sizeof value_raw) == -1)
-			{
-				log_error("sql_values: var_dump_data failed");
-				return -1;
-			}
-			vp = value_raw;
+			continue;
 		}
 
-		if (!isnull)
+		if (sql_value(sql, conn, value, sizeof value, param, v))
 		{
-			// Escape value
-			if (sql->sql_esc_value(conn, value, sizeof value, vp))
-			{
-				log_error("sql_values: escape value failed");
-				return -1;
-			}
+			log_error("sql_values: sql_value failed");
+			return -1;
 		}
 
 		n += snprintf(buffer + n, size - n, "%s%s", n? join: "",
@@ -133,17 +186,14 @@ sql_values(sql_t *sql, void *conn, char *buffer, int size, char *join,
 
 static int
 sql_key_value(sql_t *sql, void *conn, char *buffer, int size, int types, char *join,
-    var_t *record)
+    char *qualify, int *param, var_t *record)
 {
 	ll_t *ll;
 	ll_entry_t *pos;
 	var_t *v = NULL;
 	int n = 0;
 	char column[BUFLEN];
-	char value_raw[BUFLEN];
 	char value[BUFLEN];
-	char *vp = NULL;
-	int isnull;
 
 	if(record->v_type != VT_LIST) {
 		log_error("sql_key_value: bad v_type");
@@ -182,38 +232,19 @@ sql_key_value(sql_t *sql, void *conn, char *buffer, int size, int types, char *j
 			return -1;
 		}
 
-		isnull = 0;
-		// Cast value to string
-		if (v->v_data == NULL)
-		{
-			strcpy(value, "NULL");
-			isnull = 1;
-		}
-		else if (v->v_type == VT_STRING)
-		{
-			vp = v->v_data;
-		}
-		else
+		if (sql_value(sql, conn, value, sizeof value, param, v))
 		{
-			if (var_dump_data(v, value_raw, sizeof value_raw) == -1)
-			{
-				log_error("sql_key_value: var_dump_data failed");
-				return -1;
-			}
-			vp = value_raw;
+			log_error("sql_key_value: sql_value failed");
+			return -1;
 		}
 
-		// Escape value
-		if (!isnull)
+		// Upserts need the stored column qualified with the table name
+		if (v->v_flags & VF_SQL_SAFE_UPDATE && qualify)
 		{
-			if (sql->sql_esc_value(conn, value, sizeof value, vp))
-			{
-				log_error("sql_key_value: escape value for '%s' failed", vp);
-				return -1;
-			}
+			n += snprintf(buffer + n, size - n, "%s%s=%s.%s+%s",
+				n? join: "", column, qualify, column, value);
 		}
-
-		if (v->v_flags & VF_SQL_SAFE_UPDATE)
+		else if (v->v_flags & VF_SQL_SAFE_UPDATE)
 		{
 			n += snprintf(buffer + n, size - n, "%s%s=%s+%s",
 				n? join: "", column, column, value);
@@ -308,6 +339,53 @@ sql_create(sql_t *sql, void *conn, char *buffer, int size, char *tablename, var_
 
 	return 0;
 }
+
+static int
+sql_create_index(sql_t *sql, void *conn, char *buffer, int size,
+    char *tablename, char *field)
+{
+	char name[BUFLEN];
+	char index[BUFLEN];
+	char table[BUFLEN];
+	char column[BUFLEN];
+	int n;
+
+	// Index names are unique per schema in most databases
+	n = snprintf(name, sizeof name, "%s_%s_idx", tablename, field);
+	if (n >= sizeof name)
+	{
+		log_error("sql_create_index: buffer exhausted");
+		return -1;
+	}
+
+	if (sql->sql_esc_identifier(conn, index, sizeof index, name))
+	{
+		log_error("sql_create_index: escape index failed");
+		return -1;
+	}
+
+	if (sql->sql_esc_identifier(conn, table, sizeof table, tablename))
+	{
+		log_error("sql_create_index: escape table failed");
+		return -1;
+	}
+
+	if (sql->sql_esc_identifier(conn, column, sizeof column, field))
+	{
+		log_error("sql_create_index: escape column failed");
+		return -1;
+	}
+
+	n = snprintf(buffer, size, "CREATE INDEX %s ON %s (%s)", index, table,
+		column);
+	if (n >= size)
+	{
+		log_error("sql_create_index: buffer exhausted");
+		return -1;
+	}
+
+	return 0;
+}
 	
 static int
 sql_select_all(sql_t *sql, void *conn, char *buffer, int size, char *tablename,
@@ -339,8 +417,61 @@ sql_select_all(sql_t *sql, void *conn, char *buffer, int size, char *tablename,
 	return 0;
 }
 
+/*
+ * Selects the next count records ordered by key. Resumes after the key
+ * of last if set.
+ */
+static int
+sql_select_batch(sql_t *sql, void *conn, char *buffer, int size,
+    char *tablename, var_t *scheme, var_t *last, int count)
+{
+	char all[BUFLEN];
+	char keys[BUFLEN];
+	char values[BUFLEN];
+	int n = 0;
+
+	if (sql_select_all(sql, conn, all, sizeof all, tablename, scheme))
+	{
+		log_error("sql_select_batch: sql_select_all failed");
+		return -1;
+	}
+
+	if (sql_columns(sql, conn, keys, sizeof keys, SQL_KEYS, ",", scheme))
+	{
+		log_error("sql_select_batch: sql_columns failed");
+		return -1;
+	}
+
+	if (last == NULL)
+	{
+		n = snprintf(buffer, size, "%s ORDER BY %s LIMIT %d", all,
+			keys, count);
+	}
+	else
+	{
+		if (sql_values(sql, conn, values, sizeof values, SQL_KEYS, ",",
+			NULL, last))
+		{
+			log_error("sql_select_batch: sql_values failed");
+			return -1;
+		}
+
+		n = snprintf(buffer, size, "%s WHERE (%s) > (%s) ORDER BY %s "
+			"LIMIT %d", all, keys, values, keys, count);
+	}
+
+	if (n >= size)
+	{
+		log_error("sql_select_batch: buffer exhausted");
+		return -1;
+	}
+
+	return 0;
+}
+
 static int
-sql_select(sql_t *sql, void *conn, char *buffer, int size, char *tablename, var_t *record)
+sql_select(sql_t *sql, void *conn, char *buffer, int size, char *tablename,
+    int *param, var_t *record)
 {
 	char all[BUFLEN];
 	char where[BUFLEN];
@@ -352,7 +483,7 @@ sql_select(sql_t *sql, void *conn, char *buffer, int size, char *tablename, var_
 		return -1;
 	}
 
-	if (sql_key_value(sql, conn, where, sizeof where, SQL_KEYS, " AND ", record))
+	if (sql_key_value(sql, conn, where, sizeof where, SQL_KEYS, " AND ", NULL, param, record))
 	{
 		log_error("sql_select: sql_key_value failed");
 		return -1;
@@ -368,8 +499,65 @@ sql_select(sql_t *sql, void *conn, char *buffer, int size, char *tablename, var_
 	return 0;
 }
 
+/*
+ * Selects all records matching one of n lookups using a row value IN
+ * list. The key values are embedded as literals.
+ */
+static int
+sql_select_multi(sql_t *sql, void *conn, char *buffer, int size,
+    char *tablename, int count, var_t **lookups)
+{
+	char all[BUFLEN];
+	char keys[BUFLEN];
+	char values[BUFLEN];
+	int n = 0;
+	int i;
+
+	if (sql_select_all(sql, conn, all, sizeof all, tablename, lookups[0]))
+	{
+		log_error("sql_select_multi: sql_select_all failed");
+		return -1;
+	}
+
+	if (sql_columns(sql, conn, keys, sizeof keys, SQL_KEYS, ",",
+		lookups[0]))
+	{
+		log_error("sql_select_multi: sql_columns failed");
+		return -1;
+	}
+
+	n = snprintf(buffer, size, "%s WHERE (%s) IN (", all, keys);
+
+	for (i = 0; i < count && n < size; ++i)
+	{
+		if (sql_values(sql, conn, values, sizeof values, SQL_KEYS, ",",
+			NULL, lookups[i]))
+		{
+			log_error("sql_select_multi: sql_values failed");
+			return -1;
+		}
+
+		n += snprintf(buffer + n, size - n, "%s(%s)", i? ",": "",
+			values);
+	}
+
+	if (n < size)
+	{
+		n += snprintf(buffer + n, size - n, ")");
+	}
+
+	if (n >= size)
+	{
+		log_error("sql_select_multi: buffer exhausted");
+		return -1;
+	}
+
+	return 0;
+}
+
 static int
-sql_insert(sql_t *sql, void *conn, char *buffer, int size, char *tablename, var_t *record)
+sql_insert(sql_t *sql, void *conn, char *buffer, int size, char *tablename,
+    int *param, var_t *record)
 {
 	char table[BUFLEN];
 	char columns[BUFLEN];
@@ -388,7 +576,8 @@ sql_insert(sql_t *sql, void *conn, char *buffer, int size, char *tablename, var_
 		return -1;
 	}
 
-	if (sql_values(sql, conn, values, sizeof values, ",", record))
+	if (sql_values(sql, conn, values, sizeof values, SQL_ALL, ",", param,
+	    record))
 	{
 		log_error("sql_insert: sql_columns failed");
 		return -1;
@@ -406,7 +595,8 @@ sql_insert(sql_t *sql, void *conn, char *buffer, int size, char *tablename, var_
 }
 
 static int
-sql_update(sql_t *sql, void *conn, char *buffer, int size, char *tablename, var_t *record)
+sql_update(sql_t *sql, void *conn, char *buffer, int size, char *tablename,
+    int *param, var_t *record)
 {
 	char table[BUFLEN];
 	char set[BUFLEN];
@@ -419,13 +609,13 @@ sql_update(sql_t *sql, void *conn, char *buffer, int size, char *tablename, var_
 		return -1;
 	}
 
-	if (sql_key_value(sql, conn, set, sizeof set, SQL_VALUES, ",", record) == -1)
+	if (sql_key_value(sql, conn, set, sizeof set, SQL_VALUES, ",", NULL, param, record) == -1)
 	{
 		log_error("sql_update: sql_key_value failed");
 		return -1;
 	}
 
-	if (sql_key_value(sql, conn, where, sizeof where, SQL_KEYS, " AND ", record) == -1)
+	if (sql_key_value(sql, conn, where, sizeof where, SQL_KEYS, " AND ", NULL, param, record) == -1)
 	{
 		log_error("sql_update: sql_key_value failed");
 		return -1;
@@ -443,7 +633,51 @@ sql_update(sql_t *sql, void *conn, char *buffer, int size, char *tablename, var_
 }
 
 static int
-sql_delete(sql_t *sql, void *conn, char *buffer, int size, char *tablename, var_t *record)
+sql_upsert(sql_t *sql, void *conn, char *buffer, int size, char *tablename,
+    int *param, var_t *record)
+{
+	char table[BUFLEN];
+	char keys[BUFLEN];
+	char set[BUFLEN];
+	int n;
+
+	if (sql->sql_esc_identifier(conn, table, sizeof table, tablename))
+	{
+		log_error("sql_upsert: escape table failed");
+		return -1;
+	}
+
+	if (sql_insert(sql, conn, buffer, size, tablename, param, record))
+	{
+		log_error("sql_upsert: sql_insert failed");
+		return -1;
+	}
+
+	if (sql_columns(sql, conn, keys, sizeof keys, SQL_KEYS, ",", record))
+	{
+		log_error("sql_upsert: sql_columns failed");
+		return -1;
+	}
+
+	if (sql_key_value(sql, conn, set, sizeof set, SQL_VALUES, ",", table, param, record) == -1)
+	{
+		log_error("sql_upsert: sql_key_value failed");
+		return -1;
+	}
+
+	n = strlen(buffer);
+	if (sql->sql_upsert(conn, buffer + n, size - n, keys, set))
+	{
+		log_error("sql_upsert: sql_upsert failed");
+		return -1;
+	}
+
+	return 0;
+}
+
+static int
+sql_delete(sql_t *sql, void *conn, char *buffer, int size, char *tablename,
+    int *param, var_t *record)
 {
 	char table[BUFLEN];
 	char where[BUFLEN];
@@ -455,7 +689,7 @@ sql_delete(sql_t *sql, void *conn, char *buffer, int size, char *tablename, var_
 		return -1;
 	}
 
-	if (sql_key_value(sql, conn, where, sizeof where, SQL_KEYS, " AND ", record) == -1)
+	if (sql_key_value(sql, conn, where, sizeof where, SQL_KEYS, " AND ", NULL, param, record) == -1)
 	{
 		log_error("sql_delete: sql_key_value failed");
 		return -1;
@@ -472,12 +706,12 @@ sql_delete(sql_t *sql, void *conn, char *buffer, int size, char *tablename, var_
 }
 
 static int
-sql_cleanup(sql_t *sql, void *conn, char *buffer, int size, char *tablename, char *expire_raw)
+sql_cleanup(sql_t *sql, void *conn, char *buffer, int size, char *tablename,
+    char *expire_raw, unsigned long now, int limit)
 {
 	char table[BUFLEN];
 	char expire[BUFLEN];
 	int n;
-	unsigned long now = time(NULL);
 
 	if (sql->sql_esc_identifier(conn, table, sizeof table, tablename))
 	{
@@ -490,7 +724,20 @@ sql_cleanup(sql_t *sql, void *conn, char *buffer, int size, char *tablename, cha
 		log_error("sql_cleanup: escape expire failed");
 		return -1;
 	}
-	
+
+	// Chunked expiry. Dialects without sql_cleanup_batch delete all rows.
+	if (limit > 0 && sql->sql_cleanup_batch)
+	{
+		if (sql->sql_cleanup_batch(conn, buffer, size, table, expire, now,
+			limit))
+		{
+			log_error("sql_cleanup: sql_cleanup_batch failed");
+			return -1;
+		}
+
+		return 0;
+	}
+
 	n = snprintf(buffer, size, "DELETE FROM %s WHERE %s < %lu", table,
 		expire, now);
 	if (n >= size)
@@ -526,6 +773,12 @@ sql_unpack(sql_t *sql, void *conn, void *row, int nrow, var_t *scheme)
 	}
 
 	ll = scheme->v_data;
+	if (vlist_reserve(record, LL_SIZE(ll)))
+	{
+		log_error("sql_unpack: vlist_reserve failed");
+		goto error;
+	}
+
 	pos = LL_START(ll);
 
 	for (n = 0; (item = ll_next(ll, &pos)); ++n) {
@@ -609,35 +862,320 @@ exit:
 	return r;
 }
 
-int
-sql_db_get(dbt_t *dbt, var_t *lookup, var_t **record)
+static int
+sql_params(char *buffer, int size, char **params, int *nparams, int types,
+    var_t *record)
 {
-	char query[BUFLEN];
-	void *result = NULL;
-	void *row = NULL;
-	int tuples, affected;
-	int r = -1;
-
-	char *tablename = lookup->v_name;
-	void *conn = dbt->dbt_handle;
-	sql_t *sql = &dbt->dbt_driver->dd_sql;
-	var_t *scheme = dbt->dbt_scheme;
+	ll_t *ll;
+	ll_entry_t *pos;
+	var_t *v;
+	int n = 0;
+	int len;
 
-	*record = NULL;
+	ll = record->v_data;
 
-	if (tablename == NULL)
+	pos = LL_START(ll);
+	while ((v = ll_next(ll, &pos)) != NULL)
 	{
-		log_error("sql_db_get: lookup name unset");
-		return -1;
-	}
+		// Same field selection as sql_columns and sql_key_value
+		if ((types & SQL_VALUES) == 0 && (v->v_flags & VF_KEY) == 0)
+		{
+			continue;
+		}
 
-	if (sql_select(sql, conn, query, sizeof query, tablename, lookup))
-	{
-		log_error("sql_db_get: sql_select failed");
-		goto exit;
-	}
+		if ((types & SQL_KEYS) == 0 && (v->v_flags & VF_KEY))
+		{
+			continue;
+		}
 
-	if (sql->sql_exec(conn, &result, query, &tuples, &affected))
+		if (*nparams >= SQL_PARAM_MAX)
+		{
+			log_error("sql_params: too many parameters");
+			return -1;
+		}
+
+		// Strings are bound without copying
+		if (v->v_data == NULL || v->v_type == VT_STRING)
+		{
+			params[(*nparams)++] = v->v_data;
+			continue;
+		}
+
+		len = var_dump_data(v, buffer + n, size - n);
+		if (len == -1)
+		{
+			log_error("sql_params: var_dump_data failed");
+			return -1;
+		}
+		if (len >= size - n)
+		{
+			log_error("sql_params: buffer exhausted");
+			return -1;
+		}
+
+		params[(*nparams)++] = buffer + n;
+		n += len + 1;
+	}
+
+	return n;
+}
+
+/*
+ * One bit per field. sql_open rejects schemes wider than SQL_FIELDS_MAX.
+ */
+static unsigned long
+sql_safe_update_mask(var_t *record)
+{
+	ll_t *ll;
+	ll_entry_t *pos;
+	var_t *v;
+	unsigned long mask = 0;
+	int i;
+
+	ll = record->v_data;
+
+	pos = LL_START(ll);
+	for (i = 0; (v = ll_next(ll, &pos)) != NULL; ++i)
+	{
+		if (v->v_flags & VF_SQL_SAFE_UPDATE)
+		{
+			mask |= 1UL << i;
+		}
+	}
+
+	return mask;
+}
+
+static void
+sql_stmt_drop(sql_t *sql, void *conn, sql_stmt_t *stmt)
+{
+	if (stmt->ss_handle)
+	{
+		sql->sql_finalize(conn, stmt->ss_handle);
+	}
+
+	stmt->ss_handle = NULL;
+	stmt->ss_nparams = 0;
+	stmt->ss_safe_update = 0;
+
+	return;
+}
+
+static sql_stmt_t *
+sql_db_prepare(dbt_t *dbt, int op, char *tablename, var_t *record)
+{
+	char query[BUFLEN];
+	int param = 0;
+	int r;
+
+	void *conn = dbt->dbt_handle;
+	sql_t *sql = &dbt->dbt_driver->dd_sql;
+	sql_stmt_t *stmt = &dbt->dbt_stmt[op];
+	unsigned long mask = sql_safe_update_mask(record);
+
+	// The upsert statement text depends on the safe update fields
+	if (stmt->ss_handle && stmt->ss_safe_update == mask)
+	{
+		return stmt;
+	}
+
+	sql_stmt_drop(sql, conn, stmt);
+
+	switch (op)
+	{
+	case SQL_STMT_SELECT:
+		r = sql_select(sql, conn, query, sizeof query, tablename,
+			&param, record);
+		break;
+
+	case SQL_STMT_UPSERT:
+		r = sql_upsert(sql, conn, query, sizeof query, tablename,
+			&param, record);
+		break;
+
+	case SQL_STMT_DELETE:
+		r = sql_delete(sql, conn, query, sizeof query, tablename,
+			&param, record);
+		break;
+
+	default:
+		log_error("sql_db_prepare: bad statement %d", op);
+		return NULL;
+	}
+
+	if (r)
+	{
+		log_error("sql_db_prepare: building statement %d failed", op);
+		return NULL;
+	}
+
+	stmt->ss_handle = sql->sql_prepare(conn, query);
+	if (stmt->ss_handle == NULL)
+	{
+		log_error("sql_db_prepare: sql_prepare failed");
+		return NULL;
+	}
+
+	stmt->ss_nparams = param;
+	stmt->ss_safe_update = mask;
+
+	log_debug("sql_db_prepare: %s: %s", dbt->dbt_name, query);
+
+	return stmt;
+}
+
+static int
+sql_db_exec_stmt(dbt_t *dbt, int op, char *tablename, var_t *record,
+    void **result, int *tuples, int *affected)
+{
+	char buffer[BUFLEN];
+	char *params[SQL_PARAM_MAX];
+	int nparams = 0;
+	int n;
+
+	void *conn = dbt->dbt_handle;
+	sql_t *sql = &dbt->dbt_driver->dd_sql;
+	sql_stmt_t *stmt;
+
+	*result = NULL;
+
+	stmt = sql_db_prepare(dbt, op, tablename, record);
+	if (stmt == NULL)
+	{
+		log_error("sql_db_exec_stmt: sql_db_prepare failed");
+		return -1;
+	}
+
+	switch (op)
+	{
+	case SQL_STMT_UPSERT:
+		// INSERT binds all fields, the conflict clause the values
+		n = sql_params(buffer, sizeof buffer, params, &nparams,
+			SQL_ALL, record);
+		if (n == -1)
+		{
+			break;
+		}
+
+		n = sql_params(buffer + n, sizeof buffer - n, params,
+			&nparams, SQL_VALUES, record);
+		break;
+
+	default:
+		n = sql_params(buffer, sizeof buffer, params, &nparams,
+			SQL_KEYS, record);
+		break;
+	}
+
+	if (n == -1)
+	{
+		log_error("sql_db_exec_stmt: sql_params failed");
+		return -1;
+	}
+
+	if (nparams != stmt->ss_nparams)
+	{
+		log_error("sql_db_exec_stmt: expected %d parameters, got %d",
+			stmt->ss_nparams, nparams);
+		return -1;
+	}
+
+	if (sql->sql_exec_prepared(conn, stmt->ss_handle, result, nparams,
+		params, tuples, affected))
+	{
+		log_error("sql_db_exec_stmt: sql_exec_prepared failed");
+
+		// Prepare again next time
+		sql_stmt_drop(sql, conn, stmt);
+		*result = NULL;
+
+		return -1;
+	}
+
+	return 0;
+}
+
+static void
+sql_db_release_stmt(dbt_t *dbt, int op, void *result)
+{
+	sql_t *sql = &dbt->dbt_driver->dd_sql;
+	sql_stmt_t *stmt = &dbt->dbt_stmt[op];
+
+	if (stmt->ss_handle)
+	{
+		sql->sql_release(dbt->dbt_handle, stmt->ss_handle, result);
+	}
+
+	return;
+}
+
+static int
+sql_db_exec_stmt_only(dbt_t *dbt, int op, char *tablename, var_t *record)
+{
+	int tuples, affected;
+	void *result = NULL;
+	int r = -1;
+
+	if (sql_db_exec_stmt(dbt, op, tablename, record, &result, &tuples,
+		&affected))
+	{
+		log_error("sql_db_exec_stmt_only: sql_db_exec_stmt failed");
+		goto exit;
+	}
+
+	if (tuples)
+	{
+		log_error("sql_db_exec_stmt_only: query returned data");
+		goto exit;
+	}
+
+	// Successful
+	r = affected;
+
+exit:
+	sql_db_release_stmt(dbt, op, result);
+
+	return r;
+}
+
+int
+sql_db_get(dbt_t *dbt, var_t *lookup, var_t **record)
+{
+	char query[BUFLEN];
+	void *result = NULL;
+	void *row = NULL;
+	int tuples, affected;
+	int r = -1;
+
+	char *tablename = lookup->v_name;
+	void *conn = dbt->dbt_handle;
+	sql_t *sql = &dbt->dbt_driver->dd_sql;
+	var_t *scheme = dbt->dbt_scheme;
+	int prepared = SQL_PREPARED(sql, SQL_PREPARE_READ);
+
+	*record = NULL;
+
+	if (tablename == NULL)
+	{
+		log_error("sql_db_get: lookup name unset");
+		return -1;
+	}
+
+	if (prepared)
+	{
+		if (sql_db_exec_stmt(dbt, SQL_STMT_SELECT, tablename, lookup,
+			&result, &tuples, &affected))
+		{
+			log_error("sql_db_get: sql_db_exec_stmt failed");
+			goto exit;
+		}
+	}
+	else if (sql_select(sql, conn, query, sizeof query, tablename, NULL, lookup))
+	{
+		log_error("sql_db_get: sql_select failed");
+		goto exit;
+	}
+	else if (sql->sql_exec(conn, &result, query, &tuples, &affected))
 	{
 		log_error("sql_db_get: dd_sql_exec failed");
 		goto exit;
@@ -672,12 +1210,149 @@ sql_db_get(dbt_t *dbt, var_t *lookup, var_t **record)
 	// Successful
 	r = 0;
 
+exit:
+	if (prepared)
+	{
+		sql_db_release_stmt(dbt, SQL_STMT_SELECT, result);
+	}
+	else if (result)
+	{
+		sql->sql_free_result(result);
+	}
+
+	return r;
+}
+
+/*
+ * Fetches n records with a single query. Rows are assigned to their lookups
+ * by key. If a row matches no lookup (e.g. case insensitive collations) or
+ * a lookup is repeated, the unassigned lookups are fetched one by one.
+ */
+int
+sql_db_mget(dbt_t *dbt, int n, var_t **lookups, var_t **records)
+{
+	char *query = NULL;
+	void *result = NULL;
+	void *row;
+	var_t *record;
+	int tuples, affected;
+	int unmatched = 0;
+	int i, j, r = -1;
+
+	void *conn = dbt->dbt_handle;
+	sql_t *sql = &dbt->dbt_driver->dd_sql;
+	var_t *scheme = dbt->dbt_scheme;
+
+	for (i = 0; i < n; ++i)
+	{
+		records[i] = NULL;
+	}
+
+	// Single lookups may use the prepared statement
+	if (n == 1)
+	{
+		return sql_db_get(dbt, lookups[0], records);
+	}
+
+	if (lookups[0]->v_name == NULL)
+	{
+		log_error("sql_db_mget: lookup name unset");
+		return -1;
+	}
+
+	query = (char *) malloc(SQL_MGET_BUFLEN);
+	if (query == NULL)
+	{
+		log_sys_error("sql_db_mget: malloc");
+		return -1;
+	}
+
+	if (sql_select_multi(sql, conn, query, SQL_MGET_BUFLEN,
+	    lookups[0]->v_name, n, lookups))
+	{
+		log_error("sql_db_mget: sql_select_multi failed");
+		goto exit;
+	}
+
+	if (sql->sql_exec(conn, &result, query, &tuples, &affected))
+	{
+		log_error("sql_db_mget: sql_exec failed");
+		goto exit;
+	}
+
+	// Some drivers only report whether tuples exist
+	for (i = 0; tuples && (row = sql->sql_get_row(conn, result, i)); ++i)
+	{
+		record = sql_unpack(sql, conn, row, i, scheme);
+		if (record == NULL)
+		{
+			log_error("sql_db_mget: sql_unpack failed");
+			goto exit;
+		}
+
+		for (j = 0; j < n; ++j)
+		{
+			if (records[j] == NULL && dbt_key_match(lookups[j],
+			    record))
+			{
+				records[j] = record;
+				break;
+			}
+		}
+
+		if (j == n)
+		{
+			var_delete(record);
+			unmatched = 1;
+		}
+	}
+
+	for (j = 0; j < n; ++j)
+	{
+		if (records[j])
+		{
+			continue;
+		}
+
+		// Duplicate lookups receive a single row
+		for (i = 0; !unmatched && i < j; ++i)
+		{
+			if (records[i] && dbt_key_match(lookups[j], records[i]))
+			{
+				unmatched = 1;
+			}
+		}
+
+		if (unmatched && sql_db_get(dbt, lookups[j], &records[j]))
+		{
+			log_error("sql_db_mget: sql_db_get failed");
+			goto exit;
+		}
+	}
+
+	// Successful
+	r = 0;
+
 exit:
 	if (result)
 	{
 		sql->sql_free_result(result);
 	}
 
+	if (r)
+	{
+		for (i = 0; i < n; ++i)
+		{
+			if (records[i])
+			{
+				var_delete(records[i]);
+				records[i] = NULL;
+			}
+		}
+	}
+
+	free(query);
+
 	return r;
 }
 
@@ -737,6 +1412,37 @@ sql_db_set(dbt_t *dbt, var_t *record)
 		return -1;
 	}
 
+	// Single statement upsert if the dialect supports it. No transaction
+	// and no duplicate key hack required.
+	if (sql->sql_upsert && SQL_PREPARED(sql, SQL_PREPARE_WRITE))
+	{
+		if (sql_db_exec_stmt_only(dbt, SQL_STMT_UPSERT, tablename,
+			record) == -1)
+		{
+			log_error("sql_db_set: sql_db_exec_stmt_only for upsert failed");
+			return -1;
+		}
+
+		return 0;
+	}
+
+	if (sql->sql_upsert)
+	{
+		if (sql_upsert(sql, conn, query, sizeof query, tablename, NULL, record))
+		{
+			log_error("sql_db_set: sql_upsert failed");
+			return -1;
+		}
+
+		if (sql_db_exec_only(sql, conn, query) == -1)
+		{
+			log_error("sql_db_set: sql_db_exec_only for upsert failed");
+			return -1;
+		}
+
+		return 0;
+	}
+
 	// Begin
 	if (sql_db_exec_only(sql, conn, "BEGIN") == -1)
 	{
@@ -745,7 +1451,7 @@ sql_db_set(dbt_t *dbt, var_t *record)
 	}
 
 	// Prepare query string
-	if (sql_update(sql, conn, query, sizeof query, tablename, record))
+	if (sql_update(sql, conn, query, sizeof query, tablename, NULL, record))
 	{
 		log_error("sql_db_set: sql_update failed");
 		goto rollback;
@@ -767,7 +1473,7 @@ sql_db_set(dbt_t *dbt, var_t *record)
 	}
 
 	// Record needs to be inserted
-	if (sql_insert(sql, conn, query, sizeof query, tablename, record))
+	if (sql_insert(sql, conn, query, sizeof query, tablename, NULL, record))
 	{
 		log_error("sql_db_set: sql_insert failed");
 		goto rollback;
@@ -827,8 +1533,21 @@ sql_db_del(dbt_t *dbt, var_t *record)
 		return -1;
 	}
 
+	// A single prepared DELETE needs no explicit transaction
+	if (SQL_PREPARED(sql, SQL_PREPARE_WRITE))
+	{
+		if (sql_db_exec_stmt_only(dbt, SQL_STMT_DELETE, tablename,
+			record) == -1)
+		{
+			log_error("sql_db_del: sql_db_exec_stmt_only failed");
+			return -1;
+		}
+
+		return 0;
+	}
+
 	// Prepare query string
-	if (sql_delete(sql, conn, query, sizeof query, tablename, record))
+	if (sql_delete(sql, conn, query, sizeof query, tablename, NULL, record))
 	{
 		log_error("sql_db_del: sql_delete failed");
 		return -1;
@@ -858,6 +1577,52 @@ sql_db_del(dbt_t *dbt, var_t *record)
 	return 0;
 }
 
+/*
+ * Transaction hooks used by the dbt write-behind queue to flush several
+ * records at once.
+ */
+int
+sql_db_begin(dbt_t *dbt)
+{
+	sql_t *sql = &dbt->dbt_driver->dd_sql;
+
+	if (sql_db_exec_only(sql, dbt->dbt_handle, "BEGIN") == -1)
+	{
+		log_error("sql_db_begin: sql_db_exec_only failed");
+		return -1;
+	}
+
+	return 0;
+}
+
+int
+sql_db_commit(dbt_t *dbt)
+{
+	sql_t *sql = &dbt->dbt_driver->dd_sql;
+
+	if (sql_db_exec_only(sql, dbt->dbt_handle, "COMMIT") == -1)
+	{
+		log_error("sql_db_commit: sql_db_exec_only failed");
+		return -1;
+	}
+
+	return 0;
+}
+
+int
+sql_db_rollback(dbt_t *dbt)
+{
+	sql_t *sql = &dbt->dbt_driver->dd_sql;
+
+	if (sql_db_exec_only(sql, dbt->dbt_handle, "ROLLBACK") == -1)
+	{
+		log_error("sql_db_rollback: sql_db_exec_only failed");
+		return -1;
+	}
+
+	return 0;
+}
+
 int
 sql_db_walk(dbt_t *dbt, dbt_db_callback_t callback)
 {
@@ -915,6 +1680,77 @@ error:
 	return -1;
 }
 
+/*
+ * Keyset pagination: the last record of a batch is kept in the cursor.
+ * Returns the number of visited records.
+ */
+int
+sql_db_scan(dbt_t *dbt, dbt_cursor_t *cursor, int count,
+    dbt_db_callback_t callback)
+{
+	char query[BUFLEN];
+	void *result = NULL;
+	int tuples, affected;
+	void *row;
+	var_t *record;
+	int i;
+
+	void *conn = dbt->dbt_handle;
+	sql_t *sql = &dbt->dbt_driver->dd_sql;
+	var_t *scheme = dbt->dbt_scheme;
+
+	if (sql_select_batch(sql, conn, query, sizeof query, dbt->dbt_name,
+		scheme, cursor->dc_record, count))
+	{
+		log_error("sql_db_scan: sql_select_batch failed");
+		goto error;
+	}
+
+	if (sql->sql_exec(conn, &result, query, &tuples, &affected))
+	{
+		log_error("sql_db_scan: sql_exec failed");
+		goto error;
+	}
+
+	// End of table
+	if (tuples == 0)
+	{
+		sql->sql_free_result(result);
+		return 0;
+	}
+
+	for (i = 0; (row = sql->sql_get_row(conn, result, i)) != NULL; ++i)
+	{
+		record = sql_unpack(sql, conn, row, i, scheme);
+		if (record == NULL)
+		{
+			log_error("sql_db_scan: sql_unpack failed");
+			goto error;
+		}
+
+		// Cursor owns the record
+		dbt_cursor_record(cursor, record);
+
+		if (callback(dbt, record))
+		{
+			log_error("sql_db_scan: callback failed");
+			goto error;
+		}
+	}
+
+	sql->sql_free_result(result);
+
+	return i;
+
+error:
+	if (result)
+	{
+		sql->sql_free_result(result);
+	}
+
+	return -1;
+}
+
 int
 sql_db_expire(dbt_t *dbt)
 {
@@ -926,7 +1762,8 @@ sql_db_expire(dbt_t *dbt)
 	sql_t *sql = &dbt->dbt_driver->dd_sql;
 
 	// Prepare query string
-	if (sql_cleanup(sql, conn, query, sizeof query, dbt->dbt_name, dbt->dbt_expire_field))
+	if (sql_cleanup(sql, conn, query, sizeof query, dbt->dbt_name,
+		dbt->dbt_expire_field, time(NULL), dbt->dbt_expire_batch))
 	{
 		log_error("sql_db_cleanup: sql_cleanup failed");
 		return -1;
@@ -944,36 +1781,146 @@ sql_db_expire(dbt_t *dbt)
 	return affected;
 }
 
+static void
+sql_index(sql_t *sql, void *conn, char *tablename, char *field, int created)
+{
+	char query[BUFLEN];
+	void *res;
+	int tuples, affected;
+	int exists;
+
+	if (sql->sql_index_exists)
+	{
+		exists = sql->sql_index_exists(conn, tablename, field);
+		if (exists > 0)
+		{
+			log_debug("sql_index: index on %s.%s exists", tablename,
+			    field);
+			return;
+		}
+
+		// Unknown: the index can't be verified
+		if (exists < 0 && !created)
+		{
+			return;
+		}
+	}
+
+	// Without sql_index_exists indexes of existing tables can't be
+	// verified. They are only created together with the table.
+	else if (!created)
+	{
+		return;
+	}
+
+	if (!created)
+	{
+		log_warning("sql_index: table %s has no index on %s: creating it",
+		    tablename, field);
+	}
+
+	if (sql_create_index(sql, conn, query, sizeof query, tablename, field))
+	{
+		log_error("sql_index: sql_create_index failed");
+		return;
+	}
+
+	// A missing index only costs performance
+	if (sql->sql_exec(conn, &res, query, &tuples, &affected))
+	{
+		log_error("sql_index: sql_exec failed");
+		return;
+	}
+
+	sql->sql_free_result(res);
+
+	return;
+}
+
 void
-sql_open(sql_t *sql, void *conn, var_t *scheme)
+sql_open(sql_t *sql, void *conn, var_t *scheme, char *expire)
 {
 	char query[BUFLEN];
 	char *tablename = scheme->v_name;
 	void *res;
 	int tuples, affected;
+	int created = 0;
+	ll_t *ll;
+	ll_entry_t *pos;
+	var_t *v;
 
 	if (tablename == NULL)
 	{
 		log_die(EX_SOFTWARE, "sql_open: schema->v_name cannot be NULL");
 	}
 
+	// See sql_safe_update_mask
+	ll = scheme->v_data;
+	if (ll->ll_size > SQL_FIELDS_MAX)
+	{
+		log_die(EX_SOFTWARE, "sql_open: table %s has more than %d fields",
+		    tablename, (int) SQL_FIELDS_MAX);
+	}
+
 	if (sql->sql_table_exists(conn, tablename))
 	{
 		log_debug("sql_open: table %s exists", tablename);
-		return;
 	}
+	else
+	{
+		if (sql_create(sql, conn, query, sizeof query, tablename, scheme))
+		{
+			log_die(EX_SOFTWARE, "sql_open: sql_create failed");
+		}
+
+		if (sql->sql_exec(conn, &res, query, &tuples, &affected))
+		{
+			log_die(EX_SOFTWARE, "sql_open: sql_exec failed");
+		}
 
-	if (sql_create(sql, conn, query, sizeof query, tablename, scheme))
+		sql->sql_free_result(res);
+		created = 1;
+	}
+
+	/*
+	 * Secondary indexes: the expire field (used by the janitor) and all
+	 * fields flagged VF_INDEX. Key fields are covered by the primary key.
+	 */
+	ll = scheme->v_data;
+	pos = LL_START(ll);
+	while ((v = ll_next(ll, &pos)) != NULL)
 	{
-		log_die(EX_SOFTWARE, "sql_open: sql_create failed");
+		if (v->v_flags & VF_KEY)
+		{
+			continue;
+		}
+
+		if ((v->v_flags & VF_INDEX) == 0 &&
+		    (expire == NULL || strcmp(v->v_name, expire)))
+		{
+			continue;
+		}
+
+		sql_index(sql, conn, tablename, v->v_name, created);
 	}
 
-	if (sql->sql_exec(conn, &res, query, &tuples, &affected))
+	return;
+}
+
+void
+sql_close(sql_t *sql, void *conn, sql_stmt_t *stmts)
+{
+	int i;
+
+	if (sql->sql_finalize == NULL)
+	{
+		return;
+	}
+
+	for (i = 0; i < SQL_STMT_MAX; ++i)
 	{
-		log_die(EX_SOFTWARE, "sql_open: sql_exec failed");
+		sql_stmt_drop(sql, conn, stmts + i);
 	}
-	
-	sql->sql_free_result(res);
 
 	return;
 }
@@ -986,6 +1933,36 @@ sql_test_esc(void *conn, char *buffer, int size, char *src)
 	return util_quote(buffer, size, src, "'");
 }
 
+static int
+sql_test_cleanup_batch(void *conn, char *buffer, int size, char *table,
+    char *expire, unsigned long now, int limit)
+{
+	int n;
+
+	n = snprintf(buffer, size, "DELETE FROM %s WHERE %s < %lu LIMIT %d",
+		table, expire, now, limit);
+	if (n >= size)
+	{
+		return -1;
+	}
+
+	return 0;
+}
+
+static int
+sql_test_upsert(void *conn, char *buffer, int size, char *keys, char *set)
+{
+	int n;
+
+	n = snprintf(buffer, size, " ON CONFLICT (%s) DO UPDATE SET %s", keys, set);
+	if (n >= size)
+	{
+		return -1;
+	}
+
+	return 0;
+}
+
 void
 sql_test(int n)
 {
@@ -993,6 +1970,7 @@ sql_test(int n)
 	var_t *scheme, *record;
 	char query[BUFLEN];
 	char pattern[BUFLEN];
+	int param = 0;
 
 	VAR_INT_T i = n;
 	VAR_FLOAT_T f = n * 0.7;
@@ -1050,24 +2028,59 @@ sql_test(int n)
 	//printf("%s\n%s\n\n", query, pattern);
 	TEST_ASSERT(strcmp(pattern, query) == 0);
 
+	// Create Index Query
+	TEST_ASSERT(sql_create_index(&sql, NULL, query, sizeof query, "test_table", "int") == 0);
+	strcpy(pattern, "CREATE INDEX 'test_table_int_idx' ON 'test_table' ('int')");
+	//printf("%s\n%s\n\n", query, pattern);
+	TEST_ASSERT(strcmp(pattern, query) == 0);
+
 	// Select Query
-	TEST_ASSERT(sql_select(&sql, NULL, query, sizeof query, "test_table", record) == 0);
+	TEST_ASSERT(sql_select(&sql, NULL, query, sizeof query, "test_table", NULL, record) == 0);
 	snprintf(pattern, sizeof pattern, "SELECT 'int_key','float_key','string_key','addr_key','int','float','string','blob1','blob2','addr' FROM 'test_table' WHERE 'int_key'='%d' AND 'float_key'='%.2f' AND 'string_key'='foobar' AND 'addr_key'='%d.%d.%d.%d'", n, n*0.7,n,n,n,n);
 	//printf("%s\n%s\n\n", query, pattern);
 	TEST_ASSERT(strcmp(pattern, query) == 0);
 
+	// Prepared Select Query
+	sql.sql_param = "$%d";
+	TEST_ASSERT(sql_select(&sql, NULL, query, sizeof query, "test_table", &param, record) == 0);
+	TEST_ASSERT(param == 4);
+	strcpy(pattern, "SELECT 'int_key','float_key','string_key','addr_key','int','float','string','blob1','blob2','addr' FROM 'test_table' WHERE 'int_key'=$1 AND 'float_key'=$2 AND 'string_key'=$3 AND 'addr_key'=$4");
+	//printf("%s\n%s\n\n", query, pattern);
+	TEST_ASSERT(strcmp(pattern, query) == 0);
+
 	// Update Query
-	TEST_ASSERT(sql_update(&sql, NULL, query, sizeof query, "test_table", record) == 0);
+	TEST_ASSERT(sql_update(&sql, NULL, query, sizeof query, "test_table", NULL, record) == 0);
 	snprintf(pattern, sizeof pattern, "UPDATE 'test_table' SET 'int'='%d','float'='%.2f','string'='foobar','blob1'='%s','blob2'='%s','addr'='%d.%d.%d.%d' WHERE 'int_key'='%d' AND 'float_key'='%.2f' AND 'string_key'='foobar' AND 'addr_key'='%d.%d.%d.%d'", n,n*0.7,b1_64,b2_64,n,n,n,n,n,n*0.7,n,n,n,n);
 	//printf("%s\n%s\n\n", query, pattern);
 	TEST_ASSERT(strcmp(pattern, query) == 0);
 
+	// Upsert Query
+	sql.sql_upsert = sql_test_upsert;
+	TEST_ASSERT(sql_upsert(&sql, NULL, query, sizeof query, "test_table", NULL, record) == 0);
+	snprintf(pattern, sizeof pattern, "INSERT INTO 'test_table' ('int_key','float_key','string_key','addr_key','int','float','string','blob1','blob2','addr') VALUES ('%d','%.2f','foobar','%d.%d.%d.%d','%d','%.2f','foobar','%s','%s','%d.%d.%d.%d') ON CONFLICT ('int_key','float_key','string_key','addr_key') DO UPDATE SET 'int'='%d','float'='%.2f','string'='foobar','blob1'='%s','blob2'='%s','addr'='%d.%d.%d.%d'", n,n*0.7,n,n,n,n,n,n*0.7,b1_64,b2_64,n,n,n,n,n,n*0.7,b1_64,b2_64,n,n,n,n);
+	//printf("%s\n%s\n\n", query, pattern);
+	TEST_ASSERT(strcmp(pattern, query) == 0);
+
 	// Delete Query
-	TEST_ASSERT(sql_delete(&sql, NULL, query, sizeof query, "test_table", record) == 0);
+	TEST_ASSERT(sql_delete(&sql, NULL, query, sizeof query, "test_table", NULL, record) == 0);
 	snprintf(pattern, sizeof pattern, "DELETE FROM 'test_table' WHERE 'int_key'='%d' AND 'float_key'='%.2f' AND 'string_key'='foobar' AND 'addr_key'='%d.%d.%d.%d'", n,n*0.7,n,n,n,n);
 	//printf("%s\n%s\n\n", query, pattern);
 	TEST_ASSERT(strcmp(pattern, query) == 0);
 
+	// Cleanup Query
+	sql.sql_cleanup_batch = NULL;
+	TEST_ASSERT(sql_cleanup(&sql, NULL, query, sizeof query, "test_table", "expire", 1000, 100) == 0);
+	strcpy(pattern, "DELETE FROM 'test_table' WHERE 'expire' < 1000");
+	//printf("%s\n%s\n\n", query, pattern);
+	TEST_ASSERT(strcmp(pattern, query) == 0);
+
+	// Chunked Cleanup Query
+	sql.sql_cleanup_batch = sql_test_cleanup_batch;
+	TEST_ASSERT(sql_cleanup(&sql, NULL, query, sizeof query, "test_table", "expire", 1000, 100) == 0);
+	strcpy(pattern, "DELETE FROM 'test_table' WHERE 'expire' < 1000 LIMIT 100");
+	//printf("%s\n%s\n\n", query, pattern);
+	TEST_ASSERT(strcmp(pattern, query) == 0);
+
 	var_delete(scheme);
 	var_delete(record);
 
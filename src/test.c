@@ -144,8 +144,11 @@ test_run(int optind, int argc, char **argv)
 
 	test_handler_t multi_threaded_tests[] = {
 		{"ll.c", NULL, ll_test, NULL},
+		{"arena.c", NULL, arena_test, NULL},
+		{"ht.c", NULL, ht_test, NULL},
 		{"sht.c", NULL, sht_test, NULL},
 		{"util.c", NULL, util_test, NULL},
+		{"var.c", NULL, var_test, NULL},
 		{"vp.c", NULL, vp_test, NULL},
 		{"msgmod.c", NULL, msgmod_test, NULL},
 		{"regdom.c", regdom_test_init, regdom_test, regdom_clear},
@@ -156,16 +159,34 @@ test_run(int optind, int argc, char **argv)
 
 		// Database drivers are tested through dbt.c
                 {"memdb.c", dbt_test_memdb_init, dbt_test_stage1, dbt_test_clear },
+                {"memdb.c", dbt_test_memdb_init, dbt_test_mget, dbt_test_clear },
+                {"memdb.c", dbt_test_memdb_persist_init, dbt_test_stage1, dbt_test_clear },
+                {"memdb.c", dbt_test_memdb_persist_init, dbt_test_stage2, dbt_test_clear },
+                {"mmapdb.c", dbt_test_mmapdb_init, dbt_test_stage1, dbt_test_clear },
+                {"mmapdb.c", dbt_test_mmapdb_init, dbt_test_stage2, dbt_test_clear },
+                {"mmapdb.c", dbt_test_mmapdb_driver_init, dbt_test_driver, dbt_test_clear },
+                {"dbt.c", dbt_test_cache_init, dbt_test_stage1, dbt_test_clear },
+                {"dbt.c", dbt_test_queue_init, dbt_test_stage1, dbt_test_clear },
+                {"dbt.c", dbt_test_cache_init, dbt_test_mget, dbt_test_clear },
+                {"dbt.c", dbt_test_queue_init, dbt_test_mget, dbt_test_clear },
+                {"dbt.c", dbt_test_memdb_init, dbt_test_expire, dbt_test_clear },
+                {"dbt.c", dbt_test_race_init, dbt_test_race, dbt_test_clear },
+                {"dbt.c", dbt_test_breaker_init, dbt_test_breaker, dbt_test_clear },
                 {"bdb.c", dbt_test_bdb_init, dbt_test_stage1, dbt_test_clear },
                 {"bdb.c", dbt_test_bdb_init, dbt_test_stage2, dbt_test_clear },
                 {"lite.c", dbt_test_lite_init, dbt_test_stage1, dbt_test_clear },
                 {"lite.c", dbt_test_lite_init, dbt_test_stage2, dbt_test_clear },
+                {"lite.c", dbt_test_lite_mget_init, dbt_test_mget, dbt_test_clear },
                 {"pgsql.c", dbt_test_pgsql_init, dbt_test_stage1, dbt_test_clear },
                 {"pgsql.c", dbt_test_pgsql_init, dbt_test_stage2, dbt_test_clear },
                 {"sakila.c", dbt_test_mysql_init, dbt_test_stage1, dbt_test_clear },
                 {"sakila.c", dbt_test_mysql_init, dbt_test_stage2, dbt_test_clear },
                 {"mongodb.c", dbt_test_mongodb_init, dbt_test_stage1, dbt_test_clear },
                 {"mongodb.c", dbt_test_mongodb_init, dbt_test_stage2, dbt_test_clear },
+                {"mongodb.c", dbt_test_mongodb_mget_init, dbt_test_mget, dbt_test_clear },
+                {"tiered.c", dbt_test_tiered_init, dbt_test_stage1, dbt_test_clear },
+                {"tiered.c", dbt_test_tiered_init, dbt_test_stage2, dbt_test_clear },
+                {"tiered.c", dbt_test_tiered_mget_init, dbt_test_mget, dbt_test_clear },
 		{ NULL, NULL, NULL, NULL }
 	};
 
@@ -37,7 +37,7 @@ var_match(var_t * v1, var_t * v2)
 static void
 var_data_clear(var_t * v)
 {
-	if (v->v_data == NULL || (v->v_flags & VF_KEEPDATA))
+	if (v->v_data == NULL || (v->v_flags & VF_KEEPDATA) || VAR_INLINE(v))
 	{
 		return;
 	}
@@ -95,6 +95,12 @@ var_clear(var_t *v)
 void
 var_delete(var_t *v)
 {
+	// Released with the arena
+	if (v->v_flags & VF_ARENA)
+	{
+		return;
+	}
+
 	var_clear(v);
 	free(v);
 
@@ -349,6 +355,63 @@ var_data_init(var_type_t type, void *data, int flags)
 }
 
 
+/*
+ * Stores copied or created data of scalars in v_inline if it fits.
+ * Returns 1 if v_data points to v_inline.
+ */
+static int
+var_inline(var_t *v, void *data, int flags)
+{
+	switch (v->v_type)
+	{
+	case VT_INT:
+	case VT_FLOAT:
+		break;
+
+	case VT_STRING:
+	case VT_BLOB:
+		// Created strings are buffers of VAR_STRING_BUFFER_LEN
+		if (data == NULL)
+		{
+			return 0;
+		}
+		break;
+
+	default:
+		return 0;
+	}
+
+	if (data == NULL)
+	{
+		if ((flags & VF_CREATE) == 0)
+		{
+			return 0;
+		}
+
+		memset(&v->v_inline, 0, sizeof v->v_inline);
+		v->v_data = &v->v_inline;
+
+		return 1;
+	}
+
+	if ((flags & VF_COPYDATA) == 0)
+	{
+		return 0;
+	}
+
+	v->v_data = data;
+	if (var_data_size(v) > sizeof v->v_inline)
+	{
+		return 0;
+	}
+
+	memcpy(&v->v_inline, data, var_data_size(v));
+	v->v_data = &v->v_inline;
+
+	return 1;
+}
+
+
 int
 var_init(var_t *v, var_type_t type, char *name, void *data, int flags)
 {
@@ -365,6 +428,9 @@ var_init(var_t *v, var_type_t type, char *name, void *data, int flags)
 		flags ^= VF_KEEPDATA;
 	}
 
+	// Flags may be copied from an arena var
+	flags &= ~(VF_ARENA);
+
 	v->v_type = type;
 	v->v_flags = flags;
 
@@ -377,6 +443,11 @@ var_init(var_t *v, var_type_t type, char *name, void *data, int flags)
 		return -1;
 	}
 
+	if (var_inline(v, data, flags))
+	{
+		return 0;
+	}
+
 	/*
 	 * If data is set var_data_init never returns NULL.
 	 */
@@ -410,6 +481,77 @@ var_create(var_type_t type, char *name, void *data, int flags)
 }
 
 
+/*
+ * Creates a var with the same flags as var_create() but allocates the
+ * var_t and copied name and data from arena. The var is flagged VF_ARENA
+ * and released with the arena. Lists, tables, created data and names or
+ * data handed over to the var are allocated by var_create().
+ */
+var_t *
+var_arena_create(arena_t *arena, var_type_t type, char *name, void *data,
+    int flags)
+{
+	var_t *v;
+	VAR_INT_T size;
+
+	if (arena == NULL || type == VT_LIST || type == VT_TABLE ||
+	    (name && (flags & (VF_COPYNAME | VF_KEEPNAME)) == 0) ||
+	    (data && (flags & (VF_COPYDATA | VF_KEEPDATA)) == 0) ||
+	    (data == NULL && (flags & VF_CREATE)))
+	{
+		return var_create(type, name, data, flags);
+	}
+
+	v = (var_t *) arena_alloc(arena, sizeof (var_t));
+	if (v == NULL)
+	{
+		log_warning("var_arena_create: arena_alloc failed");
+		return NULL;
+	}
+
+	v->v_type = type;
+	v->v_name = name;
+	v->v_data = data;
+	v->v_flags = (flags & ~(VF_COPY)) | VF_KEEP | VF_ARENA;
+
+	if (name && (flags & VF_COPYNAME))
+	{
+		v->v_name = arena_strdup(arena, name);
+		if (v->v_name == NULL)
+		{
+			log_warning("var_arena_create: arena_strdup failed");
+			return NULL;
+		}
+	}
+
+	if (data == NULL || (flags & VF_COPYDATA) == 0)
+	{
+		return v;
+	}
+
+	if (var_inline(v, data, flags))
+	{
+		return v;
+	}
+
+	size = var_data_size(v);
+	if (size == 0)
+	{
+		log_warning("var_arena_create: bad type");
+		return NULL;
+	}
+
+	v->v_data = arena_memdup(arena, data, size);
+	if (v->v_data == NULL)
+	{
+		log_warning("var_arena_create: arena_memdup failed");
+		return NULL;
+	}
+
+	return v;
+}
+
+
 void *
 var_scan_data(var_type_t type, char *str)
 {
@@ -479,11 +621,32 @@ var_scan(var_type_t type, char *name, char *str)
 {
 	var_t *v = NULL;
 	void *data;
+	VAR_INT_T i;
+	VAR_FLOAT_T d;
 
 	if (str == NULL)
 	{
 		v = var_create(type, name, NULL, VF_COPYNAME);
 	}
+
+	/*
+	 * Scalars are copied by var_create and stored inline if they fit.
+	 * var_scan_data fails on "null".
+	 */
+	else if (type == VT_INT && strcmp(str, "null"))
+	{
+		i = atol(str);
+		v = var_create(type, name, &i, VF_COPY);
+	}
+	else if (type == VT_FLOAT && strcmp(str, "null"))
+	{
+		d = atof(str);
+		v = var_create(type, name, &d, VF_COPY);
+	}
+	else if (type == VT_STRING && strcmp(str, "null"))
+	{
+		v = var_create(type, name, str, VF_COPY);
+	}
 	else
 	{
 		data = var_scan_data(type, str);
@@ -1289,3 +1452,156 @@ var_intval(var_t *v)
 
 	return i;
 }
+
+
+#ifdef DEBUG
+
+#include <time.h>
+
+void
+var_test(int n)
+{
+	VAR_INT_T i = n;
+	VAR_FLOAT_T d = n / 2.0;
+	char *longstr = "this string does not fit into v_inline";
+	var_t *v, *copy;
+
+	v = var_create(VT_INT, "int", &i, VF_COPY);
+	TEST_ASSERT(v != NULL && VAR_INLINE(v));
+	TEST_ASSERT(*(VAR_INT_T *) v->v_data == n);
+	copy = VAR_COPY(v);
+	TEST_ASSERT(copy != NULL && VAR_INLINE(copy));
+	TEST_ASSERT(*(VAR_INT_T *) copy->v_data == n);
+	var_delete(v);
+	var_delete(copy);
+
+	v = var_create(VT_FLOAT, NULL, &d, VF_COPYDATA);
+	TEST_ASSERT(v != NULL && VAR_INLINE(v));
+	TEST_ASSERT(*(VAR_FLOAT_T *) v->v_data == d);
+	var_delete(v);
+
+	v = var_create(VT_STRING, NULL, "short", VF_COPYDATA);
+	TEST_ASSERT(v != NULL && VAR_INLINE(v));
+	TEST_ASSERT(strcmp(v->v_data, "short") == 0);
+	var_delete(v);
+
+	v = var_create(VT_STRING, NULL, longstr, VF_COPYDATA);
+	TEST_ASSERT(v != NULL && !VAR_INLINE(v) && v->v_data != longstr);
+	TEST_ASSERT(strcmp(v->v_data, longstr) == 0);
+	var_delete(v);
+
+	// Kept data is referenced
+	v = var_create(VT_INT, NULL, &i, VF_KEEPDATA);
+	TEST_ASSERT(v != NULL && v->v_data == &i);
+	var_delete(v);
+
+	v = var_create(VT_INT, NULL, NULL, VF_CREATE);
+	TEST_ASSERT(v != NULL && VAR_INLINE(v));
+	TEST_ASSERT(*(VAR_INT_T *) v->v_data == 0);
+	var_delete(v);
+
+	v = var_create(VT_STRING, NULL, NULL, VF_CREATE);
+	TEST_ASSERT(v != NULL && v->v_data != NULL && !VAR_INLINE(v));
+	var_delete(v);
+
+	v = var_scan(VT_INT, "int", "42");
+	TEST_ASSERT(v != NULL && VAR_INLINE(v));
+	TEST_ASSERT(*(VAR_INT_T *) v->v_data == 42);
+	var_delete(v);
+
+	v = var_scan(VT_FLOAT, "float", "0.5");
+	TEST_ASSERT(v != NULL && *(VAR_FLOAT_T *) v->v_data == 0.5);
+	var_delete(v);
+
+	TEST_ASSERT(var_scan(VT_INT, "int", "null") == NULL);
+
+	v = var_cast_copy(VT_STRING, &(var_t) { VT_INT, NULL, &i, VF_KEEP });
+	TEST_ASSERT(v != NULL && atol(v->v_data) == n);
+	var_delete(v);
+
+	return;
+}
+
+static unsigned long
+var_bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+/*
+ * Creates and deletes copies of scalars like exp_math_* and vp_unpack do.
+ */
+void
+var_bench(int records)
+{
+	static struct {
+		char		*vb_name;
+		var_type_t	 vb_type;
+		char		*vb_str;
+	} bench[] = {
+		{ "int", VT_INT, "1234567" },
+		{ "float", VT_FLOAT, "0.25" },
+		{ "string", VT_STRING, "192.168.100.200" },
+		{ NULL, VT_NULL, NULL }
+	};
+	unsigned long create, scan;
+	var_t *v, *template;
+	int i, b;
+
+	for (b = 0; bench[b].vb_name; ++b)
+	{
+		template = var_scan(bench[b].vb_type, NULL, bench[b].vb_str);
+		if (template == NULL)
+		{
+			log_error("var_bench: var_scan failed");
+			return;
+		}
+
+		create = var_bench_now();
+
+		for (i = 0; i < records; ++i)
+		{
+			v = var_create(template->v_type, NULL,
+			    template->v_data, VF_COPYDATA);
+			if (v == NULL)
+			{
+				log_error("var_bench: var_create failed");
+				break;
+			}
+
+			var_delete(v);
+		}
+
+		create = var_bench_now() - create;
+		scan = var_bench_now();
+
+		for (i = 0; i < records; ++i)
+		{
+			v = var_scan(template->v_type, NULL,
+			    bench[b].vb_str);
+			if (v == NULL)
+			{
+				log_error("var_bench: var_scan failed");
+				break;
+			}
+
+			var_delete(v);
+		}
+
+		scan = var_bench_now() - scan;
+
+		printf("var=%s records=%d create_delete_ns=%.1f "
+		    "scan_delete_ns=%.1f\n", bench[b].vb_name, records,
+		    (double) create / records, (double) scan / records);
+
+		var_delete(template);
+	}
+
+	return;
+}
+
+#endif
@@ -20,6 +20,22 @@ vlist_create(char *name, int flags)
 }
 
 
+/*
+ * Allocates room for size items at once. Used for records of known schemes.
+ */
+int
+vlist_reserve(var_t *list, int size)
+{
+	if (ll_reserve(list->v_data, size))
+	{
+		log_sys_warning("vlist_reserve: ll_reserve");
+		return -1;
+	}
+
+	return 0;
+}
+
+
 int
 vlist_append(var_t *list, var_t *item)
 {
@@ -158,6 +174,15 @@ vlist_record(var_t *scheme, ...)
 	}
 
 	ll = scheme->v_data;
+	if (vlist_reserve(record, LL_SIZE(ll)))
+	{
+		log_warning("vlist_record: vlist_reserve failed");
+
+		va_end(ap);
+		var_delete(record);
+		return NULL;
+	}
+
 	pos = LL_START(ll);
 
 	while ((v = ll_next(ll, &pos)))
@@ -202,6 +227,12 @@ vlist_record_from_table(var_t *scheme, var_t *table)
 	}
 
 	ll = scheme->v_data;
+	if (vlist_reserve(record, LL_SIZE(ll)))
+	{
+		log_warning("vlist_record_from_table: vlist_reserve failed");
+		goto error;
+	}
+
 	pos = LL_START(ll);
 
 	while ((vs = ll_next(ll, &pos)))
@@ -321,3 +352,96 @@ vlist_record_keys_missing(var_t *record, var_t *table)
 
 	return 0;
 }
+
+
+#ifdef DEBUG
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+static unsigned long
+vlist_bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+/*
+ * Builds, traverses and deletes greylist shaped records.
+ */
+void
+vlist_bench(int records)
+{
+	var_t *scheme, *record, *item;
+	VAR_INT_T n = 0;
+	unsigned long build = 0, walk = 0, start;
+	ll_t *list;
+	ll_entry_t *pos;
+	int i, fields = 0;
+
+	scheme = vlist_scheme("greylist",
+		"origin",		VT_STRING,	VF_KEEPNAME | VF_KEY,
+		"envfrom_addr",		VT_STRING,	VF_KEEPNAME | VF_KEY,
+		"envrcpt_addr",		VT_STRING,	VF_KEEPNAME | VF_KEY,
+		"greylist_created",	VT_INT,		VF_KEEPNAME,
+		"greylist_updated",	VT_INT,		VF_KEEPNAME,
+		"greylist_expire",	VT_INT,		VF_KEEPNAME,
+		"greylist_connections",	VT_INT,		VF_KEEPNAME,
+		"greylist_deadline",	VT_INT,		VF_KEEPNAME,
+		"greylist_delay",	VT_INT,		VF_KEEPNAME,
+		"greylist_attempts",	VT_INT,		VF_KEEPNAME,
+		"greylist_visa",	VT_INT,		VF_KEEPNAME,
+		"greylist_passed",	VT_INT,		VF_KEEPNAME,
+		NULL);
+	if (scheme == NULL)
+	{
+		log_error("vlist_bench: vlist_scheme failed");
+		return;
+	}
+
+	for (i = 0; i < records; ++i)
+	{
+		start = vlist_bench_now();
+
+		record = vlist_record(scheme, "127.0.0.1", "from@example.org",
+		    "rcpt@example.org", &n, &n, &n, &n, &n, &n, &n, &n, &n);
+		if (record == NULL)
+		{
+			log_error("vlist_bench: vlist_record failed");
+			break;
+		}
+
+		build += vlist_bench_now() - start;
+		start = vlist_bench_now();
+
+		list = record->v_data;
+		pos = LL_START(list);
+		while ((item = ll_next(list, &pos)))
+		{
+			fields += item->v_type == VT_INT;
+		}
+
+		var_delete(record);
+
+		walk += vlist_bench_now() - start;
+	}
+
+	var_delete(scheme);
+
+	if (i == 0)
+	{
+		return;
+	}
+
+	printf("list=vlist records=%d fields=%d build_ns=%.1f "
+	    "walk_delete_ns=%.1f\n", i, fields / i, (double) build / i,
+	    (double) walk / i);
+
+	return;
+}
+
+#endif
@@ -222,6 +222,132 @@ error:
 }
 
 
+void
+vp_key_clear(vp_key_t *vk)
+{
+	if (vk->vk_vp.vp_key && vk->vk_vp.vp_key != vk->vk_buffer)
+	{
+		free(vk->vk_vp.vp_key);
+	}
+
+	vk->vk_vp.vp_key = NULL;
+	vk->vk_vp.vp_klen = 0;
+
+	return;
+}
+
+static int
+vp_key_append(vp_key_t *vk, void *data, int size)
+{
+	vp_t *vp = &vk->vk_vp;
+	char *p;
+
+	// Oversized keys are moved to the heap
+	if (vp->vp_klen + size > VP_KEY_BUFLEN)
+	{
+		if (vp->vp_key == vk->vk_buffer)
+		{
+			p = malloc(vp->vp_klen + size);
+			if (p != NULL)
+			{
+				memcpy(p, vk->vk_buffer, vp->vp_klen);
+			}
+		}
+		else
+		{
+			p = realloc(vp->vp_key, vp->vp_klen + size);
+		}
+
+		if (p == NULL)
+		{
+			log_sys_error("vp_key_append: malloc");
+			return -1;
+		}
+
+		vp->vp_key = p;
+	}
+
+	memcpy(vp->vp_key + vp->vp_klen, data, size);
+	vp->vp_klen += size;
+
+	return 0;
+}
+
+/*
+ * Packs the key fields of record like vp_pack but into vk->vk_buffer. Used
+ * for lookups and deletes. vk->vk_vp has no data. Release the key with
+ * vp_key_clear.
+ */
+int
+vp_pack_key(vp_key_t *vk, var_t *record)
+{
+	vp_t *vp = &vk->vk_vp, *packed;
+	var_t *item;
+	ll_t *ll;
+	ll_entry_t *pos;
+
+	memset(vp, 0, sizeof (vp_t));
+	vp->vp_key = vk->vk_buffer;
+
+	if(record->v_type != VT_LIST) {
+		log_error("vp_pack_key: bad v_type");
+		goto error;
+	}
+
+	ll = record->v_data;
+	pos = LL_START(ll);
+	while ((item = ll_next(ll, &pos)))
+	{
+		if ((item->v_flags & VF_KEY) == 0)
+		{
+			continue;
+		}
+
+		if (item->v_data == NULL)
+		{
+			log_error("vp_pack_key: key %s has no value",
+			    item->v_name);
+			goto error;
+		}
+
+		// Lists and tables need to be dumped by vp_pack
+		if (item->v_type == VT_LIST || item->v_type == VT_TABLE)
+		{
+			goto pack;
+		}
+
+		if (vp_key_append(vk, item->v_data, var_data_size(item)))
+		{
+			log_error("vp_pack_key: vp_key_append failed");
+			goto error;
+		}
+	}
+
+	return 0;
+
+pack:
+	vp_key_clear(vk);
+
+	packed = vp_pack(record);
+	if (packed == NULL)
+	{
+		log_error("vp_pack_key: vp_pack failed");
+		return -1;
+	}
+
+	vp->vp_key = packed->vp_key;
+	vp->vp_klen = packed->vp_klen;
+	packed->vp_key = NULL;
+	vp_delete(packed);
+
+	return 0;
+
+error:
+	vp_key_clear(vk);
+
+	return -1;
+}
+
 var_t *
 vp_unpack(vp_t *vp, var_t *scheme)
 {
@@ -255,6 +381,12 @@ vp_unpack(vp_t *vp, var_t *scheme)
 	}
 
 	ll = scheme->v_data;
+	if (vlist_reserve(record, LL_SIZE(ll)))
+	{
+		log_error("vp_unpack: vlist_reserve failed");
+		goto error;
+	}
+
 	pos = LL_START(ll);
 
 	for (n = 0; (item = ll_next(ll, &pos)); ++n) {
@@ -336,6 +468,8 @@ vp_test(int n)
 {
 	var_t *scheme;
 	vp_t *vp;
+	vp_key_t vk;
+	char long_key[VP_KEY_BUFLEN * 2];
 	static char bkey_str[] = "foobar";
 	static char bdata_str[] = "hello world";
 	blob_t *bkey;
@@ -381,6 +515,13 @@ vp_test(int n)
 
 	TEST_ASSERT((vp = vp_pack(record)) != NULL);
 
+	// Key only
+	TEST_ASSERT(vp_pack_key(&vk, record) == 0);
+	TEST_ASSERT(vk.vk_vp.vp_key == vk.vk_buffer);
+	TEST_ASSERT(vk.vk_vp.vp_klen == vp->vp_klen);
+	TEST_ASSERT(memcmp(vk.vk_vp.vp_key, vp->vp_key, vp->vp_klen) == 0);
+	vp_key_clear(&vk);
+
 	free(bkey);
 	free(bdata);
 
@@ -493,6 +634,28 @@ vp_test(int n)
 	TEST_ASSERT((v->v_flags & VF_KEY) == 0);
 	TEST_ASSERT(b == NULL);
 
+	var_delete(record);
+
+	// Oversized key is moved to the heap
+	memset(long_key, 'x', sizeof long_key - 1);
+	long_key[sizeof long_key - 1] = 0;
+
+	bkey = blob_create(bkey_str, strlen(bkey_str) + 1);
+	TEST_ASSERT(bkey != NULL);
+
+	TEST_ASSERT((record = vlist_record(scheme, &key_int, &key_float,
+		long_key, bkey, NULL, NULL, NULL, NULL, NULL, NULL, NULL,
+		NULL)) != NULL);
+
+	TEST_ASSERT((vp = vp_pack(record)) != NULL);
+	TEST_ASSERT(vp_pack_key(&vk, record) == 0);
+	TEST_ASSERT(vk.vk_vp.vp_key != vk.vk_buffer);
+	TEST_ASSERT(vk.vk_vp.vp_klen == vp->vp_klen);
+	TEST_ASSERT(memcmp(vk.vk_vp.vp_key, vp->vp_key, vp->vp_klen) == 0);
+	vp_key_clear(&vk);
+	vp_delete(vp);
+
+	free(bkey);
 	var_delete(record);
 	var_delete(scheme);
 }
@@ -2,6 +2,13 @@
 
 #include <mopher.h>
 
+/*
+ * Vars set into vtable_arena_table by this thread are allocated from
+ * vtable_arena. See vtable_arena_set.
+ */
+static __thread var_t *vtable_arena_table;
+static __thread arena_t *vtable_arena;
+
 
 var_t *
 vtable_create(char *name, int flags)
@@ -169,15 +176,36 @@ vtable_remv(var_t *table, ...)
 }
 
 
+/*
+ * Vars set with vtable_set_new into table are allocated from arena until
+ * vtable_arena_set is called again. The setting is per thread. A NULL
+ * arena allocates from the heap.
+ */
+void
+vtable_arena_set(var_t *table, arena_t *arena)
+{
+	vtable_arena_table = table;
+	vtable_arena = arena;
+
+	return;
+}
+
+
 int
 vtable_set_new(var_t *table, var_type_t type, char *name, void *data, int flags)
 {
+	arena_t *arena = NULL;
 	var_t *v;
 
-	v = var_create(type, name, data, flags);
+	if (table == vtable_arena_table)
+	{
+		arena = vtable_arena;
+	}
+
+	v = var_arena_create(arena, type, name, data, flags);
 	if (v == NULL)
 	{
-		log_error("vtable_set_new: var_create failed");
+		log_error("vtable_set_new: var_arena_create failed");
 		return -1;
 	}
 
@@ -386,3 +414,124 @@ vtable_is_null(var_t *table, char *name)
 
 	return 0;
 }
+
+
+#ifdef DEBUG
+
+#include <stdio.h>
+#include <time.h>
+
+#define VTABLE_BENCH_HEADERS 20
+
+static unsigned long
+vtable_bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+/*
+ * Sets and clears the mailspec vars of a message like milter.c does, once
+ * allocated from the heap and once from an arena. mallocs counts the calls
+ * to malloc for vars, names and data.
+ */
+void
+vtable_bench(int messages)
+{
+	static char *symbols[] = { "envfrom", "envfrom_addr", "envfrom_domain",
+	    "envrcpt", "envrcpt_addr", "envrcpt_domain", "recipients",
+	    "queue_id", "message_id", "subject", "body_size", "message_size",
+	    "greylist_listed", "greylist_delayed", NULL };
+	static char *value = "mopher <mopher@example.org>";
+	unsigned long elapsed[2], allocs = 0, chunks = 0;
+	arena_t arena;
+	arena_chunk_t *ac;
+	var_t *table;
+	VAR_INT_T stage;
+	char **symbol;
+	int i, h, mode;
+
+	for (mode = 0; mode < 2; ++mode)
+	{
+		table = vtable_create("mailspec", VF_KEEPNAME);
+		if (table == NULL)
+		{
+			log_error("vtable_bench: vtable_create failed");
+			return;
+		}
+
+		arena_init(&arena, 0);
+		vtable_arena_set(table, mode? &arena: NULL);
+
+		elapsed[mode] = vtable_bench_now();
+
+		for (i = 0; i < messages; ++i)
+		{
+			for (h = 0; h < VTABLE_BENCH_HEADERS; ++h)
+			{
+				stage = MS_HEADER;
+
+				vtable_setv(table,
+				    VT_INT, "stage", &stage,
+					VF_KEEPNAME | VF_COPYDATA,
+				    VT_STRING, "stagename", "header", VF_KEEP,
+				    VT_STRING, "header_name", "Received",
+					VF_KEEPNAME | VF_COPYDATA,
+				    VT_STRING, "header_value", value,
+					VF_KEEPNAME | VF_COPYDATA,
+				    VT_NULL);
+			}
+
+			// Module symbols copy their names
+			for (symbol = symbols; *symbol; ++symbol)
+			{
+				vtable_set_new(table, VT_STRING, *symbol, value,
+				    VF_COPY);
+			}
+
+			for (symbol = symbols; *symbol; ++symbol)
+			{
+				vtable_remove(table, *symbol);
+			}
+
+			vtable_remv(table, "stage", "stagename", "header_name",
+			    "header_value", NULL);
+
+			if (mode == 0)
+			{
+				continue;
+			}
+
+			allocs += arena.a_allocs;
+			for (ac = arena.a_chunks; ac; ac = ac->ac_next)
+			{
+				++chunks;
+			}
+
+			arena_reset(&arena);
+		}
+
+		elapsed[mode] = vtable_bench_now() - elapsed[mode];
+
+		vtable_arena_set(NULL, NULL);
+		var_delete(table);
+		arena_clear(&arena);
+	}
+
+	// The arena keeps one chunk across messages
+	chunks -= messages > 1? messages - 1: 0;
+
+	printf("table=vtable alloc=heap messages=%d ns_per_message=%.0f "
+	    "mallocs_per_message=%.1f\n", messages,
+	    (double) elapsed[0] / messages, (double) allocs / messages);
+	printf("table=vtable alloc=arena messages=%d ns_per_message=%.0f "
+	    "mallocs_per_message=%.1f\n", messages,
+	    (double) elapsed[1] / messages, (double) chunks / messages);
+
+	return;
+}
+
+#endif